@@ -0,0 +1,57 @@
+;; gc-mark.jl -- time the mark phase on deep and wide object graphs
+
+;; Run from the top of the build tree with `./test bench/gc-mark.jl'.
+;; Each graph is kept live while a number of full collections are
+;; timed; the time for an empty heap is subtracted, leaving (roughly)
+;; the cost of marking the graph.
+
+(define gc-mark-rounds 10)
+
+;; A chain of nested one-element vectors, DEPTH levels deep.
+(define (deep-vectors depth)
+  (do ((i 0 (1+ i))
+       (v '() (vector v)))
+      ((= i depth) v)))
+
+;; A chain of conses nested through the car, DEPTH levels deep.
+(define (deep-cars depth)
+  (do ((i 0 (1+ i))
+       (l '() (cons l i)))
+      ((= i depth) l)))
+
+;; A vector of WIDTH small lists, each holding a string.
+(define (wide-vector width)
+  (let ((v (make-vector width)))
+    (do ((i 0 (1+ i)))
+	((= i width) v)
+      (vector-set! v i (list i (number->string i))))))
+
+;; A list of WIDTH three-element vectors.
+(define (wide-list width)
+  (do ((i 0 (1+ i))
+       (l '() (cons (vector i i i) l)))
+      ((= i width) l)))
+
+(define (time-collections)
+  (let ((start (current-utime)))
+    (do ((i 0 (1+ i)))
+	((= i gc-mark-rounds))
+      (garbage-collect))
+    (quotient (- (current-utime) start) gc-mark-rounds)))
+
+(define (run-gc-mark-bench)
+  (let ((base (time-collections)))
+    (format *standard-output* "%-24s %8d us/gc\n" "baseline" base)
+    (mapc (lambda (test)
+	    (let* ((graph ((cadr test) (caddr test)))
+		   (elapsed (time-collections)))
+	      (format *standard-output* "%-24s %8d us/mark\n"
+		      (format nil "%s %d" (car test) (caddr test))
+		      (- elapsed base))
+	      graph))
+	  (list (list "deep-vectors" deep-vectors 100000)
+		(list "deep-cars" deep-cars 200000)
+		(list "wide-vector" wide-vector 200000)
+		(list "wide-list" wide-list 200000)))))
+
+(run-gc-mark-bench)
@@ -0,0 +1,45 @@
+;; globals.jl -- cost of global variable references from compiled code
+
+;; Run from the top of the build tree with `./test bench/globals.jl'.
+;; The loop references thirty functions imported from other modules,
+;; and reads and sets a module variable, so each iteration executes
+;; many OP_REFQ and an OP_SETQ instruction. The time per iteration and
+;; the hit rate of the inline caches (from structure-stats) are
+;; reported.
+
+(require 'rep.data.tables)
+(require 'rep.structures)
+(require 'rep.vm.compiler)
+
+(define globals-bench-rounds 1000000)
+
+(define globals-counter 0)
+
+(define (globals-loop rounds)
+  (do ((i 0 (1+ i)))
+      ((= i rounds))
+    (and symbol-name table-ref table-set! table-bound? char-upcase
+	 char-downcase char-alphabetic? char-numeric? char? abs gcd exact?
+	 inexact? even? odd? positive? negative? keyword? fixnum? integer?
+	 real? rational? symbol? string-upcase string-downcase
+	 make-table make-weak-table table-for-each identity
+	 (set! globals-counter (1+ globals-counter)))))
+
+(define (stat key)
+  (cdr (assq key (structure-stats))))
+
+(define (run-globals-bench)
+  (let ((hits (stat 'inline-cache-hits))
+	(misses (stat 'inline-cache-misses))
+	(start (current-utime)))
+    (globals-loop globals-bench-rounds)
+    (let ((elapsed (- (current-utime) start))
+	  (hits (- (stat 'inline-cache-hits) hits))
+	  (misses (- (stat 'inline-cache-misses) misses)))
+      (format *standard-output* "%d ns/iteration, %d hits, %d misses\n"
+	      (quotient (* elapsed 1000) globals-bench-rounds)
+	      hits misses))))
+
+(compile-function globals-loop)
+
+(run-globals-bench)
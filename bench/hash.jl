@@ -0,0 +1,80 @@
+;; hash.jl -- throughput and distribution of the builtin hash functions
+
+;; Run from the top of the build tree with `./test bench/hash.jl'.
+;; The first part times string-hash on strings of various lengths.
+;; The second hashes sets of similar keys into a power-of-two number
+;; of buckets, by the low bits of the hash codes, and reports the
+;; fullest bucket and the chi-squared statistic. For a uniform hash
+;; the statistic should be close to the number of buckets.
+
+(require 'rep.data.tables)
+(require 'rep.vm.compiler)
+
+(define hash-bench-rounds 200000)
+
+(define (time-hash fun arg rounds)
+  (let ((start (current-utime)))
+    (do ((i 0 (1+ i)))
+	((= i rounds))
+      (fun arg))
+    (- (current-utime) start)))
+
+(define (run-throughput)
+  (format *standard-output* "%-24s %8s %8s\n" "string-hash" "ns/hash" "MB/s")
+  (mapc (lambda (len)
+	  (let* ((string (make-string len #\x))
+		 (rounds (max 1000 (quotient (* hash-bench-rounds 16)
+					     (max len 16))))
+		 (elapsed (max 1 (time-hash string-hash string rounds))))
+	    (format *standard-output* "%-24s %8d %8d\n"
+		    (format nil "%d bytes" len)
+		    (quotient (* elapsed 1000) rounds)
+		    (quotient (* len rounds) elapsed))))
+	'(4 8 16 32 64 128 1024 16384)))
+
+(define (distribution fun make-key count bits)
+  (let* ((buckets (ash 1 bits))
+	 (mask (1- buckets))
+	 (counts (make-vector buckets 0)))
+    (do ((i 0 (1+ i)))
+	((= i count))
+      (let ((b (logand (fun (make-key i)) mask)))
+	(vector-set! counts b (1+ (vector-ref counts b)))))
+    (let loop ((i 0)
+	       (worst 0)
+	       (sum 0))
+      (if (= i buckets)
+	  ;; chi-squared = sum((c - e)^2 / e), with e = count / buckets
+	  (cons worst (quotient (- (* sum buckets) (* count count)) count))
+	(let ((c (vector-ref counts i)))
+	  (loop (1+ i) (max worst c) (+ sum (* c c))))))))
+
+(define (run-distribution)
+  (let ((count 200000)
+	(bits 16))
+    (format *standard-output* "\n%-24s %8s %8s  (%d keys, %d buckets)\n"
+	    "distribution" "fullest" "chi^2" count (ash 1 bits))
+    (mapc (lambda (test)
+	    (let ((result (distribution (cadr test) (caddr test) count bits)))
+	      (format *standard-output* "%-24s %8d %8d\n"
+		      (car test) (car result) (cdr result))))
+	  (list (list "string key-N" string-hash
+		      (lambda (i) (format nil "key-%d" i)))
+		(list "string paths" string-hash
+		      (lambda (i)
+			(format nil "/usr/share/lib/%d/%d/file.jl"
+				(quotient i 100) (remainder i 100))))
+		(list "string N-suffix" string-hash
+		      (lambda (i) (format nil "%dxxxxxxxxxxxxxxxxxxxxxxxxx" i)))
+		(list "symbol-hash" symbol-hash
+		      (lambda (i) (intern (format nil "hash-bench-%d" i))))
+		(list "equal-hash lists" equal-hash
+		      (lambda (i) (list i (* i 2))))
+		(list "equal-hash vectors" equal-hash
+		      (lambda (i) (vector (quotient i 256) (remainder i 256))))))))
+
+(compile-function time-hash)
+(compile-function distribution)
+
+(run-throughput)
+(run-distribution)
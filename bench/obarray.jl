@@ -0,0 +1,44 @@
+;; obarray.jl -- cost of interning as the obarray fills
+
+;; Run from the top of the build tree with `./test bench/obarray.jl'.
+;; Symbols are interned into the default obarray in batches, each
+;; batch timing intern and then find-symbol on its new names. With a
+;; fixed number of buckets both get slower as the chains lengthen.
+
+(require 'rep.vm.compiler)
+
+(define obarray-bench-batch 50000)
+(define obarray-bench-batches 8)
+
+(define (make-names start count)
+  (let ((v (make-vector count)))
+    (do ((i 0 (1+ i)))
+	((= i count) v)
+      (vector-set! v i (format nil "obarray-bench-%d" (+ start i))))))
+
+(define (time-each fun names)
+  (let ((start (current-utime)))
+    (do ((i 0 (1+ i)))
+	((= i (vector-length names)))
+      (fun (vector-ref names i)))
+    (quotient (* (- (current-utime) start) 1000) (vector-length names))))
+
+(define (run-obarray-bench)
+  (format *standard-output* "%-24s %8s %8s  (ns)\n" "symbols" "intern" "find")
+  (do ((b 0 (1+ b)))
+      ((= b obarray-bench-batches))
+    (let* ((names (make-names (* b obarray-bench-batch) obarray-bench-batch))
+	   (intern-ns (time-each intern names))
+	   (find-ns (time-each find-symbol names)))
+      (format *standard-output* "%-24d %8d %8d\n"
+	      (cdr (assq 'symbols (obarray-statistics)))
+	      intern-ns find-ns)))
+  (let ((stats (obarray-statistics)))
+    (format *standard-output* "\nbuckets %d, used %d, longest chain %d\n"
+	    (cdr (assq 'buckets stats)) (cdr (assq 'used-buckets stats))
+	    (cdr (assq 'longest-chain stats)))))
+
+(compile-function make-names)
+(compile-function time-each)
+
+(run-obarray-bench)
@@ -0,0 +1,79 @@
+;; persistent.jl -- cost of persistent maps and vectors
+
+;; Run from the top of the build tree with `./test bench/persistent.jl'.
+;; COUNT fixnum keys are added to a hash table, to a persistent map one
+;; at a time, and to a transient map, then each is searched for every
+;; key. The same is done with vectors, pushing COUNT elements and then
+;; reading them back. Times are in milliseconds.
+
+(require 'rep.data.tables)
+(require 'rep.data.persistent)
+(require 'rep.vm.compiler)
+
+(define persistent-bench-count 200000)
+
+(define (time-ms thunk)
+  (let ((start (current-utime)))
+    (thunk)
+    (quotient (- (current-utime) start) 1000)))
+
+(define (fill-table n)
+  (let ((tab (make-table eq-hash eq?)))
+    (do ((i 0 (1+ i)))
+	((= i n) tab)
+      (table-set! tab i i))))
+
+(define (fill-pmap n)
+  (do ((i 0 (1+ i))
+       (m (make-pmap eq-hash eq?) (pmap-set m i i)))
+      ((= i n) m)))
+
+(define (fill-transient-pmap n)
+  (let ((tr (pmap-transient (make-pmap eq-hash eq?))))
+    (do ((i 0 (1+ i)))
+	((= i n) (pmap-persistent! tr))
+      (pmap-set! tr i i))))
+
+(define (search ref obj n)
+  (do ((i 0 (1+ i)))
+      ((= i n))
+    (ref obj i)))
+
+(define (fill-pvector n)
+  (do ((i 0 (1+ i))
+       (v (pvector) (pvector-push v i)))
+      ((= i n) v)))
+
+(define (fill-transient-pvector n)
+  (let ((tr (pvector-transient (pvector))))
+    (do ((i 0 (1+ i)))
+	((= i n) (pvector-persistent! tr))
+      (pvector-push! tr i))))
+
+(define (run-persistent-bench)
+  (let ((n persistent-bench-count)
+	result)
+    (format *standard-output* "%-24s %8s %8s  (ms, %d keys)\n"
+	    "structure" "fill" "search" n)
+    (mapc (lambda (test)
+	    (let ((fill (time-ms (lambda ()
+				   (set! result ((cadr test) n))))))
+	      (format *standard-output* "%-24s %8d %8d\n" (car test) fill
+		      (time-ms (lambda ()
+				 (search (caddr test) result n))))))
+	  (list (list "table" fill-table table-ref)
+		(list "pmap" fill-pmap pmap-ref)
+		(list "transient pmap" fill-transient-pmap pmap-ref)
+		(list "vector" (lambda (n) (make-vector n 0)) vector-ref)
+		(list "pvector" fill-pvector pvector-ref)
+		(list "transient pvector" fill-transient-pvector
+		      pvector-ref)))))
+
+(compile-function fill-table)
+(compile-function fill-pmap)
+(compile-function fill-transient-pmap)
+(compile-function search)
+(compile-function fill-pvector)
+(compile-function fill-transient-pvector)
+
+(run-persistent-bench)
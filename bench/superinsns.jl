@@ -0,0 +1,136 @@
+;; superinsns.jl -- instructions saved by the superinstructions
+
+;; Run from the top of the build tree with `./test bench/superinsns.jl'.
+;; The compiler's sources are copied into two temporary trees, and
+;; compiled in one with superinstructions and in the other without
+;; (binding *compiler-no-superinstructions*). A child rep is started
+;; for each tree, loading the compiler from it, which times the
+;; compiler compiling its own sources, then does so again under the
+;; bytecode profiler to count the instructions dispatched. Both counts
+;; and the best time of five runs are reported for each tree.
+
+(require 'rep.io.files)
+(require 'rep.io.processes)
+(require 'rep.regexp)
+(require 'rep.structures)
+
+(define superinsns-modules '(rep.vm.bytecode-defs
+			     rep.vm.bytecodes
+			     rep.vm.peephole
+			     rep.vm.assembler
+			     rep.vm.compiler
+			     rep.vm.compiler.basic
+			     rep.vm.compiler.bindings
+			     rep.vm.compiler.inline
+			     rep.vm.compiler.lap
+			     rep.vm.compiler.modules
+			     rep.vm.compiler.rep
+			     rep.vm.compiler.src
+			     rep.vm.compiler.utils))
+
+(define superinsns-rounds 5)
+
+(define (source-files tree)
+  (mapcar (lambda (module)
+	    (expand-file-name (concat (structure-file module) ".jl") tree))
+	  superinsns-modules))
+
+(define (make-directories dir)
+  (set! dir (directory-file-name dir))
+  (unless (file-exists? dir)
+    (make-directories (file-name-directory dir))
+    (make-directory dir)))
+
+(define (copy-sources tree)
+  (for-each (lambda (module)
+	      (let ((dest (expand-file-name (concat (structure-file module)
+						    ".jl") tree)))
+		(make-directories (file-name-directory dest))
+		(copy-file (expand-file-name (concat (structure-file module)
+						     ".jl") lisp-lib-directory)
+			   dest)))
+	    superinsns-modules))
+
+(define (compile-sources tree)
+  (for-each compile-file (source-files tree)))
+
+;; In the child: load the compiler from TREE, then compile the sources
+;; in WORK, printing the result for the parent to read
+(define (child-run tree work)
+  (set! *load-path* (cons tree *load-path*))
+  (require 'rep.vm.compiler)
+  (require 'rep.vm.interpreter)
+  (let ((best nil))
+    (do ((i 0 (1+ i)))
+	((= i superinsns-rounds))
+      (let ((start (current-utime)))
+	(compile-sources work)
+	(let ((elapsed (- (current-utime) start)))
+	  (when (or (not best) (< elapsed best))
+	    (set! best elapsed)))))
+    (start-bytecode-profiler)
+    (compile-sources work)
+    (stop-bytecode-profiler)
+    (format *standard-output* "\n(superinsns-result %d %d)\n"
+	    (apply + (vector->list (car (fetch-bytecode-profile)))) best)))
+
+;; Start a child rep using the compiler in TREE, return (DISPATCHES TIME)
+(define (run-child tree work)
+  (let* ((output (make-string-output-stream))
+	 (status (call-process (make-process output) nil
+			       "./test" "--batch" "bench/superinsns.jl"
+			       "--child" tree work))
+	 (text (get-output-stream-string output)))
+    (unless (and (zero? status)
+		 (string-match "\\(superinsns-result ([0-9]+) ([0-9]+)\\)"
+			       text))
+      (error "Child failed: %s" text))
+    (list (string->number (expand-last-match "\\1"))
+	  (string->number (expand-last-match "\\2")))))
+
+(define (run-superinsns-bench)
+  (require 'rep.vm.compiler)
+  (let* ((top (make-temp-name))
+	 (plain (expand-file-name "plain" top))
+	 (fused (expand-file-name "fused" top))
+	 (work (expand-file-name "work" top)))
+    (make-directory top)
+    (unwind-protect
+	(progn
+	  (copy-sources plain)
+	  (copy-sources fused)
+	  (copy-sources work)
+	  (let ((*compiler-no-superinstructions* t))
+	    (compile-sources plain))
+	  (compile-sources fused)
+	  (let ((without (run-child plain work))
+		(with (run-child fused work)))
+	    (format *standard-output* "%-24s %12s %8s\n\n"
+		    "Compiler" "Dispatches" "ms")
+	    (format *standard-output* "%-24s %12d %8d\n"
+		    "without superinsns" (car without)
+		    (quotient (cadr without) 1000))
+	    (format *standard-output* "%-24s %12d %8d\n"
+		    "with superinsns" (car with) (quotient (cadr with) 1000))
+	    (format *standard-output*
+		    "\nWith superinsns: %d%% of the dispatches, %d%% of the time\n"
+		    (quotient (* (car with) 100) (car without))
+		    (quotient (* (cadr with) 100) (cadr without)))))
+      (delete-directory-tree top))))
+
+(define (delete-directory-tree dir)
+  (for-each (lambda (file)
+	      (unless (member file '("." ".."))
+		(let ((name (expand-file-name file dir)))
+		  (if (file-directory? name)
+		      (delete-directory-tree name)
+		    (delete-file name)))))
+	    (directory-files dir))
+  (delete-directory dir))
+
+(let ((tree (get-command-line-option "--child" t)))
+  (if tree
+      (let ((work (car *command-line-args*)))
+	(set! *command-line-args* (cdr *command-line-args*))
+	(child-run tree work))
+    (run-superinsns-bench)))
@@ -0,0 +1,85 @@
+;; tables.jl -- time hash table insertion, lookup and deletion
+
+;; Run from the top of the build tree with `./test bench/tables.jl'.
+;; Each table kind is filled with COUNT keys, then every key is looked
+;; up (hits), the same number of absent keys are looked up (misses),
+;; and finally every key is deleted. Lookups and deletions visit the
+;; keys in a different random order to insertion, so that neither the
+;; order of allocation nor of hash codes is rewarded. Times are per
+;; operation; the timing loops are compiled so that they don't swamp
+;; the table costs.
+
+(require 'rep.data.tables)
+(require 'rep.vm.compiler)
+
+(define table-bench-count 200000)
+
+(define (make-keys kind start count)
+  (let ((v (make-vector count)))
+    (do ((i 0 (1+ i)))
+	((= i count) v)
+      (let ((k (+ start i)))
+	(vector-set! v i
+		     (case kind
+		       ((fixnum) k)
+		       ((string) (format nil "key-%d" k))
+		       ((symbol) (intern (format nil "table-bench-%d" k)))
+		       ((list) (list k (* k 2)))))))))
+
+(define (shuffle keys)
+  (let ((v (copy-sequence keys)))
+    (do ((i (1- (vector-length v)) (1- i)))
+	((<= i 0) v)
+      (let ((j (random (1+ i)))
+	    (tem (vector-ref v i)))
+	(vector-set! v i (vector-ref v j))
+	(vector-set! v j tem)))))
+
+(define (time-per-op count thunk)
+  (let ((start (current-utime)))
+    (thunk)
+    (quotient (* (- (current-utime) start) 1000) count)))
+
+(define (run-one name hash compare kind)
+  (let* ((keys (make-keys kind 0 table-bench-count))
+	 (misses (make-keys kind table-bench-count table-bench-count))
+	 (order (shuffle keys))
+	 (tab (make-table hash compare))
+	 (n (vector-length keys))
+	 (insert (time-per-op
+		  n (lambda ()
+		      (do ((i 0 (1+ i)))
+			  ((= i n))
+			(table-set! tab (vector-ref keys i) i)))))
+	 (hit (time-per-op
+	       n (lambda ()
+		   (do ((i 0 (1+ i)))
+		       ((= i n))
+		     (table-ref tab (vector-ref order i))))))
+	 (miss (time-per-op
+		n (lambda ()
+		    (do ((i 0 (1+ i)))
+			((= i n))
+		      (table-ref tab (vector-ref misses i))))))
+	 (delete (time-per-op
+		  n (lambda ()
+		      (do ((i 0 (1+ i)))
+			  ((= i n))
+			(table-delete! tab (vector-ref order i)))))))
+    (format *standard-output* "%-24s %8d %8d %8d %8d\n"
+	    name insert hit miss delete)))
+
+(compile-function run-one)
+
+(define (run-tables-bench)
+  (format *standard-output* "%-24s %8s %8s %8s %8s  (ns/op, %d keys)\n"
+	  "table" "insert" "hit" "miss" "delete" table-bench-count)
+  (run-one "eq-hash eq?" eq-hash eq? 'fixnum)
+  (run-one "eq-hash eqv?" eq-hash eqv? 'fixnum)
+  (run-one "symbol-hash eq?" symbol-hash eq? 'symbol)
+  (run-one "string-hash string=?" string-hash string=? 'string)
+  (run-one "equal-hash equal?" equal-hash equal? 'list)
+  (run-one "lisp hash and compare"
+	   (lambda (x) (eq-hash x)) (lambda (x y) (eq? x y)) 'fixnum))
+
+(run-tables-bench)
@@ -0,0 +1,63 @@
+;; weak-tables.jl -- cost of weak tables to the garbage collector
+
+;; Run from the top of the build tree with `./test bench/weak-tables.jl'.
+;; A table of COUNT entries is kept live, with its keys also held in a
+;; vector, while full collections are timed. The churn test then adds
+;; CHURN entries whose keys are garbage before each collection. Times
+;; are the processor time of each collection, and of its weak phase,
+;; as recorded by the collector.
+
+(require 'rep.data.tables)
+
+(define weak-bench-count 1000000)
+(define weak-bench-churn 10000)
+(define weak-bench-rounds 10)
+
+(define (make-keys count)
+  (let ((v (make-vector count)))
+    (do ((i 0 (1+ i)))
+	((= i count) v)
+      (vector-set! v i (list i)))))
+
+(define (fill-table tab keys)
+  (do ((i 0 (1+ i)))
+      ((= i (vector-length keys)) tab)
+    (table-set! tab (vector-ref keys i) i)))
+
+(define (add-garbage tab count)
+  (do ((i 0 (1+ i)))
+      ((= i count))
+    (table-set! tab (list i) i)))
+
+;; Returns (GC-TIME . WEAK-TIME), in microseconds per collection.
+(define (time-collections #!optional tab churn)
+  (let ((total 0)
+	(weak 0))
+    (do ((i 0 (1+ i)))
+	((= i weak-bench-rounds))
+      (when churn
+	(add-garbage tab churn))
+      (garbage-collect)
+      (let ((stats (garbage-collection-statistics)))
+	(set! total (+ total (cdr (assq 'cpu-time stats))))
+	(set! weak (+ weak (caddr (assq 'weak stats))))))
+    (cons (quotient total weak-bench-rounds)
+	  (quotient weak weak-bench-rounds))))
+
+(define (run-weak-tables-bench)
+  (let ((keys (make-keys weak-bench-count)))
+    (format *standard-output* "%-24s %8s %8s %8s %8s  (us, %d keys)\n"
+	    "table" "gc" "weak" "churn gc" "weak" weak-bench-count)
+    (mapc (lambda (test)
+	    (let* ((tab (fill-table ((cdr test)) keys))
+		   (live (time-collections))
+		   (churn (time-collections tab weak-bench-churn)))
+	      (format *standard-output* "%-24s %8d %8d %8d %8d\n"
+		      (car test) (car live) (cdr live)
+		      (car churn) (cdr churn))
+	      tab))
+	  (list (cons "strong" (lambda () (make-table eq-hash eq?)))
+		(cons "weak key"
+		      (lambda () (make-weak-table eq-hash eq?)))))))
+
+(run-weak-tables-bench)
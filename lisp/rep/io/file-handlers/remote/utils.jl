@@ -69,7 +69,8 @@ explicitly, or by the remote-ftp-host-user-alist variable.")
   (defun remote-register-file-handle (fh)
     (remote-fh-guardian fh))
 
-  (defun remote-after-gc ()
+  (defun remote-after-gc (#!optional stats)
+    (declare (unused stats))
     (do ((fh (remote-fh-guardian) (remote-fh-guardian)))
 	((not fh))
       (when (file-binding fh)
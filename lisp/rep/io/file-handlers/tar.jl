@@ -348,7 +348,8 @@
   (interactive)
   (set! tarfh-dir-cache nil))
 
-(defun tarfh-after-gc ()
+(defun tarfh-after-gc (#!optional stats)
+  (declare (unused stats))
   (let loop ((fh (tarfh-fh-guardian)))
     (when fh
       (when (file-binding fh)
@@ -25,7 +25,10 @@
 
     (export call-in-profiler
 	    print-profile
-	    profile-interval)
+	    profile-interval
+	    call-in-allocation-profiler
+	    print-allocation-profile
+	    allocation-profile-interval)
 
     (open rep
 	  rep.lang.record-profile
@@ -61,4 +64,43 @@
 			      (symbol-name name) local
 			      (round (* (/ local total-samples) 100)) total
 			      (round (* (/ total total-samples) 100))))))
-		profile))))
+		profile)))
+
+  (define (call-in-allocation-profiler thunk #!optional interval)
+    (start-allocation-profiler interval)
+    (unwind-protect
+	(thunk)
+      (stop-allocation-profiler)))
+
+  (define (print-allocation-profile #!optional stream count)
+    ;; functions are (NAME SELF-OBJECTS SELF-BYTES TOTAL-OBJECTS
+    ;; TOTAL-BYTES), stacks ((NAME...) OBJECTS BYTES)
+    (let* ((stream (or stream *standard-output*))
+	   (profile (fetch-allocation-profile))
+	   (functions (sort! (car profile)
+			     (lambda (x y) (> (list-ref x 2) (list-ref y 2)))))
+	   (stacks (sort! (cdr profile)
+			  (lambda (x y) (> (caddr x) (caddr y)))))
+	   (total-bytes (max 1 (apply + (mapcar caddr stacks)))))
+      (format stream "%-32s %10s %10s        %10s %10s\n\n"
+	      "Function Name" "Objects" "Self" "Objects" "Total")
+      (for-each (lambda (f)
+		  (let ((self (list-ref f 2))
+			(total (list-ref f 4)))
+		    (when (> self 0)
+		      (format stream "%-32s %10d %10d (%3d%%) %10d %10d (%3d%%)\n"
+			      (symbol-name (car f)) (list-ref f 1) self
+			      (quotient (* self 100) total-bytes)
+			      (list-ref f 3) total
+			      (quotient (* total 100) total-bytes)))))
+		functions)
+      (format stream "\n%10s %10s  %s\n\n" "Objects" "Bytes" "Stack")
+      (let loop ((rest stacks)
+		 (i 0))
+	(when (and rest (< i (or count 20)))
+	  (format stream "%10d %10d  %s\n"
+		  (cadr (car rest)) (caddr (car rest))
+		  (if (car (car rest))
+		      (mapconcat symbol-name (car (car rest)) " < ")
+		    "<top-level>"))
+	  (loop (cdr rest) (1+ i)))))))
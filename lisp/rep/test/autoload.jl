@@ -33,6 +33,7 @@ Jade, select this file, then evaluate:
 
 ;;; ::autoload-start::
 (autoload-self-test 'rep.data 'rep.test.data)
+(autoload-self-test 'rep.vm 'rep.test.vm)
 (autoload-self-test 'rep.data.queues 'rep.data.queues)
 (autoload-self-test 'rep.data.heap 'rep.data.heap)
 (autoload-self-test 'rep.www.quote-url 'rep.www.quote-url)
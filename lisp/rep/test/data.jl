@@ -24,7 +24,10 @@
 (define-module rep.data.self-tests ()
 
     (open rep
+	  rep.data.persistent
 	  rep.data.records
+	  rep.data.tables
+	  rep.io.files
 	  rep.test.framework)
 
 ;;; equality function tests
@@ -194,7 +197,14 @@
       (test (= (string-length sub) 1))
       (test (= (byte-string-length sub) 3)))
 
-    (test (string=? (substring s2 2 4) "\x2603;\x2603;")))
+    (test (string=? (substring s2 2 4) "\x2603;\x2603;"))
+
+    ;; short strings must be able to grow out of their inline storage
+    (let ((s3 (make-string 15 #\a)))
+      (string-set! s3 0 #\x2603)
+      (test (= (string-length s3) 15))
+      (test (= (byte-string-length s3) 17))
+      (test (string=? s3 (concat #\x2603 (make-string 14 #\a))))))
 
 ;;; string-util tests
 
@@ -236,12 +246,372 @@
     (test (string=? (mapconcat string-upcase '("foo" "bar" "baz") " ")
 		   "FOO BAR BAZ")))
 
+;;; hash table tests
+
+  ;; fill a table with COUNT keys made by MAKE-KEY, delete every other
+  ;; one, and check what's left
+  (define (check-table tab make-key count)
+    (do ((i 0 (1+ i)))
+	((= i count))
+      (table-set! tab (make-key i) i))
+    (test (= (table-size tab) count))
+    (do ((i 0 (+ i 2)))
+	((>= i count))
+      (table-delete! tab (make-key i)))
+    (test (= (table-size tab) (quotient count 2)))
+    (test (do ((i 0 (1+ i))
+	       (ok t (and ok (if (= (remainder i 2) 0)
+				 (not (table-bound? tab (make-key i)))
+			       (eqv? (table-ref tab (make-key i)) i)))))
+	      ((= i count) ok)))
+    (do ((i 0 (1+ i)))
+	((= i count))
+      (table-set! tab (make-key i) (- i)))
+    (test (= (table-size tab) count))
+    (test (eqv? (table-ref tab (make-key (1- count))) (- 1 count)))
+    (let ((sum 0))
+      (table-for-each (lambda (k v)
+			(declare (unused k))
+			(set! sum (+ sum v)))
+		      tab)
+      (test (= sum (- (quotient (* count (1- count)) 2))))))
+
+  (define (table-self-test)
+    (check-table (make-table eq-hash eq?) identity 1000)
+    (check-table (make-table eq-hash eqv?) identity 1000)
+    (check-table (make-table symbol-hash eq?)
+		 (lambda (i) (intern (format nil "table-test-%d" i))) 1000)
+    (check-table (make-table string-hash string=?)
+		 (lambda (i) (format nil "key %d" i)) 1000)
+    (check-table (make-table equal-hash equal?)
+		 (lambda (i) (list i (number->string i))) 1000)
+    (check-table (make-table (lambda (x) (remainder x 7))
+			     (lambda (x y) (= x y)))
+		 identity 200)
+    (check-table (make-table eq-hash eq? 5000) identity 5000)
+    (test (= (string-hash "a long string key, longer than sixteen bytes")
+	     (string-hash (concat "a long string key, "
+				  "longer than sixteen bytes"))))
+    (test (= (symbol-hash 'foo) (string-hash "foo")))
+    (test (= (equal-hash (list 1 "two" (vector 'three)))
+	     (equal-hash (list 1 "two" (vector 'three)))))
+    ;; strings are hashed and compared over their full length
+    (let ((tab (make-table string-hash string=?))
+	  (nul (make-string 1 (integer->char 0))))
+      (test (not (string=? (concat "a" nul "b") (concat "a" nul "c"))))
+      (table-set! tab (concat "a" nul "b") 1)
+      (test (eqv? (table-ref tab (concat "a" nul "b")) 1))
+      (test (not (table-bound? tab (concat "a" nul "c")))))
+    (test (not (table-ref (make-table string-hash string=?) "absent")))
+    ;; cached hash codes follow the string contents
+    (let ((s (copy-sequence "abc"))
+	  (c (string->immutable-string "immutable key")))
+      (string-hash s)
+      (string-set! s 0 #\x)
+      (test (= (string-hash s) (string-hash "xbc")))
+      (test (= (string-hash c) (string-hash c) (string-hash "immutable key")))
+      (test (= (symbol-hash 'car) (string-hash "car"))))
+    ;; keys added during a walk may or may not be seen, but the
+    ;; existing keys must each be seen once, even as the table grows
+    (let ((tab (make-table eq-hash eq?))
+	  (seen 0))
+      (do ((i 0 (1+ i)))
+	  ((= i 100))
+	(table-set! tab i t))
+      (table-for-each (lambda (k v)
+			(declare (unused v))
+			(when (< k 100)
+			  (set! seen (1+ seen))
+			  (do ((j 0 (1+ j)))
+			      ((= j 20))
+			    (table-set! tab (+ 1000 (* k 20) j) nil))))
+		      tab)
+      (test (= seen 100))
+      (test (= (table-size tab) 2100)))
+    (let ((tab (make-table (lambda (x) (declare (unused x)) 0) eq?)))
+      (table-set! tab 'a 1)
+      (table-set! tab 'b 2)
+      (test (eqv? (table-ref tab 'b) 2))
+      (table-delete! tab 'a)
+      (test (not (table-bound? tab 'a)))
+      (test (eqv? (table-ref tab 'b) 2))))
+
+;;; obarray tests
+
+  (define (obarray-self-test)
+    (let ((ob (make-obarray 4))
+	  (name (lambda (i) (format nil "obarray-test-%d" i))))
+      (do ((i 0 (1+ i)))
+	  ((= i 1000))
+	(intern (name i) ob))
+      (do ((i 0 (1+ i)))
+	  ((= i 1000))
+	(when (= (logand i 1) 0)
+	  (unintern (find-symbol (name i) ob) ob)))
+      (test (do ((i 0 (1+ i))
+		 (ok t (and ok (eq? (not (find-symbol (name i) ob))
+				    (= (logand i 1) 0)))))
+		((= i 1000) ok)))
+      (let* ((stats (obarray-statistics ob))
+	     (lengths (cdr (assq 'chain-lengths stats))))
+	(test (= (cdr (assq 'symbols stats)) 500))
+	(test (>= (cdr (assq 'buckets stats)) 1000))
+	(test (= (apply + lengths) (cdr (assq 'buckets stats))))
+	(test (= (length lengths) (1+ (cdr (assq 'longest-chain stats)))))
+	(test (= (- (cdr (assq 'buckets stats)) (car lengths))
+		 (cdr (assq 'used-buckets stats)))))
+      (let ((found (apropos "^obarray-test-99.$" nil ob)))
+	(test (= (length found) 5))
+	(test (memq (find-symbol "obarray-test-991" ob) found))))
+
+    ;; the builtin symbols are already in the default obarray, and
+    ;; symbols chained after them must survive collections
+    (test (eq? (find-symbol "cons") 'cons))
+    (test (eq? (intern (concat "symbol-" "name")) 'symbol-name))
+    (do ((i 0 (1+ i)))
+	((= i 2000))
+      (intern (format nil "obarray-test-%d" i)))
+    (garbage-collect)
+    (test (do ((i 0 (1+ i))
+	       (ok t (and ok (find-symbol (format nil "obarray-test-%d" i)))))
+	      ((= i 2000) ok)))
+    (do ((i 0 (1+ i)))
+	((= i 2000))
+      (unintern (find-symbol (format nil "obarray-test-%d" i)))))
+
+;;; persistent map and vector tests
+
+  (define (pmap-self-test)
+    (let* ((empty (make-pmap))
+	   (m1 (pmap-set empty '(a) 1))
+	   (m2 (pmap-set m1 "b" 2))
+	   (m3 (pmap-delete m2 '(a))))
+      (test (= (pmap-size empty) 0))
+      (test (eqv? (pmap-ref m1 (list 'a)) 1))
+      (test (not (pmap-bound? m1 "b")))
+      (test (eq? (pmap-ref m3 '(a) 'none) 'none))
+      (test (= (pmap-size m2) 2))
+      (test (equal? m3 (alist->pmap '(("b" . 2)))))
+      (test (= (equal-hash m2) (equal-hash (alist->pmap (pmap->alist m2)))))
+      (test (not (equal? m2 m3))))
+    ;; a thousand keys through a transient, all colliding in the low
+    ;; bits of their hash codes, then removed again persistently
+    (let ((tr (pmap-transient (make-pmap (lambda (x) (* x 1024)) =))))
+      (do ((i 0 (1+ i)))
+	  ((= i 1000))
+	(pmap-set! tr i (* i i)))
+      (let ((m (pmap-persistent! tr))
+	    (sum 0))
+	(test (= (pmap-size m) 1000))
+	(pmap-for-each (lambda (k v)
+			 (when (= v (* k k))
+			   (set! sum (+ sum k))))
+		       m)
+	(test (= sum 499500))
+	(let loop ((i 0)
+		   (m2 m))
+	  (if (< i 1000)
+	      (loop (+ i 2) (pmap-delete m2 i))
+	    (test (= (pmap-size m2) 500))
+	    (test (not (pmap-bound? m2 10)))
+	    (test (eqv? (pmap-ref m2 11) 121))))
+	(test (eqv? (pmap-ref m 10) 100)))))
+
+  (define (pvector-self-test)
+    (let* ((v (list->pvector (make-list 100 'x)))
+	   (v2 (pvector-set v 50 'y))
+	   (tr (pvector-transient v2)))
+      (test (eq? (pvector-ref v 50) 'x))
+      (test (eq? (pvector-ref v2 50) 'y))
+      (test (equal? (pvector-push (pvector 1 2) 3) (pvector 1 2 3)))
+      (test (equal? (pvector->list (pvector-pop (pvector 1 2 3))) '(1 2)))
+      (do ((i 0 (1+ i)))
+	  ((= i 2000))
+	(pvector-push! tr i))
+      (pvector-set! tr 0 'z)
+      (pvector-pop! tr)
+      (let ((v3 (pvector-persistent! tr)))
+	(test (= (pvector-length v3) 2099))
+	(test (eqv? (pvector-ref v3 2098) 1998))
+	(test (eq? (pvector-ref v3 0) 'z))
+	(test (eq? (pvector-ref v2 0) 'x))
+	(test (= (pvector-length v2) 100))
+	(let loop ((v4 v3))
+	  (if (> (pvector-length v4) 1)
+	      (loop (pvector-pop v4))
+	    (test (equal? v4 (pvector 'z)))))
+	(test (= (equal-hash v3)
+		 (equal-hash (list->pvector (pvector->list v3))))))))
+
+;;; garbage collector tests
+
+  ;; old objects must keep young values stored into them alive across
+  ;; minor collections
+  (define (gc-self-test)
+    (let ((old-mode (garbage-collector-mode 'generational))
+	  (old-policy (garbage-pacing-policy 'fixed))
+	  (old-threshold (garbage-threshold 10000))
+	  (v (make-vector 100))
+	  (l (make-list 100)))
+      (garbage-collect)
+      (do ((i 0 (1+ i))
+	   (cell l (cdr cell)))
+	  ((= i 100))
+	(vector-set! v i (list i (number->string i)))
+	(set-car! cell (cons i (make-string i #\x))))
+      (do ((i 0 (1+ i)))
+	  ((= i 5000))
+	(list i (make-string 8)))
+      (test (do ((i 0 (1+ i))
+		 (ok t (and ok (equal? (vector-ref v i)
+				       (list i (number->string i))))))
+		((= i 100) ok)))
+      (test (do ((i 0 (1+ i))
+		 (cell l (cdr cell))
+		 (ok t (and ok (= (caar cell) i)
+			    (string=? (cdar cell) (make-string i #\x)))))
+		((= i 100) ok)))
+      (test (eq? (garbage-collector-mode old-mode) 'generational))
+      (garbage-threshold old-threshold)
+      (test (eq? (garbage-pacing-policy old-policy) 'fixed))))
+
+  ;; Adds 100 entries to TAB, the value of each made by (MAKE-VALUE KEY
+  ;; PREVIOUS-KEY). Returns the last ten (KEY . VALUE) pairs.
+  (define (fill-weak-table tab make-value)
+    (let ((kept '())
+	  (prev nil))
+      (do ((i 0 (1+ i)))
+	  ((= i 100) kept)
+	(let* ((key (list 'key i))
+	       (value (make-value key prev)))
+	  (table-set! tab key value)
+	  (set! prev key)
+	  (when (>= i 90)
+	    (set! kept (cons (cons key value) kept)))))))
+
+  ;; Returns the number of entries left in a table of WEAKNESS after a
+  ;; collection, when only the parts of the last ten entries selected by
+  ;; KEEP are otherwise reachable.
+  (define (weak-table-survivors weakness make-value keep)
+    (let* ((tab (make-weak-table equal-hash equal? nil weakness))
+	   (kept (mapcar keep (fill-weak-table tab make-value))))
+      (garbage-collect)
+      (car (list (table-size tab) kept))))
+
+  (define (weak-table-self-test)
+    (let ((none (lambda (x) (declare (unused x)) nil))
+	  (fresh (lambda (k p) (declare (unused k p)) (list 'value)))
+	  (own-key (lambda (k p) (declare (unused p)) (list k)))
+	  (prev-key (lambda (k p) (declare (unused k)) (list p))))
+      (test (= (weak-table-survivors 'key fresh car) 10))
+      (test (= (weak-table-survivors 'key fresh cdr) 0))
+      (test (= (weak-table-survivors 'key fresh none) 0))
+      ;; values only keep their keys alive when reachable otherwise
+      (test (= (weak-table-survivors 'key own-key cdr) 10))
+      (test (= (weak-table-survivors 'key own-key none) 0))
+      (test (= (weak-table-survivors 'key prev-key car) 100))
+      (test (= (weak-table-survivors 'value fresh cdr) 10))
+      (test (= (weak-table-survivors 'value fresh car) 0))
+      (test (= (weak-table-survivors 'key-and-value fresh identity) 10))
+      (test (= (weak-table-survivors 'key-and-value fresh car) 0))
+      (test (= (weak-table-survivors 'key-and-value fresh cdr) 0)))
+    ;; young weak keys and referents survive minor collections while
+    ;; they're reachable
+    (let ((old-mode (garbage-collector-mode 'generational))
+	  (old-policy (garbage-pacing-policy 'fixed))
+	  (old-threshold (garbage-threshold 10000))
+	  (tab (make-weak-table eq-hash eq?))
+	  (key (list 'key)))
+      (garbage-collect)
+      (table-set! tab key (list 'value))
+      (let ((ref (make-weak key)))
+	(do ((i 0 (1+ i)))
+	    ((= i 5000))
+	  (list i (make-string 8)))
+	(test (eq? (weak-ref ref) key)))
+      (test (equal? (table-ref tab key) '(value)))
+      (garbage-collector-mode old-mode)
+      (garbage-threshold old-threshold)
+      (garbage-pacing-policy old-policy)))
+
+  ;; vectors of each size class, and large ones, must survive
+  ;; collections while unreachable ones of the same sizes are freed
+  (define (vector-gc-self-test)
+    (let ((keep (do ((n 0 (1+ n))
+		     (l '() (cons (make-vector n n) l)))
+		    ((= n 600) l))))
+      (do ((i 0 (1+ i)))
+	  ((= i 3))
+	(do ((n 0 (1+ n)))
+	    ((= n 600))
+	  (make-vector n))
+	(garbage-collect))
+      (test (let loop ((l keep)
+		       (n 599))
+	      (cond ((null? l) (= n -1))
+		    ((and (= (vector-length (car l)) n)
+			  (or (= n 0) (eqv? (vector-ref (car l) (1- n)) n)))
+		     (loop (cdr l) (1- n)))
+		    (t nil))))))
+
+  ;; statistics of the last collection are recorded and passed to
+  ;; *after-gc-hook*
+  (define (gc-statistics-self-test)
+    (let* ((record nil)
+	   (hook (lambda (#!optional stats) (set! record stats)))
+	   (before (cdr (assq 'collections (garbage-collection-totals)))))
+      (let ((*after-gc-hook* (list hook)))
+	(garbage-collect))
+      (test (equal? record (garbage-collection-statistics)))
+      (test (eq? (cdr (assq 'kind record)) 'major))
+      (test (= (cdr (assq 'number record)) (1+ before)))
+      (test (= (length (cdr (assq 'mark record))) 2))
+      (test (> (cadr (assq 'cons (cdr (assq 'types record)))) 0))
+      (test (= (apply + (mapcar cdr (garbage-pause-histogram)))
+	       (cdr (assq 'collections (garbage-collection-totals))))))
+    ;; freed objects of types from rep_define_type are counted too,
+    ;; as reported by each type's sweep function. Guardians have no
+    ;; size function, so their bytes aren't counted
+    (do ((i 0 (1+ i)))
+	((= i 100))
+      (make-table equal-hash equal?)
+      (pvector i)
+      (make-guardian))
+    (garbage-collect)
+    (let ((types (cdr (assq 'types (garbage-collection-statistics)))))
+      (mapc (lambda (type)
+	      (let ((stats (assq type types)))
+		(test (and stats (>= (list-ref stats 3) 100)))
+		(test (or (eq? type 'guardian) (> (list-ref stats 4) 0)))))
+	    '(table pvector guardian))))
+
+  ;; a heap snapshot can be written, and the collection still works
+  (define (heap-snapshot-self-test)
+    (let ((file (make-temp-name))
+	  (data (list (make-vector 10 'a) "string")))
+      (test (write-heap-snapshot file))
+      (let ((stream (open-file file 'read)))
+	(test (string=? (substring (read-line stream) 0 8) "REPHEAP1"))
+	(close-file stream))
+      (delete-file file)
+      (test (equal? data (list (make-vector 10 'a) "string")))
+      (test (eq? (cdr (assq 'kind (garbage-collection-statistics))) 'major))))
+
   (define (self-test)
     (equality-self-test)
     (cons-self-test)
     (record-self-test)
     (string-encoding-test)
-    (string-util-self-test))
+    (string-util-self-test)
+    (table-self-test)
+    (weak-table-self-test)
+    (obarray-self-test)
+    (pmap-self-test)
+    (pvector-self-test)
+    (gc-self-test)
+    (vector-gc-self-test)
+    (gc-statistics-self-test)
+    (heap-snapshot-self-test))
 
   ;;###autoload
   (define-self-test 'rep.data self-test))
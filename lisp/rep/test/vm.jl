@@ -0,0 +1,171 @@
+#| rep.test.vm -- checks for the virtual machine
+
+   $Id$
+
+   Copyright (C) 2001 John Harper <jsh@users.sourceforge.net>
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+|#
+
+(define-module rep.vm.self-tests ()
+
+    (open rep
+	  rep.structures
+	  rep.vm.interpreter
+	  rep.vm.compiler
+	  rep.vm.bytecodes
+	  rep.test.framework)
+
+;;; inline caches of global references
+
+  (define cached-variable 0)
+  (define (cached-ref) cached-variable)
+  (define (cached-set! x) (set! cached-variable x))
+  (define (imported-ref s) (string-upcase s))
+
+  (define (ref-cache-stat key)
+    (cdr (assq key (structure-stats))))
+
+  ;; a throwaway structure opening rep, so that shadowing one of its
+  ;; bindings there doesn't affect anything else
+  (define (make-ref-cache-structure)
+    (make-structure nil (eval '(lambda () (%open-modules '(rep)))) nil))
+
+  ;; compiled references and assignments see every change, including
+  ;; a local definition shadowing an imported binding
+  (define (ref-cache-self-test)
+    (let ((hits (ref-cache-stat 'inline-cache-hits)))
+      (do ((i 0 (1+ i)))
+	  ((= i 100))
+	(cached-set! i)
+	(test (= (cached-ref) i)))
+      (test (equal? (imported-ref "a") "A"))
+      (test (> (ref-cache-stat 'inline-cache-hits) hits)))
+    (let* ((s (make-ref-cache-structure))
+	   (ref (compile-function (eval '(lambda (x) (string-upcase x)) s))))
+      (test (equal? (ref "a") "A"))
+      (structure-define s 'string-upcase
+			(lambda (x)
+			  (declare (unused x))
+			  'shadowed))
+      (test (eq? (ref "a") 'shadowed))
+      (eval '(makunbound 'string-upcase) s)
+      (test (equal? (ref "a") "A")))
+    (test (> (cdr (assq 'bindings (structure-stats (current-structure)))) 0))
+    ;; definitions in structures no cache depends on don't flush them
+    (let ((flushes (ref-cache-stat 'inline-cache-flushes))
+	  (s (make-structure nil nil nil)))
+      (structure-define s 'unlinked-variable 1)
+      (test (= (ref-cache-stat 'inline-cache-flushes) flushes))))
+
+;;; bytecode profiler tests
+
+  (define (profiled-loop n)
+    (do ((i 0 (1+ i))
+	 (acc '() (cons i acc)))
+	((= i n) acc)))
+
+  (define (profiled-entry profile)
+    (let loop ((rest (caddr profile)))
+      (cond ((null? rest) nil)
+	    ((eq? (car (car rest)) profiled-loop) (car rest))
+	    (t (loop (cdr rest))))))
+
+  ;; every instruction executed by a compiled function while the
+  ;; profiler runs is counted, and none after it stops
+  (define (bytecode-profile-self-test)
+    (start-bytecode-profiler)
+    (profiled-loop 100)
+    (stop-bytecode-profiler)
+    (profiled-loop 100)
+    (let* ((profile (fetch-bytecode-profile))
+	   (entry (profiled-entry profile)))
+      (test entry)
+      (test (> (cadr entry) 100))
+      (test (= (cadr entry) (apply + (vector->list (caddr entry)))))
+      (test (>= (apply + (vector->list (car profile))) (cadr entry)))
+      (test (cadr profile))))
+
+  ;; when compiled, most of the body is superinstructions
+  (define superinsn-source
+    '(lambda (x y)
+       (cond ((eq? (car x) 'a) (cdr x))
+	     ((not y) (or (cdr x) 'none))
+	     (t (car x)))))
+
+  (define (superinsn-fn x y)
+    (cond ((eq? (car x) 'a) (cdr x))
+	  ((not y) (or (cdr x) 'none))
+	  (t (car x))))
+
+  (define (code-has-opcode? fun op)
+    (let ((code (vector-ref (closure-function fun) 0)))
+      (let loop ((i 0))
+	(cond ((= i (byte-string-length code)) nil)
+	      ((= (byte-string-ref code i) op) t)
+	      (t (loop (1+ i)))))))
+
+  (define (superinstruction-self-test)
+    (test (= (superinsn-fn '(a . 1) nil) 1))
+    (test (eq? (superinsn-fn '(b . 2) t) 'b))
+    (test (eq? (superinsn-fn '(b) nil) 'none))
+    (test (= (superinsn-fn '(b . 3) nil) 3))
+    (test (eq? (car (condition-case data
+			(apply superinsn-fn '((a)))
+		      (missing-arg data)))
+	       'missing-arg))
+    (let ((with (compile-function (eval superinsn-source)))
+	  (without (let ((*compiler-no-superinstructions* t))
+		     (compile-function (eval superinsn-source)))))
+      (test (code-has-opcode? with (bytecode reg-ref-car)))
+      (test (code-has-opcode? with (bytecode eq-jn)))
+      (test (not (code-has-opcode? without (bytecode reg-ref-car))))
+      (test (not (code-has-opcode? without (bytecode eq-jn))))
+      (test (eq? (without '(b) nil) 'none))))
+
+  ;; a tail call, a throw to a catch and a handled error
+  (define (threaded-fn n)
+    (cond ((zero? n) '(done "constant"))
+	  ((zero? (remainder n 3))
+	   (catch 'threaded (throw 'threaded (list n 'thrown))))
+	  ((= (remainder n 3) 1)
+	   (condition-case nil
+	       (+ n 'nan)
+	     (error (list n 'caught))))
+	  (t (threaded-fn (1- n)))))
+
+  ;; results don't change once the function has been run often enough
+  ;; to be translated to direct-threaded code (when configured with
+  ;; --enable-direct-threaded), or after collecting garbage
+  (define (direct-threaded-self-test)
+    (let ((expected '((done "constant") (3 thrown) (4 caught) (4 caught))))
+      (test (let loop ((i 0))
+	      (cond ((= i 200) t)
+		    ((equal? (mapcar threaded-fn '(0 3 4 5)) expected)
+		     (when (= i 100)
+		       (garbage-collect))
+		     (loop (1+ i)))
+		    (t nil))))))
+
+  (define (self-test)
+    (ref-cache-self-test)
+    (bytecode-profile-self-test)
+    (superinstruction-self-test)
+    (direct-threaded-self-test))
+
+  ;;###autoload
+  (define-self-test 'rep.vm self-test))
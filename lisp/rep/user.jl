@@ -101,6 +101,10 @@ where OPTIONS are any of:
 
     --check		run self tests and exit
 
+    --image FILE	restore the environment saved in FILE
+    --dump-image FILE [MODULE...]
+			save the booted environment (with MODULEs) to FILE
+
     --version		print version details
     --no-rc		don't load rc or site-init files
     --quit, -q		terminate the interpreter process\n" program-name)
@@ -323,7 +323,7 @@
    'collect
    (lambda ()
      (let ((stats (garbage-collect t)))
-       (format *standard-output* "Used %d/%d cons, %d/%d tuples, %d strings, %d vector slots, %d/%d closures\n"
+       (format *standard-output* "Used %d/%d cons, %d/%d tuples, %d strings, %d vector slots, %d/%d closures; %d bytes released\n"
 	       (car (list-ref stats 0))
 	       (+ (car (list-ref stats 0)) (cdr (list-ref stats 0)))
 	       (car (list-ref stats 1))
@@ -331,7 +331,8 @@
 	       (car (list-ref stats 2))
 	       (list-ref stats 3)
 	       (car (list-ref stats 4))
-	       (+ (car (list-ref stats 4)) (cdr (list-ref stats 4)))))))
+	       (+ (car (list-ref stats 4)) (cdr (list-ref stats 4)))
+	       (list-ref stats 5)))))
 
   (define-repl-command
    'disassemble
@@ -474,6 +475,24 @@ commands may be abbreviated to their unique leading characters.\n\n")
      (print-profile))
    "FORM")
 
+  (define-repl-command
+   'allocation-profile
+   (lambda (form)
+     (require 'rep.lang.profiler)
+     (format *standard-output* "%S\n\n" (call-in-allocation-profiler
+				       (lambda () (repl-eval form))))
+     (print-allocation-profile))
+   "FORM")
+
+  (define-repl-command
+   'bytecode-profile
+   (lambda (form)
+     (require 'rep.vm.profiler)
+     (format *standard-output* "%S\n\n" (call-in-bytecode-profiler
+				       (lambda () (repl-eval form))))
+     (print-bytecode-profile))
+   "FORM")
+
   (define-repl-command
    'check
    (lambda (#!optional module)
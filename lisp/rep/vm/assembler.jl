@@ -167,6 +167,15 @@
 
 	      (t (emit-insn 'push (get-const-id arg)))))
 
+      (define (emit-superinsn-jmp insn)
+	;; the register number, if any, precedes the address
+	(emit-byte (bytecode-ref (car insn)))
+	(when (cddr insn)
+	  (if (< (cadr insn) 256)
+	      (emit-byte (cadr insn))
+	    (error "Argument overflow in superinstruction: %s" (car insn))))
+	(emit-label-addr (get-label (last insn))))
+
       (define (emit-push-label arg)
 	;; push address of label
 	(emit-byte (bytecode pushi-pair-pos))
@@ -195,6 +204,8 @@
 			 (emit-insn (car insn) (get-const-id (cadr insn))))
 			((memq (car insn) byte-jmp-insns)
 			 (emit-jmp (car insn) (cadr insn)))
+			((memq (car insn) byte-superinsn-jmp-insns)
+			 (emit-superinsn-jmp insn))
 			(t (apply emit-insn insn))))
 		insns)
 
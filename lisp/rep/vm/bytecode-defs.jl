@@ -36,7 +36,7 @@
 
   ;; Instruction set version
   (defconst bytecode-major 12)
-  (defconst bytecode-minor 0)
+  (defconst bytecode-minor 1)
 
   ;; macro to get a named bytecode
   (defmacro bytecode (name)
@@ -224,6 +224,18 @@
 
       (undefined . #xd5)
 
+;;; Superinstructions, only emitted by the peephole optimizer. Each
+;;; takes a register number in the next byte, or a two-byte address,
+;;; or both
+
+      (reg-ref-car . #xd6)		;push (car reg[n])
+      (reg-ref-cdr . #xd7)		;push (cdr reg[n])
+      (dup-reg-set . #xd8)		;reg[n] = stk[0]
+      (required-arg-reg-set . #xd9)	;reg[n] = next argument
+      (reg-ref-jn . #xda)		;if reg[n] nil, jmp x
+      (reg-ref-jt . #xdb)		;if reg[n] t, jmp x
+      (eq-jn . #xdc)			;pop two, if not eq?, jmp x
+
       (last-before-jmps . #xf7)
 
 ;;; All jmps take two-byte arguments
@@ -273,8 +285,8 @@
      0   -1  0   -1  -1  0   0   nil
      -1  -2  -1  -1  0   0   -1  -2	;#xc0
      -1  +1  +1  +1  0   0   nil nil
-     -1 -2 0 -1 -2 1 nil nil		;#xd0
-     nil nil nil nil nil nil nil nil
+     -1 -2 0 -1 -2 1 +1 +1		;#xd0
+     0   0   0   0   -2  nil nil nil
      -1  nil nil nil nil nil nil nil	;#xe0
      -1  nil nil nil nil nil nil nil
      nil nil nil nil nil nil nil nil	;#xf0
@@ -30,6 +30,7 @@
 	    byte-varref-free-insns byte-side-effect-free-insns
 	    byte-pushes-undefined-insns
 	    byte-conditional-jmp-insns byte-jmp-insns
+	    byte-superinsn-jmp-insns
 	    byte-opcodes-with-constants byte-varref-insns
 	    byte-varset-insns byte-varbind-insns
 	    byte-list-ref-insns byte-list-tail-insns)
@@ -39,7 +40,12 @@
 ;;; Description of instruction set for when optimising
 
   ;; list of instructions that always have a 1-byte argument following them
-  (define byte-two-byte-insns (list (bytecode pushi)))
+  (define byte-two-byte-insns
+    (list (bytecode pushi)
+	  (bytecode reg-ref-car)
+	  (bytecode reg-ref-cdr)
+	  (bytecode dup-reg-set)
+	  (bytecode required-arg-reg-set)))
 
   ;; list of instructions that always have a 2-byte argument following them
   (define byte-three-byte-insns
@@ -52,7 +58,8 @@
 	  (bytecode jn)
 	  (bytecode jt)
 	  (bytecode jnp)
-	  (bytecode jtp)))
+	  (bytecode jtp)
+	  (bytecode eq-jn)))
 
   ;; list of instructions that are both side-effect free and don't
   ;; reference any variables. Also none of these may ever raise exceptions
@@ -85,6 +92,10 @@
   ;; list of all jump instructions
   (define byte-jmp-insns (list* 'jmp 'ejmp byte-conditional-jmp-insns))
 
+  ;; list of superinstructions ending in a jump, their label is always
+  ;; the last argument
+  (define byte-superinsn-jmp-insns '(reg-ref-jn reg-ref-jt eq-jn))
+
   ;; list of all varref instructions
   (define byte-varref-insns '(env-ref refq reg-ref))
 
@@ -51,6 +51,10 @@ their position in that file.")
 
   (defvar *compiler-no-low-level-optimisations* nil)
 
+  (defvar *compiler-no-superinstructions* nil
+    "When true the peephole optimiser doesn't combine common pairs of
+instructions into single superinstructions.")
+
   (defvar *compiler-debug* nil)
 
   (define-module-alias compiler rep.vm.compiler)
@@ -372,7 +372,9 @@
     (unless *compiler-no-low-level-optimisations*
       (let ((tem (peephole-optimizer (assembly-code asm))))
 	(assembly-code-set asm (car tem))
-	(assembly-max-stack-set asm (+ (assembly-max-stack asm) (cdr tem)))))
+	(assembly-max-stack-set asm (+ (assembly-max-stack asm) (cdr tem))))
+      (unless *compiler-no-superinstructions*
+	(assembly-code-set asm (emit-superinstructions (assembly-code asm)))))
     (when *compiler-debug*
       (format *standard-error* "lap-1 code: %S\n\n" (assembly-code asm))))
 
@@ -23,9 +23,11 @@
 (define-module rep.vm.disassembler
 
     (export disassemble
-	    disassemble-1)
+	    disassemble-1
+	    opcode-name)
 
     (open rep
+	  rep.regexp
 	  rep.vm.bytecodes)
 
   (define-module-alias disassembler rep.vm.disassembler)
@@ -75,15 +77,35 @@
      "variable-set!" "required-arg" "optional-arg" "rest-arg"
      "not-zero?" "keyword-arg" "optional-arg*" "keyword-arg*"
      "vector-ref" "vector-set!" "string-length"
-     "string-ref" "string-set!" "undefined" nil nil	; #xd0
-     nil nil nil nil nil nil nil nil
+     "string-ref" "string-set!" "undefined" "reg-ref-car #%d"
+     "reg-ref-cdr #%d"					; #xd0
+     "dup-reg-set #%d" "required-arg-reg-set #%d" "reg-ref-jn #%d @%d"
+     "reg-ref-jt #%d @%d" "eq-jn @%d" nil nil nil
      nil nil nil nil nil nil nil nil	; #xe0
      nil nil nil nil nil nil nil nil
      nil nil nil nil nil nil nil nil	; #xf0
      "ejmp @%d" "jpn @%d" "jpt @%d" "jmp @%d"
      "jn @%d" "jt @%d" "jnp @%d" "jtp @%d" ])
 
-  (define (disassemble-1 code-string consts stream #!optional depth)
+  ;; Return the name of the instruction with opcode OP
+  (define (opcode-name op)
+    (let ((name (vector-ref disassembler-opcodes
+			    (if (< op (bytecode last-with-args))
+				(logand op #xf8)
+			      op))))
+      (cond ((null? name)
+	     (format nil "<%d>" op))
+	    ((string-match "^push %d" name)
+	     "pushi")
+	    ((string-match " [#@]%d" name)
+	     (substring name 0 (match-start)))
+	    (t name))))
+
+  ;; COUNTS, if given, is a vector holding the number of times the
+  ;; instruction at each offset was executed, as collected by the
+  ;; bytecode profiler. Each line is then prefixed by its count and
+  ;; its share of the total.
+  (define (disassemble-1 code-string consts stream #!optional depth counts)
     (define (const-ref i)
       (if (< i (vector-length consts))
 	  (vector-ref consts i)
@@ -94,10 +116,15 @@
     (let
 	((i 0)
 	 (indent (make-string depth))
+	 (total (and counts (apply + (vector->list counts))))
 	 c arg op)
       (while (< i (byte-string-length code-string))
 	(set! c (code-ref i))
-	(format stream "\n%s%d\t" indent i)
+	(if counts
+	    (let ((count (vector-ref counts i)))
+	      (format stream "\n%s%10d %3d%%  %d\t" indent count
+		      (if (zero? total) 0 (quotient (* count 100) total)) i))
+	  (format stream "\n%s%d\t" indent i))
 	(cond
 	 ((< c (bytecode last-with-args))
 	  (set! op (logand c #xf8))
@@ -157,6 +184,21 @@
 	  (when (= c (bytecode pushi-pair-neg))
 	    (set! arg (- arg)))
 	  (format stream (vector-ref disassembler-opcodes c) arg))
+	 ((memq c byte-two-byte-insns)
+	  (set! arg (code-ref (1+ i)))
+	  (set! i (1+ i))
+	  (format stream (vector-ref disassembler-opcodes c) arg))
+	 ((memq c byte-three-byte-insns)
+	  (set! arg (logior (ash (code-ref (1+ i)) 8)
+			    (code-ref (+ i 2))))
+	  (set! i (+ i 2))
+	  (format stream (vector-ref disassembler-opcodes c) arg))
+	 ((or (= c (bytecode reg-ref-jn))
+	      (= c (bytecode reg-ref-jt)))
+	  (set! arg (code-ref (1+ i)))
+	  (format stream (vector-ref disassembler-opcodes c) arg
+		  (logior (ash (code-ref (+ i 2)) 8) (code-ref (+ i 3))))
+	  (set! i (+ i 3)))
 	 (t
 	  (set! op (vector-ref disassembler-opcodes c))
 	  (if op
@@ -166,8 +208,10 @@
       (write stream #\newline)))
 
   ;;;###autoload
-  (defun disassemble (arg #!optional stream depth)
-    "Dissasembles ARG, with output to STREAM, or the *disassembly* buffer."
+  (defun disassemble (arg #!optional stream depth counts)
+    "Dissasembles ARG, with output to STREAM, or the *disassembly* buffer.
+If COUNTS is given, it's a vector of instruction counts, as returned by
+`fetch-bytecode-profile', to annotate the listing with."
     (interactive "aFunction to disassemble:")
     (let
 	(code-string consts stack
@@ -217,4 +261,4 @@
 		(byte-string-length code-string) (vector-length consts)
 		(logand stack #x3ff) (logand (ash stack -10) #x3ff)
 		(ash stack -20)))
-      (disassemble-1 code-string consts stream depth))))
+      (disassemble-1 code-string consts stream depth counts))))
@@ -26,7 +26,8 @@
 
 (define-module rep.vm.peephole
 
-    (export peephole-optimizer)
+    (export peephole-optimizer
+	    emit-superinstructions)
 
     (open rep
 	  rep.vm.bytecodes)
@@ -558,4 +559,46 @@
 	(shift))
 
       ;; drop the extra cons we added
-      (cons (cdr code-string) extra-stack))))
+      (cons (cdr code-string) extra-stack)))
+
+  ;; Return the superinstruction doing the work of INSN0; INSN1, or
+  ;; false. These pairs are the most frequently executed in the
+  ;; compiler itself (see `print-bytecode-profile')
+  (define (superinstruction insn0 insn1)
+    (cond
+     ;; reg-ref X; {car,cdr} --> reg-ref-{car,cdr} X
+     ;; reg-ref X; {jn,jt} Y --> reg-ref-{jn,jt} X Y
+     ((and (eq? (car insn0) 'reg-ref) (< (cadr insn0) 256))
+      (case (car insn1)
+	((car) (list 'reg-ref-car (cadr insn0)))
+	((cdr) (list 'reg-ref-cdr (cadr insn0)))
+	((jn) (list 'reg-ref-jn (cadr insn0) (cadr insn1)))
+	((jt) (list 'reg-ref-jt (cadr insn0) (cadr insn1)))))
+
+     ;; dup; reg-set X --> dup-reg-set X
+     ;; required-arg; reg-set X --> required-arg-reg-set X
+     ((and (eq? (car insn1) 'reg-set) (< (cadr insn1) 256))
+      (case (car insn0)
+	((dup) (list 'dup-reg-set (cadr insn1)))
+	((required-arg) (list 'required-arg-reg-set (cadr insn1)))))
+
+     ;; eq?; jn X --> eq-jn X
+     ((and (eq? (car insn0) 'eq?) (eq? (car insn1) 'jn))
+      (list 'eq-jn (cadr insn1)))))
+
+  ;; Replace pairs of instructions in CODE by superinstructions,
+  ;; modifying and returning it. Must be the last pass, the rest of the
+  ;; optimizer doesn't know about them. Labels are separate elements
+  ;; of CODE, so no pair can span one
+  (define (emit-superinstructions code)
+    (let ((point code)
+	  tem)
+      (while (cdr point)
+	(if (and (pair? (car point))
+		 (pair? (cadr point))
+		 (set-tem! (superinstruction (car point) (cadr point))))
+	    (progn
+	      (set-car! point tem)
+	      (set-cdr! point (cddr point)))
+	  (set! point (cdr point))))
+      code)))
@@ -0,0 +1,108 @@
+#| profiler.jl -- reporting the bytecode profiler's counts
+
+   $Id$
+
+   Copyright (C) 2015 John Harper <jsh@unfactored.org>
+
+   This file is part of librep.
+
+   librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Jade; see the file COPYING.  If not, write to
+   the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+|#
+
+(define-module rep.vm.profiler
+
+    (export call-in-bytecode-profiler
+	    print-bytecode-profile
+	    disassemble-profile)
+
+    (open rep
+	  rep.vm.interpreter
+	  rep.vm.disassembler
+	  rep.data.tables)
+
+  (define (call-in-bytecode-profiler thunk)
+    (start-bytecode-profiler)
+    (unwind-protect
+	(thunk)
+      (stop-bytecode-profiler)))
+
+  ;; Return an alist of (KEY . COUNT) from table TAB, largest first
+  (define (sorted-counts tab)
+    (let ((lst '()))
+      (table-for-each (lambda (k v)
+			(set! lst (cons (cons k v) lst))) tab)
+      (sort! lst (lambda (x y) (> (cdr x) (cdr y))))))
+
+  (define (add-count! tab key count)
+    (table-set! tab key (+ (or (table-ref tab key) 0) count)))
+
+  (define (function-name fun)
+    (cond ((null? fun) "<top-level>")
+	  ((closure-name fun) (format nil "%s" (closure-name fun)))
+	  (t "<anonymous>")))
+
+  (define (print-counts stream counts total count)
+    (let loop ((rest counts)
+	       (i 0))
+      (when (and rest (< i count))
+	(format stream "%-32s %12d (%3d%%)\n" (car (car rest)) (cdr (car rest))
+		(quotient (* (cdr (car rest)) 100) total))
+	(loop (cdr rest) (1+ i)))))
+
+  ;; Instructions taking an argument are counted under a single name,
+  ;; whichever encoding of the argument was used
+  (define (print-bytecode-profile #!optional stream count)
+    (let* ((stream (or stream *standard-output*))
+	   (count (or count 20))
+	   (profile (fetch-bytecode-profile))
+	   (ops (make-table string-hash string=?))
+	   (pairs (make-table equal-hash equal?))
+	   (total 0))
+      (do ((i 0 (1+ i)))
+	  ((= i 256))
+	(let ((n (vector-ref (car profile) i)))
+	  (unless (zero? n)
+	    (add-count! ops (opcode-name i) n)
+	    (set! total (+ total n)))))
+      (set! total (max total 1))
+      (for-each (lambda (cell)
+		  (add-count! pairs (concat (opcode-name (car (car cell)))
+					    " " (opcode-name (cdr (car cell))))
+			      (cdr cell)))
+		(cadr profile))
+      (format stream "%-32s %12s\n\n" "Instruction" "Executed")
+      (print-counts stream (sorted-counts ops) total count)
+      (format stream "\n%-32s %12s\n\n" "Instruction Pair" "Executed")
+      (print-counts stream (sorted-counts pairs) total count)
+      (format stream "\n%-32s %12s\n\n" "Function Name" "Executed")
+      (print-counts stream (mapcar (lambda (f)
+				     (cons (function-name (car f)) (cadr f)))
+				   (sort! (caddr profile)
+					  (lambda (x y)
+					    (> (cadr x) (cadr y)))))
+		    total count)))
+
+  ;; Disassemble FUN with the number of times each of its instructions
+  ;; was executed
+  (define (disassemble-profile fun #!optional stream)
+    (let ((code (closure-function fun))
+	  (counts nil))
+      (for-each (lambda (f)
+		  (when (and (car f) (eq? (closure-function (car f)) code))
+		    (set! counts (caddr f))))
+		(caddr (fetch-bytecode-profile)))
+      (unless counts
+	(error "No bytecode profile of function: %s" (function-name fun)))
+      (disassemble fun stream 0 counts))))
@@ -65,7 +65,7 @@ rep_apply_(repv fun, repv arglist, bool tail_posn)
   rep_PUSH_CALL(lc);
 
   if (rep_data_after_gc >= rep_gc_threshold) {
-    Fgarbage_collect(rep_nil);
+    rep_gc_auto();
   }
 
 again:;
@@ -22,7 +22,7 @@
 #define BYTECODES_H
 
 #define BYTECODE_MAJOR_VERSION 12
-#define BYTECODE_MINOR_VERSION 0
+#define BYTECODE_MINOR_VERSION 1
 
 /* Number of bits encoded in each extra opcode forming the argument. */
 #define ARG_SHIFT    8
@@ -273,6 +273,21 @@
 
 #define OP_UNDEFINED 0xd5
 
+/* Superinstructions, each doing the work of the common pair of
+   instructions it's named after. They're only emitted by the peephole
+   optimizer. Those using a register have its number in the following
+   byte (so only registers 0 to 255 are reachable); the jumps take the
+   usual two-byte address after that. */
+
+#define OP_REG_REF_CAR 0xd6		/* push (car reg[pc[0]]) */
+#define OP_REG_REF_CDR 0xd7		/* push (cdr reg[pc[0]]) */
+#define OP_DUP_REG_SET 0xd8		/* reg[pc[0]] = stk[0] */
+#define OP_REQUIRED_ARG_REG_SET 0xd9	/* reg[pc[0]] = next arg */
+#define OP_REG_REF_JN 0xda		/* if (not reg[pc[0]]) jmp pc[1,2] */
+#define OP_REG_REF_JT 0xdb		/* if reg[pc[0]] jmp pc[1,2] */
+#define OP_EQ_JN 0xdc			/* if (not (eq? pop[2] pop[1]))
+					   jmp pc[0,1] */
+
 
 /* Jump opcodes */
 
@@ -70,7 +70,7 @@ current environment.
   f->env = rep_env;
   f->structure = rep_structure;
 
-  rep_data_after_gc += sizeof(rep_closure);
+  rep_NOTE_ALLOCATION(sizeof(rep_closure));
   return rep_VAL(f);
 }
 
@@ -98,6 +98,7 @@ Set the function value in the closure CLOSURE to FUNCTION.
   rep_DECLARE1(closure, rep_CLOSUREP);
 
   rep_CLOSURE(closure)->fun = fun;
+  rep_GC_WRITE_BARRIER(closure, fun);
 
   return rep_undefined_value;
 }
@@ -122,6 +123,7 @@ DEFUN("set-closure-structure!", Fset_closure_structure,
   rep_DECLARE2(structure, rep_STRUCTUREP);
 
   rep_CLOSURE(closure)->structure = structure;
+  rep_GC_WRITE_BARRIER(closure, structure);
 
   return rep_undefined_value;
 }
@@ -145,6 +147,7 @@ DEFUN("set-closure-name!", Fset_closure_name,
   rep_DECLARE1(closure, rep_CLOSUREP);
 
   rep_CLOSURE(closure)->name = name;
+  rep_GC_WRITE_BARRIER(closure, name);
 
   return rep_undefined_value;
 }
@@ -188,9 +191,11 @@ closure_sweep(void)
     for (int i = 0; i < CLOSURES_PER_BLOCK; i++) {
       /* If on the freelist then the CELL_IS_8 bit will be unset
          (since the pointer is long aligned) */
-      if (rep_CELL_CONS_P(rep_VAL(&sb->data[i]))
-	  || !rep_GC_CELL_MARKEDP(rep_VAL(&sb->data[i])))
-      {
+      bool on_freelist = rep_CELL_CONS_P(rep_VAL(&sb->data[i]));
+      if (on_freelist || !rep_GC_CELL_MARKEDP(rep_VAL(&sb->data[i]))) {
+	if (!on_freelist) {
+	  rep_gc_note_freed(rep_Closure, 1, sizeof(rep_closure));
+	}
 	sb->data[i].car = rep_VAL(closure_free_list);
 	closure_free_list = &sb->data[i];
       } else {
@@ -104,6 +104,7 @@ arguments, the datum and the stream to print to.
   repv cell = Fassq(id, printer_alist);
   if (cell && rep_CONSP(cell)) {
     rep_CDR(cell) = printer;
+    rep_GC_WRITE_BARRIER(cell, printer);
   } else {
     printer_alist = Fcons(Fcons(id, printer), printer_alist);
   }
@@ -135,6 +136,7 @@ VALUE, else signal an error.
   rep_DECLARE(1, obj, DATUMP(obj) && DATUM_ID(obj) == id);
 
   DATUM_VALUE(obj) = value;
+  rep_GC_WRITE_BARRIER(obj, value);
 
   return rep_undefined_value;
 }
@@ -151,6 +153,15 @@ created using the `make-datum' function).
   return DATUMP(arg) && DATUM_ID(arg) == id ? Qt : rep_nil;
 }
 
+
+/* The (ID . PRINTER) pairs given to define-datum-printer, for image.c. */
+
+repv
+rep_datum_printers(void)
+{
+  return printer_alist;
+}
+
 
 /* dl hooks */
 
@@ -430,6 +430,22 @@ rep_dl_lookup_symbol(int idx, const char *name)
   return x_dlsym(handle, name);
 }
 
+/* Return the names of the rep modules loaded so far, in order. */
+
+repv
+rep_dl_libraries(void)
+{
+  repv lst = rep_nil;
+
+  for (int i = dl_module_count - 1; i >= 0; i--) {
+    if (dl_modules[i].is_rep_module) {
+      lst = Fcons(dl_modules[i].file_name, lst);
+    }
+  }
+
+  return lst;
+}
+
 void
 rep_dl_mark_data(void)
 {
@@ -96,6 +96,7 @@ eval_list(repv list)
 
     repv cell = Fcons(tmp, rep_nil);
     *last = cell;
+    rep_GC_CDRLOC_BARRIER(last, result, cell);
     last = rep_CDRLOC(cell);
 
     list = rep_CDR(list);
@@ -109,6 +110,7 @@ eval_list(repv list)
 
   if (result && last && !rep_NILP(list)) {
     *last = rep_eval(list, false);
+    rep_GC_CDRLOC_BARRIER(last, result, *last);
   }
 
   rep_POPGC; rep_POPGC;
@@ -222,6 +224,7 @@ inner_eval(repv obj, bool tail_posn)
 	  }
 	  copy_to_vector(rep_CDR(args), len, vec);
 	  rep_CDR(args) = Flist_star(len, vec);
+	  rep_GC_WRITE_BARRIER(args, rep_CDR(args));
 	  rep_stack_free(repv, len, vec);
 	}
       } else {
@@ -266,7 +269,7 @@ rep_eval(repv obj, bool tail_posn)
   if (rep_data_after_gc >= rep_gc_threshold) {
     rep_GC_root gc_obj;
     rep_PUSHGC(gc_obj, obj);
-    Fgarbage_collect(rep_nil);
+    rep_gc_auto();
     rep_POPGC;
   }
 
@@ -329,6 +332,7 @@ rep_eval(repv obj, bool tail_posn)
       rep_push_regexp_data(&re_data);
 
       rep_CAR(db_args) = result;
+      rep_GC_WRITE_BARRIER(db_args, result);
 
       if (!rep_apply(Fsymbol_value(Qdebug_exit, Qt), db_args)) {
 	result = 0;
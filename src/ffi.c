@@ -1110,6 +1110,11 @@ subr_sweep(void)
     for (int i = 0; i < SUBRS_PER_BLOCK; i++) {
       rep_ffi_subr *p = &b->data[i];
       if (!rep_GC_CELL_MARKEDP(rep_VAL(p))) {
+	/* Cells already on the free list have a null type. */
+	if (p->car != 0) {
+	  rep_gc_note_freed_cell(rep_VAL(p));
+	  p->car = 0;
+	}
 	p->fn_ptr = free_list;
 	free_list = p;
       } else {
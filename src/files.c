@@ -666,7 +666,7 @@ static repv
 make_file(void)
 {
   repv file = rep_VAL(rep_alloc(sizeof(rep_file)));
-  rep_data_after_gc += sizeof(rep_file);
+  rep_NOTE_ALLOCATION(sizeof(rep_file));
 
   rep_FILE(file)->car = rep_File | rep_LFF_BOGUS_LINE_NUMBER;
   rep_FILE(file)->name = rep_nil;
@@ -688,6 +688,7 @@ file_sweep(void)
   while (lf) {
     rep_file *nxt = lf->next;
     if (!rep_GC_CELL_MARKEDP(rep_VAL(lf))) {
+      rep_gc_note_freed_cell(rep_VAL(lf));
       if (rep_LOCAL_FILE_P(rep_VAL(lf)) && !(lf->car & rep_LFF_DONT_CLOSE)) {
 	fclose(lf->file.fh);
       }
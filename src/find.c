@@ -89,7 +89,7 @@ rep_compile_regexp(repv re)
   }
 
   struct cached_regexp *ptr = rep_alloc(sizeof(struct cached_regexp));
-  rep_data_after_gc += sizeof(struct cached_regexp) + compiled->regsize;
+  rep_NOTE_ALLOCATION(sizeof(struct cached_regexp) + compiled->regsize);
 
   ptr->regexp = re;
   ptr->compiled = compiled;
@@ -103,11 +103,14 @@ rep_compile_regexp(repv re)
   return compiled;
 }
 
-/* Remove any cached compilation of STRING from the regexp cache */
+/* Remove any cached compilation of STRING from the regexp cache, and
+   forget its cached hash code. Called after STRING is modified. */
 
 void
 rep_invalidate_string(repv str)
 {
+  rep_STRING(str)->hash = 0;
+
   if (!(rep_STRING(str)->car & rep_STRING_REGEXP)) {
     return;
   }
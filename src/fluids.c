@@ -75,8 +75,10 @@ variable object FLUID to VALUE.
   repv tem = rep_search_special_environment(f);
   if (tem != rep_nil) {
     rep_CDR(tem) = v;
+    rep_GC_WRITE_BARRIER(tem, v);
   } else {
     FLUID_GLOBAL_VALUE(f) = v;
+    rep_GC_WRITE_BARRIER(f, v);
   }
 
   return rep_undefined_value;
@@ -19,11 +19,40 @@
    the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
 
 #include "repint.h"
+#include "pointer-hash.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <limits.h>
+
+#ifdef HAVE_MALLOC_H
+# include <malloc.h>
+#endif
 
 DEFSYM(after_gc_hook, "*after-gc-hook*");
+DEFSYM(generational, "generational");
+DEFSYM(mark_sweep, "mark-sweep");
+DEFSYM(fixed, "fixed");
+DEFSYM(proportional, "proportional");
+DEFSYM(minor, "minor");
+DEFSYM(major, "major");
+DEFSYM(number, "number");
+DEFSYM(kind, "kind");
+DEFSYM(pause, "pause");
+DEFSYM(cpu_time, "cpu-time");
+DEFSYM(mark, "mark");
+DEFSYM(weak, "weak");
+DEFSYM(sweep, "sweep");
+DEFSYM(allocated_bytes, "allocated-bytes");
+DEFSYM(live_bytes, "live-bytes");
+DEFSYM(freed_bytes, "freed-bytes");
+DEFSYM(types, "types");
+DEFSYM(collections, "collections");
+DEFSYM(minor_collections, "minor-collections");
+DEFSYM(pause_time, "pause-time");
+DEFSYM(max_pause, "max-pause");
+DEFSYM(released_bytes, "released-bytes");
 
 static repv **static_roots;
 static int next_static_root, allocated_static_roots;
@@ -31,18 +60,200 @@ static int next_static_root, allocated_static_roots;
 rep_GC_root *rep_gc_root_stack = 0;
 rep_GC_n_roots *rep_gc_n_roots_stack = 0;
 
+char rep_gc_block_types[64 + 256] = {
+  [rep_String] = 1,
+  [rep_Vector] = 1,
+  [rep_Bytecode] = 1,
+};
+
 /* Bytes of storage used since last gc. */
 
 int rep_data_after_gc;
 
-/* Value that rep_data_after_gc should be before collecting. */
+/* Allocation sampling. When rep_data_after_gc reaches
+   rep_alloc_sample_point, rep_NOTE_ALLOCATION calls rep_alloc_sample(),
+   which passes the size of the allocation to rep_alloc_sampler. That
+   must call rep_alloc_sample_after() to set the next sample point. */
+
+int rep_alloc_sample_point = INT_MAX;
+void (*rep_alloc_sampler)(size_t bytes);
+
+/* Value that rep_data_after_gc should be before collecting. This is
+   set by the pacing policy after each collection. */
 
 int rep_gc_threshold = 200000;
 
+/* The pacing policy. With the fixed policy the threshold is always
+   gc_min_threshold, the proportional policy sets it to a percentage of
+   the data that survived the last collection, within the minimum and
+   maximum. If the pause goal is non-zero the threshold is also reduced
+   while minor collections take longer than that many microseconds. */
+
+static bool gc_proportional = true;
+static int gc_min_threshold = 200000;
+static int gc_max_threshold = 64 * 1024 * 1024;
+static int gc_growth_percent = 100;
+static int gc_pause_goal;
+
+/* Estimated size of the data that survived the last collection, and
+   the upper limit on the threshold imposed by the pause goal. */
+
+static size_t live_after_gc;
+static int pause_limit = INT_MAX;
+
 /*  Value that rep_data_after_gc should be before collecting while idle. */
 
 int rep_idle_gc_threshold = 20000;
 
+/* When true, collections triggered by the thresholds only reclaim
+   cons cells and strings allocated since the previous collection (the
+   nursery). Cells that survive a collection are marked old. Any store
+   into an old object must pass through rep_GC_WRITE_BARRIER, which
+   records the stored value in the remembered set. */
+
+#ifdef GENERATIONAL_GC
+bool rep_gc_generational = true;
+#else
+bool rep_gc_generational = false;
+#endif
+
+/* True while a minor collection is in progress. */
+
+bool rep_gc_minor;
+
+/* True while a collection is writing a heap snapshot. */
+
+bool rep_gc_snapshot;
+
+/* The remembered set, an open-addressed hash set of values stored into
+   old objects since the last collection. Each entry is treated as a
+   root by the next minor collection. */
+
+static repv *remembered;
+static int remembered_size, remembered_count;
+
+/* Cells other than conses and strings marked during a minor
+   collection. They aren't swept, so their mark bits are cleared from
+   this log afterwards. */
+
+static repv *mark_log;
+static int mark_log_size, mark_log_count;
+
+/* Set when the next collection must be a full one, e.g. old bits
+   aren't valid since generational mode was just enabled. */
+
+static bool need_major = true;
+
+/* Full collections are done after this many minor collections, or
+   when the old cons and string data has doubled since the last one. */
+
+#define MAX_MINOR_COLLECTIONS 16
+
+static int minors_since_major;
+static size_t old_bytes_at_major;
+
+/* Bytes of cons, string, tuple and vector blocks released by the
+   sweeper. */
+
+size_t rep_gc_released_bytes;
+
+/* Set when blocks have been released since malloc_trim() was called. */
+
+static bool trim_needed;
+
+/* Completely empty blocks found when sweeping are only released once
+   enough have been kept to satisfy the allocation expected before the
+   next collection, plus this many. */
+
+#define MIN_EMPTY_BLOCKS 4
+
+/* The mark stack. While marking is in progress rep_mark_value() just
+   pushes its argument, the outermost call then pops and scans objects
+   until the stack is empty. Objects are marked when popped, so an
+   entry may already be marked by then. */
+
+static repv *mark_stack;
+static int mark_stack_size, mark_stack_top;
+static bool marking;
+
+/* Initial number of entries in the mark stack, it's doubled each time
+   it fills. */
+
+#define MARK_STACK_INITIAL_SIZE 4096
+
+/* Statistics for each type, indexed by rep_GC_TYPE_INDEX. Live objects
+   are counted while marking. Freed storage is counted by the sweepers
+   as it's reclaimed (cons cells when the collection finds them unused),
+   and accumulates until the end of the next collection. */
+
+typedef struct gc_type_stats_struct gc_type_stats;
+
+struct gc_type_stats_struct {
+  size_t live_objects, live_bytes;
+  size_t freed_objects, freed_bytes;
+};
+
+static gc_type_stats type_stats[64 + 256];
+
+/* The timed phases of a collection. */
+
+enum { PHASE_MARK, PHASE_WEAK, PHASE_SWEEP, N_PHASES };
+
+/* Statistics of the most recent collection. NUMBER is zero until the
+   first collection has finished. */
+
+static struct {
+  unsigned long number;
+  bool minor;
+  long long wall[N_PHASES], cpu[N_PHASES];
+  size_t allocated_bytes, live_bytes, freed_bytes;
+  gc_type_stats types[64 + 256];
+} last_gc;
+
+/* Totals over all collections. */
+
+static unsigned long gc_count, gc_minor_count;
+static unsigned long long gc_total_wall, gc_total_cpu;
+static unsigned long long gc_total_allocated, gc_total_freed;
+static long long gc_max_pause;
+
+/* Pause times of full and minor collections. Bucket I counts the
+   pauses shorter than PAUSE_BUCKET_BASE << I microseconds, the last
+   bucket all others. */
+
+#define PAUSE_BUCKETS 16
+#define PAUSE_BUCKET_BASE 64
+
+static unsigned long pause_histogram[2][PAUSE_BUCKETS];
+
+/* Heap snapshots are written by a full collection. While marking,
+   rep_MARKVAL then passes every reference to rep_mark_value(), even to
+   cells that are already marked, so that each edge of the graph is
+   seen. The edges of the object being scanned are collected in
+   snapshot_edges; references from the roots are written as they're
+   found. See write-heap-snapshot for the file format. */
+
+enum {
+  ROOT_STATIC = 1, ROOT_GC_STACK, ROOT_TYPES, ROOT_OTHER, ROOT_CALL_STACK
+};
+
+static const char *root_names[] = {
+  0, "static", "gc-roots", "types", "other", "call-stack"
+};
+
+#define SNAPSHOT_BUFFER_SIZE 65536
+
+static struct {
+  FILE *fh;
+  int root;
+  bool failed;
+  repv *edges;
+  int edges_size, edge_count;
+  char types_written[64 + 256];
+  size_t fill;
+  uint8_t buffer[SNAPSHOT_BUFFER_SIZE];
+} *snapshot;
+
 void
 rep_mark_static(repv *obj)
 {
@@ -60,18 +271,245 @@ rep_mark_static(repv *obj)
   static_roots[next_static_root++] = obj;
 }
 
-/* Mark a single Lisp object. Note that VAL must not be NULL, and must
-   not already have been marked, (see the rep_MARKVAL macro in lisp.h) */
+/* Allocate a GC block, aligned to its size, with a cleared header. */
+
+void *
+rep_gc_alloc_block(void)
+{
+  return rep_gc_alloc_large_block(rep_GC_BLOCK_SIZE);
+}
+
+/* Allocate SIZE bytes, aligned like a GC block and starting with a
+   cleared block header. Used for objects too big to share a block,
+   the mark bit of the object after the header is found as usual. */
+
+void *
+rep_gc_alloc_large_block(size_t size)
+{
+  void *block;
+
+  if (posix_memalign(&block, rep_GC_BLOCK_SIZE, size) != 0) {
+    return NULL;
+  }
+
+  memset(block, 0, sizeof(rep_gc_block));
+  return block;
+}
 
 void
-rep_mark_value(repv val)
+rep_gc_free_block(void *block)
 {
-  if (rep_INTP(val)) {
+  free(block);
+}
+
+/* Called by the sweeper for each empty block that it finds. KEPT counts
+   the empty blocks already kept since the last collection. Returns true
+   if this block should be kept as well, false if it should be released
+   (SIZE bytes). */
+
+bool
+rep_gc_keep_empty_block(int *kept, size_t size)
+{
+  if (*kept < rep_gc_threshold / rep_GC_BLOCK_SIZE + MIN_EMPTY_BLOCKS) {
+    (*kept)++;
+    return true;
+  }
+
+  rep_gc_released_bytes += size;
+  trim_needed = true;
+  return false;
+}
+
+/* Set bits in the bitmap MAP for the granules at which each of the
+   COUNT cells of SIZE bytes, starting at byte OFFSET of a block,
+   begins. */
+
+void
+rep_gc_cell_map(uintptr_t *map, size_t offset, size_t size, int count)
+{
+  memset(map, 0, rep_GC_BITMAP_WORDS * sizeof(uintptr_t));
+
+  for (int i = 0; i < count; i++) {
+    size_t granule = (offset + i * size) / rep_GC_GRANULE_SIZE;
+    map[granule / rep_GC_WORD_BITS]
+      |= (uintptr_t)1 << (granule % rep_GC_WORD_BITS);
+  }
+}
+
+/* Called for each cons or string block once marking has finished.
+   Updates the block's old bits (generational mode only) and returns
+   the number of cells in it that are still live. */
+
+int
+rep_gc_block_marked(rep_gc_block *block)
+{
+  int live = 0;
+
+  for (int i = 0; i < rep_GC_BITMAP_WORDS; i++) {
+    if (rep_gc_minor) {
+      block->old[i] |= block->mark[i];
+    } else {
+      block->old[i] = rep_gc_generational ? block->mark[i] : 0;
+    }
+    live += rep_popcount(block->mark[i] | block->old[i]);
+  }
+
+  return live;
+}
+
+static void
+remember(repv val)
+{
+  if (remembered_count * 2 >= remembered_size) {
+    repv *old = remembered;
+    int old_size = remembered_size;
+
+    remembered_size = old_size ? old_size * 2 : 256;
+    remembered = rep_alloc(remembered_size * sizeof(repv));
+    assert(remembered != 0);
+    memset(remembered, 0, remembered_size * sizeof(repv));
+    remembered_count = 0;
+
+    for (int i = 0; i < old_size; i++) {
+      if (old[i]) {
+	remember(old[i]);
+      }
+    }
+
+    if (old) {
+      rep_free(old);
+    }
+  }
+
+  int mask = remembered_size - 1;
+  int i = pointer_hash(val) & mask;
+
+  while (remembered[i]) {
+    if (remembered[i] == val) {
+      return;
+    }
+    i = (i + 1) & mask;
+  }
+
+  remembered[i] = val;
+  remembered_count++;
+}
+
+static void
+clear_remembered(void)
+{
+  if (remembered_count > 0) {
+    memset(remembered, 0, remembered_size * sizeof(repv));
+    remembered_count = 0;
+  }
+}
+
+/* Slow path of rep_GC_WRITE_BARRIER. VAL is a cell that was stored
+   into OBJ (or zero if OBJ is unknown). */
+
+void
+rep_gc_write_barrier(repv obj, repv val)
+{
+  if (val == 0) {
+    return;
+  }
+
+  /* Young cons cells are always traced when reachable. */
+
+  if (obj != 0 && rep_CELL_CONS_P(obj) && !rep_GC_OLDP(obj)) {
+    return;
+  }
+
+  /* Old or static values can't be freed by a minor collection. */
+
+  if (rep_CELL_CONS_P(val)) {
+    if (rep_GC_OLDP(val)) {
+      return;
+    }
+  } else if (rep_CELL_STATIC_P(val)) {
+    return;
+  } else if (rep_CELL8_TYPE(val) == rep_String && rep_GC_OLDP(val)) {
     return;
   }
 
-  /* Must now be a cell (i.e. pointer). */
+  remember(val);
+}
+
+/* Called by rep_NOTE_ALLOCATION when an allocation of BYTES bytes
+   reaches the sample point. */
+
+void
+rep_alloc_sample(size_t bytes)
+{
+  rep_alloc_sample_point = INT_MAX;
+
+  if (rep_alloc_sampler) {
+    rep_alloc_sampler(bytes);
+  }
+}
+
+/* Take the next allocation sample after BYTES more bytes have been
+   allocated. */
+
+void
+rep_alloc_sample_after(int bytes)
+{
+  rep_alloc_sample_point = (rep_data_after_gc < INT_MAX - bytes
+			    ? rep_data_after_gc + bytes : INT_MAX - 1);
+}
+
+/* Count VAL, an object of BYTES bytes, as live. */
+
+static inline void
+count_live(repv val, size_t bytes)
+{
+  gc_type_stats *stats = &type_stats[rep_GC_TYPE_INDEX(rep_PTR(val)->car)];
+  stats->live_objects++;
+  stats->live_bytes += bytes;
+}
+
+/* Called by the sweepers when they free OBJECTS objects of the type
+   with type code CAR, using BYTES bytes in total. */
+
+void
+rep_gc_note_freed(repv car, size_t objects, size_t bytes)
+{
+  gc_type_stats *stats = &type_stats[rep_GC_TYPE_INDEX(car)];
+  stats->freed_objects += objects;
+  stats->freed_bytes += bytes;
+}
+
+/* Set the mark bit of a cell that isn't a cons or a string, and count
+   it as live. BYTES is its size. */
+
+static inline void
+mark_cell(repv val, size_t bytes)
+{
+  count_live(val, bytes);
+
+  if (rep_GC_BLOCK_CELL_P(val)) {
+    rep_GC_BLOCK_SET_MARK(val);
+  } else {
+    rep_GC_SET_CELL(val);
+  }
+
+  if (rep_gc_minor) {
+    if (mark_log_count == mark_log_size) {
+      mark_log_size = mark_log_size ? mark_log_size * 2 : 1024;
+      mark_log = rep_realloc(mark_log, mark_log_size * sizeof(repv));
+      assert(mark_log != 0);
+    }
+    mark_log[mark_log_count++] = val;
+  }
+}
+
+/* Mark VAL, an unmarked cell, and push the cells it references onto
+   the mark stack. Lists, symbol chains and closure bodies are followed
+   iteratively. */
 
+static void
+scan_value(repv val)
+{
 again:
   if (rep_CELL_CONS_P(val)) {
     /* A pair. */
@@ -95,9 +533,10 @@ again:
   if (rep_CELL16P(val)) {
     /* A user allocated type. */
 
-    rep_GC_SET_CELL(val);
-
     const rep_type *t = rep_get_type(rep_CELL16_TYPE(val));
+
+    mark_cell(val, t->size ? t->size(val) : 0);
+
     if (t->mark) {
       t->mark(val);
     }
@@ -109,16 +548,16 @@ again:
 
   switch (rep_CELL8_TYPE(val)) {
   case rep_Vector:
-  case rep_Bytecode:
-    rep_GC_SET_CELL(val);
+  case rep_Bytecode: {
     int len = rep_VECTOR_LEN(val);
+    mark_cell(val, rep_VECT_SIZEOF(len));
     for (int i = 0; i < len; i++) {
       rep_MARKVAL(rep_VECTI(val, i));
     }
-    break;
+    break; }
 
   case rep_Symbol:
-    rep_GC_SET_CELL(val);
+    mark_cell(val, sizeof(rep_tuple));
     rep_MARKVAL(rep_SYM(val)->name);
     val = rep_SYM(val)->next;
     if (val && !rep_VOIDP(val) && !rep_GC_MARKEDP(val)) {
@@ -128,16 +567,18 @@ again:
 
   case rep_String:
     if (!rep_CELL_STATIC_P(val)) {
-      rep_GC_SET_CELL(val);
+      rep_GC_BLOCK_SET_MARK(val);
+      count_live(val, (sizeof(rep_string) + 1
+		       + (rep_STRING(val)->car >> rep_STRING_LEN_SHIFT)));
     }
     break;
 
   case rep_Number:
-    rep_GC_SET_CELL(val);
+    mark_cell(val, rep_number_size(val));
     break;
 
   case rep_Closure:
-    rep_GC_SET_CELL(val);
+    mark_cell(val, sizeof(rep_closure));
     rep_MARKVAL(rep_CLOSURE(val)->name);
     rep_MARKVAL(rep_CLOSURE(val)->env);
     rep_MARKVAL(rep_CLOSURE(val)->structure);
@@ -148,7 +589,7 @@ again:
     break;
 
   case rep_Char:
-    rep_GC_SET_CELL(val);
+    mark_cell(val, sizeof(rep_tuple));
     val = rep_CHAR(val)->next;
     if (val && !rep_GC_MARKEDP(val)) {
       goto again;
@@ -160,8 +601,9 @@ again:
     break;
 
   default: {
-    rep_GC_SET_CELL(val);
     const rep_type *t = rep_get_type(rep_CELL8_TYPE(val));
+    mark_cell(val, (t->size ? t->size(val)
+		    : rep_GC_BLOCK_CELL_P(val) ? sizeof(rep_tuple) : 0));
     if (t->mark) {
       t->mark(val);
     }
@@ -169,101 +611,1065 @@ again:
   }
 }
 
-DEFUN("garbage-threshold", Fgarbage_threshold,
-      Sgarbage_threshold, (repv val), rep_Subr1) /*
-::doc:rep.data#garbage-threshold::
-garbage-threshold [NEW-VALUE]
+/* Push VAL onto the mark stack. Returns false if the stack is full and
+   can't be grown. */
 
-The number of bytes of storage which must be used before a garbage-
-collection is triggered.
-::end:: */
+static inline bool
+push_mark_stack(repv val)
 {
-  return rep_handle_var_int(val, &rep_gc_threshold);
+  if (mark_stack_top == mark_stack_size) {
+    int new_size = (mark_stack_size ? mark_stack_size * 2
+		    : MARK_STACK_INITIAL_SIZE);
+    repv *new_stack = rep_realloc(mark_stack, new_size * sizeof(repv));
+    if (!new_stack) {
+      return false;
+    }
+    mark_stack = new_stack;
+    mark_stack_size = new_size;
+  }
+
+  mark_stack[mark_stack_top++] = val;
+  return true;
 }
 
-DEFUN("idle-garbage-threshold", Fidle_garbage_threshold,
-      Sidle_garbage_threshold, (repv val), rep_Subr1) /*
-::doc:rep.data#idle-garbage-threshold::
-idle-garbage-threshold [NEW-VALUE]
+/* Heap snapshot output. Integers are written as unsigned LEB128
+   numbers, cell addresses divided by eight (cells are at least that
+   aligned). */
 
-The number of bytes of storage which must be used before a garbage-
-collection is triggered when the editor is idle.
-::end:: */
+#define SNAPSHOT_ADDR(v) ((uint64_t)(v) >> 3)
+
+static void
+snapshot_flush(void)
 {
-  return rep_handle_var_int(val, &rep_idle_gc_threshold);
+  if (snapshot->fill > 0
+      && fwrite(snapshot->buffer, 1, snapshot->fill,
+		snapshot->fh) != snapshot->fill)
+  {
+    snapshot->failed = true;
+  }
+  snapshot->fill = 0;
 }
 
-DEFUN_INT("garbage-collect", Fgarbage_collect,
-	  Sgarbage_collect, (repv stats), rep_Subr1, "") /*
-::doc:rep.data#garbage-collect::
-garbage-collect
+static inline void
+snapshot_byte(int c)
+{
+  if (snapshot->fill == SNAPSHOT_BUFFER_SIZE) {
+    snapshot_flush();
+  }
+  snapshot->buffer[snapshot->fill++] = c;
+}
 
-Scans all allocated storage for unusable data, and puts it onto the free-
-list. This is done automatically when the amount of storage used since the
-last garbage-collection is greater than `garbage-threshold'.
-::end:: */
+static inline void
+snapshot_uint(uint64_t x)
 {
-  rep_macros_before_gc();
+  while (x >= 0x80) {
+    snapshot_byte((x & 0x7f) | 0x80);
+    x >>= 7;
+  }
+  snapshot_byte(x);
+}
 
-  /* Mark static objects. */
+static void
+snapshot_string(const char *str, size_t len)
+{
+  snapshot_uint(len);
+  for (size_t i = 0; i < len; i++) {
+    snapshot_byte(str[i]);
+  }
+}
 
-  for(int i = 0; i < next_static_root; i++) {
-    rep_MARKVAL(*static_roots[i]);
+/* Set the root set that references are currently coming from. */
+
+static inline void
+snapshot_root(int root)
+{
+  if (rep_gc_snapshot) {
+    snapshot->root = root;
   }
+}
 
-  /* Mark stack based objects protected from GC. */
+/* The size in bytes of cell VAL, as counted while marking. */
 
-  for (rep_GC_root *root = rep_gc_root_stack; root; root = root->next) {
-    rep_MARKVAL(*root->ptr);
+static size_t
+cell_size(repv val)
+{
+  if (rep_CELL_CONS_P(val)) {
+    return sizeof(rep_cons);
   }
 
-  for (rep_GC_n_roots *root = rep_gc_n_roots_stack; root; root = root->next) {
-    for (int i = 0; i < root->count; i++) {
-      rep_MARKVAL(root->first[i]);
-    }
+  if (rep_CELL16P(val)) {
+    const rep_type *t = rep_get_type(rep_CELL16_TYPE(val));
+    return t->size ? t->size(val) : 0;
   }
 
-  /* Do data-type specific marking. */
+  switch (rep_CELL8_TYPE(val)) {
+  case rep_Vector:
+  case rep_Bytecode:
+    return rep_VECT_SIZEOF(rep_VECTOR_LEN(val));
 
-  rep_mark_types();
+  case rep_Symbol:
+  case rep_Char:
+    return sizeof(rep_tuple);
 
-  rep_mark_regexp_data();
-  rep_mark_origins ();
+  case rep_String:
+    return (sizeof(rep_string) + 1
+	    + (rep_STRING(val)->car >> rep_STRING_LEN_SHIFT));
 
-#ifdef HAVE_DYNAMIC_LOADING
-  rep_dl_mark_data();
-#endif
+  case rep_Number:
+    return rep_number_size(val);
 
-  /* Mark the Lisp backtrace. */
+  case rep_Closure:
+    return sizeof(rep_closure);
 
-  for (rep_stack_frame *lc = rep_call_stack; lc; lc = lc->next) {
-    rep_MARKVAL(lc->fun);
-    rep_MARKVAL(lc->args);
-    rep_MARKVAL(lc->current_form);
-    rep_MARKVAL(lc->saved_env);
-    rep_MARKVAL(lc->saved_structure);
+  default: {
+    const rep_type *t = rep_get_type(rep_CELL8_TYPE(val));
+    return (t->size ? t->size(val)
+	    : rep_GC_BLOCK_CELL_P(val) ? sizeof(rep_tuple) : 0); }
   }
+}
 
-  /* Handle weak or guarded objects that weren't marked. */
-
-  rep_run_guardians ();
-  rep_scan_weak_refs ();
-  rep_scan_origins ();
+/* Called by the sweepers of types defined by rep_define_type() before
+   they free the unmarked cell VAL. */
 
-  /* Finished marking, start sweeping. */
+void
+rep_gc_note_freed_cell(repv val)
+{
+  rep_gc_note_freed(rep_PTR(val)->car, 1, cell_size(val));
+}
 
-  rep_sweep_tuples ();
-  rep_sweep_types();
+static void snapshot_scan(repv val);
 
-  /* Done. */
+/* Record a reference to VAL, from the current root set if ROOT is
+   true, else from the object being scanned. VAL is marked and queued
+   to be scanned if it hasn't been seen before. */
 
-  rep_data_after_gc = 0;
+static void
+snapshot_ref(repv val, bool root)
+{
+  if (rep_CELL8P(val)) {
+    int type = rep_CELL8_TYPE(val);
+    if (type == rep_Subr || type == rep_SF
+	|| (type == rep_String && rep_CELL_STATIC_P(val)))
+    {
+      /* Static data, not part of the heap. */
+      return;
+    }
+  }
+
+  if (root) {
+    snapshot_byte('r');
+    snapshot_uint(snapshot->root);
+    snapshot_uint(SNAPSHOT_ADDR(val));
+  } else {
+    if (snapshot->edge_count == snapshot->edges_size) {
+      int new_size = snapshot->edges_size ? snapshot->edges_size * 2 : 256;
+      repv *new_edges = rep_realloc(snapshot->edges,
+				    new_size * sizeof(repv));
+      if (new_edges) {
+	snapshot->edges = new_edges;
+	snapshot->edges_size = new_size;
+      }
+    }
+    if (snapshot->edge_count < snapshot->edges_size) {
+      snapshot->edges[snapshot->edge_count++] = val;
+    } else {
+      snapshot->failed = true;
+    }
+  }
+
+  if (rep_GC_MARKEDP(val)) {
+    return;
+  }
+
+  /* Unlike scan_value() cells are marked when pushed, each is only
+     written once. */
+
+  if (rep_CELL_CONS_P(val)) {
+    rep_GC_SET_CONS(val);
+  } else if (rep_CELL8_TYPE(val) == rep_String) {
+    rep_GC_BLOCK_SET_MARK(val);
+    count_live(val, cell_size(val));
+  } else {
+    mark_cell(val, cell_size(val));
+  }
+
+  if (!push_mark_stack(val)) {
+    snapshot_scan(val);
+  }
+}
+
+#define SNAPSHOT_REF(v)				\
+  do {						\
+    repv _v = (v);				\
+    if (_v != 0 && !rep_INTP(_v)) {		\
+      snapshot_ref(_v, false);			\
+    }						\
+  } while (0)
+
+/* Write the record of VAL, a marked cell, with its references. */
+
+static void
+snapshot_scan(repv val)
+{
+  int base = snapshot->edge_count;
+  repv label = 0;
+
+  if (rep_CELL_CONS_P(val)) {
+    SNAPSHOT_REF(rep_CAR(val));
+    SNAPSHOT_REF(rep_CDR(val));
+  } else if (rep_CELL16P(val)) {
+    const rep_type *t = rep_get_type(rep_CELL16_TYPE(val));
+    if (t->mark) {
+      t->mark(val);
+    }
+  } else {
+    switch (rep_CELL8_TYPE(val)) {
+    case rep_Vector:
+    case rep_Bytecode:
+      for (int i = 0; i < rep_VECTOR_LEN(val); i++) {
+	SNAPSHOT_REF(rep_VECTI(val, i));
+      }
+      break;
+
+    case rep_Symbol:
+      SNAPSHOT_REF(rep_SYM(val)->name);
+      if (!rep_VOIDP(rep_SYM(val)->next)) {
+	SNAPSHOT_REF(rep_SYM(val)->next);
+      }
+      label = rep_SYM(val)->name;
+      break;
+
+    case rep_String:
+    case rep_Number:
+      break;
+
+    case rep_Closure:
+      SNAPSHOT_REF(rep_CLOSURE(val)->fun);
+      SNAPSHOT_REF(rep_CLOSURE(val)->name);
+      SNAPSHOT_REF(rep_CLOSURE(val)->env);
+      SNAPSHOT_REF(rep_CLOSURE(val)->structure);
+      label = rep_CLOSURE(val)->name;
+      break;
+
+    case rep_Char:
+      SNAPSHOT_REF(rep_CHAR(val)->next);
+      break;
+
+    case rep_Structure:
+      label = rep_STRUCTURE(val)->name;
+      /* fall through */
+
+    default: {
+      const rep_type *t = rep_get_type(rep_CELL8_TYPE(val));
+      if (t->mark) {
+	t->mark(val);
+      }
+      break; }
+    }
+  }
+
+  repv type = rep_CELL_TYPE(val);
+  int index = rep_GC_TYPE_INDEX(type);
+
+  if (!snapshot->types_written[index]) {
+    const char *name = rep_get_type(type)->name;
+    snapshot_byte('T');
+    snapshot_uint(index);
+    snapshot_string(name, strlen(name));
+    snapshot->types_written[index] = true;
+  }
+
+  snapshot_byte('O');
+  snapshot_uint(SNAPSHOT_ADDR(val));
+  snapshot_uint(index);
+  snapshot_uint(cell_size(val));
+  snapshot_uint(snapshot->edge_count - base);
+
+  for (int i = base; i < snapshot->edge_count; i++) {
+    int64_t delta = ((int64_t)SNAPSHOT_ADDR(snapshot->edges[i])
+		     - (int64_t)SNAPSHOT_ADDR(val));
+    snapshot_uint(((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+  }
+
+  snapshot->edge_count = base;
+
+  if (label && rep_SYMBOLP(label)) {
+    label = rep_SYM(label)->name;
+  }
+  if (label && rep_STRINGP(label)) {
+    snapshot_byte('L');
+    snapshot_uint(SNAPSHOT_ADDR(val));
+    snapshot_string(rep_STR(label), rep_STRING_LEN(label));
+  }
+}
+
+/* Mark a single Lisp object. Note that VAL must not be NULL, and must
+   not already have been marked, (see the rep_MARKVAL macro in lisp.h)
+
+   When called while marking (from scan_value() or a type's mark
+   function) VAL is only pushed onto the mark stack. If the stack can't
+   grow it's scanned immediately instead, using the C stack.
+
+   While a heap snapshot is being written VAL may already be marked,
+   the reference to it is recorded and it's only scanned once. */
+
+void
+rep_mark_value(repv val)
+{
+  if (rep_INTP(val)) {
+    return;
+  }
+
+  if (marking) {
+    if (rep_gc_snapshot) {
+      snapshot_ref(val, false);
+    } else if (!push_mark_stack(val)) {
+      scan_value(val);
+    }
+    return;
+  }
+
+  marking = true;
+
+  if (rep_gc_snapshot) {
+    snapshot_ref(val, true);
+    while (mark_stack_top > 0) {
+      snapshot_scan(mark_stack[--mark_stack_top]);
+    }
+  } else {
+    scan_value(val);
+    while (mark_stack_top > 0) {
+      val = mark_stack[--mark_stack_top];
+      if (!rep_GC_MARKEDP(val)) {
+	scan_value(val);
+      }
+    }
+  }
+
+  marking = false;
+}
+
+/* Set rep_gc_threshold from the pacing parameters. */
+
+static void
+update_threshold(void)
+{
+  if (!gc_proportional) {
+    rep_gc_threshold = gc_min_threshold;
+    return;
+  }
+
+  size_t trigger = live_after_gc / 100 * gc_growth_percent;
+
+  trigger = MIN(trigger, (size_t)gc_max_threshold);
+  trigger = MIN(trigger, (size_t)pause_limit);
+  trigger = MAX(trigger, (size_t)gc_min_threshold);
+
+  rep_gc_threshold = trigger;
+}
+
+/* Called after each collection, LIVE is the estimated size of the
+   surviving data and PAUSE the time taken in microseconds. */
+
+static void
+pace(bool minor, size_t live, long long pause)
+{
+  live_after_gc = live;
+
+  if (gc_pause_goal > 0 && minor) {
+    if (pause > gc_pause_goal) {
+      pause_limit = MAX(gc_min_threshold, (int)(rep_gc_threshold
+						* (double)gc_pause_goal
+						/ pause));
+    } else if (pause < gc_pause_goal / 2) {
+      pause_limit = pause_limit < INT_MAX / 2 ? pause_limit * 2 : INT_MAX;
+    }
+  }
+
+  update_threshold();
+}
+
+static repv
+handle_pacing_var(repv val, int *ptr)
+{
+  repv old = rep_handle_var_int(val, ptr);
+  update_threshold();
+  return old;
+}
+
+DEFUN("garbage-threshold", Fgarbage_threshold,
+      Sgarbage_threshold, (repv val), rep_Subr1) /*
+::doc:rep.data#garbage-threshold::
+garbage-threshold [NEW-VALUE]
+
+The number of bytes of storage which must be used before a garbage-
+collection is triggered. With the `proportional' pacing policy this is
+the minimum threshold.
+::end:: */
+{
+  return handle_pacing_var(val, &gc_min_threshold);
+}
+
+DEFUN("garbage-threshold-maximum", Fgarbage_threshold_maximum,
+      Sgarbage_threshold_maximum, (repv val), rep_Subr1) /*
+::doc:rep.data#garbage-threshold-maximum::
+garbage-threshold-maximum [NEW-VALUE]
+
+The maximum number of bytes of storage which may be used before a
+garbage-collection is triggered, when using the `proportional' pacing
+policy.
+::end:: */
+{
+  return handle_pacing_var(val, &gc_max_threshold);
+}
+
+DEFUN("garbage-growth-ratio", Fgarbage_growth_ratio,
+      Sgarbage_growth_ratio, (repv val), rep_Subr1) /*
+::doc:rep.data#garbage-growth-ratio::
+garbage-growth-ratio [NEW-VALUE]
+
+With the `proportional' pacing policy, the amount of storage allocated
+before the next garbage-collection, as a percentage of the data that
+survived the previous one.
+::end:: */
+{
+  return handle_pacing_var(val, &gc_growth_percent);
+}
+
+DEFUN("garbage-pause-goal", Fgarbage_pause_goal,
+      Sgarbage_pause_goal, (repv val), rep_Subr1) /*
+::doc:rep.data#garbage-pause-goal::
+garbage-pause-goal [NEW-VALUE]
+
+When non-zero and using the `proportional' pacing policy, the desired
+maximum duration of a minor garbage-collection, in microseconds. The
+threshold is reduced while collections take longer than this.
+::end:: */
+{
+  repv old = rep_handle_var_int(val, &gc_pause_goal);
+  if (gc_pause_goal <= 0) {
+    pause_limit = INT_MAX;
+  }
+  update_threshold();
+  return old;
+}
+
+DEFUN("garbage-pacing-policy", Fgarbage_pacing_policy,
+      Sgarbage_pacing_policy, (repv policy), rep_Subr1) /*
+::doc:rep.data#garbage-pacing-policy::
+garbage-pacing-policy [NEW-POLICY]
+
+Returns the policy used to decide when to collect garbage, either
+`fixed' or `proportional'. If NEW-POLICY is given the policy is
+changed to it.
+
+With the `fixed' policy a collection is triggered whenever
+`garbage-threshold' bytes have been allocated. With the `proportional'
+policy the threshold is `garbage-growth-ratio' percent of the data that
+survived the last collection, bounded by `garbage-threshold' and
+`garbage-threshold-maximum'.
+::end:: */
+{
+  repv old = gc_proportional ? Qproportional : Qfixed;
+
+  if (policy == Qproportional) {
+    gc_proportional = true;
+  } else if (policy == Qfixed) {
+    gc_proportional = false;
+  } else if (policy != rep_nil) {
+    return rep_signal_arg_error(policy, 1);
+  }
+
+  update_threshold();
+  return old;
+}
+
+DEFUN("idle-garbage-threshold", Fidle_garbage_threshold,
+      Sidle_garbage_threshold, (repv val), rep_Subr1) /*
+::doc:rep.data#idle-garbage-threshold::
+idle-garbage-threshold [NEW-VALUE]
+
+The number of bytes of storage which must be used before a garbage-
+collection is triggered when the editor is idle.
+::end:: */
+{
+  return rep_handle_var_int(val, &rep_idle_gc_threshold);
+}
+
+static size_t
+old_bytes(void)
+{
+  return (rep_used_cons * sizeof(rep_cons)
+	  + rep_used_strings * sizeof(rep_string)
+	  + rep_allocated_string_bytes);
+}
+
+/* Estimate of the size of the data that's still in use. */
+
+static size_t
+live_bytes(void)
+{
+  return (old_bytes()
+	  + rep_used_tuples * sizeof(rep_tuple)
+	  + rep_used_vector_slots * sizeof(repv)
+	  + rep_used_closures * sizeof(rep_closure));
+}
+
+/* Called at the end of each collection. WALL and CPU give the real and
+   processor times at the start of each phase, and at the end of the
+   collection. ALLOCATED is the number of bytes allocated since the
+   previous collection, USED_CONS the number of cons cells in use
+   before this one. */
+
+static void
+record_stats(bool minor, long long *wall, long long *cpu,
+	     size_t allocated, int used_cons)
+{
+  /* Conses aren't counted while marking. Nor are old strings in a
+     minor collection, then all strings in use are counted, with the
+     data of those waiting to be swept. */
+
+  gc_type_stats *cons = &type_stats[rep_Cons];
+  cons->live_objects = rep_used_cons;
+  cons->live_bytes = rep_used_cons * sizeof(rep_cons);
+  cons->freed_objects += used_cons - rep_used_cons;
+  cons->freed_bytes += (used_cons - rep_used_cons) * sizeof(rep_cons);
+
+  if (minor) {
+    gc_type_stats *strings = &type_stats[rep_String];
+    strings->live_objects = rep_used_strings;
+    strings->live_bytes = (rep_used_strings * (sizeof(rep_string) + 1)
+			   + rep_allocated_string_bytes);
+  }
+
+  last_gc.number = ++gc_count;
+  last_gc.minor = minor;
+  last_gc.allocated_bytes = allocated;
+  last_gc.live_bytes = 0;
+  last_gc.freed_bytes = 0;
+
+  for (int i = 0; i < N_PHASES; i++) {
+    last_gc.wall[i] = wall[i + 1] - wall[i];
+    last_gc.cpu[i] = cpu[i + 1] - cpu[i];
+  }
+
+  for (int i = 0; i < 64 + 256; i++) {
+    last_gc.types[i] = type_stats[i];
+    last_gc.live_bytes += type_stats[i].live_bytes;
+    last_gc.freed_bytes += type_stats[i].freed_bytes;
+    type_stats[i].freed_objects = type_stats[i].freed_bytes = 0;
+  }
+
+  long long pause = wall[N_PHASES] - wall[PHASE_MARK];
+
+  if (minor) {
+    gc_minor_count++;
+  }
+  gc_total_wall += pause;
+  gc_total_cpu += cpu[N_PHASES] - cpu[PHASE_MARK];
+  gc_total_allocated += allocated;
+  gc_total_freed += last_gc.freed_bytes;
+  gc_max_pause = MAX(gc_max_pause, pause);
+
+  int bucket = 0;
+  while (bucket < PAUSE_BUCKETS - 1
+	 && pause >= (long long)PAUSE_BUCKET_BASE << bucket)
+  {
+    bucket++;
+  }
+  pause_histogram[minor][bucket]++;
+}
+
+/* Returns the statistics of the last collection, as an alist. */
+
+static repv
+gc_record(void)
+{
+  if (last_gc.number == 0) {
+    return rep_nil;
+  }
+
+  repv types = rep_nil;
+
+  for (int i = 64 + 256 - 1; i >= 0; i--) {
+    gc_type_stats *stats = &last_gc.types[i];
+    if (stats->live_objects == 0 && stats->freed_objects == 0) {
+      continue;
+    }
+    repv car = i < 64 ? i : ((((i - 64) << rep_CELL16_TYPE_SHIFT)
+			      | rep_CELL_IS_8 | rep_CELL_IS_16));
+    const rep_type *t = rep_get_type(car);
+    if (!t) {
+      continue;
+    }
+    repv name = Fintern(rep_string_copy(t->name), rep_nil);
+    types = Fcons(rep_list_5(name,
+			     rep_make_long_uint(stats->live_objects),
+			     rep_make_long_uint(stats->live_bytes),
+			     rep_make_long_uint(stats->freed_objects),
+			     rep_make_long_uint(stats->freed_bytes)),
+		  types);
+  }
+
+  repv phases[N_PHASES];
+
+  for (int i = 0; i < N_PHASES; i++) {
+    phases[i] = rep_LIST_2(rep_make_longlong_int(last_gc.wall[i]),
+			   rep_make_longlong_int(last_gc.cpu[i]));
+  }
+
+  long long pause = 0, cpu_time = 0;
+
+  for (int i = 0; i < N_PHASES; i++) {
+    pause += last_gc.wall[i];
+    cpu_time += last_gc.cpu[i];
+  }
+
+  repv record = Fcons(Fcons(Qtypes, types), rep_nil);
+
+#define ADD(key, value) record = Fcons(Fcons(key, value), record)
+
+  ADD(Qfreed_bytes, rep_make_long_uint(last_gc.freed_bytes));
+  ADD(Qlive_bytes, rep_make_long_uint(last_gc.live_bytes));
+  ADD(Qallocated_bytes, rep_make_long_uint(last_gc.allocated_bytes));
+  ADD(Qsweep, phases[PHASE_SWEEP]);
+  ADD(Qweak, phases[PHASE_WEAK]);
+  ADD(Qmark, phases[PHASE_MARK]);
+  ADD(Qcpu_time, rep_make_longlong_int(cpu_time));
+  ADD(Qpause, rep_make_longlong_int(pause));
+  ADD(Qkind, last_gc.minor ? Qminor : Qmajor);
+  ADD(Qnumber, rep_make_long_uint(last_gc.number));
+
+#undef ADD
+
+  return record;
+}
+
+/* Collect garbage. If MINOR is true only the nursery (conses and
+   strings allocated since the previous collection) is reclaimed. */
+
+static void
+collect(bool minor)
+{
+  long long wall[N_PHASES + 1], cpu[N_PHASES + 1];
+
+  wall[PHASE_MARK] = rep_utime();
+  cpu[PHASE_MARK] = rep_cpu_utime();
+
+  int used_cons = rep_used_cons;
+  size_t allocated = rep_data_after_gc;
+
+  for (int i = 0; i < 64 + 256; i++) {
+    type_stats[i].live_objects = type_stats[i].live_bytes = 0;
+  }
+
+  rep_gc_minor = minor;
+
+  /* Objects left unswept by the previous collection still have its
+     marks. Tuples are only swept by full collections, so their marks
+     are needed until then. */
+
+  rep_cons_clear_marks();
+  rep_string_clear_marks();
+  if (!minor) {
+    rep_tuples_clear_marks();
+  }
+
+  rep_macros_before_gc();
+
+  /* Mark static objects. */
+
+  snapshot_root(ROOT_STATIC);
+
+  for(int i = 0; i < next_static_root; i++) {
+    rep_MARKVAL(*static_roots[i]);
+  }
+
+  /* Mark stack based objects protected from GC. */
+
+  snapshot_root(ROOT_GC_STACK);
+
+  for (rep_GC_root *root = rep_gc_root_stack; root; root = root->next) {
+    rep_MARKVAL(*root->ptr);
+  }
+
+  for (rep_GC_n_roots *root = rep_gc_n_roots_stack; root; root = root->next) {
+    for (int i = 0; i < root->count; i++) {
+      rep_MARKVAL(root->first[i]);
+    }
+  }
+
+  /* Do data-type specific marking. */
+
+  snapshot_root(ROOT_TYPES);
+
+  rep_mark_types();
+
+  snapshot_root(ROOT_OTHER);
+
+  rep_mark_regexp_data();
+  rep_mark_origins ();
+
+#ifdef HAVE_DYNAMIC_LOADING
+  rep_dl_mark_data();
+#endif
+
+  /* Mark the Lisp backtrace. */
+
+  snapshot_root(ROOT_CALL_STACK);
+
+  for (rep_stack_frame *lc = rep_call_stack; lc; lc = lc->next) {
+    rep_MARKVAL(lc->fun);
+    rep_MARKVAL(lc->args);
+    rep_MARKVAL(lc->current_form);
+    rep_MARKVAL(lc->saved_env);
+    rep_MARKVAL(lc->saved_structure);
+  }
+
+  /* Mark values stored into old objects. */
+
+  if (minor) {
+    for (int i = 0; i < remembered_size; i++) {
+      rep_MARKVAL(remembered[i]);
+    }
+  }
+
+  /* A heap snapshot only covers the objects reachable from the roots,
+     the rest are marked normally. */
+
+  rep_gc_snapshot = false;
+
+  /* Handle weak or guarded objects that weren't marked. */
+
+  wall[PHASE_WEAK] = rep_utime();
+  cpu[PHASE_WEAK] = rep_cpu_utime();
+
+  rep_mark_weak_tables ();
+  rep_run_guardians ();
+  rep_mark_weak_tables ();
+  rep_scan_weak_tables ();
+  rep_scan_weak_refs ();
+  rep_scan_origins ();
+  rep_scan_ref_caches();
+  rep_scan_bytecode_profile();
+  rep_scan_direct_threaded_code();
+
+  /* Finished marking, start sweeping. */
+
+  wall[PHASE_SWEEP] = rep_utime();
+  cpu[PHASE_SWEEP] = rep_cpu_utime();
+
+  if (minor) {
+    rep_cons_sweep();
+    rep_string_sweep();
+
+    for (int i = 0; i < mark_log_count; i++) {
+      if (rep_GC_BLOCK_CELL_P(mark_log[i])) {
+	rep_GC_BLOCK_CLR_MARK(mark_log[i]);
+      } else {
+	rep_GC_CLR_CELL(mark_log[i]);
+      }
+    }
+    mark_log_count = 0;
+
+    minors_since_major++;
+  } else {
+    rep_sweep_tuples ();
+    rep_sweep_types();
+
+    if (rep_gc_generational) {
+      need_major = false;
+    }
+    minors_since_major = 0;
+    old_bytes_at_major = old_bytes();
+  }
+
+  rep_gc_minor = false;
+  clear_remembered();
+
+  /* Done. */
+
+  wall[N_PHASES] = rep_utime();
+  cpu[N_PHASES] = rep_cpu_utime();
+
+  rep_data_after_gc = 0;
+  if (rep_alloc_sample_point != INT_MAX) {
+    rep_alloc_sample_point = (allocated < (size_t)rep_alloc_sample_point
+			      ? rep_alloc_sample_point - (int)allocated : 0);
+  }
+  pace(minor, live_bytes(), wall[N_PHASES] - wall[PHASE_MARK]);
+
+  record_stats(minor, wall, cpu, allocated, used_cons);
 
   rep_types_after_gc();
-  Fcall_hook(Qafter_gc_hook, rep_nil, rep_nil);
+
+  repv hook = Fsymbol_value(Qafter_gc_hook, Qt);
+  if (hook && !rep_VOIDP(hook) && hook != rep_nil) {
+    Fcall_hook(Qafter_gc_hook, rep_LIST_1(gc_record()), rep_nil);
+  }
+}
+
+/* Called when more than the threshold amount of data has been
+   allocated since the last collection. */
+
+void
+rep_gc_auto(void)
+{
+  bool minor = (rep_gc_generational && !need_major
+		&& minors_since_major < MAX_MINOR_COLLECTIONS
+		&& old_bytes() < 2 * MAX(old_bytes_at_major,
+					 (size_t)gc_min_threshold));
+  collect(minor);
+}
+
+DEFUN("garbage-collector-mode", Fgarbage_collector_mode,
+      Sgarbage_collector_mode, (repv mode), rep_Subr1) /*
+::doc:rep.data#garbage-collector-mode::
+garbage-collector-mode [NEW-MODE]
+
+Returns the current garbage collection policy, either `mark-sweep' or
+`generational'. If NEW-MODE is given the policy is changed to it.
+
+In generational mode the collections triggered by `garbage-threshold'
+normally only reclaim the cons cells and strings allocated since the
+previous collection; `garbage-collect' always reclaims everything.
+::end:: */
+{
+  repv old = rep_gc_generational ? Qgenerational : Qmark_sweep;
+
+  if (mode == Qgenerational) {
+    if (!rep_gc_generational) {
+      rep_gc_generational = true;
+      need_major = true;
+    }
+  } else if (mode == Qmark_sweep) {
+    rep_gc_generational = false;
+  } else if (mode != rep_nil) {
+    return rep_signal_arg_error(mode, 1);
+  }
+
+  return old;
+}
+
+/* Sweep all cons, string and tuple blocks that haven't been swept since
+   the last collection, freeing their unused cells now. */
+
+void
+rep_gc_finish_sweep(void)
+{
+  rep_cons_finish_sweep();
+  rep_string_finish_sweep();
+  rep_tuples_finish_sweep();
+
+#ifdef HAVE_MALLOC_TRIM
+  /* Give the freed blocks back to the system. */
+
+  if (trim_needed) {
+    malloc_trim(0);
+    trim_needed = false;
+  }
+#endif
+}
+
+DEFUN("finish-garbage-collection", Ffinish_garbage_collection,
+      Sfinish_garbage_collection, (void), rep_Subr0) /*
+::doc:rep.data#finish-garbage-collection::
+finish-garbage-collection
+
+Collections triggered by `garbage-threshold' only mark the data that is
+still in use, the unused storage is found and freed later, as more
+memory is needed. This function frees all such storage immediately.
+::end:: */
+{
+  rep_gc_finish_sweep();
+  return Qt;
+}
+
+DEFUN("garbage-collection-statistics", Fgarbage_collection_statistics,
+      Sgarbage_collection_statistics, (void), rep_Subr0) /*
+::doc:rep.data#garbage-collection-statistics::
+garbage-collection-statistics
+
+Returns an alist describing the most recent garbage collection, or nil
+if there hasn't been one. The same alist is passed to the functions in
+`*after-gc-hook*'. Its keys are:
+
+  number		The number of collections so far, including this one.
+  kind			Either `major' (all data was collected) or `minor'.
+  pause			Microseconds taken by the collection.
+  cpu-time		Microseconds of processor time used.
+  mark, weak, sweep	Lists (WALL CPU) of the microseconds taken by each
+			phase: marking, handling guardians and weak
+			references, and queuing or sweeping storage.
+  allocated-bytes	Bytes allocated since the previous collection.
+  live-bytes		Bytes of data found to be in use.
+  freed-bytes		Bytes of storage freed since the previous collection.
+  types			A list with an element (NAME LIVE-OBJECTS LIVE-BYTES
+			FREED-OBJECTS FREED-BYTES) for each type of data.
+
+Most storage is freed gradually after a collection has finished, so
+freed storage is counted when the next collection finishes. Cons cells
+are the exception, they're counted by the collection that finds them
+unused. Bytes are only counted for types that know the size of their
+objects.
+::end:: */
+{
+  return gc_record();
+}
+
+DEFUN("garbage-collection-totals", Fgarbage_collection_totals,
+      Sgarbage_collection_totals, (void), rep_Subr0) /*
+::doc:rep.data#garbage-collection-totals::
+garbage-collection-totals
+
+Returns an alist of counters covering all garbage collections so far:
+`collections', `minor-collections', `pause-time' and `cpu-time' (in
+microseconds), `max-pause', `allocated-bytes', `freed-bytes' and
+`released-bytes' (storage given back to the system).
+::end:: */
+{
+  repv ret = rep_nil;
+
+#define ADD(key, value) ret = Fcons(Fcons(key, value), ret)
+
+  ADD(Qreleased_bytes, rep_make_long_uint(rep_gc_released_bytes));
+  ADD(Qfreed_bytes, rep_make_longlong_int(gc_total_freed));
+  ADD(Qallocated_bytes, rep_make_longlong_int(gc_total_allocated));
+  ADD(Qmax_pause, rep_make_longlong_int(gc_max_pause));
+  ADD(Qcpu_time, rep_make_longlong_int(gc_total_cpu));
+  ADD(Qpause_time, rep_make_longlong_int(gc_total_wall));
+  ADD(Qminor_collections, rep_make_long_uint(gc_minor_count));
+  ADD(Qcollections, rep_make_long_uint(gc_count));
+
+#undef ADD
+
+  return ret;
+}
+
+DEFUN("garbage-pause-histogram", Fgarbage_pause_histogram,
+      Sgarbage_pause_histogram, (repv kind), rep_Subr1) /*
+::doc:rep.data#garbage-pause-histogram::
+garbage-pause-histogram [KIND]
+
+Returns a list of elements (LIMIT . COUNT), COUNT being the number of
+garbage collections that took less than LIMIT microseconds, but not
+less than the previous limit. The last element's LIMIT is nil.
+
+KIND may be `major' or `minor' to only count that kind of collection.
+::end:: */
+{
+  if (kind != rep_nil && kind != Qmajor && kind != Qminor) {
+    return rep_signal_arg_error(kind, 1);
+  }
+
+  repv ret = rep_nil;
+
+  for (int i = PAUSE_BUCKETS - 1; i >= 0; i--) {
+    unsigned long count = 0;
+    if (kind != Qminor) {
+      count += pause_histogram[0][i];
+    }
+    if (kind != Qmajor) {
+      count += pause_histogram[1][i];
+    }
+    repv limit = (i < PAUSE_BUCKETS - 1
+		  ? rep_make_long_uint((uintptr_t)PAUSE_BUCKET_BASE << i)
+		  : rep_nil);
+    ret = Fcons(Fcons(limit, rep_make_long_uint(count)), ret);
+  }
+
+  return ret;
+}
+
+DEFUN("write-heap-snapshot", Fwrite_heap_snapshot,
+      Swrite_heap_snapshot, (repv file), rep_Subr1) /*
+::doc:rep.data#write-heap-snapshot::
+write-heap-snapshot LOCAL-FILE-NAME
+
+Collects garbage, writing a description of all data found to be in use
+to the file called LOCAL-FILE-NAME (which must name a file in the local
+filing system). Use the `rep-heap-report' program to analyze it.
+
+The file starts with the eight bytes `REPHEAP1', followed by records
+each introduced by a single character. Numbers are unsigned LEB128,
+addresses are divided by eight, strings are a length then bytes.
+
+  T INDEX NAME		Objects with type INDEX are called NAME.
+  R ROOT NAME		Root set number ROOT is called NAME.
+  r ROOT ADDRESS	The object at ADDRESS is referenced by ROOT.
+  O ADDRESS TYPE SIZE COUNT EDGE...
+			An object of SIZE bytes, with COUNT references.
+			Each EDGE is the difference between the address
+			referred to and ADDRESS, zig-zag encoded.
+  L ADDRESS NAME	The object at ADDRESS is named NAME.
+  E			The end of the snapshot.
+::end:: */
+{
+  rep_DECLARE1(file, rep_STRINGP);
+
+  FILE *fh = fopen(rep_STR(file), "wb");
+  if (!fh) {
+    return rep_signal_file_error(file);
+  }
+
+  snapshot = rep_alloc(sizeof(*snapshot));
+  if (!snapshot) {
+    fclose(fh);
+    return rep_mem_error();
+  }
+
+  memset(snapshot, 0, sizeof(*snapshot));
+  snapshot->fh = fh;
+  snapshot->root = ROOT_OTHER;
+
+  for (const char *c = "REPHEAP1"; *c; c++) {
+    snapshot_byte(*c);
+  }
+
+  for (int i = ROOT_STATIC; i <= ROOT_CALL_STACK; i++) {
+    snapshot_byte('R');
+    snapshot_uint(i);
+    snapshot_string(root_names[i], strlen(root_names[i]));
+  }
+
+  rep_gc_snapshot = true;
+  collect(false);
+  rep_gc_finish_sweep();
+
+  snapshot_byte('E');
+  snapshot_flush();
+
+  bool failed = snapshot->failed;
+  if (fclose(fh) != 0) {
+    failed = true;
+  }
+
+  rep_free(snapshot->edges);
+  rep_free(snapshot);
+  snapshot = 0;
+
+  return failed ? rep_signal_file_error(file) : Qt;
+}
+
+DEFUN_INT("garbage-collect", Fgarbage_collect,
+	  Sgarbage_collect, (repv stats), rep_Subr1, "") /*
+::doc:rep.data#garbage-collect::
+garbage-collect [STATS]
+
+Scans all allocated storage for unusable data, and puts it onto the free-
+list. This is done automatically when the amount of storage used since the
+last garbage-collection is greater than `garbage-threshold'.
+
+If STATS is non-nil a list describing the memory in use is returned. Its
+last element is the total number of bytes of storage that the collector
+has released back to the system.
+::end:: */
+{
+  collect(false);
+  rep_gc_finish_sweep();
 
   if (stats != rep_nil) {
-    return rep_list_5(Fcons(rep_MAKE_INT(rep_used_cons),
+    return rep_LIST_6(Fcons(rep_MAKE_INT(rep_used_cons),
 			    rep_MAKE_INT(rep_allocated_cons - rep_used_cons)),
 		      Fcons(rep_MAKE_INT(rep_used_tuples),
 			    rep_MAKE_INT(rep_allocated_tuples
@@ -274,7 +1680,8 @@ last garbage-collection is greater than `garbage-threshold'.
 		      rep_MAKE_INT(rep_used_vector_slots),
 		      Fcons(rep_MAKE_INT(rep_used_closures),
 			    rep_MAKE_INT(rep_allocated_closures
-					 - rep_used_closures)));
+					 - rep_used_closures)),
+		      rep_make_long_uint(rep_gc_released_bytes));
   } else {
     return Qt;
   }
@@ -286,7 +1693,39 @@ rep_gc_init(void)
   repv tem = rep_push_structure("rep.data");
   rep_ADD_SUBR(Sgarbage_threshold);
   rep_ADD_SUBR(Sidle_garbage_threshold);
+  rep_ADD_SUBR(Sgarbage_threshold_maximum);
+  rep_ADD_SUBR(Sgarbage_growth_ratio);
+  rep_ADD_SUBR(Sgarbage_pause_goal);
+  rep_ADD_SUBR(Sgarbage_pacing_policy);
+  rep_ADD_SUBR(Sgarbage_collector_mode);
   rep_ADD_SUBR_INT(Sgarbage_collect);
+  rep_ADD_SUBR(Sfinish_garbage_collection);
+  rep_ADD_SUBR(Sgarbage_collection_statistics);
+  rep_ADD_SUBR(Sgarbage_collection_totals);
+  rep_ADD_SUBR(Sgarbage_pause_histogram);
+  rep_ADD_SUBR(Swrite_heap_snapshot);
   rep_INTERN_SPECIAL(after_gc_hook);
+  rep_INTERN(generational);
+  rep_INTERN(mark_sweep);
+  rep_INTERN(fixed);
+  rep_INTERN(proportional);
+  rep_INTERN(minor);
+  rep_INTERN(major);
+  rep_INTERN(number);
+  rep_INTERN(kind);
+  rep_INTERN(pause);
+  rep_INTERN(cpu_time);
+  rep_INTERN(mark);
+  rep_INTERN(weak);
+  rep_INTERN(sweep);
+  rep_INTERN(allocated_bytes);
+  rep_INTERN(live_bytes);
+  rep_INTERN(freed_bytes);
+  rep_INTERN(types);
+  rep_INTERN(collections);
+  rep_INTERN(minor_collections);
+  rep_INTERN(pause_time);
+  rep_INTERN(max_pause);
+  rep_INTERN(released_bytes);
   rep_pop_structure(tem);
 }
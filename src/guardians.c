@@ -29,11 +29,12 @@ DEFUN("make-primitive-guardian", Fmake_primitive_guardian,
 
   g->car = rep_Guardian;
   g->accessible = rep_nil;
+  g->old_accessible = rep_nil;
   g->inaccessible = rep_nil;
   g->next = guardians;
   guardians = g;
 
-  rep_data_after_gc += sizeof(rep_guardian);
+  rep_NOTE_ALLOCATION(sizeof(rep_guardian));
 
   return rep_VAL(g);
 }
@@ -80,40 +81,51 @@ rep_run_guardians(void)
 
   struct list_node *changed_list = NULL;
 
-  /* Scan all guardians for unmarked objects that used to be accessible. */
+  /* Scan all guardians for unmarked objects that used to be accessible.
+     Objects that have survived a collection are old, and only full
+     collections need to look at them again. */
 
   for (rep_guardian *g = guardians; g; g = g->next) {
-    repv *ptr = &g->accessible;
+    repv lists[2] = {g->accessible, rep_nil};
 
-    while (1) {
-      /* Cons cells store mark bit in cdr, so mask it out. */
+    g->accessible = rep_nil;
+    if (!rep_gc_minor) {
+      lists[1] = g->old_accessible;
+      g->old_accessible = rep_nil;
+    }
 
-      repv cell = *ptr & ~rep_VALUE_CONS_MARK_BIT;
-      if (cell == rep_nil) {
-	break;
-      }
+    for (int i = 0; i < 2; i++) {
+      repv cell = lists[i];
 
-      if (!rep_GC_MARKEDP(rep_CAR(cell))) {
-	/* Move object to inaccessible list. Have to preserve the cons
-	   mark bit in '*ptr'. */
+      while (cell != rep_nil) {
+	repv next = rep_CDR(cell);
 
-	*ptr = rep_GCDR(cell) | (*ptr & rep_VALUE_CONS_MARK_BIT);
-	rep_CDR(cell) = g->inaccessible;
-	g->inaccessible = cell;
+	if (!rep_GC_LIVEP(rep_CAR(cell))) {
+	  /* Move object to inaccessible list. */
 
-	/* Note that we need to mark this object. */
+	  rep_CDR(cell) = g->inaccessible;
+	  g->inaccessible = cell;
 
-	struct list_node *new = alloca(sizeof (struct list_node));
-	new->obj = rep_CAR(cell);
-	new->next = changed_list;
-	changed_list = new;
-      } else {
-	ptr = rep_CDRLOC (cell);
-      }
+	  /* Note that we need to mark this object. */
 
-      /* Mark the list infrastructure. */
+	  struct list_node *new = alloca(sizeof (struct list_node));
+	  new->obj = rep_CAR(cell);
+	  new->next = changed_list;
+	  changed_list = new;
+	} else {
+	  rep_CDR(cell) = g->old_accessible;
+	  g->old_accessible = cell;
+	}
 
-      rep_GC_SET_CONS(cell);
+	/* Mark the list infrastructure (old cells count as marked in
+	   minor collections, and mustn't have their mark bits set). */
+
+	if (!rep_GC_MARKEDP(cell)) {
+	  rep_GC_SET_CONS(cell);
+	}
+
+	cell = next;
+      }
     }
   }
 
@@ -133,6 +145,7 @@ sweep_guardians(void)
   while (g) {
     rep_guardian *next = g->next;
     if (!rep_GC_CELL_MARKEDP(rep_VAL(g))) {
+      rep_gc_note_freed_cell(rep_VAL(g));
       rep_free(g);
     } else {
       rep_GC_CLR_CELL(rep_VAL (g));
@@ -0,0 +1,197 @@
+/* hash.c -- hashing strings of bytes
+
+   Copyright (C) 1993-2015 John Harper <jsh@unfactored.org>
+
+   This file is part of Librep.
+
+   Librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   Librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+/* notes:
+
+   The hash is derived from Wang Yi's wyhash (public domain). Input is
+   read eight bytes at a time and folded in with 64x64->128 bit
+   multiplies, keeping three independent lanes for long strings so
+   that the multiplies overlap. Short strings are read with at most
+   four overlapping loads and no loop.
+
+   All string hashing (string-hash, symbol-hash, equal-hash and the
+   obarrays) goes through rep_hash_bytes(), so that they agree.
+
+   The seed is fixed by default, so hash codes, and the order tables
+   are walked in, are the same from one run to the next. Setting the
+   environment variable REP_HASH_SEED to a number uses that as the
+   seed instead, setting it to `random' picks a different seed for
+   each process, making hash collisions hard to arrange from outside.
+   The seed can't change once symbols have been interned, so it's
+   only read at startup. */
+
+#include "repint.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+
+static const uint64_t secret[4] = {
+  0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+  0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL,
+};
+
+uint64_t rep_hash_seed = 0x2d358dccaa6c78a5ULL;
+
+/* Multiply A and B, returning the 128-bit product in them. */
+
+static inline void
+mum(uint64_t *a, uint64_t *b)
+{
+#ifdef __SIZEOF_INT128__
+  __uint128_t r = (__uint128_t) *a * *b;
+  *a = (uint64_t) r;
+  *b = (uint64_t) (r >> 64);
+#else
+  uint64_t ha = *a >> 32, hb = *b >> 32;
+  uint64_t la = (uint32_t) *a, lb = (uint32_t) *b;
+  uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  uint64_t t = rl + (rm0 << 32);
+  uint64_t c = t < rl;
+  uint64_t lo = t + (rm1 << 32);
+  c += lo < t;
+  uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+  *a = lo;
+  *b = hi;
+#endif
+}
+
+static inline uint64_t
+mix(uint64_t a, uint64_t b)
+{
+  mum(&a, &b);
+  return a ^ b;
+}
+
+static inline uint64_t
+read8(const uint8_t *p)
+{
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap64(v);
+#endif
+  return v;
+}
+
+static inline uint64_t
+read4(const uint8_t *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap32(v);
+#endif
+  return v;
+}
+
+/* Return a 64-bit hash of the LEN bytes at DATA. */
+
+uint64_t
+rep_hash_bytes(const void *data, size_t len)
+{
+  const uint8_t *p = data;
+  uint64_t seed = rep_hash_seed ^ mix(rep_hash_seed ^ secret[0], secret[1]);
+  uint64_t a, b;
+
+  if (len <= 16) {
+    if (len >= 4) {
+      size_t mid = (len >> 3) << 2;
+      a = (read4(p) << 32) | read4(p + mid);
+      b = (read4(p + len - 4) << 32) | read4(p + len - 4 - mid);
+    } else if (len > 0) {
+      a = ((uint64_t) p[0] << 16) | ((uint64_t) p[len >> 1] << 8)
+	   | p[len - 1];
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t i = len;
+    if (i > 48) {
+      uint64_t lane1 = seed, lane2 = seed;
+      do {
+	seed = mix(read8(p) ^ secret[1], read8(p + 8) ^ seed);
+	lane1 = mix(read8(p + 16) ^ secret[2], read8(p + 24) ^ lane1);
+	lane2 = mix(read8(p + 32) ^ secret[3], read8(p + 40) ^ lane2);
+	p += 48;
+	i -= 48;
+      } while (i > 48);
+      seed ^= lane1 ^ lane2;
+    }
+    while (i > 16) {
+      seed = mix(read8(p) ^ secret[1], read8(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+    a = read8(p + i - 16);
+    b = read8(p + i - 8);
+  }
+
+  a ^= secret[1];
+  b ^= seed;
+  mum(&a, &b);
+  return mix(a ^ secret[0] ^ len, b ^ secret[1]);
+}
+
+static uint64_t
+random_seed(void)
+{
+  uint64_t seed = 0;
+
+#ifdef HAVE_FCNTL_H
+  int fd = open("/dev/urandom", O_RDONLY);
+  if (fd >= 0) {
+    if (read(fd, &seed, sizeof(seed)) != sizeof(seed)) {
+      seed = 0;
+    }
+    close(fd);
+  }
+#endif
+
+  if (seed == 0) {
+    seed = mix((uint64_t) time(NULL) ^ secret[2],
+	       (uint64_t) getpid() ^ (uintptr_t) &seed);
+  }
+
+  return seed;
+}
+
+void
+rep_hash_init(void)
+{
+  const char *env = getenv("REP_HASH_SEED");
+
+  if (env && *env) {
+    if (strcmp(env, "random") == 0) {
+      rep_hash_seed = random_seed();
+    } else {
+      rep_hash_seed = strtoull(env, NULL, 0);
+    }
+  }
+}
@@ -0,0 +1,1604 @@
+/* image.c -- saving and restoring the initialized Lisp environment
+
+   Copyright (C) 1993-2015 John Harper <jsh@unfactored.org>
+
+   This file is part of Librep.
+
+   Librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   Librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+/* notes:
+
+   An image holds the state left by loading the standard Lisp modules,
+   plus any others asked for, so that a process can start from it
+   instead of loading them again. `rep --dump-image FILE [MODULE...]'
+   boots as usual, loads each MODULE, writes FILE and exits, then
+   `rep --image FILE ...' reads FILE in place of the bootstrap, see
+   rep_load_environment().
+
+   Only what the Lisp code changed is saved. rep_image_baseline() is
+   called before the bootstrap, when the structures hold only what the
+   C code defined, which is the state every process starts in. It
+   records each of their bindings, and the image then holds the
+   bindings that are new or different, everything they refer to, and
+   the configuration of each structure.
+
+   The file is a header, then one record per object. All fields are
+   64-bit words. A reference to another value is either a fixnum as
+   is, the index of its record shifted left two bits with the low bit
+   set, or the index of one of a few constants shifted left two bits.
+   Symbols are saved by name and interned again, while subrs and
+   special forms are saved as the structure they're bound in and the
+   name of their binding there, so that the image doesn't depend on
+   where librep or any of its modules are mapped. Modules loaded from
+   shared libraries are loaded again before anything else is restored.
+
+   The reader maps the file and checks that every record is well
+   formed and every reference in range, before creating an object for
+   each record and then filling in their contents. Tables are created
+   after everything else, and filled last, since hashing a key may
+   depend on its contents. */
+
+#include "repint.h"
+#include "bytecodes.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
+#define IMAGE_MAGIC "REPIMG01"
+
+#define IMAGE_VERSION (1 | (sizeof(repv) << 8)			\
+		       | (BYTECODE_MAJOR_VERSION << 16)		\
+		       | (BYTECODE_MINOR_VERSION << 24))
+
+enum header {
+  HEADER_MAGIC,
+  HEADER_VERSION,
+  HEADER_OBJECTS,
+  HEADER_WORDS,				/* following the header */
+  HEADER_STRUCTURES,			/* vector of structures */
+  HEADER_PRINTERS,			/* alist of datum printers */
+  HEADER_LIBRARIES,			/* vector of library names */
+  HEADER_SIZE,
+};
+
+/* Each record starts with a word holding its type in the low eight
+   bits, and the number of words following. */
+
+enum record {
+  REC_CONS = 1,				/* CAR CDR */
+  REC_VECTOR,				/* FLAGS ELT... */
+  REC_BYTECODE,				/* FLAGS ELT... */
+  REC_STRING,				/* FLAGS LENGTH BYTES... */
+  REC_SYMBOL,				/* KIND FLAGS NEXT LENGTH BYTES... */
+  REC_NUMBER,				/* TYPE BITS or LENGTH BYTES... */
+  REC_CHAR,				/* CODE */
+  REC_CLOSURE,				/* FUN NAME ENV STRUCTURE */
+  REC_DATUM,				/* ID VALUE */
+  REC_TABLE,				/* HASH COMPARE WEAKNESS COUNT
+					   KEY VALUE... */
+  REC_STRUCTURE,			/* ROLE NAME FLAGS INHERITED IMPORTS
+					   ACCESSIBLE SPECIALS HANDLERS VM
+					   COUNT SYMBOL VALUE FLAGS... */
+  REC_SUBR,				/* STRUCTURE-NAME SYMBOL */
+  REC_FILE,				/* 0, 1 or 2 for stdin..stderr */
+  REC_MAX,
+};
+
+#define RECORD(type, length) ((type) | ((uint64_t)(length) << 8))
+#define RECORD_TYPE(w) ((int)((w) & 0xff))
+#define RECORD_LENGTH(w) ((w) >> 8)
+
+/* Values saved by reference to the running process. */
+
+enum constant {
+  CONST_NULL,
+  CONST_NIL,
+  CONST_VOID,
+  CONST_SCM_T,
+  CONST_SCM_F,
+  CONST_UNDEFINED,
+  CONST_OBARRAY,
+  CONST_KEYWORD_OBARRAY,
+  N_CONSTANTS,
+};
+
+enum symbol_kind {
+  SYMBOL_INTERNED,
+  SYMBOL_KEYWORD,
+  SYMBOL_UNINTERNED,
+};
+
+enum structure_role {
+  ROLE_ANONYMOUS,
+  ROLE_NAMED,
+  ROLE_DEFAULT,
+  ROLE_SPECIALS,
+};
+
+#define SYMBOL_FLAGS (rep_SF_KEYWORD | rep_SF_LOCAL | rep_SF_SET_LOCAL	\
+		      | rep_SF_DEBUG | rep_SF_SPECIAL | rep_SF_WEAK	\
+		      | rep_SF_WEAK_MOD | rep_SF_DEFVAR | rep_SF_LITERAL)
+
+#define STRUCTURE_FLAGS (rep_STF_EXPORT_ALL | rep_STF_SET_BINDS	\
+			 | rep_PENDING_CLOSE)
+
+#define BINDING_CONSTANT 1
+#define BINDING_EXPORTED 2
+
+#define REF_OBJECT(i) (((uint64_t)(i) << 2) | 1)
+#define REF_CONSTANT(i) ((uint64_t)(i) << 2)
+
+/* Each structure's bindings when the baseline was taken, a list of
+   (STRUCTURE . [SYMBOL VALUE FLAGS ...]). A structure still waiting
+   for its lazy initialisation has nil instead of the vector. */
+
+static repv baseline;
+
+DEFSTRING(cant_save, "Can't save object in image");
+
+static repv
+constant_value(int i)
+{
+  switch (i) {
+  case CONST_NIL:
+    return rep_nil;
+  case CONST_VOID:
+    return rep_void;
+  case CONST_SCM_T:
+    return rep_scm_t;
+  case CONST_SCM_F:
+    return rep_scm_f;
+  case CONST_UNDEFINED:
+    return rep_undefined_value;
+  case CONST_OBARRAY:
+    return rep_obarray;
+  case CONST_KEYWORD_OBARRAY:
+    return rep_keyword_obarray;
+  default:
+    return 0;
+  }
+}
+
+static inline int
+binding_flags(const rep_struct_node *n)
+{
+  return (n->is_constant ? BINDING_CONSTANT : 0)
+	  | (n->is_exported ? BINDING_EXPORTED : 0);
+}
+
+
+/* Maps from objects to numbers, by address. */
+
+typedef struct {
+  repv *keys;
+  size_t *values;
+  size_t size, count;
+} object_map;
+
+static inline size_t
+map_slot(const object_map *m, repv key)
+{
+  return (size_t)(((uint64_t)(key >> 3) * UINT64_C(0x9e3779b97f4a7c15))
+		  >> 32) & (m->size - 1);
+}
+
+static bool
+map_ref(const object_map *m, repv key, size_t *value)
+{
+  if (m->size == 0) {
+    return false;
+  }
+
+  for (size_t i = map_slot(m, key);; i = (i + 1) & (m->size - 1)) {
+    if (m->keys[i] == key) {
+      *value = m->values[i];
+      return true;
+    } else if (m->keys[i] == 0) {
+      return false;
+    }
+  }
+}
+
+static bool
+map_set(object_map *m, repv key, size_t value)
+{
+  if ((m->count + 1) * 2 > m->size) {
+    object_map old = *m;
+    m->size = old.size ? old.size * 2 : 256;
+    m->count = 0;
+    m->keys = rep_alloc(m->size * sizeof(repv));
+    m->values = rep_alloc(m->size * sizeof(size_t));
+    if (!m->keys || !m->values) {
+      rep_free(m->keys);
+      rep_free(m->values);
+      *m = old;
+      return false;
+    }
+    memset(m->keys, 0, m->size * sizeof(repv));
+    for (size_t i = 0; i < old.size; i++) {
+      if (old.keys[i] != 0) {
+	map_set(m, old.keys[i], old.values[i]);
+      }
+    }
+    rep_free(old.keys);
+    rep_free(old.values);
+  }
+
+  size_t i = map_slot(m, key);
+  while (m->keys[i] != 0 && m->keys[i] != key) {
+    i = (i + 1) & (m->size - 1);
+  }
+
+  if (m->keys[i] == 0) {
+    m->count++;
+  }
+
+  m->keys[i] = key;
+  m->values[i] = value;
+  return true;
+}
+
+static void
+map_clear(object_map *m)
+{
+  if (m->size != 0) {
+    memset(m->keys, 0, m->size * sizeof(repv));
+  }
+  m->count = 0;
+}
+
+static void
+map_free(object_map *m)
+{
+  rep_free(m->keys);
+  rep_free(m->values);
+  memset(m, 0, sizeof(*m));
+}
+
+
+/* Baseline. */
+
+void
+rep_image_baseline(void)
+{
+  if (!baseline) {
+    rep_mark_static(&baseline);
+  }
+
+  baseline = rep_nil;
+
+  for (rep_struct *s = rep_structure_list(); s; s = s->next) {
+    if (s->init) {
+      baseline = Fcons(Fcons(rep_VAL(s), rep_nil), baseline);
+      continue;
+    }
+
+    int count = 0;
+    unsigned int total_buckets = s->bucket_mask ? s->bucket_mask + 1 : 0;
+
+    for (unsigned int i = 0; i < total_buckets; i++) {
+      for (rep_struct_node *n = s->buckets[i]; n; n = n->next) {
+	count++;
+      }
+    }
+
+    repv vec = rep_make_vector(count * 3);
+    if (!vec) {
+      return;
+    }
+
+    int j = 0;
+    for (unsigned int i = 0; i < total_buckets; i++) {
+      for (rep_struct_node *n = s->buckets[i]; n; n = n->next) {
+	rep_VECTI(vec, j++) = n->symbol;
+	rep_VECTI(vec, j++) = n->binding;
+	rep_VECTI(vec, j++) = rep_MAKE_INT(binding_flags(n));
+      }
+    }
+
+    baseline = Fcons(Fcons(rep_VAL(s), vec), baseline);
+  }
+}
+
+/* Return the bindings of structure S when the baseline was taken, nil
+   if it hadn't been initialised, or a null pointer if it didn't exist
+   then. */
+
+static repv
+baseline_bindings(repv s)
+{
+  for (repv lst = baseline; rep_CONSP(lst); lst = rep_CDR(lst)) {
+    if (rep_CAR(rep_CAR(lst)) == s) {
+      return rep_CDR(rep_CAR(lst));
+    }
+  }
+  return 0;
+}
+
+
+/* Writing images. */
+
+typedef struct {
+  rep_struct *s;
+  repv symbol;
+} subr_home;
+
+typedef struct {
+  uint64_t *words;
+  size_t count, size;
+  repv *objects;			/* indexed by record number */
+  size_t n_objects, objects_size;
+  object_map indices;			/* object to record number */
+  object_map subrs;			/* subr to index in HOMES */
+  subr_home *homes;
+  size_t n_homes, homes_size;
+  object_map scratch;
+  bool failed;				/* out of memory */
+  repv bad_object;
+} writer;
+
+static void
+emit(writer *w, uint64_t word)
+{
+  if (w->count == w->size) {
+    size_t new_size = w->size ? w->size * 2 : 65536;
+    uint64_t *words = rep_realloc(w->words, new_size * sizeof(uint64_t));
+    if (!words) {
+      w->failed = true;
+      return;
+    }
+    w->words = words;
+    w->size = new_size;
+  }
+
+  w->words[w->count++] = word;
+}
+
+static void
+emit_bytes(writer *w, const void *data, size_t len)
+{
+  emit(w, len);
+
+  for (size_t i = 0; i < len; i += 8) {
+    uint64_t word = 0;
+    memcpy(&word, (const uint8_t *)data + i, MIN(8, len - i));
+    emit(w, word);
+  }
+}
+
+/* Start a record of TYPE, returning the position of its header. */
+
+static inline size_t
+begin_record(writer *w, int type)
+{
+  size_t start = w->count;
+  emit(w, type);
+  return start;
+}
+
+static inline void
+end_record(writer *w, size_t start)
+{
+  if (!w->failed) {
+    w->words[start] = RECORD(w->words[start], w->count - start - 1);
+  }
+}
+
+/* Return the reference to V, giving it a record number if it hasn't
+   been seen before. */
+
+static uint64_t
+object_ref(writer *w, repv v)
+{
+  if (rep_INTP(v)) {
+    return (uint64_t)v;
+  }
+
+  for (int i = 0; i < N_CONSTANTS; i++) {
+    if (constant_value(i) == v) {
+      return REF_CONSTANT(i);
+    }
+  }
+
+  size_t index;
+  if (map_ref(&w->indices, v, &index)) {
+    return REF_OBJECT(index);
+  }
+
+  if (w->n_objects == w->objects_size) {
+    size_t new_size = w->objects_size ? w->objects_size * 2 : 4096;
+    repv *objects = rep_realloc(w->objects, new_size * sizeof(repv));
+    if (!objects) {
+      w->failed = true;
+      return REF_CONSTANT(CONST_NIL);
+    }
+    w->objects = objects;
+    w->objects_size = new_size;
+  }
+
+  index = w->n_objects;
+  if (!map_set(&w->indices, v, index)) {
+    w->failed = true;
+    return REF_CONSTANT(CONST_NIL);
+  }
+
+  w->objects[w->n_objects++] = v;
+  return REF_OBJECT(index);
+}
+
+static inline void
+emit_ref(writer *w, repv v)
+{
+  emit(w, object_ref(w, v));
+}
+
+static inline bool
+subr_p(repv v)
+{
+  return rep_CELLP(v) && !rep_CONSP(v) && !rep_CELL16P(v)
+	  && (rep_CELL8_TYPE(v) == rep_Subr || rep_CELL8_TYPE(v) == rep_SF);
+}
+
+/* Record that subr V can be found as the binding of SYM in S, unless
+   it already has a home, or SYM isn't the subr's own name. */
+
+static void
+add_subr_home(writer *w, rep_struct *s, repv sym, repv v)
+{
+  size_t index;
+  if (!subr_p(v) || map_ref(&w->subrs, v, &index)) {
+    return;
+  }
+
+  repv name = rep_XSUBR(v)->name;
+  repv sym_name = rep_SYM(sym)->name;
+  if (rep_STRING_LEN(name) != rep_STRING_LEN(sym_name)
+      || memcmp(rep_STR(name), rep_STR(sym_name), rep_STRING_LEN(name)) != 0)
+  {
+    return;
+  }
+
+  if (w->n_homes == w->homes_size) {
+    size_t new_size = w->homes_size ? w->homes_size * 2 : 1024;
+    subr_home *homes = rep_realloc(w->homes, new_size * sizeof(subr_home));
+    if (!homes) {
+      w->failed = true;
+      return;
+    }
+    w->homes = homes;
+    w->homes_size = new_size;
+  }
+
+  w->homes[w->n_homes].s = s;
+  w->homes[w->n_homes].symbol = sym;
+  if (!map_set(&w->subrs, v, w->n_homes)) {
+    w->failed = true;
+    return;
+  }
+  w->n_homes++;
+}
+
+/* Find a named structure binding each subr under its own name. The
+   baseline bindings come first, since the reader's own initialisation
+   recreates those before the image is restored (lazily initialised
+   structures redo their initialisation when first searched); after
+   them, the structures created by loading libraries. A binding the Lisp code
+   made during the boot (e.g. `load' copied into `rep') doesn't exist
+   until the image's structures are filled in, so can't be used. */
+
+static void
+find_subr_homes(writer *w)
+{
+  for (repv lst = baseline; rep_CONSP(lst); lst = rep_CDR(lst)) {
+    rep_struct *s = rep_STRUCTURE(rep_CAR(rep_CAR(lst)));
+    repv base = rep_CDR(rep_CAR(lst));
+    if (!rep_SYMBOLP(s->name)) {
+      continue;
+    }
+    if (base == rep_nil) {
+      unsigned int total_buckets = s->bucket_mask ? s->bucket_mask + 1 : 0;
+      for (unsigned int i = 0; i < total_buckets; i++) {
+	for (rep_struct_node *n = s->buckets[i]; n; n = n->next) {
+	  add_subr_home(w, s, n->symbol, n->binding);
+	}
+      }
+      continue;
+    }
+    for (int i = 0; i < rep_VECTOR_LEN(base); i += 3) {
+      add_subr_home(w, s, rep_VECTI(base, i), rep_VECTI(base, i + 1));
+    }
+  }
+
+  for (rep_struct *s = rep_structure_list(); s; s = s->next) {
+    if (!rep_SYMBOLP(s->name) || baseline_bindings(rep_VAL(s)) != 0) {
+      continue;
+    }
+
+    unsigned int total_buckets = s->bucket_mask ? s->bucket_mask + 1 : 0;
+
+    for (unsigned int i = 0; i < total_buckets; i++) {
+      for (rep_struct_node *n = s->buckets[i]; n; n = n->next) {
+	add_subr_home(w, s, n->symbol, n->binding);
+      }
+    }
+  }
+}
+
+static void
+write_structure(writer *w, repv v)
+{
+  rep_struct *s = rep_STRUCTURE(v);
+
+  int role = (v == rep_default_structure ? ROLE_DEFAULT
+	      : v == rep_specials_structure ? ROLE_SPECIALS
+	      : rep_SYMBOLP(s->name) ? ROLE_NAMED : ROLE_ANONYMOUS);
+
+  emit(w, role);
+  emit_ref(w, role == ROLE_NAMED ? s->name : rep_nil);
+  emit(w, s->car & STRUCTURE_FLAGS);
+  emit_ref(w, s->inherited);
+  emit_ref(w, s->imports);
+  emit_ref(w, s->accessible);
+  emit_ref(w, s->special_variables);
+  emit_ref(w, s->file_handlers);
+  emit(w, s->apply_bytecode != NULL);
+
+  /* Index the bindings the structure started with, so that only
+     those that have changed are saved. */
+
+  repv base = baseline_bindings(v);
+  if (base == rep_nil) {
+    base = 0;
+  }
+  map_clear(&w->scratch);
+  if (base) {
+    for (int i = 0; i < rep_VECTOR_LEN(base); i += 3) {
+      if (!map_set(&w->scratch, rep_VECTI(base, i), i)) {
+	w->failed = true;
+	return;
+      }
+    }
+  }
+
+  size_t count_pos = w->count;
+  emit(w, 0);
+
+  uint64_t count = 0;
+  unsigned int total_buckets = s->bucket_mask ? s->bucket_mask + 1 : 0;
+
+  for (unsigned int i = 0; i < total_buckets; i++) {
+    for (rep_struct_node *n = s->buckets[i]; n; n = n->next) {
+      size_t j;
+      if (base && map_ref(&w->scratch, n->symbol, &j)
+	  && rep_VECTI(base, j + 1) == n->binding
+	  && rep_VECTI(base, j + 2) == rep_MAKE_INT(binding_flags(n)))
+      {
+	continue;
+      }
+      emit_ref(w, n->symbol);
+      emit_ref(w, n->binding);
+      emit(w, binding_flags(n));
+      count++;
+    }
+  }
+
+  if (!w->failed) {
+    w->words[count_pos] = count;
+  }
+}
+
+struct table_data {
+  writer *w;
+  uint64_t count;
+};
+
+static void
+write_table_entry(repv key, repv value, void *data)
+{
+  struct table_data *d = data;
+  emit_ref(d->w, key);
+  emit_ref(d->w, value);
+  d->count++;
+}
+
+static void
+write_table(writer *w, repv v)
+{
+  repv hash_fun, cmp_fun;
+  repv weakness = rep_table_functions(v, &hash_fun, &cmp_fun);
+
+  emit_ref(w, hash_fun);
+  emit_ref(w, cmp_fun);
+  emit_ref(w, weakness);
+
+  size_t count_pos = w->count;
+  emit(w, 0);
+
+  struct table_data d = {w, 0};
+  rep_table_walk(v, write_table_entry, &d);
+
+  if (!w->failed) {
+    w->words[count_pos] = d.count;
+  }
+}
+
+static void
+write_record(writer *w, repv v)
+{
+  size_t start;
+
+  if (rep_CONSP(v)) {
+    start = begin_record(w, REC_CONS);
+    emit_ref(w, rep_CAR(v));
+    emit_ref(w, rep_CDR(v));
+    end_record(w, start);
+    return;
+  }
+
+  if (rep_CELL16P(v)) {
+    if (Ftablep(v) != rep_nil) {
+      start = begin_record(w, REC_TABLE);
+      write_table(w, v);
+      end_record(w, start);
+    } else {
+      w->bad_object = v;
+    }
+    return;
+  }
+
+  switch (rep_CELL8_TYPE(v)) {
+  case rep_Vector:
+  case rep_Bytecode: {
+    start = begin_record(w, rep_CELL8_TYPE(v) == rep_Vector
+			 ? REC_VECTOR : REC_BYTECODE);
+    emit(w, (rep_VECT(v)->car & rep_VECTOR_IMMUTABLE) != 0);
+    int len = rep_VECTOR_LEN(v);
+    for (int i = 0; i < len; i++) {
+      emit_ref(w, rep_VECTI(v, i));
+    }
+    break;
+  }
+
+  case rep_String:
+    start = begin_record(w, REC_STRING);
+    emit(w, !rep_STRING_WRITABLE_P(v));
+    emit_bytes(w, rep_STR(v), rep_STRING_LEN(v));
+    break;
+
+  case rep_Symbol: {
+    repv name = rep_SYM(v)->name;
+    int kind = (Ffind_symbol(name, rep_obarray) == v ? SYMBOL_INTERNED
+		: Ffind_symbol(name, rep_keyword_obarray) == v
+		? SYMBOL_KEYWORD : SYMBOL_UNINTERNED);
+    start = begin_record(w, REC_SYMBOL);
+    emit(w, kind);
+    emit(w, rep_SYM(v)->car & SYMBOL_FLAGS);
+    emit_ref(w, kind == SYMBOL_UNINTERNED ? rep_SYM(v)->next : 0);
+    emit_bytes(w, rep_STR(name), rep_STRING_LEN(name));
+    break;
+  }
+
+  case rep_Number:
+    start = begin_record(w, REC_NUMBER);
+    emit(w, rep_NUMBER_TYPE(v));
+    if (rep_NUMBER_FLOAT_P(v)) {
+      double d = rep_get_float(v);
+      uint64_t bits;
+      memcpy(&bits, &d, sizeof(bits));
+      emit(w, bits);
+    } else {
+      repv str = Fnumber_to_string(v, rep_nil);
+      if (!str) {
+	w->bad_object = v;
+	return;
+      }
+      emit_bytes(w, rep_STR(str), rep_STRING_LEN(str));
+    }
+    break;
+
+  case rep_Char:
+    start = begin_record(w, REC_CHAR);
+    emit(w, rep_CHAR_VALUE(v));
+    break;
+
+  case rep_Closure:
+    start = begin_record(w, REC_CLOSURE);
+    emit_ref(w, rep_CLOSURE(v)->fun);
+    emit_ref(w, rep_CLOSURE(v)->name);
+    emit_ref(w, rep_CLOSURE(v)->env);
+    emit_ref(w, rep_CLOSURE(v)->structure);
+    break;
+
+  case rep_Datum:
+    start = begin_record(w, REC_DATUM);
+    emit_ref(w, rep_TUPLE(v)->a);
+    emit_ref(w, rep_TUPLE(v)->b);
+    break;
+
+  case rep_Structure:
+    start = begin_record(w, REC_STRUCTURE);
+    write_structure(w, v);
+    break;
+
+  case rep_Subr:
+  case rep_SF: {
+    size_t index;
+    if (!map_ref(&w->subrs, v, &index)) {
+      w->bad_object = v;
+      return;
+    }
+    start = begin_record(w, REC_SUBR);
+    emit_ref(w, w->homes[index].s->name);
+    emit_ref(w, w->homes[index].symbol);
+    break;
+  }
+
+  case rep_File:
+    start = begin_record(w, REC_FILE);
+    if (v == Fstdin_file()) {
+      emit(w, 0);
+    } else if (v == Fstdout_file()) {
+      emit(w, 1);
+    } else if (v == Fstderr_file()) {
+      emit(w, 2);
+    } else {
+      w->bad_object = v;
+      return;
+    }
+    break;
+
+  default:
+    w->bad_object = v;
+    return;
+  }
+
+  end_record(w, start);
+}
+
+/* Return a vector of the structures whose state should be saved. */
+
+static repv
+saved_structures(void)
+{
+  int count = 0;
+  for (rep_struct *s = rep_structure_list(); s; s = s->next) {
+    if (!s->init && (rep_SYMBOLP(s->name)
+		     || rep_VAL(s) == rep_default_structure
+		     || rep_VAL(s) == rep_specials_structure))
+    {
+      count++;
+    }
+  }
+
+  repv vec = rep_make_vector(count);
+  if (!vec) {
+    return 0;
+  }
+
+  for (rep_struct *s = rep_structure_list(); s; s = s->next) {
+    if (!s->init && (rep_SYMBOLP(s->name)
+		     || rep_VAL(s) == rep_default_structure
+		     || rep_VAL(s) == rep_specials_structure))
+    {
+      rep_VECTI(vec, --count) = rep_VAL(s);
+    }
+  }
+
+  return vec;
+}
+
+static repv
+list_to_vector(repv lst)
+{
+  repv len = Flength(lst);
+  if (!len) {
+    return 0;
+  }
+
+  repv vec = rep_make_vector(rep_INT(len));
+  if (!vec) {
+    return 0;
+  }
+
+  for (int i = 0; rep_CONSP(lst); i++, lst = rep_CDR(lst)) {
+    rep_VECTI(vec, i) = rep_CAR(lst);
+  }
+
+  return vec;
+}
+
+/* Write the image of everything changed since rep_image_baseline()
+   to FILE. */
+
+repv
+rep_dump_image(repv file)
+{
+  rep_DECLARE1(file, rep_STRINGP);
+
+  if (!baseline) {
+    DEFSTRING(no_baseline, "No baseline for image");
+    return Fsignal(Qerror, rep_LIST_1(rep_VAL(&no_baseline)));
+  }
+
+  repv structures = saved_structures();
+  if (!structures) {
+    return rep_mem_error();
+  }
+
+  rep_GC_root gc_file, gc_structures, gc_libraries;
+  rep_PUSHGC(gc_file, file);
+  rep_PUSHGC(gc_structures, structures);
+
+#ifdef HAVE_DYNAMIC_LOADING
+  repv libraries = list_to_vector(rep_dl_libraries());
+#else
+  repv libraries = list_to_vector(rep_nil);
+#endif
+  rep_PUSHGC(gc_libraries, libraries);
+
+  writer w;
+  memset(&w, 0, sizeof(w));
+
+  uint64_t header[HEADER_SIZE];
+  memcpy(&header[HEADER_MAGIC], IMAGE_MAGIC, 8);
+  header[HEADER_VERSION] = IMAGE_VERSION;
+
+  find_subr_homes(&w);
+
+  header[HEADER_STRUCTURES] = object_ref(&w, structures);
+  header[HEADER_PRINTERS] = object_ref(&w, rep_datum_printers());
+  header[HEADER_LIBRARIES] = object_ref(&w, libraries ? libraries : rep_nil);
+
+  /* Writing each record adds anything it refers to that hasn't been
+     seen yet to the end of the list. */
+
+  for (size_t i = 0; (i < w.n_objects && !w.failed
+		      && !w.bad_object && !rep_throw_value); i++) {
+    write_record(&w, w.objects[i]);
+  }
+
+  header[HEADER_OBJECTS] = w.n_objects;
+  header[HEADER_WORDS] = w.count;
+
+  repv ret = Qt;
+
+  if (rep_throw_value) {
+    ret = 0;
+  } else if (w.failed || !libraries) {
+    ret = rep_mem_error();
+  } else if (w.bad_object) {
+    ret = Fsignal(Qerror, rep_list_2(rep_VAL(&cant_save), w.bad_object));
+  } else {
+    /* Write to a temporary file then rename it, so that processes
+       starting meanwhile never see part of an image. */
+
+    size_t len = rep_STRING_LEN(file);
+    char *tmp = rep_alloc(len + 5);
+    if (!tmp) {
+      ret = rep_mem_error();
+    } else {
+      memcpy(tmp, rep_STR(file), len);
+      memcpy(tmp + len, ".tmp", 5);
+
+      FILE *fh = fopen(tmp, "wb");
+      if (!fh
+	  || fwrite(header, sizeof(uint64_t), HEADER_SIZE, fh) != HEADER_SIZE
+	  || fwrite(w.words, sizeof(uint64_t), w.count, fh) != w.count
+	  || fclose(fh) != 0
+	  || rename(tmp, rep_STR(file)) != 0)
+      {
+	int saved_errno = errno;
+	remove(tmp);
+	errno = saved_errno;
+	ret = rep_signal_file_error(file);
+      }
+
+      rep_free(tmp);
+    }
+  }
+
+  rep_free(w.words);
+  rep_free(w.objects);
+  rep_free(w.homes);
+  map_free(&w.indices);
+  map_free(&w.subrs);
+  map_free(&w.scratch);
+
+  rep_POPGC; rep_POPGC; rep_POPGC;
+
+  return ret;
+}
+
+
+/* Reading images. */
+
+typedef struct {
+  const uint64_t *words;
+  size_t n_words;
+  size_t *offsets;			/* of each record's header */
+  size_t n_objects;
+  repv *objs;
+  const char *error;
+} reader;
+
+static inline bool
+valid_ref(const reader *r, uint64_t ref)
+{
+  if (ref & rep_VALUE_IS_INT) {
+    return true;
+  } else if (ref & 1) {
+    return (ref >> 2) < r->n_objects;
+  } else {
+    return (ref >> 2) < N_CONSTANTS;
+  }
+}
+
+static inline repv
+decode(const reader *r, uint64_t ref)
+{
+  if (ref & rep_VALUE_IS_INT) {
+    return (repv)ref;
+  } else if (ref & 1) {
+    return r->objs[ref >> 2];
+  } else {
+    return constant_value(ref >> 2);
+  }
+}
+
+static inline bool
+valid_refs(const reader *r, const uint64_t *p, size_t count)
+{
+  for (size_t i = 0; i < count; i++) {
+    if (!valid_ref(r, p[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* True if P[0] is a byte count filling exactly the WORDS words after
+   it. */
+
+static inline bool
+valid_bytes(const uint64_t *p, size_t words)
+{
+  return p[0] <= rep_MAX_STRING_LEN && (p[0] + 7) / 8 == words - 1;
+}
+
+static bool
+valid_record(const reader *r, size_t i)
+{
+  const uint64_t *p = r->words + r->offsets[i];
+  size_t n = RECORD_LENGTH(p[0]);
+  p++;
+
+  switch (RECORD_TYPE(p[-1])) {
+  case REC_CONS:
+  case REC_DATUM:
+  case REC_SUBR:
+    return n == 2 && valid_refs(r, p, 2);
+
+  case REC_VECTOR:
+  case REC_BYTECODE:
+    return n >= 1 && valid_refs(r, p + 1, n - 1);
+
+  case REC_STRING:
+    return n >= 2 && valid_bytes(p + 1, n - 1);
+
+  case REC_SYMBOL:
+    return (n >= 4 && p[0] <= SYMBOL_UNINTERNED && valid_ref(r, p[2])
+	    && valid_bytes(p + 3, n - 3));
+
+  case REC_NUMBER:
+    if (n >= 1 && p[0] == rep_NUMBER_FLOAT) {
+      return n == 2;
+    } else {
+      return (n >= 2 && (p[0] == rep_NUMBER_BIGNUM
+			 || p[0] == rep_NUMBER_RATIONAL)
+	      && valid_bytes(p + 1, n - 1));
+    }
+
+  case REC_CHAR:
+    return n == 1;
+
+  case REC_CLOSURE:
+    return n == 4 && valid_refs(r, p, 4);
+
+  case REC_TABLE:
+    return (n >= 4 && valid_refs(r, p, 3) && p[3] <= n
+	    && n - 4 == p[3] * 2 && valid_refs(r, p + 4, n - 4));
+
+  case REC_STRUCTURE:
+    if (n < 10 || p[0] > ROLE_SPECIALS || !valid_ref(r, p[1])
+	|| !valid_refs(r, p + 3, 5) || p[9] > n || n - 10 != p[9] * 3)
+    {
+      return false;
+    }
+    for (size_t j = 10; j < n; j += 3) {
+      if (!valid_refs(r, p + j, 2)) {
+	return false;
+      }
+    }
+    return true;
+
+  case REC_FILE:
+    return n == 1 && p[0] <= 2;
+
+  default:
+    return false;
+  }
+}
+
+/* Find the start of each record and check it. */
+
+static bool
+index_records(reader *r)
+{
+  r->offsets = rep_alloc(MAX(r->n_objects, 1) * sizeof(size_t));
+  if (!r->offsets) {
+    r->error = "out of memory";
+    return false;
+  }
+
+  size_t pos = 0;
+  for (size_t i = 0; i < r->n_objects; i++) {
+    if (pos >= r->n_words
+	|| RECORD_LENGTH(r->words[pos]) > r->n_words - pos - 1)
+    {
+      r->error = "truncated";
+      return false;
+    }
+    r->offsets[i] = pos;
+    pos += RECORD_LENGTH(r->words[pos]) + 1;
+  }
+
+  if (pos != r->n_words) {
+    r->error = "trailing data";
+    return false;
+  }
+
+  for (size_t i = 0; i < r->n_objects; i++) {
+    if (!valid_record(r, i)) {
+      r->error = "invalid record";
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static inline const uint64_t *
+payload(const reader *r, size_t i, int *type, size_t *length)
+{
+  const uint64_t *p = r->words + r->offsets[i];
+  *type = RECORD_TYPE(p[0]);
+  *length = RECORD_LENGTH(p[0]);
+  return p + 1;
+}
+
+static inline repv
+read_string(const uint64_t *p)
+{
+  return rep_string_copy_n((const char *)(p + 1), p[0]);
+}
+
+/* Create the objects that don't depend on others existing first. */
+
+static bool
+create_objects(reader *r)
+{
+  for (size_t i = 0; i < r->n_objects; i++) {
+    int type;
+    size_t n;
+    const uint64_t *p = payload(r, i, &type, &n);
+    repv v = rep_nil;
+
+    switch (type) {
+    case REC_CONS:
+      v = Fcons(rep_nil, rep_nil);
+      break;
+
+    case REC_VECTOR:
+    case REC_BYTECODE:
+      v = Fmake_vector(rep_MAKE_INT(n - 1), rep_nil);
+      if (v && type == REC_BYTECODE) {
+	rep_BYTECODE(v)->car = ((rep_BYTECODE(v)->car & ~rep_CELL8_TYPE_MASK)
+				| rep_Bytecode);
+      }
+      break;
+
+    case REC_STRING:
+      v = read_string(p + 1);
+      if (v && p[0]) {
+	rep_STRING(v)->car |= rep_STRING_IMMUTABLE;
+      }
+      break;
+
+    case REC_SYMBOL:
+      if (p[0] == SYMBOL_UNINTERNED) {
+	v = read_string(p + 3);
+	if (v) {
+	  rep_STRING(v)->car |= rep_STRING_IMMUTABLE;
+	  v = Fmake_symbol(v);
+	}
+      } else {
+	v = rep_intern_symbol((const char *)(p + 4), p[3],
+			      p[0] == SYMBOL_KEYWORD
+			      ? rep_keyword_obarray : rep_obarray);
+      }
+      break;
+
+    case REC_NUMBER:
+      if (p[0] == rep_NUMBER_FLOAT) {
+	double d;
+	memcpy(&d, &p[1], sizeof(d));
+	v = rep_make_float(d, true);
+      } else {
+	v = read_string(p + 1);
+	if (v) {
+	  v = Fstring_to_number(v, rep_nil);
+	}
+	if (v && !rep_NUMBERP(v)) {
+	  r->error = "invalid number";
+	  return false;
+	}
+      }
+      break;
+
+    case REC_CHAR:
+      v = rep_intern_char(p[0]);
+      break;
+
+    case REC_CLOSURE:
+      v = Fmake_closure(rep_nil, rep_nil);
+      break;
+
+    case REC_DATUM:
+      v = Fmake_datum(rep_nil, rep_nil);
+      break;
+
+    case REC_FILE:
+      v = p[0] == 0 ? Fstdin_file() : p[0] == 1 ? Fstdout_file()
+	  : Fstderr_file();
+      break;
+    }
+
+    if (!v) {
+      r->error = "can't create object";
+      return false;
+    }
+
+    r->objs[i] = v;
+  }
+
+  return true;
+}
+
+/* Return the vector at reference REF, or a null pointer. */
+
+static repv
+root_vector(const reader *r, uint64_t ref)
+{
+  if (!valid_ref(r, ref)) {
+    return 0;
+  }
+  repv v = decode(r, ref);
+  return rep_VECTORP(v) ? v : 0;
+}
+
+static bool
+load_libraries(reader *r, repv libraries)
+{
+  for (int i = 0; i < rep_VECTOR_LEN(libraries); i++) {
+    repv name = rep_VECTI(libraries, i);
+    if (!rep_STRINGP(name)) {
+      r->error = "invalid library";
+      return false;
+    }
+#ifdef HAVE_DYNAMIC_LOADING
+    repv old = rep_structure;
+    rep_structure = rep_default_structure;
+    repv ret = rep_dl_open_structure(name);
+    rep_structure = old;
+    if (!ret) {
+      r->error = "can't load library";
+      return false;
+    }
+#else
+    r->error = "no dynamic loading";
+    return false;
+#endif
+  }
+
+  return true;
+}
+
+static bool
+resolve_subrs(reader *r)
+{
+  for (size_t i = 0; i < r->n_objects; i++) {
+    int type;
+    size_t n;
+    const uint64_t *p = payload(r, i, &type, &n);
+
+    if (type != REC_SUBR) {
+      continue;
+    }
+
+    repv name = decode(r, p[0]);
+    repv sym = decode(r, p[1]);
+    if (!rep_SYMBOLP(name) || !rep_SYMBOLP(sym)) {
+      r->error = "invalid subr";
+      return false;
+    }
+
+    repv s = Ffind_structure(name);
+    rep_struct_node *node = (rep_STRUCTUREP(s)
+			     ? rep_structure_lookup(s, sym) : NULL);
+    if (!node || !subr_p(node->binding)) {
+      r->error = "missing subr";
+      return false;
+    }
+
+    r->objs[i] = node->binding;
+  }
+
+  return true;
+}
+
+static bool
+create_structures(reader *r)
+{
+  for (size_t i = 0; i < r->n_objects; i++) {
+    int type;
+    size_t n;
+    const uint64_t *p = payload(r, i, &type, &n);
+
+    if (type != REC_STRUCTURE) {
+      continue;
+    }
+
+    repv s;
+    switch (p[0]) {
+    case ROLE_DEFAULT:
+      s = rep_default_structure;
+      break;
+
+    case ROLE_SPECIALS:
+      s = rep_specials_structure;
+      break;
+
+    case ROLE_NAMED: {
+      repv name = decode(r, p[1]);
+      if (!rep_SYMBOLP(name)) {
+	r->error = "invalid structure";
+	return false;
+      }
+      s = Ffind_structure(name);
+      if (!rep_STRUCTUREP(s)) {
+	s = Fmake_structure(rep_nil, rep_nil, rep_nil, name);
+      }
+      break;
+    }
+
+    default:
+      s = Fmake_structure(rep_nil, rep_nil, rep_nil, rep_nil);
+    }
+
+    if (!s) {
+      r->error = "can't create structure";
+      return false;
+    }
+
+    r->objs[i] = s;
+  }
+
+  return true;
+}
+
+static bool
+create_tables(reader *r)
+{
+  for (size_t i = 0; i < r->n_objects; i++) {
+    int type;
+    size_t n;
+    const uint64_t *p = payload(r, i, &type, &n);
+
+    if (type != REC_TABLE) {
+      continue;
+    }
+
+    repv hash_fun = decode(r, p[0]);
+    repv cmp_fun = decode(r, p[1]);
+    repv weakness = decode(r, p[2]);
+    repv size = rep_MAKE_INT(MIN(p[3], rep_LISP_MAX_INT));
+
+    repv tab = (weakness == rep_nil
+		? Fmake_table(hash_fun, cmp_fun, size)
+		: Fmake_weak_table(hash_fun, cmp_fun, size, weakness));
+    if (!tab) {
+      r->error = "can't create table";
+      return false;
+    }
+
+    r->objs[i] = tab;
+  }
+
+  return true;
+}
+
+static inline void
+set_field(repv obj, repv *field, repv value)
+{
+  *field = value;
+  rep_GC_WRITE_BARRIER(obj, value);
+}
+
+static bool
+fill_objects(reader *r)
+{
+  for (size_t i = 0; i < r->n_objects; i++) {
+    int type;
+    size_t n;
+    const uint64_t *p = payload(r, i, &type, &n);
+    repv v = r->objs[i];
+
+    switch (type) {
+    case REC_CONS:
+      set_field(v, &rep_CAR(v), decode(r, p[0]));
+      set_field(v, rep_CDRLOC(v), decode(r, p[1]));
+      break;
+
+    case REC_VECTOR:
+    case REC_BYTECODE:
+      for (size_t j = 1; j < n; j++) {
+	set_field(v, &rep_VECTI(v, j - 1), decode(r, p[j]));
+      }
+      if (p[0]) {
+	rep_VECT(v)->car |= rep_VECTOR_IMMUTABLE;
+      }
+      break;
+
+    case REC_SYMBOL:
+      rep_SYM(v)->car |= p[1] & SYMBOL_FLAGS;
+      if (p[0] == SYMBOL_UNINTERNED) {
+	set_field(v, &rep_SYM(v)->next, decode(r, p[2]));
+      }
+      break;
+
+    case REC_CLOSURE:
+      set_field(v, &rep_CLOSURE(v)->fun, decode(r, p[0]));
+      set_field(v, &rep_CLOSURE(v)->name, decode(r, p[1]));
+      set_field(v, &rep_CLOSURE(v)->env, decode(r, p[2]));
+      set_field(v, &rep_CLOSURE(v)->structure, decode(r, p[3]));
+      break;
+
+    case REC_DATUM:
+      set_field(v, &rep_TUPLE(v)->a, decode(r, p[0]));
+      set_field(v, &rep_TUPLE(v)->b, decode(r, p[1]));
+      break;
+
+    case REC_STRUCTURE: {
+      rep_struct *s = rep_STRUCTURE(v);
+
+      /* Structures are always scanned by minor collections, so need
+	 no write barrier. */
+
+      s->car = (s->car & ~STRUCTURE_FLAGS) | (p[2] & STRUCTURE_FLAGS);
+      s->inherited = decode(r, p[3]);
+      s->imports = decode(r, p[4]);
+      s->accessible = decode(r, p[5]);
+      s->special_variables = decode(r, p[6]);
+      s->file_handlers = decode(r, p[7]);
+
+      if (!p[8]) {
+	s->apply_bytecode = NULL;
+      } else if (!s->apply_bytecode) {
+	Fstructure_install_vm(v, rep_nil);
+      }
+
+      for (size_t j = 10; j < n; j += 3) {
+	repv sym = decode(r, p[j]);
+	if (!rep_SYMBOLP(sym)) {
+	  r->error = "invalid binding";
+	  return false;
+	}
+	rep_structure_install(v, sym, decode(r, p[j + 1]),
+			      (p[j + 2] & BINDING_CONSTANT) != 0,
+			      (p[j + 2] & BINDING_EXPORTED) != 0);
+      }
+      break;
+    }
+    }
+  }
+
+  return true;
+}
+
+static bool
+fill_tables(reader *r)
+{
+  for (size_t i = 0; i < r->n_objects; i++) {
+    int type;
+    size_t n;
+    const uint64_t *p = payload(r, i, &type, &n);
+
+    if (type != REC_TABLE) {
+      continue;
+    }
+
+    for (size_t j = 4; j < n; j += 2) {
+      if (!Ftable_set(r->objs[i], decode(r, p[j]), decode(r, p[j + 1]))) {
+	r->error = "can't fill table";
+	return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+static bool
+restore(reader *r, const uint64_t *header)
+{
+  repv structures = root_vector(r, header[HEADER_STRUCTURES]);
+  repv libraries = root_vector(r, header[HEADER_LIBRARIES]);
+  if (!valid_ref(r, header[HEADER_PRINTERS]) || !structures || !libraries) {
+    r->error = "invalid header";
+    return false;
+  }
+
+  /* Nothing is changed until the libraries are loaded. */
+
+  if (!load_libraries(r, libraries)
+      || !resolve_subrs(r)
+      || !create_structures(r)
+      || !create_tables(r)
+      || !fill_objects(r)
+      || !fill_tables(r))
+  {
+    return false;
+  }
+
+  for (repv lst = decode(r, header[HEADER_PRINTERS]);
+       rep_CONSP(lst) && rep_CONSP(rep_CAR(lst)); lst = rep_CDR(lst))
+  {
+    Fdefine_datum_printer(rep_CAR(rep_CAR(lst)), rep_CDR(rep_CAR(lst)));
+  }
+
+  rep_structures_changed();
+  return true;
+}
+
+/* Restore the state saved in image FILE. Returns false, after printing
+   a message, if FILE can't be used. */
+
+bool
+rep_load_image(repv file)
+{
+  if (!rep_STRINGP(file)) {
+    return false;
+  }
+
+  const char *error = NULL;
+  void *data = NULL;
+  size_t size = 0;
+  bool mapped = false;
+
+  int fd = open(rep_STR(file), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    error = strerror(errno);
+  } else if ((size_t)st.st_size < HEADER_SIZE * sizeof(uint64_t)
+	     || st.st_size % sizeof(uint64_t) != 0) {
+    error = "not an image";
+  } else {
+    size = st.st_size;
+#ifdef HAVE_SYS_MMAN_H
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      data = NULL;
+    } else {
+      mapped = true;
+    }
+#endif
+    if (!data) {
+      data = rep_alloc(size);
+      if (!data || read(fd, data, size) != (ssize_t)size) {
+	rep_free(data);
+	data = NULL;
+	error = "can't read file";
+      }
+    }
+  }
+
+  if (fd >= 0) {
+    close(fd);
+  }
+
+  reader r;
+  memset(&r, 0, sizeof(r));
+
+  const uint64_t *header = data;
+
+  if (!error) {
+    r.words = header + HEADER_SIZE;
+    r.n_words = size / sizeof(uint64_t) - HEADER_SIZE;
+    r.n_objects = header[HEADER_OBJECTS];
+
+    if (memcmp(&header[HEADER_MAGIC], IMAGE_MAGIC, 8) != 0) {
+      error = "not an image";
+    } else if (header[HEADER_VERSION] != IMAGE_VERSION) {
+      error = "wrong version";
+    } else if (header[HEADER_WORDS] != r.n_words
+	       || r.n_objects > r.n_words) {
+      error = "truncated";
+    }
+  }
+
+  if (!error && index_records(&r)) {
+    r.objs = rep_alloc(MAX(r.n_objects, 1) * sizeof(repv));
+    if (!r.objs) {
+      r.error = "out of memory";
+    } else {
+      for (size_t i = 0; i < r.n_objects; i++) {
+	r.objs[i] = rep_nil;
+      }
+
+      rep_GC_n_roots gc_objs;
+      rep_PUSHGCN(gc_objs, r.objs, r.n_objects);
+
+      if (create_objects(&r)) {
+	restore(&r, header);
+      }
+
+      rep_POPGCN;
+    }
+  }
+
+  if (!error) {
+    error = r.error;
+  }
+
+  rep_free(r.offsets);
+  rep_free(r.objs);
+
+  if (mapped) {
+#ifdef HAVE_SYS_MMAN_H
+    munmap(data, size);
+#endif
+  } else {
+    rep_free(data);
+  }
+
+  if (error) {
+    rep_throw_value = 0;
+    fprintf(stderr, "rep: can't use image %s: %s\n", rep_STR(file), error);
+    return false;
+  }
+
+  return true;
+}
@@ -19,23 +19,447 @@
    the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
 
 #include "repint.h"
+#include "bytecodes.h"
 
 #include <assert.h>
+#include <string.h>
 
 /* Define this to check if the compiler gets things right. */
 
 #undef TRUST_NO_ONE
 
-/* Define this to record bytecode-use histograms. */
+DEFSYM(bytecode_error, "bytecode-error");
 
-#undef BYTECODE_PROFILE
+/* Bytecode profiler. While it's running each function entered by the
+   VM counts the instructions it executes at each offset of its code,
+   through its entry in this table. The opcodes executed, and the
+   pairs of opcodes executed consecutively, are also counted. */
 
-DEFSYM(bytecode_error, "bytecode-error");
+typedef struct profile_fn_struct profile_fn;
+
+struct profile_fn_struct {
+  profile_fn *next;
+  repv code;				/* weak key, byte-code string */
+  repv fun;				/* weak, a closure running CODE */
+  uintptr_t total;
+  uintptr_t counts[1];			/* per byte of CODE */
+};
+
+#define PROFILE_HASH(v) (((v) >> 3) & profile_mask)
+
+static bool profiling;
+static uintptr_t profile_ops[256];
+static uintptr_t *profile_pairs;
+static profile_fn **profile_buckets;
+static unsigned int profile_mask, profile_count;
+
+static bool
+grow_profile(void)
+{
+  unsigned int total = profile_buckets ? (profile_mask + 1) * 2 : 256;
+  profile_fn **buckets = rep_alloc(total * sizeof(profile_fn *));
+  if (!buckets) {
+    return false;
+  }
+  memset(buckets, 0, total * sizeof(profile_fn *));
+
+  unsigned int old_total = profile_buckets ? profile_mask + 1 : 0;
+  profile_mask = total - 1;
+
+  for (unsigned int i = 0; i < old_total; i++) {
+    profile_fn *next;
+    for (profile_fn *f = profile_buckets[i]; f; f = next) {
+      next = f->next;
+      f->next = buckets[PROFILE_HASH(f->code)];
+      buckets[PROFILE_HASH(f->code)] = f;
+    }
+  }
+
+  rep_free(profile_buckets);
+  profile_buckets = buckets;
+  return true;
+}
+
+/* Return the profile entry of byte-code string CODE, which is about to
+   be run by the current call frame, or a null pointer if there's no
+   memory for one. */
+
+static profile_fn *
+profile_function(repv code)
+{
+  repv fun = rep_call_stack ? rep_call_stack->fun : rep_nil;
+  if (!rep_CLOSUREP(fun) || !rep_BYTECODEP(rep_CLOSURE(fun)->fun)
+      || rep_BYTECODE_CODE(rep_CLOSURE(fun)->fun) != code)
+  {
+    fun = 0;
+  }
+
+  if (profile_buckets) {
+    for (profile_fn *f = profile_buckets[PROFILE_HASH(code)]; f; f = f->next) {
+      if (f->code == code) {
+	if (!f->fun) {
+	  f->fun = fun;
+	}
+	return f;
+      }
+    }
+  }
+
+  if ((!profile_buckets || profile_count > profile_mask * 2)
+      && !grow_profile())
+  {
+    return NULL;
+  }
+
+  size_t len = MAX(rep_STRING_LEN(code), 1);
+  size_t size = sizeof(profile_fn) + (len - 1) * sizeof(uintptr_t);
+  profile_fn *f = rep_alloc(size);
+  if (!f) {
+    return NULL;
+  }
+  memset(f, 0, size);
+
+  f->code = code;
+  f->fun = fun;
+  f->next = profile_buckets[PROFILE_HASH(code)];
+  profile_buckets[PROFILE_HASH(code)] = f;
+  profile_count++;
+
+  return f;
+}
+
+/* Count the instruction at offset PC of the code of function F. PREV
+   is the opcode executed before it in the same frame, or -1. */
+
+static inline void
+profile_insn(profile_fn *f, const uint8_t *pc_base, const uint8_t *pc,
+	     int *prev)
+{
+  int op = *pc;
+
+  profile_ops[op]++;
+  if (*prev >= 0 && profile_pairs) {
+    profile_pairs[(*prev << 8) | op]++;
+  }
+  *prev = op;
+
+  f->total++;
+  f->counts[pc - pc_base]++;
+}
+
+/* Called by the garbage collector after marking, forgets the functions
+   whose code wasn't. */
+
+void
+rep_scan_bytecode_profile(void)
+{
+  if (profile_count == 0) {
+    return;
+  }
+
+  for (unsigned int i = 0; i <= profile_mask; i++) {
+    profile_fn **ptr = &profile_buckets[i];
+    profile_fn *f;
+    while ((f = *ptr)) {
+      if (rep_GC_LIVEP(f->code)) {
+	if (f->fun && !rep_GC_LIVEP(f->fun)) {
+	  f->fun = 0;
+	}
+	ptr = &f->next;
+      } else {
+	*ptr = f->next;
+	rep_free(f);
+	profile_count--;
+      }
+    }
+  }
+}
 
-#ifdef BYTECODE_PROFILE
-static int bytecode_profile[256];
+/* Direct-threaded code (only with GNU CC, when configured with
+   --enable-direct-threaded). Once a byte-code string has been run
+   about DT_THRESHOLD times (by frames that weren't being profiled)
+   it's translated to an array of cells, one per byte of the code, and
+   the threaded VM runs that instead. The cell of each opcode holds the
+   address of its handler and any argument embedded in the opcode, the
+   cell following it the decoded value of any other operand (see
+   lispmach.h). Since the cells parallel the bytes, offsets into the
+   code, such as the addresses of exception handlers, mean the same in
+   both. */
+
+#if defined(__GNUC__) && defined(ENABLE_DIRECT_THREADED)
+# define DIRECT_THREADED_VM 1
 #endif
 
+#ifdef DIRECT_THREADED_VM
+
+typedef struct dt_cell_struct dt_cell;
+
+struct dt_cell_struct {
+  void *insn;
+  intptr_t arg;
+};
+
+typedef struct dt_code_struct dt_code;
+
+struct dt_code_struct {
+  dt_code *next;
+  repv code;				/* weak key, byte-code string */
+  repv consts;				/* weak, the constants of CELLS */
+  dt_cell *cells;			/* null if not translatable */
+};
+
+#define DT_THRESHOLD 64
+
+#define DT_HASH(v) (((v) >> 3) & dt_mask)
+
+/* Calls of code not yet in the table are only counted, in a slot
+   shared by all strings hashing to it, so that running cold code
+   needs neither a table lookup nor an allocation. */
+
+#define DT_CALLS_SIZE 1024
+
+static uint8_t dt_calls[DT_CALLS_SIZE];
+
+static dt_code **dt_buckets;
+static unsigned int dt_mask, dt_count;
+
+static bool
+grow_direct_threaded(void)
+{
+  unsigned int total = dt_buckets ? (dt_mask + 1) * 2 : 256;
+  dt_code **buckets = rep_alloc(total * sizeof(dt_code *));
+  if (!buckets) {
+    return false;
+  }
+  memset(buckets, 0, total * sizeof(dt_code *));
+
+  unsigned int old_total = dt_buckets ? dt_mask + 1 : 0;
+  dt_mask = total - 1;
+
+  for (unsigned int i = 0; i < old_total; i++) {
+    dt_code *next;
+    for (dt_code *d = dt_buckets[i]; d; d = next) {
+      next = d->next;
+      d->next = buckets[DT_HASH(d->code)];
+      buckets[DT_HASH(d->code)] = d;
+    }
+  }
+
+  rep_free(dt_buckets);
+  dt_buckets = buckets;
+  return true;
+}
+
+/* The number of operand bytes following opcode OP. */
+
+static int
+operand_bytes(int op)
+{
+  if (op <= OP_LAST_WITH_ARGS) {
+    switch (op & OP_ARG_MASK) {
+    case OP_ARG_1BYTE:
+      return 1;
+    case OP_ARG_2BYTE:
+      return 2;
+    default:
+      return 0;
+    }
+  }
+
+  switch (op) {
+  case OP_PUSHI:
+  case OP_REG_REF_CAR:
+  case OP_REG_REF_CDR:
+  case OP_DUP_REG_SET:
+  case OP_REQUIRED_ARG_REG_SET:
+    return 1;
+
+  case OP_PUSHIWN:
+  case OP_PUSHIWP:
+  case OP_EQ_JN:
+    return 2;
+
+  case OP_REG_REF_JN:
+  case OP_REG_REF_JT:
+    return 3;
+
+  default:
+    return op > OP_LAST_BEFORE_JMPS ? 2 : 0;
+  }
+}
+
+/* Translate byte-code string CODE using constants CONSTS, HANDLERS
+   being the direct-threaded handler of each opcode and UNKNOWN that of
+   unknown opcodes. Bytes that aren't opcodes get UNKNOWN, as does the
+   cell after the last. Returns a null pointer if there's no memory,
+   or CODE refers outside itself or CONSTS. */
+
+static dt_cell *
+translate_code(repv code, repv consts, void **handlers, void *unknown)
+{
+  const uint8_t *bytes = (const uint8_t *)rep_STR(code);
+  size_t len = rep_STRING_LEN(code);
+
+  dt_cell *cells = rep_alloc((len + 1) * sizeof(dt_cell));
+  if (!cells) {
+    return NULL;
+  }
+  for (size_t i = 0; i <= len; i++) {
+    cells[i].insn = unknown;
+    cells[i].arg = 0;
+  }
+
+  size_t i = 0;
+  while (i < len) {
+    int op = bytes[i];
+    size_t n = operand_bytes(op);
+    if (i + n >= len) {
+      goto fail;
+    }
+
+    cells[i].insn = handlers[op];
+
+    if (op <= OP_LAST_WITH_ARGS) {
+      dt_cell *cell = &cells[i];
+      intptr_t arg = op & OP_ARG_MASK;
+      if (n != 0) {
+	cell = &cells[i + 1];
+	arg = n == 1 ? bytes[i + 1] : (bytes[i + 1] << ARG_SHIFT) | bytes[i + 2];
+      }
+      if ((op & OP_OP_MASK) == OP_PUSH) {
+	if (arg >= rep_VECTOR_LEN(consts)) {
+	  goto fail;
+	}
+	arg = (intptr_t)rep_VECTI(consts, arg);
+      }
+      cell->arg = arg;
+    } else {
+      size_t addr = 0;
+      switch (op) {
+      case OP_REG_REF_JN:
+      case OP_REG_REF_JT:
+	cells[i + 1].arg = bytes[i + 1];
+	addr = i + 2;
+	break;
+
+      case OP_EQ_JN:
+	addr = i + 1;
+	break;
+
+      default:
+	if (op > OP_LAST_BEFORE_JMPS) {
+	  addr = i + 1;
+	} else if (n == 1) {
+	  cells[i + 1].arg = bytes[i + 1];
+	} else if (n == 2) {
+	  cells[i + 1].arg = (bytes[i + 1] << ARG_SHIFT) | bytes[i + 2];
+	}
+      }
+
+      if (addr != 0) {
+	size_t target = (bytes[addr] << ARG_SHIFT) | bytes[addr + 1];
+	if (target >= len) {
+	  goto fail;
+	}
+	cells[addr].arg = (intptr_t)&cells[target];
+      }
+    }
+
+    i += 1 + n;
+  }
+
+  return cells;
+
+fail:
+  rep_free(cells);
+  return NULL;
+}
+
+/* Return the direct-threaded translation of CODE, with constants
+   CONSTS, which is about to be run by an unprofiled frame, or a null
+   pointer if it should be run as byte-code. HANDLERS and UNKNOWN are
+   passed to translate_code(). */
+
+static inline const dt_cell *
+direct_threaded_code(repv code, repv consts, void **handlers, void *unknown)
+{
+  uint8_t *calls = &dt_calls[(code >> 3) & (DT_CALLS_SIZE - 1)];
+  dt_code *d = NULL;
+
+  if (*calls < DT_THRESHOLD) {
+    (*calls)++;
+    return NULL;
+  }
+
+  if (dt_buckets) {
+    for (d = dt_buckets[DT_HASH(code)]; d; d = d->next) {
+      if (d->code == code) {
+	break;
+      }
+    }
+  }
+
+  if (!d) {
+    if (!rep_VECTORP(consts)
+	|| ((!dt_buckets || dt_count > dt_mask * 2)
+	    && !grow_direct_threaded()))
+    {
+      return NULL;
+    }
+
+    d = rep_alloc(sizeof(dt_code));
+    if (!d) {
+      return NULL;
+    }
+
+    /* Only attempt the translation once. */
+
+    d->code = code;
+    d->consts = consts;
+    d->cells = translate_code(code, consts, handlers, unknown);
+    d->next = dt_buckets[DT_HASH(code)];
+    dt_buckets[DT_HASH(code)] = d;
+    dt_count++;
+  }
+
+  return d->consts == consts ? d->cells : NULL;
+}
+
+/* Called by the garbage collector after marking, frees the
+   translations of code or constants that weren't. */
+
+void
+rep_scan_direct_threaded_code(void)
+{
+  if (dt_count == 0) {
+    return;
+  }
+
+  for (unsigned int i = 0; i <= dt_mask; i++) {
+    dt_code **ptr = &dt_buckets[i];
+    dt_code *d;
+    while ((d = *ptr)) {
+      if (rep_GC_LIVEP(d->code) && rep_GC_LIVEP(d->consts)) {
+	ptr = &d->next;
+      } else {
+	*ptr = d->next;
+	rep_free(d->cells);
+	rep_free(d);
+	dt_count--;
+      }
+    }
+  }
+}
+
+#else /* DIRECT_THREADED_VM */
+
+void
+rep_scan_direct_threaded_code(void)
+{
+}
+
+#endif /* !DIRECT_THREADED_VM */
+
 #ifdef TRUST_NO_ONE
 # define ASSERT(x) assert(x)
 #else
@@ -178,29 +602,151 @@ Returns t if ARG is a byte code subroutine(i.e. compiled Lisp code).
   return rep_BYTECODEP(arg) ? Qt : rep_nil;
 }
 
-#ifdef BYTECODE_PROFILE
+DEFUN("start-bytecode-profiler", Fstart_bytecode_profiler,
+      Sstart_bytecode_profiler, (void), rep_Subr0) /*
+::doc:rep.vm.interpreter#start-bytecode-profiler::
+start-bytecode-profiler
 
-static void
-print_bytecode_profile(void)
+Discard any existing bytecode profile, then start counting the
+instructions executed by compiled functions called from now on.
+::end:: */
 {
-  for (int i = 0; i < 256; i++) {
-    printf("%8d %8d\n", i, bytecode_profile[i]);
+  if (!profile_pairs) {
+    profile_pairs = rep_alloc(256 * 256 * sizeof(uintptr_t));
+    if (!profile_pairs) {
+      return rep_mem_error();
+    }
   }
+
+  memset(profile_ops, 0, sizeof(profile_ops));
+  memset(profile_pairs, 0, 256 * 256 * sizeof(uintptr_t));
+
+  /* Functions that were being profiled may still be running, so
+     their entries are reset, not freed. */
+
+  if (profile_buckets) {
+    for (unsigned int i = 0; i <= profile_mask; i++) {
+      for (profile_fn *f = profile_buckets[i]; f; f = f->next) {
+	memset(f->counts, 0, MAX(rep_STRING_LEN(f->code), 1)
+	       * sizeof(uintptr_t));
+	f->total = 0;
+      }
+    }
+  }
+
+  profiling = true;
+  return Qt;
+}
+
+DEFUN("stop-bytecode-profiler", Fstop_bytecode_profiler,
+      Sstop_bytecode_profiler, (void), rep_Subr0) /*
+::doc:rep.vm.interpreter#stop-bytecode-profiler::
+stop-bytecode-profiler
+
+Stop counting the instructions executed by compiled functions. The
+profile collected so far is kept.
+::end:: */
+{
+  profiling = false;
+  return Qt;
 }
 
-DEFUN("bytecode-profile", Fbytecode_profile,
-       Sbytecode_profile, (repv reset), rep_Subr1)
+DEFUN("fetch-bytecode-profile", Ffetch_bytecode_profile,
+      Sfetch_bytecode_profile, (void), rep_Subr0) /*
+::doc:rep.vm.interpreter#fetch-bytecode-profile::
+fetch-bytecode-profile
+
+Return the profile recorded since the bytecode profiler was last
+started, as a list `(OPCODES PAIRS FUNCTIONS)'.
+
+OPCODES is a vector of 256 elements, the number of times each opcode
+was executed. PAIRS is an alist `((FIRST . SECOND) . COUNT)', the
+number of times opcode SECOND was executed directly after FIRST in the
+same function. FUNCTIONS has an element `(FUNCTION TOTAL COUNTS)' for
+each function that executed instructions: FUNCTION is a closure, or
+nil if the code wasn't called as one, TOTAL is the number of
+instructions executed, and COUNTS is a vector containing the number of
+times the instruction at each offset of the function's code was
+executed.
+::end:: */
 {
-  if (reset != rep_nil) {
-    memset(bytecode_profile, 0, sizeof(bytecode_profile));
-  } else {
-    print_bytecode_profile();
+  repv ops = rep_nil, pairs = rep_nil, funs = rep_nil;
+  rep_GC_root gc_ops, gc_pairs, gc_funs;
+  rep_PUSHGC(gc_ops, ops);
+  rep_PUSHGC(gc_pairs, pairs);
+  rep_PUSHGC(gc_funs, funs);
+
+  repv ret = 0;
+
+  ops = Fmake_vector(rep_MAKE_INT(256), rep_MAKE_INT(0));
+  if (!ops) {
+    goto out;
+  }
+  for (int i = 0; i < 256; i++) {
+    rep_VECTI(ops, i) = rep_make_long_uint(profile_ops[i]);
   }
 
-  return rep_nil;
-}
+  if (profile_pairs) {
+    for (int i = 256 * 256 - 1; i >= 0; i--) {
+      if (profile_pairs[i] != 0) {
+	pairs = Fcons(Fcons(Fcons(rep_MAKE_INT(i >> 8),
+				  rep_MAKE_INT(i & 255)),
+			    rep_make_long_uint(profile_pairs[i])), pairs);
+      }
+    }
+  }
 
-#endif /* BYTECODE_PROFILE */
+  /* Allocating may collect garbage, freeing entries, so only the
+     entries of code that's been protected are used. */
+
+  repv codes = rep_nil;
+  rep_GC_root gc_codes;
+  rep_PUSHGC(gc_codes, codes);
+
+  if (profile_buckets) {
+    for (unsigned int i = 0; i <= profile_mask; i++) {
+      for (profile_fn *f = profile_buckets[i]; f; f = f->next) {
+	if (f->total != 0) {
+	  codes = Fcons(f->code, codes);
+	}
+      }
+    }
+  }
+
+  for (; rep_CONSP(codes); codes = rep_CDR(codes)) {
+    repv code = rep_CAR(codes);
+    profile_fn *f;
+    for (f = profile_buckets[PROFILE_HASH(code)]; f; f = f->next) {
+      if (f->code == code) {
+	break;
+      }
+    }
+    if (!f) {
+      continue;
+    }
+    size_t len = rep_STRING_LEN(code);
+    repv counts = Fmake_vector(rep_MAKE_INT(len), rep_MAKE_INT(0));
+    if (!counts) {
+      rep_POPGC;
+      goto out;
+    }
+    for (size_t j = 0; j < len; j++) {
+      if (f->counts[j] != 0) {
+	rep_VECTI(counts, j) = rep_make_long_uint(f->counts[j]);
+      }
+    }
+    funs = Fcons(rep_list_3(f->fun ? f->fun : rep_nil,
+			    rep_make_long_uint(f->total), counts), funs);
+  }
+
+  rep_POPGC;
+
+  ret = rep_list_3(ops, pairs, funs);
+
+out:
+  rep_POPGC; rep_POPGC; rep_POPGC;
+  return ret;
+}
 
 void
 rep_lispmach_init(void)
@@ -210,10 +756,9 @@ rep_lispmach_init(void)
   rep_ADD_SUBR(Svalidate_byte_code);
   rep_ADD_SUBR(Smake_byte_code_subr);
   rep_ADD_SUBR(Sbytecodep);
-#ifdef BYTECODE_PROFILE
-  rep_ADD_SUBR(Sbytecode_profile);
-  atexit(print_bytecode_profile);
-#endif
+  rep_ADD_SUBR(Sstart_bytecode_profiler);
+  rep_ADD_SUBR(Sstop_bytecode_profiler);
+  rep_ADD_SUBR(Sfetch_bytecode_profile);
   rep_INTERN(bytecode_error);
   rep_DEFINE_ERROR(bytecode_error);
   rep_pop_structure(tem);
@@ -21,8 +21,8 @@
 /* free macros:
 
 	ASSERT(expr)
-	BYTECODE_PROFILE
 	THREADED_VM
+	DIRECT_THREADED_VM
 	BC_APPLY_SELF
 
    defined functions:
@@ -121,26 +121,64 @@ unbind_n(repv *ptr, int n)
 #define CHECK_NEXT	 					\
   do {								\
     ASSERT(STACK_USAGE <= stack_size);				\
-    ASSERT(((char *)pc - pc_base) < rep_STRING_LEN(code));	\
+    ASSERT((pc - pc_base) < CELLS(rep_STRING_LEN(code)));	\
   } while (0)
 
-#ifdef BYTECODE_PROFILE
-# define PROFILE_NEXT do {bytecode_profile[*pc]++;} while (0)
-#else
-# define PROFILE_NEXT
-#endif
-
 #define SAFE_NEXT__	\
   do {			\
     CHECK_NEXT;		\
-    PROFILE_NEXT;	\
     X_SAFE_NEXT;	\
   } while (0)
 
 #define SAFE_NEXT SAFE_NEXT__
 
-#define FETCH		(*pc++)
-#define FETCH2(var)	((var) = (FETCH << ARG_SHIFT), (var) += FETCH)
+/* The instructions are expanded once for each representation of the
+   code they can run, VM_MODE is the prefix of the macros accessing the
+   current representation. BC is the byte-code string itself, DT (only
+   with DIRECT_THREADED_VM) its direct-threaded translation, an array
+   of cells parallel to the string, see direct_threaded_code(). In both
+   PC points to the next byte of the representation. Since a macro can't
+   expand to itself, the definitions of these macros mustn't use each
+   other. */
+
+#define CELLS(n)		rep_CONCAT(VM_MODE, _CELLS)(n)
+#define FETCH			rep_CONCAT(VM_MODE, _FETCH)
+#define FETCH2(var)		rep_CONCAT(VM_MODE, _FETCH2)(var)
+#define CONSTANT(n)		rep_CONCAT(VM_MODE, _CONSTANT)(n)
+#define JMP_TARGET		rep_CONCAT(VM_MODE, _JMP_TARGET)
+#define NEXT_INSN_IS_RETURN	rep_CONCAT(VM_MODE, _NEXT_INSN_IS_RETURN)
+#define LAST_OPCODE		rep_CONCAT(VM_MODE, _LAST_OPCODE)
+
+/* The name of label NAME in the current expansion. */
+
+#define LABEL(name)		VM_LABEL(VM_MODE, _, name)
+#define VM_LABEL(a, b, c)	VM_LABEL__(a, b, c)
+#define VM_LABEL__(a, b, c)	a ## b ## c
+
+#define BC_CELLS(n)		(n)
+#define BC_FETCH		(*pc++)
+#define BC_FETCH2(var)		((var) = (*pc++ << ARG_SHIFT), (var) += *pc++)
+#define BC_CONSTANT(n)		rep_VECT(consts)->array[n]
+#define BC_JMP_TARGET		(pc_base + ((pc[0] << ARG_SHIFT) | pc[1]))
+#define BC_NEXT_INSN_IS_RETURN	(*pc == OP_RETURN)
+#define BC_LAST_OPCODE		pc[-1]
+
+/* The inline cache for constant number N. */
+
+#define REF_CACHE(n)						\
+  ((refs || (refs = rep_ref_caches(consts))) ? refs + (n) : &scratch_ref)
+
+/* Count the instruction at PC if the bytecode profiler is running,
+   otherwise stop profiling this frame. */
+
+#define PROFILE_INSN(pc)				\
+  do {							\
+    if (profiling) {					\
+      profile_insn(prof, pc_base, pc, &prev_op);	\
+    } else {						\
+      STOP_PROFILE;					\
+    }							\
+  } while (0)
 
 #define SYNC_GC				\
   do {					\
@@ -183,7 +221,13 @@ unbind_n(repv *ptr, int n)
 /* Non-threaded interpretation, just use a big switch statement in
    a while loop. */
 
-# define BEGIN_DISPATCH fetch: switch (FETCH) {
+# define BEGIN_DISPATCH			\
+  fetch:					\
+    if (prof) {					\
+      PROFILE_INSN(pc);				\
+    }						\
+    switch (FETCH) {
+# define STOP_PROFILE	prof = NULL
 # define END_DISPATCH }
 
 /* Output the case statement for an instruction OP, with an embedded
@@ -205,9 +249,9 @@ unbind_n(repv *ptr, int n)
 
 # define X_SAFE_NEXT	goto fetch
 # define INLINE_NEXT	if (!ERROR_OCCURRED_P) SAFE_NEXT; else HANDLE_ERROR
-# define NEXT		goto check_error
+# define NEXT		goto LABEL(check_error)
 # define RETURN		goto quit
-# define HANDLE_ERROR	goto error
+# define HANDLE_ERROR	goto LABEL(error)
 
 #else /* !THREADED_VM */
 
@@ -222,16 +266,55 @@ unbind_n(repv *ptr, int n)
      url =          "http://www.complang.tuwien.ac.at/papers/ertl93.ps.Z",
    }
 
-   the intitial implementation by Ceri Storey, completed by John Harper. */
+   the intitial implementation by Ceri Storey, completed by John Harper.
+
+   With DIRECT_THREADED_VM, functions that are run often are translated
+   to direct-threaded code, each opcode replaced by the address of its
+   handler, which is run by a second expansion of the instructions. */
+
+# define BEGIN_DISPATCH	SAFE_NEXT; { PROFILE_HANDLER
+# define PROFILE_HANDLER rep_CONCAT(VM_MODE, _PROFILE_HANDLER)
+# define X_SAFE_NEXT	rep_CONCAT(VM_MODE, _X_SAFE_NEXT)
+# define EMBEDDED_ARG(op) rep_CONCAT(VM_MODE, _EMBEDDED_ARG)(op)
+
+/* While a frame is being profiled every opcode is dispatched through
+   PROFILE_CFA, to a handler that counts the instruction, then jumps to
+   its real handler. Profiled frames always run the byte-code. */
 
-# define BEGIN_DISPATCH SAFE_NEXT; {
+# define BC_PROFILE_HANDLER			\
+  LABEL(insn_profile):				\
+    PROFILE_INSN(pc - 1);			\
+    goto *cfa__[pc[-1]];
+# define BC_X_SAFE_NEXT	goto *cfa[*pc++]
+# define BC_EMBEDDED_ARG(op) (pc[-1] - op)
+
+/* In direct-threaded code an operand that isn't embedded in its opcode
+   is decoded into the cell following the opcode's, for a PUSH the
+   constant itself, for a jump the address of its target's cell. */
+
+# define DT_PC			((const dt_cell *)pc)
+
+# define DT_PROFILE_HANDLER
+# define DT_X_SAFE_NEXT	goto *(pc += sizeof(dt_cell), DT_PC[-1].insn)
+# define DT_EMBEDDED_ARG(op) (DT_PC[-1].arg)
+
+# define DT_CELLS(n)		((n) * sizeof(dt_cell))
+# define DT_FETCH		(pc += sizeof(dt_cell), DT_PC[-1].arg)
+# define DT_FETCH2(var)		((var) = DT_PC->arg, pc += 2 * sizeof(dt_cell))
+# define DT_CONSTANT(n)		((repv) (n))
+# define DT_JMP_TARGET		((const uint8_t *)DT_PC->arg)
+# define DT_NEXT_INSN_IS_RETURN	(DT_PC->insn == &&TAG(OP_RETURN))
+# define DT_LAST_OPCODE						\
+  (((const uint8_t *)rep_STR(code))[(pc - pc_base) / sizeof(dt_cell) - 1])
+
+# define STOP_PROFILE	(prof = NULL, cfa = cfa__)
 # define END_DISPATCH }
 
-# define TAG(op)	rep_CONCAT(insn_, op)
-# define TAG0(op)	rep_CONCAT(insn_0_, op)
-# define TAG1(op)	rep_CONCAT(insn_1_, op)
-# define TAG2(op)	rep_CONCAT(insn_2_, op)
-# define TAG_DEFAULT	insn_default
+# define TAG(op)	VM_LABEL(VM_MODE, _insn_, op)
+# define TAG0(op)	VM_LABEL(VM_MODE, _insn_0_, op)
+# define TAG1(op)	VM_LABEL(VM_MODE, _insn_1_, op)
+# define TAG2(op)	VM_LABEL(VM_MODE, _insn_2_, op)
+# define TAG_DEFAULT	LABEL(insn_default)
 
 # define INSN(op) TAG(op):
 # define DEFAULT_INSN TAG_DEFAULT:
@@ -242,14 +325,13 @@ unbind_n(repv *ptr, int n)
   TAG1(op):				\
     arg = FETCH; goto TAG(op);		\
   TAG0(op):				\
-    arg = pc[-1] - op;			\
+    arg = EMBEDDED_ARG(op);		\
     INSN(op)
 
-# define X_SAFE_NEXT	goto *cfa[FETCH]
 # define INLINE_NEXT	if (!ERROR_OCCURRED_P) SAFE_NEXT; else HANDLE_ERROR
-# define NEXT		goto check_error
+# define NEXT		goto LABEL(check_error)
 # define RETURN		goto quit
-# define HANDLE_ERROR	goto error
+# define HANDLE_ERROR	goto LABEL(error)
 
 # define JUMP_TABLE							\
   /* 0x00 */								\
@@ -341,9 +423,10 @@ unbind_n(repv *ptr, int n)
   /* 0xd0 */								\
   &&TAG(OP_VECTOR_REF), &&TAG(OP_VECTOR_SET), &&TAG(OP_STRING_LENGTH),	\
   &&TAG(OP_STRING_REF), &&TAG(OP_STRING_SET), &&TAG(OP_UNDEFINED),	\
-  &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT,		\
-  &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT,		\
-  &&TAG_DEFAULT, &&TAG_DEFAULT,						\
+  &&TAG(OP_REG_REF_CAR), &&TAG(OP_REG_REF_CDR), &&TAG(OP_DUP_REG_SET),	\
+  &&TAG(OP_REQUIRED_ARG_REG_SET), &&TAG(OP_REG_REF_JN),			\
+  &&TAG(OP_REG_REF_JT), &&TAG(OP_EQ_JN), &&TAG_DEFAULT, &&TAG_DEFAULT,	\
+  &&TAG_DEFAULT,							\
   /* 0xe0 */								\
   &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT,		\
   &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT, &&TAG_DEFAULT,		\
@@ -566,1563 +649,68 @@ again: {
 
   /* Initialize the various virtual registers. */
 
-  const uint8_t *pc_base = (const uint8_t *)rep_STR(code);
-  const uint8_t *pc = pc_base;
-
   repv *sp = stack;
   repv *bp = bindings;
   repv *rp = registers;
 
-  /* Start of the VM fetch-execute sequence. */
-  {
-#ifdef THREADED_VM
-    static void *cfa__[256] = { JUMP_TABLE };
-    void **cfa = cfa__;
-#endif
-
-    /* Shared argument register for INSN_WITH_ARG(). */
-
-    int arg;
-
-    BEGIN_DISPATCH
-
-    INSN_WITH_ARG(OP_CALL) {
-
-      /* Args are still available above the top of the stack, this just
-         makes things a bit easier. */
-
-      POPN(arg);
-      repv fun = TOP;
-
-      rep_stack_frame lc;
-      lc.fun = fun;
-      lc.args = rep_void;
-      rep_PUSH_CALL(lc);
-
-      SYNC_GC;
-
-      bool was_closed = rep_CLOSUREP(fun);
-      if (was_closed) {
-	rep_USE_CLOSURE(fun);
-	fun = rep_CLOSURE(fun)->fun;
-      }
-
-      if (rep_CELLP(fun) && !rep_CELL_CONS_P(fun)) {
-	if (rep_CELL8_TYPE(fun) == rep_Subr) {
-	  TOP = call_subr(fun, arg, sp + 1);
-	} else if (was_closed && rep_CELL8_TYPE(fun) == rep_Bytecode) {
-	  repv (*bc_apply) (repv, int, repv *) =
-	    rep_STRUCTURE(rep_structure)->apply_bytecode;
-
-	  if (bc_apply == BC_APPLY_SELF) {
-	    if (impurity != 0 || *pc != OP_RETURN) {
-
-	      /* Not a tail-call we can eliminate. */
-
-	      TOP = inline_apply_bytecode(fun, arg, sp+1);
-
-	    } else {
-
-	      /* Tail-calling in place. */
-
-	      rep_call_stack = lc.next;
-	      rep_call_stack->fun = lc.fun;
-	      rep_call_stack->args = lc.args;
-
-	      /* Arguments for the function call */
-
-	      argv = sp + 1;
-	      argc = arg;
-
-	      /* Switch old argv and stack, or reallocate? */
-
-	      int n_stack_size = rep_INT(rep_BYTECODE_STACK(fun)) & 0x3ff;
-	      if (argv_size >= n_stack_size) {
-		/* argv is big enough to be new stack */
-		repv *tem_stack = stack;
-		int tem_size = stack_size;
-		stack = argv_base;
-		stack_size = argv_size;
-		argv_base = tem_stack;
-		argv_size = tem_size;
-	      } else {
-		argv_base = stack;
-		argv_size = stack_size;
-		stack = alloca(sizeof(repv) * (n_stack_size + 1));
-		stack_size = n_stack_size;
-	      }
-
-	      code = fun;
-
-	      /* Also called from F_APPLY. Inputs: code = bytecode-subr. */
-
-	    do_tail_recursion:;
-
-	      /* Allocate new bind-stack? */
-
-	      int n_bindings_size
-	        = (rep_INT(rep_BYTECODE_STACK(code)) >> 10) & 0x3ff;
-	      if (bindings_size < n_bindings_size) {
-		bindings = alloca(sizeof(repv) * (n_bindings_size + 1));
-		bindings_size = n_bindings_size;
-	      }
-
-	      /* Allocate new registers? */
-
-	      int n_registers_size = rep_INT(rep_BYTECODE_STACK(code)) >> 20;
-	      if (registers_size < n_registers_size) {
-		registers = alloca(sizeof(repv) * n_registers_size);
-		registers_size = n_registers_size;
-		for (int i = 0; i < registers_size; i++) {
-		  registers[i] = 0;
-		}
-	      }
-
-	      consts = rep_BYTECODE_CONSTANTS(code);
-	      code = rep_BYTECODE_CODE(code);
-
-	      gc_bindings.first = bindings;
-	      gc_stack.first = stack + 1;
-	      gc_registers.first = registers;
-	      gc_registers.count = registers_size;
-	      gc_argv.first = argv;
-	      gc_argv.count = argc;
-
-	      goto again;
-	    }
-	  } else {
-	    TOP = bc_apply(fun, arg, sp+1);
-	  }
-	} else {
-	  TOP = rep_value_type(fun)->apply(fun, argc, argv);
-	}
-	rep_POP_CALL(lc);
-	INLINE_NEXT;
-      } else {				/* not cell8 type */
-	POPN(-arg);
-	repv lst = rep_nil;
-	while (arg-- > 0) {
-	  repv x = POP;
-	  lst = Fcons(x, lst);
-	}
-	rep_POP_CALL(lc);
-	TOP = rep_apply(TOP, lst);
-	NEXT;
-      }
-    }
-
-    INSN_WITH_ARG(OP_PUSH) {
-      ASSERT(arg < rep_VECTOR_LEN(consts));
-      PUSH(rep_VECT(consts)->array[arg]);
-      SAFE_NEXT;
-    }
-
-    INSN(OP_BIND) {
-      repv value = POP;
-      rep_env = Fcons(value, rep_env);
-      BIND_TOP = rep_MARK_LEX_BINDING(BIND_TOP);
-      SAFE_NEXT;
-    }
-
-    INSN(OP_SPEC_BIND) {
-      repv sym = POP;
-      repv value = POP;
-      impurity++;
-      BIND_TOP = rep_bind_special(BIND_TOP, sym, value);
-      if (rep_throw_value) {
-	HANDLE_ERROR;
-      }
-      NEXT;
-    }
-
-    INSN(OP_ENV_REF_0) {
-      ASSERT(rep_list_length(rep_env) > 0);
-      PUSH(rep_CAR(rep_env));
-      SAFE_NEXT;
-    }
-
-    INSN(OP_ENV_REF_1) {
-      ASSERT(rep_list_length(rep_env) > 1);
-      PUSH(rep_CADR(rep_env));
-      SAFE_NEXT;
-    }
-
-    INSN(OP_ENV_REF_2) {
-      ASSERT(rep_list_length(rep_env) > 2);
-      PUSH(rep_CADDR(rep_env));
-      SAFE_NEXT;
-    }
-
-    INSN(OP_ENV_REF_3) {
-      ASSERT(rep_list_length(rep_env) > 3);
-      PUSH(rep_CADDDR(rep_env));
-      SAFE_NEXT;
-    }
-
-    INSN(OP_ENV_REF_4) {
-      ASSERT(rep_list_length(rep_env) > 4);
-      PUSH(rep_CAR(rep_CDDDDR(rep_env)));
-      SAFE_NEXT;
-    }
-
-    INSN(OP_ENV_REF_5) {
-      ASSERT(rep_list_length(rep_env) > 5);
-      PUSH(rep_CADR(rep_CDDDDR(rep_env)));
-      SAFE_NEXT;
-    }
-
-    INSN(OP_ENV_REF_6) {
-      arg = FETCH;
-      ASSERT(rep_list_length(rep_env) > arg);
-      PUSH(rep_CAR(list_tail(rep_env, arg)));
-      SAFE_NEXT;
-    }
-
-    INSN(OP_ENV_REF_7) {
-      FETCH2(arg);
-      ASSERT(rep_list_length(rep_env) > arg);
-      PUSH(rep_CAR(list_tail(rep_env, arg)));
-      SAFE_NEXT;
-    }
-
-    INSN_WITH_ARG(OP_ENV_SET) {
-      ASSERT(rep_list_length(rep_env) > arg);
-      repv value = POP;
-      rep_CAR(list_tail(rep_env, arg)) = value;
-      SAFE_NEXT;
-    }
-
-    /* This code expanded from Fstructure_ref() and lookup() in
-       structures.c */
-
-    INSN_WITH_ARG(OP_REFQ) {
-      ASSERT(arg < rep_VECTOR_LEN(consts));
-      repv var = rep_VECT(consts)->array[arg];
-      rep_struct *s = rep_STRUCTURE(rep_structure);
-      if (s->bucket_mask != 0) {
-	rep_struct_node *n;
-	for (n = s->buckets[rep_STRUCT_HASH(s, var)]; n; n = n->next) {
-	  if (n->symbol == var) {
-	    PUSH(n->binding);
-	    SAFE_NEXT;
-	  }
-	}
-      } else if (s->init) {
-	TOP = Fstructure_ref(rep_VAL(s), var);
-	NEXT;
-      }
-      rep_struct_node *n = rep_search_imports(s, var);
-      if (n) {
-	PUSH(n->binding);
-	SAFE_NEXT;
-      }
-      Fsignal(Qvoid_value, rep_LIST_1(var));
-      HANDLE_ERROR;
-    }
-
-    INSN_WITH_ARG(OP_SETQ) {
-      ASSERT(arg < rep_VECTOR_LEN(consts));
-      repv sym = rep_VECT(consts)->array[arg];
-      repv value = POP;
-      Fstructure_set(rep_structure, sym, value);
-      SAFE_NEXT;
-    }
-
-    INSN(OP_REG_REF_0) {
-      ASSERT(registers_size > 0);
-      PUSH(rp[0]);
-      ASSERT(TOP != 0);
-      SAFE_NEXT;
-    }
-
-    INSN(OP_REG_REF_1) {
-      ASSERT(registers_size > 1);
-      PUSH(rp[1]);
-      ASSERT(TOP != 0);
-      SAFE_NEXT;
-    }
-
-    INSN(OP_REG_REF_2) {
-      ASSERT(registers_size > 2);
-      PUSH(rp[2]);
-      ASSERT(TOP != 0);
-      SAFE_NEXT;
-    }
-
-    INSN(OP_REG_REF_3) {
-      ASSERT(registers_size > 3);
-      PUSH(rp[3]);
-      ASSERT(TOP != 0);
-      SAFE_NEXT;
-    }
-
-    INSN(OP_REG_REF_4) {
-      ASSERT(registers_size > 4);
-      PUSH(rp[4]);
-      ASSERT(TOP != 0);
-      SAFE_NEXT;
-    }
-
-    INSN(OP_REG_REF_5) {
-      ASSERT(registers_size > 5);
-      PUSH(rp[5]);
-      ASSERT(TOP != 0);
-      SAFE_NEXT;
-    }
-
-    INSN(OP_REG_REF_6) {
-      arg = FETCH;
-      ASSERT(registers_size > arg);
-      PUSH(rp[arg]);
-      ASSERT(TOP != 0);
-      SAFE_NEXT;
-    }
-
-    INSN(OP_REG_REF_7) {
-      FETCH2(arg);
-      ASSERT(registers_size > arg);
-      PUSH(rp[arg]);
-      ASSERT(TOP != 0);
-      SAFE_NEXT;
-    }
-
-    INSN(OP_REG_SET_0) {
-      ASSERT(registers_size > 0);
-      rp[0] = POP;
-      SAFE_NEXT;
-    }
-
-    INSN(OP_REG_SET_1) {
-      ASSERT(registers_size > 1);
-      rp[1] = POP;
-      SAFE_NEXT;
-    }
-
-    INSN(OP_REG_SET_2) {
-      ASSERT(registers_size > 2);
-      rp[2] = POP;
-      SAFE_NEXT;
-    }
-
-    INSN(OP_REG_SET_3) {
-      ASSERT(registers_size > 3);
-      rp[3] = POP;
-      SAFE_NEXT;
-    }
-
-    INSN(OP_REG_SET_4) {
-      ASSERT(registers_size > 4);
-      rp[4] = POP;
-      SAFE_NEXT;
-    }
-
-    INSN(OP_REG_SET_5) {
-      ASSERT(registers_size > 5);
-      rp[5] = POP;
-      SAFE_NEXT;
-    }
-
-    INSN(OP_REG_SET_6) {
-      arg = FETCH;
-      ASSERT(registers_size > arg);
-      rp[arg] = POP;
-      SAFE_NEXT;
-    }
-
-    INSN(OP_REG_SET_7) {
-      FETCH2(arg);
-      ASSERT(registers_size > arg);
-      rp[arg] = POP;
-      SAFE_NEXT;
-    }
-
-    INSN(OP_REF) {
-      TOP = Fsymbol_value(TOP, rep_nil);
-      NEXT;
-    }
-
-    INSN(OP__SET) {
-      repv sym = POP;
-      repv value = POP;
-      Freal_set(sym, value);
-      NEXT;
-    }
-
-    INSN(OP_FLUID_REF) {
-      repv cell = rep_search_special_environment(TOP);
-      if (cell != rep_nil) {
-	TOP = rep_CDR(cell);
-	SAFE_NEXT;
-      } else if (rep_CONSP(TOP)) {
-	TOP = rep_CDR(TOP);
-	SAFE_NEXT;
-      }
-      Fsignal(Qvoid_value, rep_LIST_1(TOP));
-      HANDLE_ERROR;
-    }
-
-    INSN(OP_ENCLOSE) {
-      TOP = Fmake_closure(TOP, rep_nil);
-      INLINE_NEXT;
-    }
-
-    INSN(OP_PUSH_FRAME) {
-      ASSERT(BIND_USAGE < bindings_size + 1);
-      BIND_PUSH(rep_EMPTY_BINDING_FRAME);
-      SAFE_NEXT;
-    }
-
-    INSN(OP_POP_FRAME) {
-      ASSERT(bp > bindings);
-      impurity -= unbind(BIND_RET_POP);
-      SAFE_NEXT;
-    }
-
-    INSN(OP_DUP) {
-      repv tem = TOP;
-      PUSH(tem);
-      SAFE_NEXT;
-    }
-
-    INSN(OP_SWAP) {
-      ASSERT(STACK_USAGE >= 2);
-      repv tem = TOP;
-      TOP = sp[-1];
-      sp[-1] = tem;
-      SAFE_NEXT;
-    }
-
-    INSN(OP_POP) {
-      POP;
-      SAFE_NEXT;
-    }
-
-    INSN(OP_NIL) {
-      PUSH(rep_nil);
-      SAFE_NEXT;
-    }
-
-    INSN(OP_T) {
-      PUSH(Qt);
-      SAFE_NEXT;
-    }
-
-    INSN(OP_CONS) {
-      CALL_2(Fcons);
-    }
-
-    INSN(OP_CAR) {
-      repv tem = TOP;
-      if (rep_CONSP(tem)) {
-	TOP = rep_CAR(tem);
-      } else {
-	TOP = rep_nil;
-      }
-      SAFE_NEXT;
-    }
+  /* Inline caches parallel to CONSTS, found on first use. Should
+     there be no memory for them, SCRATCH_REF is used instead. */
 
-    INSN(OP_CDR) {
-      repv tem = TOP;
-      if (rep_CONSP(tem)) {
-	TOP = rep_CDR(tem);
-      } else {
-	TOP = rep_nil;
-      }
-      SAFE_NEXT;
-    }
+  rep_ref_cache *refs = NULL;
+  rep_ref_cache scratch_ref = {0};
 
-    INSN(OP_SET_CAR) {
-      CALL_2(Fset_car);
-    }
+  /* This frame's entry in the bytecode profile, if it's being
+     profiled, and the last opcode it executed. */
 
-    INSN(OP_SET_CDR) {
-      CALL_2(Fset_cdr);
-    }
+  profile_fn *prof = profiling ? profile_function(code) : NULL;
+  int prev_op = -1;
 
-    INSN(OP_LIST_REF) {
-      CALL_2(Flist_ref);
-    }
+  /* Shared argument register for INSN_WITH_ARG(). Also holds the
+     constants of direct-threaded PUSH instructions. */
 
-    INSN(OP_LIST_TAIL) {
-      CALL_2(Flist_tail);
-    }
+  intptr_t arg;
 
-    INSN(OP_ARRAY_SET) {
-      CALL_3(Faset);
-    }
+  /* The code being run, in one of the representations described
+     above. Both expansions of the instructions share these. */
 
-    INSN(OP_ARRAY_REF) {
-      CALL_2(Faref);
-    }
-
-    INSN(OP_LENGTH) {
-      CALL_1(Flength);
-    }
+  const uint8_t *pc_base, *pc;
 
-    INSN(OP_ADD) {
-      /* Open-code fixnum arithmetic */
-      repv arg2 = POP;
-      repv arg1 = TOP;
-      if (rep_INTP_2(arg1, arg2)) {
-#if defined(HAVE_OVERFLOW_BUILTINS) && INTPTR_MAX == LONG_MAX
-	/* see rep_number_add(). */
-	long x;
-	if (!__builtin_saddl_overflow(arg1, arg2 - 2, &x)) {
-	  TOP = (repv)x;
-	  SAFE_NEXT;
-	}
-#else
-	intptr_t x = rep_INT(arg1) + rep_INT(arg2);
-	if (x >= rep_LISP_MIN_INT && x <= rep_LISP_MAX_INT) {
-	  TOP = rep_MAKE_INT(x);
-	  SAFE_NEXT;
-	}
-#endif
-      }
-      TOP = rep_number_add(arg1, arg2);
-      INLINE_NEXT;
-    }
-
-    INSN(OP_NEG) {
-      /* Open-code fixnum arithmetic */
-      repv tem = TOP;
-      if (rep_INTP(tem)) {
-#if defined(HAVE_OVERFLOW_BUILTINS) && INTPTR_MAX == LONG_MAX
-	/* see rep_number_neg(). */
-	long x;
-	if (!__builtin_ssubl_overflow(4, tem, &x)) {
-	  TOP = (repv)x;
-	  SAFE_NEXT;
-	}
-#else
-	intptr_t x = - rep_INT(tem);
-	if (x >= rep_LISP_MIN_INT && x <= rep_LISP_MAX_INT) {
-	  TOP = rep_MAKE_INT(x);
-	  SAFE_NEXT;
-	}
-#endif
-      }
-      TOP = rep_number_neg(tem);
-      INLINE_NEXT;
-    }
-
-    INSN(OP_SUB) {
-      /* Open-code fixnum arithmetic */
-      repv arg2 = POP;
-      repv arg1 = TOP;
-      if (rep_INTP_2(arg1, arg2)) {
-#if defined(HAVE_OVERFLOW_BUILTINS) && INTPTR_MAX == LONG_MAX
-	/* see rep_number_sub(). */
-	long x;
-	if (!__builtin_ssubl_overflow(arg1, arg2 - 2, &x)) {
-	  TOP = (repv)x;
-	  SAFE_NEXT;
-	}
-#else
-	intptr_t x = rep_INT(arg1) - rep_INT(arg2);
-	if (x >= rep_LISP_MIN_INT && x <= rep_LISP_MAX_INT) {
-	  TOP = rep_MAKE_INT(x);
-	  SAFE_NEXT;
-	}
-#endif
-      }
-      TOP = rep_number_sub(arg1, arg2);
-      INLINE_NEXT;
-    }
-
-    INSN(OP_MUL) {
-      repv arg2 = POP;
-      repv arg1 = TOP;
-#if defined(HAVE_OVERFLOW_BUILTINS) && INTPTR_MAX == LONG_MAX
-      if (rep_INTP_2(arg1, arg2)) {
-	/* see rep_number_mul(). */
-	long x;
-	if (!__builtin_smull_overflow(arg1 - 2, rep_INT(arg2), &x)
-	    && !__builtin_saddl_overflow(x, 2, &x)) {
-	  TOP = x;
-	  SAFE_NEXT;
-	}
-      }
+#ifdef THREADED_VM
+  void **cfa = NULL;
 #endif
-      TOP = rep_number_sub(arg1, arg2);
-      NEXT;
-    }
-
-    INSN(OP_DIV) {
-      CALL_2(rep_number_div);
-    }
-
-    INSN(OP_REMAINDER) {
-      CALL_2(Fremainder);
-    }
-
-    INSN(OP_LOGNOT) {
-      CALL_1(Flognot);
-    }
-
-    INSN(OP_NULLP) {
-      if (TOP == rep_nil) {
-	TOP = Qt;
-      } else {
-	TOP = rep_nil;
-      }
-      SAFE_NEXT;
-    }
-
-    INSN(OP_LOGIOR) {
-      CALL_2(rep_number_logior);
-    }
-
-    INSN(OP_LOGXOR) {
-      CALL_2(rep_number_logxor);
-    }
-
-    INSN(OP_LOGAND) {
-      CALL_2(rep_number_logand);
-    }
 
-    INSN(OP_EQUAL) {
-      repv tem = POP;
-      TOP = (rep_value_cmp(TOP, tem) == 0) ? Qt : rep_nil;
-      NEXT;
-    }
-
-    INSN(OP_EQ) {
-      repv tem = POP;
-      TOP = (TOP == tem) ? Qt : rep_nil;
-      SAFE_NEXT;
-    }
-
-    INSN(OP_STRUCT_REF) {
-      CALL_2(Fstructure_access);
-    }
-
-    INSN(OP_LIST_LENGTH) {
-      CALL_1(Flist_length);
-    }
-
-    INSN(OP_GT) {
-      repv arg2 = POP;
-      repv arg1 = TOP;
-      if (rep_INTP_2(arg1, arg2)) {
-	TOP = rep_INT(arg1) > rep_INT(arg2) ? Qt : rep_nil;
-	SAFE_NEXT;
-      } else if (rep_NUMBERP(arg1) || rep_NUMBERP(arg2)) {
-	TOP = rep_compare_numbers(arg1, arg2) > 0 ? Qt : rep_nil;
-	SAFE_NEXT;
-      } else {
-	TOP = rep_value_cmp(arg1, arg2) > 0 ? Qt : rep_nil;
-	NEXT;
-      }
-    }
-
-    INSN(OP_GE) {
-      repv arg2 = POP;
-      repv arg1 = TOP;
-      if (rep_INTP_2(arg1, arg2)) {
-	TOP = rep_INT(arg1) >= rep_INT(arg2) ? Qt : rep_nil;
-	SAFE_NEXT;
-      } else if (rep_NUMBERP(arg1) || rep_NUMBERP(arg2)) {
-	TOP = rep_compare_numbers(arg1, arg2) >= 0 ? Qt : rep_nil;
-	SAFE_NEXT;
-      } else {
-	TOP = rep_value_cmp(arg1, arg2) >= 0 ? Qt : rep_nil;
-	NEXT;
-      }
-    }
-
-    INSN(OP_LT) {
-      repv arg2 = POP;
-      repv arg1 = TOP;
-      if (rep_INTP_2(arg1, arg2)) {
-	TOP = rep_INT(arg1) < rep_INT(arg2) ? Qt : rep_nil;
-	SAFE_NEXT;
-      } else if (rep_NUMBERP(arg1) || rep_NUMBERP(arg2)) {
-	TOP = rep_compare_numbers(arg1, arg2) < 0 ? Qt : rep_nil;
-	SAFE_NEXT;
-      } else {
-	TOP = rep_value_cmp(arg1, arg2) < 0 ? Qt : rep_nil;
-	NEXT;
-      }
-    }
+#ifdef DIRECT_THREADED_VM
+  /* Run the direct-threaded translation of CODE, if it has one. */
+  {
+# define VM_MODE DT
+    static void *cfa__[256] = { JUMP_TABLE };
+    const dt_cell *cells = (prof ? NULL
+			    : direct_threaded_code(code, consts, cfa__,
+						   &&TAG_DEFAULT));
+    if (cells) {
+      pc_base = pc = (const uint8_t *)cells;
 
-    INSN(OP_LE) {
-      repv arg2 = POP;
-      repv arg1 = TOP;
-      if (rep_INTP_2(arg1, arg2)) {
-	TOP = rep_INT(arg1) <= rep_INT(arg2) ? Qt : rep_nil;
-	SAFE_NEXT;
-      } else if (rep_NUMBERP(arg1) || rep_NUMBERP(arg2)) {
-	TOP = rep_compare_numbers(arg1, arg2) <= 0 ? Qt : rep_nil;
-	SAFE_NEXT;
-      } else {
-	TOP = rep_value_cmp(arg1, arg2) <= 0 ? Qt : rep_nil;
-	NEXT;
-      }
+# include "lispmach_insns.h"
     }
-
-    INSN(OP_INC) {
-      repv tem = TOP;
-      if (rep_INTP(tem)) {
-#if defined(HAVE_OVERFLOW_BUILTINS) && INTPTR_MAX == LONG_MAX
-	/* see Fplus1(). */
-	long x;
-	if (!__builtin_saddl_overflow(tem, 4, &x)) {
-	  TOP = (repv)x;
-	  SAFE_NEXT;
-	}
-#else
-	intptr_t x = rep_INT(tem) + 1;
-	if (x <= rep_LISP_MAX_INT) {
-	  TOP = rep_MAKE_INT(x);
-	  SAFE_NEXT;
-	}
+# undef VM_MODE
+  }
 #endif
-      }
-      TOP = Fplus1(tem);
-      NEXT;
-    }
 
-    INSN(OP_DEC) {
-      repv tem = TOP;
-      if (rep_INTP(tem)) {
-#if defined(HAVE_OVERFLOW_BUILTINS) && INTPTR_MAX == LONG_MAX
-	/* see Fsub1(). */
-	long x;
-	if (!__builtin_ssubl_overflow(tem, 4, &x)) {
-	  TOP = (repv)x;
-	  SAFE_NEXT;
-	}
-#else
-	intptr_t x = rep_INT(tem) - 1;
-	if (x >= rep_LISP_MIN_INT) {
-	  TOP = rep_MAKE_INT(x);
-	  SAFE_NEXT;
-	}
+  /* Start of the VM fetch-execute sequence. */
+  {
+#define VM_MODE BC
+#ifdef THREADED_VM
+    static void *cfa__[256] = { JUMP_TABLE };
+    static void *profile_cfa__[256] = {
+      [0 ... 255] = &&LABEL(insn_profile)
+    };
+    cfa = prof ? profile_cfa__ : cfa__;
 #endif
-      }
-      TOP = Fsub1(tem);
-      NEXT;
-    }
-
-    INSN(OP_ASH) {
-      CALL_2(Fash);
-    }
-
-    INSN(OP_ZEROP) {
-      repv tem = TOP;
-      if (rep_INTP(tem)) {
-	TOP = (tem == rep_MAKE_INT(0)) ? Qt : rep_nil;
-	SAFE_NEXT;
-      }
-      TOP = Fzerop(tem);
-      NEXT;
-    }
-
-    INSN(OP_NOT_ZERO_P) {
-      repv tem = TOP;
-      if (rep_INTP(tem)) {
-	TOP = (tem != rep_MAKE_INT(0)) ? Qt : rep_nil;
-	SAFE_NEXT;
-      }
-      tem = Fzerop(tem);
-      if (tem) {
-	tem = tem == rep_nil ? Qt : rep_nil;
-      }
-      TOP = tem;
-      NEXT;
-    }
-
-    INSN(OP_ATOMP) {
-      if (!rep_CONSP(TOP)) {
-	TOP = Qt;
-      } else {
-	TOP = rep_nil;
-      }
-      SAFE_NEXT;
-    }
-
-    INSN(OP_PAIRP) {
-      if (rep_CONSP(TOP)) {
-	TOP = Qt;
-      } else {
-	TOP = rep_nil;
-      }
-      SAFE_NEXT;
-    }
-
-    INSN(OP_LISTP) {
-      if (rep_CONSP(TOP) || rep_NILP(TOP)) {
-	TOP = Qt;
-      } else {
-	TOP = rep_nil;
-      }
-      SAFE_NEXT;
-    }
-
-    INSN(OP_NUMBERP) {
-      if (rep_NUMERICP(TOP)) {
-	TOP = Qt;
-      } else {
-	TOP = rep_nil;
-      }
-      SAFE_NEXT;
-    }
-
-    INSN(OP_STRINGP) {
-      if (rep_STRINGP(TOP)) {
-	TOP = Qt;
-      } else {
-	TOP = rep_nil;
-      }
-      SAFE_NEXT;
-    }
-
-    INSN(OP_VECTORP) {
-      if (rep_VECTORP(TOP)) {
-	TOP = Qt;
-      } else {
-	TOP = rep_nil;
-      }
-      SAFE_NEXT;
-    }
-
-    /* This takes two arguments, TAG and THROW-VALUE. THROW-VALUE is
-       the saved copy of rep_throw_value, if (car THROW-VALUE) == TAG
-       we match, and we leave two values on the stack, nil on top (to
-       pacify EJMP), (cdr THROW-VALUE) below that. */
-
-    INSN(OP_CATCH) {
-      repv tag = POP;
-      repv value = TOP;		/* rep_throw_value */
-      if (rep_CONSP(value) && rep_CAR(value) == tag) {
-	TOP = rep_CDR(value);	/* leave result at stk[1] */
-	PUSH(rep_nil);		/* cancel error */
-      }
-      SAFE_NEXT;
-    }
-
-    INSN(OP_THROW) {
-      repv value = POP;
-      if (!rep_throw_value) {
-	rep_throw_value = Fcons(TOP, value);
-	HANDLE_ERROR;
-      }
-      SAFE_NEXT;
-    }
-
-    /* Pop our single argument and cons it onto the bind-stack in a
-       pair with the current stack-pointer. This installs an address in
-       the code string as an error handler. */
-
-    INSN(OP_BINDERR) {
-      repv handler = POP;
-      ASSERT(BIND_USAGE < bindings_size + 1);
-      BIND_PUSH(Fcons(Qerror, Fcons(handler, rep_MAKE_INT(STACK_USAGE))));
-      impurity++;
-      SAFE_NEXT;
-    }
-
-    INSN(OP_RETURN) {
-      unbind_n(bindings, BIND_USAGE);
-      RETURN;
-    }
-
-    INSN(OP_POP_FRAMES) {
-      unbind_n(bindings + 1, BIND_USAGE - 1);
-      bp = bindings;
-      impurity = rep_SPEC_BINDINGS(BIND_TOP);
-      SAFE_NEXT;
-    }
-
-    INSN(OP_BOUNDP) {
-      CALL_1(Fboundp);
-    }
-
-    INSN(OP_SYMBOLP) {
-      if (rep_SYMBOLP(TOP)) {
-	TOP = Qt;
-      } else {
-	TOP = rep_nil;
-      }
-      SAFE_NEXT;
-    }
-
-    INSN(OP_GET) {
-      CALL_2(Fget);
-    }
-
-    INSN(OP_PUT) {
-      CALL_3(Fput);
-    }
-
-    /* This should be called with two values on the stack.
-       1. conditions of the error handler
-       2. rep_throw_value of the exception
-
-       This function pops(1) and tests it against the error in(2). If
-       they match it sets(2) to nil, and binds the error data to the
-       next lexical binding. */
-
-    INSN(OP_ERRORPRO) {
-      repv tem = POP;
-      if (rep_CONSP(TOP) && rep_CAR(TOP) == Qerror
-	  && rep_compare_error(rep_CDR(TOP), tem))
-      {
-	/* The handler matches the error. */
-	tem = rep_CDR(TOP);	/* the error data */
-	rep_env = Fcons(tem, rep_env);
-	ASSERT(BIND_USAGE < bindings_size + 1);
-	BIND_PUSH(rep_MARK_LEX_BINDING(rep_EMPTY_BINDING_FRAME));
-	TOP = rep_nil;
-      }
-      NEXT;
-    }
-
-    INSN(OP_SIGNAL) {
-      SYNC_GC;
-      CALL_2(Fsignal);
-    }
-
-    INSN(OP_QUOTIENT) {
-      CALL_2(Fquotient);
-    }
-
-    INSN(OP_REVERSE) {
-      CALL_1(Freverse);
-    }
-
-    INSN(OP_NREVERSE) {
-      CALL_1(Fnreverse);
-    }
-
-    INSN(OP_ASSOC) {
-      CALL_2(Fassoc);
-    }
-
-    INSN(OP_ASSQ) {
-      CALL_2(Fassq);
-    }
-
-    INSN(OP_RASSOC) {
-      CALL_2(Frassoc);
-    }
-
-    INSN(OP_RASSQ) {
-      CALL_2(Frassq);
-    }
-
-    INSN(OP_LAST) {
-      CALL_1(Flast);
-    }
-
-    INSN(OP_MAPCAR) {
-      SYNC_GC;
-      CALL_2(Fmapcar);
-    }
-
-    INSN(OP_MAPC) {
-      SYNC_GC;
-      CALL_2(Fmapc);
-    }
-
-    INSN(OP_MEMBER) {
-      CALL_2(Fmember);
-    }
-
-    INSN(OP_MEMQ) {
-      CALL_2(Fmemq);
-    }
-
-    INSN(OP_DELETE) {
-      CALL_2(Fdelete);
-    }
-
-    INSN(OP_DELQ) {
-      CALL_2(Fdelq);
-    }
-
-    INSN(OP_DELETE_IF) {
-      SYNC_GC;
-      CALL_2(Fdelete_if);
-    }
-
-    INSN(OP_DELETE_IF_NOT) {
-      SYNC_GC;
-      CALL_2(Fdelete_if_not);
-    }
-
-    INSN(OP_COPY_SEQUENCE) {
-      CALL_1(Fcopy_sequence);
-    }
-
-    INSN(OP_SEQUENCEP) {
-      CALL_1(Fsequencep);
-    }
-
-    INSN(OP_FUNCTIONP) {
-      CALL_1(Ffunctionp);
-    }
-
-    INSN(OP_SPECIAL_FORM_P) {
-      CALL_1(Fspecial_form_p);
-    }
-
-    INSN(OP_SUBRP) {
-      CALL_1(Fsubrp);
-    }
-
-    INSN(OP_EQV) {
-      CALL_2(Feql);
-    }
-
-    INSN(OP_MAX) {
-      CALL_2(rep_number_max);
-    }
-
-    INSN(OP_MIN) {
-      CALL_2(rep_number_min);
-    }
-
-    INSN(OP_FILTER) {
-      SYNC_GC;
-      CALL_2(Ffilter);
-    }
-
-    INSN(OP_MACROP) {
-      CALL_1(Fmacrop);
-    }
-
-    INSN(OP_BYTECODEP) {
-      CALL_1(Fbytecodep);
-    }
-
-    INSN(OP_PUSHI0) {
-      PUSH(rep_MAKE_INT(0));
-      SAFE_NEXT;
-    }
-
-    INSN(OP_PUSHI1) {
-      PUSH(rep_MAKE_INT(1));
-      SAFE_NEXT;
-    }
-
-    INSN(OP_PUSHI2) {
-      PUSH(rep_MAKE_INT(2));
-      SAFE_NEXT;
-    }
-
-    INSN(OP_PUSHIM1) {
-      PUSH(rep_MAKE_INT(-1));
-      SAFE_NEXT;
-    }
- 
-    INSN(OP_PUSHIM2) {
-      PUSH(rep_MAKE_INT(-2));
-      SAFE_NEXT;
-    }
-
-    INSN(OP_PUSHI) {
-      arg = FETCH;
-      if (arg < 128) {
-	PUSH(rep_MAKE_INT(arg));
-      } else {
-	PUSH(rep_MAKE_INT(((int) arg) - 256));
-      }
-      SAFE_NEXT;
-    }
-
-    INSN(OP_PUSHIWN) {
-      FETCH2(arg);
-      PUSH(rep_MAKE_INT(- ((int) arg)));
-      SAFE_NEXT;
-    }
-
-    INSN(OP_PUSHIWP) {
-      FETCH2(arg);
-      PUSH(rep_MAKE_INT(arg));
-      SAFE_NEXT;
-    }
-
-    INSN(OP_CAAR) {
-      repv tem = TOP;
-      if (rep_CONSP(tem) && rep_CONSP(rep_CAR(tem))) {
-	TOP = rep_CAAR(tem);
-      } else {
-	TOP = rep_nil;
-      }
-      SAFE_NEXT;
-    }
-
-    INSN(OP_CADR) {
-      repv tem = TOP;
-      if (rep_CONSP(tem) && rep_CONSP(rep_CDR(tem))) {
-	TOP = rep_CADR(tem);
-      } else {
-	TOP = rep_nil;
-      }
-      SAFE_NEXT;
-    }
-
-    INSN(OP_CDAR) {
-      repv tem = TOP;
-      if (rep_CONSP(tem) && rep_CONSP(rep_CAR(tem))) {
-	TOP = rep_CDAR(tem);
-      } else {
-	TOP = rep_nil;
-      }
-      SAFE_NEXT;
-    }
-
-    INSN(OP_CDDR) {
-      repv tem = TOP;
-      if (rep_CONSP(tem) && rep_CONSP(rep_CDR(tem))) {
-	TOP = rep_CDDR(tem);
-      } else {
-	TOP = rep_nil;
-      }
-      SAFE_NEXT;
-    }
-
-    INSN(OP_CADDR) {
-      TOP = list_ref(TOP, 2);
-      SAFE_NEXT;
-    }
-
-    INSN(OP_CADDDR) {
-      TOP = list_ref(TOP, 3);
-      SAFE_NEXT;
-    }
-
-    INSN(OP_CADDDDR) {
-      TOP = list_ref(TOP, 4);
-      SAFE_NEXT;
-    }
-
-    INSN(OP_CADDDDDR) {
-      TOP = list_ref(TOP, 5);
-      SAFE_NEXT;
-    }
-
-    INSN(OP_CADDDDDDR) {
-      TOP = list_ref(TOP, 6);
-      SAFE_NEXT;
-    }
 
-    INSN(OP_CADDDDDDDR) {
-      TOP = list_ref(TOP, 7);
-      SAFE_NEXT;
-    }
-
-    INSN(OP_FLOOR) {
-      CALL_1(Ffloor);
-    }
-
-    INSN(OP_CEILING) {
-      CALL_1(Fceiling);
-    }
-
-    INSN(OP_TRUNCATE) {
-      CALL_1(Ftruncate);
-    }
-
-    INSN(OP_ROUND) {
-      CALL_1(Fround);
-    }
-
-    INSN(OP_APPLY) {
-      repv args = POP;
-      repv fun = TOP;
-      SYNC_GC;
-      if (impurity == 0 && *pc == OP_RETURN && rep_CLOSUREP(fun)
-	  && rep_BYTECODEP(rep_CLOSURE(fun)->fun)
-	  && rep_STRUCTURE(rep_CLOSURE(fun)->structure)->apply_bytecode == 0)
-      {
-	rep_USE_CLOSURE(fun);
-	fun = rep_CLOSURE(fun)->fun;
-	int nargs = rep_list_length(args);
-	if (nargs < 0) {
-	  HANDLE_ERROR;
-	}
-	if (nargs <= argv_size) {
-	  argv = argv_base;
-	} else {
-	  /* Can't just copy over argv, reallocate */
-	  argv = alloca(sizeof(repv) * nargs);
-	  argv_base = argv; argv_size = nargs;
-	}
-	for (int i = 0; i < nargs; i++) {
-	  argv[i] = rep_CAR(args);
-	  args = rep_CDR(args);
-	}
-	argc = nargs;
-	int n_stack_size = rep_INT(rep_BYTECODE_STACK(fun)) & 0x3ff;
-	if (n_stack_size > stack_size) {
-	  stack = alloca(sizeof(repv) * (n_stack_size + 1));
-	  stack_size = n_stack_size;
-	}
-	code = fun;
-	goto do_tail_recursion;	/* passes `code' */
-      }
-      /* not a tail call */
-      TOP = rep_apply(fun, args);
-      NEXT;
-    }
-
-    INSN(OP_ARRAY_LENGTH) {
-      CALL_1(Farray_length);
-    }
-
-    INSN(OP_VECTOR_LENGTH) {
-      CALL_1(Fvector_length);
-    }
-
-    INSN(OP_EXP) {
-      CALL_1(Fexp);
-    }
-
-    INSN(OP_LOG) {
-      CALL_1(Flog);
-    }
-
-    INSN(OP_COS) {
-      CALL_1(Fcos);
-    }
-
-    INSN(OP_SIN) {
-      CALL_1(Fsin);
-    }
-
-    INSN(OP_TAN) {
-      CALL_1(Ftan);
-    }
-
-    INSN(OP_SQRT) {
-      CALL_1(Fsqrt);
-    }
-
-    INSN(OP_EXPT) {
-      CALL_2(Fexpt);
-    }
-
-    INSN(OP_SWAP2) {
-      ASSERT(STACK_USAGE >= 3);
-      repv tem = TOP;
-      TOP = sp[-1];
-      sp[-1] = sp[-2];
-      sp[-2] = tem;
-      SAFE_NEXT;
-    }
-
-    INSN(OP_MODULO) {
-      CALL_2(Fmod);
-    }
-
-    INSN(OP_MAKE_CLOSURE) {
-      CALL_2(Fmake_closure);
-    }
-
-    INSN(OP_RESET_FRAMES) {
-      unbind_n(bindings, BIND_USAGE);
-      bp = bindings - 1;
-      impurity = 0;
-      SAFE_NEXT;
-    }
-
-    INSN(OP_CLOSUREP) {
-      if (rep_CLOSUREP(TOP)) {
-	TOP = Qt;
-      } else {
-	TOP = rep_nil;
-      }
-      SAFE_NEXT;
-    }
-
-    INSN(OP_POP_ALL) {
-      sp = stack;
-      SAFE_NEXT;
-    }
-
-    INSN(OP_FLUID_SET) {
-      CALL_2(Ffluid_set);
-    }
-
-    INSN(OP_FLUID_BIND) {
-      repv arg2 = POP;
-      repv arg1 = POP;
-      rep_special_env = Fcons(Fcons(arg1, arg2), rep_special_env);
-      BIND_TOP = rep_MARK_SPEC_BINDING(BIND_TOP);
-      impurity++;
-      SAFE_NEXT;
-    }
-
-    INSN(OP_MEMV) {
-      CALL_2(Fmemql);
-    }
-
-    INSN(OP_NUM_EQ) {
-      repv arg2 = POP;
-      repv arg1 = TOP;
-      if (rep_INTP_2(arg1, arg2)) {
-	TOP = arg1 == arg2 ? Qt : rep_nil;
-	SAFE_NEXT;
-      } else if (rep_NUMBERP(arg1) || rep_NUMBERP(arg2)) {
-	TOP = rep_compare_numbers(arg1, arg2) == 0 ? Qt : rep_nil;
-	SAFE_NEXT;
-      } else {
-	TOP = rep_value_cmp(arg1, arg2) == 0 ? Qt : rep_nil;
-	NEXT;
-      }
-    }
-
-    INSN(OP__DEFINE) {
-      repv value = POP;
-      TOP = Fstructure_define(rep_structure, TOP, value);
-      NEXT;
-    }
+    pc_base = pc = (const uint8_t *)rep_STR(code);
 
-    INSN(OP_SET) {
-      CALL_2(Freal_set);
-    }
-
-    INSN(OP_REQUIRED_ARG) {
-      if (argptr < argc) {
-	PUSH(argv[argptr++]);
-	SAFE_NEXT;
-      }
-      rep_signal_missing_arg(argptr + 1);
-      HANDLE_ERROR;
-    }
-
-    INSN(OP_OPTIONAL_ARG) {
-      PUSH((argptr < argc) ? argv[argptr++] : rep_nil);
-      SAFE_NEXT;
-    }
-
-    INSN(OP_REST_ARG) {
-      repv lst = rep_nil;
-      for (int i = argc - 1; i >= argptr; i--) {
-	if (argv[i] != 0) {
-	  lst = Fcons(argv[i], lst);
-	}
-      }
-      argptr = argc;
-      PUSH(lst);
-      SAFE_NEXT;
-    }
-
-    INSN(OP_KEYWORD_ARG) {
-      repv sym = POP;
-      for (int i = argptr; i < argc - 1; i++) {
-	if (argv[i] == sym) {
-	  PUSH(argv[i+1]);
-	  argv[i] = argv[i+1] = 0;
-	  SAFE_NEXT;
-	}
-      }
-      PUSH(rep_nil);
-      SAFE_NEXT;
-    }
-
-    INSN(OP_OPTIONAL_ARG_) {
-      if (argptr < argc) {
-	PUSH(argv[argptr++]);
-	PUSH(Qt);
-      } else {
-	PUSH(rep_nil);
-      }
-      SAFE_NEXT;
-    }
-
-    INSN(OP_KEYWORD_ARG_) {
-      repv sym = POP;
-      for (int i = argptr; i < argc - 1; i += 2) {
-	if (argv[i] == sym) {
-	  PUSH(argv[i+1]);
-	  PUSH(Qt);
-	  argv[i] = argv[i+1] = 0;
-	  SAFE_NEXT;
-	}
-      }
-      PUSH(rep_nil);
-      SAFE_NEXT;
-    }
-
-    INSN(OP_VECTOR_REF) {
-      CALL_2(Fvector_ref);
-    }
-
-    INSN(OP_VECTOR_SET) {
-      CALL_3(Fvector_set);
-    }
-
-    INSN(OP_STRING_LENGTH) {
-      CALL_1(Fstring_length);
-    }
-
-    INSN(OP_STRING_REF) {
-      CALL_2(Fstring_ref);
-    }
-
-    INSN(OP_STRING_SET) {
-      CALL_3(Fstring_set);
-    }
-
-    INSN(OP_UNDEFINED) {
-      PUSH(rep_undefined_value);
-      SAFE_NEXT;
-    }
-
-    /** Jump instructions. **/
-
-    /* Pop the stack; if it's nil jmp pc[0,1], otherwise set
-       rep_throw_value = ARG and goto the error handler. */
-
-    INSN(OP_EJMP) {
-      repv tem = POP;
-      if (rep_NILP(tem)) {
-	goto do_jmp;
-      }
-      rep_throw_value = tem;
-      HANDLE_ERROR;
-    }
-
-    INSN(OP_JN) {
-      repv tem = POP;
-      if (rep_NILP(tem)) {
-	goto do_jmp;
-      }
-      pc += 2;
-      SAFE_NEXT;
-    }
-
-    INSN(OP_JT) {
-      repv tem = POP;
-      if (!rep_NILP(tem)) {
-	goto do_jmp;
-      }
-      pc += 2;
-      SAFE_NEXT;
-    }
-
-    INSN(OP_JPN) {
-      if (rep_NILP(TOP)) {
-	POP;
-	goto do_jmp;
-      }
-      pc += 2;
-      SAFE_NEXT;
-    }
-
-    INSN(OP_JPT) {
-      if (!rep_NILP(TOP)) {
-	POP;
-	goto do_jmp;
-      }
-      pc += 2;
-      SAFE_NEXT;
-    }
-
-    INSN(OP_JNP) {
-      if (rep_NILP(TOP)) {
-	goto do_jmp;
-      }
-      POP;
-      pc += 2;
-      SAFE_NEXT;
-    }
-
-    INSN(OP_JTP) {
-      if (!rep_NILP(TOP)) {
-	goto do_jmp;
-      }
-      POP;
-      pc += 2;
-      SAFE_NEXT;
-    }
-
-    INSN(OP_JMP) {
-    do_jmp:;
-      const uint8_t *old_pc = pc;
-      pc = pc_base + ((pc[0] << ARG_SHIFT) | pc[1]);
-
-      /* Only check for interrupts / GC on backwards jumps, i.e. loops. */
-
-      if (pc < old_pc) {
-	rep_TEST_INT;
-	if (rep_INTERRUPTP) {
-	  HANDLE_ERROR;
-	}
-
-	if (rep_data_after_gc >= rep_gc_threshold) {
-	  SYNC_GC;
-	  Fgarbage_collect(rep_nil);
-	}
-      }
-
-      SAFE_NEXT;
-    }
-
-    DEFAULT_INSN {
-      Fsignal(Qbytecode_error,
-	      rep_list_2(rep_VAL(&unknown_op), rep_MAKE_INT(pc[-1])));
-      HANDLE_ERROR;
-    }
-
-    END_DISPATCH
-	
-    /* Check if the instruction raised an exception. */
-
-  check_error:
-    if (ERROR_OCCURRED_P) {
-      /* Some form of error occurred. Unwind the binding stack. */
-    error:
-      while (!BIND_TOP_P) {
-	repv item = BIND_RET_POP;
-
-	if (!rep_CONSP(item) || rep_CAR(item) != Qerror) {
-
-	  rep_GC_root gc_throwval;
-	  repv throwval = rep_throw_value;
-	  rep_throw_value = 0;
-	  rep_PUSHGC(gc_throwval, throwval);
-	  SYNC_GC;
-	  impurity -= unbind(item);
-	  rep_POPGC;
-	  rep_throw_value = throwval;
-
-	} else if (rep_throw_value) {
-
-	  item = rep_CDR(item);
-
-	  /* item is an exception-handler, (PC . SP)
-
-	     When the code at PC is called, it will have the current
-	     stack usage set to SP, and then the value of
-	     rep_throw_value pushed on top.
-
-	     The handler can then use the EJMP instruction to pass
-	     control back to the error: label, or simply continue
-	     execution as normal. */
-
-	  sp = stack + rep_INT(rep_CDR(item));
-	  PUSH(rep_throw_value);
-	  rep_throw_value = 0;
-	  pc = pc_base + rep_INT(rep_CAR(item));
-	  impurity--;
-	  SAFE_NEXT;
-
-	} else {
-
-	  /* car is an exception handler, but rep_throw_value isn't
-	     set, so there's nothing to handle. Keep unwinding. */
-	  impurity--;
-	}
-      }
-      TOP = 0;
-      RETURN;
-    }
-    SAFE_NEXT__;
+#include "lispmach_insns.h"
+#undef VM_MODE
   }
 
 quit:
@@ -2136,7 +724,7 @@ quit:
   /* moved to after the execution, to avoid needing to gc protect argv */
 
   if (rep_data_after_gc >= rep_gc_threshold) {
-    Fgarbage_collect(rep_nil);
+    rep_gc_auto();
   }
 
   rep_lisp_depth--;
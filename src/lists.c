@@ -20,37 +20,125 @@
 
 #include "repint.h"
 
-#define CONS_PER_BLOCK 1022 /* ~8k */
+#include <string.h>
+#include <stddef.h>
+
+#define CONS_PER_BLOCK \
+  ((rep_GC_BLOCK_SIZE - sizeof(rep_gc_block)) / sizeof(rep_cons))
 
 typedef struct cons_block_struct cons_block;
 
 struct cons_block_struct {
-  cons_block *next;
+  rep_gc_block header;
   rep_ALIGN_CELL(rep_cons cons[CONS_PER_BLOCK]);
 };
 
+/* Blocks that have been swept since the last collection, and those
+   that haven't yet. The free list only contains cells from swept
+   blocks. */
+
 static cons_block *cons_block_list;
+static cons_block *cons_sweep_list;
 static rep_cons *cons_free_list;
 
+/* Number of empty blocks kept by sweep_block() since the last
+   collection. */
+
+static int empty_blocks_kept;
+
 int rep_allocated_cons, rep_used_cons;
 
 void
 rep_cons_free(repv cn)
 {
+  /* In generational mode the cell may be in the remembered set, so
+     leave it for the collector. */
+
+  if (rep_gc_generational) {
+    return;
+  }
+
   rep_CDR(cn) = rep_VAL(cons_free_list);
   cons_free_list = rep_CONS(cn);
   rep_used_cons--;
 }
 
+/* Put the unmarked cells of block CB onto the free list, and move it
+   to the list of swept blocks. Blocks with no live cells may be
+   released instead. */
+
+static void
+sweep_block(cons_block *cb)
+{
+  static uintptr_t cell_map[rep_GC_BITMAP_WORDS];
+  static bool cell_map_ready;
+
+  if (!cell_map_ready) {
+    rep_gc_cell_map(cell_map, offsetof(cons_block, cons),
+		    sizeof(rep_cons), CONS_PER_BLOCK);
+    cell_map_ready = true;
+  }
+
+  rep_cons *free_list = NULL;
+  rep_cons *free_tail = NULL;
+  int freed = 0;
+
+  /* Only the cells that aren't marked or old are touched. */
+
+  for (int i = 0; i < rep_GC_BITMAP_WORDS; i++) {
+    uintptr_t dead = cell_map[i] & ~(cb->header.mark[i] | cb->header.old[i]);
+    freed += rep_popcount(dead);
+    for (; dead != 0; dead &= dead - 1) {
+      rep_cons *cell = rep_GC_CELL_AT(cb, i, rep_ctz(dead));
+      if (!free_tail) {
+	free_tail = cell;
+      }
+      cell->cdr = rep_VAL(free_list);
+      free_list = cell;
+    }
+  }
+
+  if (freed == CONS_PER_BLOCK
+      && !rep_gc_keep_empty_block(&empty_blocks_kept, rep_GC_BLOCK_SIZE))
+  {
+    rep_gc_free_block(cb);
+    rep_allocated_cons -= CONS_PER_BLOCK;
+    return;
+  }
+
+  if (free_tail) {
+    free_tail->cdr = rep_VAL(cons_free_list);
+    cons_free_list = free_list;
+  }
+
+  memset(cb->header.mark, 0, sizeof(cb->header.mark));
+
+  cb->header.next = (rep_gc_block *)cons_block_list;
+  cons_block_list = cb;
+}
+
 /* Note that the cell returned is not linked into the free-list! */
 
 static rep_cons *
 refill_free_list(void)
 {
-  cons_block *cb = rep_alloc(sizeof(cons_block));
+  while (cons_sweep_list) {
+    cons_block *cb = cons_sweep_list;
+    cons_sweep_list = (cons_block *)cb->header.next;
+    sweep_block(cb);
+    if (cons_free_list) {
+      rep_cons *c = cons_free_list;
+      cons_free_list = rep_CONS(c->cdr);
+      return c;
+    }
+  }
+
+  rep_static_assert(sizeof(cons_block) <= rep_GC_BLOCK_SIZE);
+
+  cons_block *cb = rep_gc_alloc_block();
   rep_allocated_cons += CONS_PER_BLOCK;
 
-  cb->next = cons_block_list;
+  cb->header.next = (rep_gc_block *)cons_block_list;
   cons_block_list = cb;
 
   for (int i = 1; i < CONS_PER_BLOCK - 1; i++) {
@@ -78,7 +166,7 @@ Returns a new cons-cell with car CAR and cdr CDR.
   }
 
   rep_used_cons++;
-  rep_data_after_gc += sizeof(rep_cons);
+  rep_NOTE_ALLOCATION(sizeof(rep_cons));
 
   c->car = car;
   c->cdr = cdr;
@@ -86,27 +174,58 @@ Returns a new cons-cell with car CAR and cdr CDR.
   return rep_VAL (c);
 }
 
+/* Called before marking. Blocks that weren't swept after the previous
+   collection still have its mark bits set. Their unmarked cells are
+   unreachable, so can be left for the next sweep. */
+
+void
+rep_cons_clear_marks(void)
+{
+  for (cons_block *cb = cons_sweep_list; cb;
+       cb = (cons_block *)cb->header.next)
+  {
+    memset(cb->header.mark, 0, sizeof(cb->header.mark));
+  }
+}
+
+/* Called after marking. Nothing is freed here, all blocks are queued
+   to be swept when Fcons next needs more cells. (In a minor collection
+   old cells are left alone, otherwise marked cells become old in
+   generational mode and the rest will be freed.) */
+
 void
 rep_cons_sweep(void)
 {
-  rep_cons *free_list = 0;
+  cons_block *list = cons_sweep_list;
   int used = 0;
 
-  for (cons_block *cb = cons_block_list; cb; cb = cb->next) {
-    for (int i = 0; i < CONS_PER_BLOCK; i++) {
-      rep_cons *cell = &cb->cons[i];
-      if (!rep_GC_CONS_MARKEDP(rep_VAL(cell))) {
-	cell->cdr = rep_VAL(free_list);
-	free_list = cell;
-      } else {
-	rep_GC_CLR_CONS(rep_VAL(cell));
-	used++;
-      }
-    }
+  while (cons_block_list) {
+    cons_block *cb = cons_block_list;
+    cons_block_list = (cons_block *)cb->header.next;
+    cb->header.next = (rep_gc_block *)list;
+    list = cb;
+  }
+
+  for (cons_block *cb = list; cb; cb = (cons_block *)cb->header.next) {
+    used += rep_gc_block_marked(&cb->header);
   }
 
-  cons_free_list = free_list;
+  cons_sweep_list = list;
+  cons_free_list = 0;
   rep_used_cons = used;
+  empty_blocks_kept = 0;
+}
+
+/* Sweep all blocks not yet swept since the last collection. */
+
+void
+rep_cons_finish_sweep(void)
+{
+  while (cons_sweep_list) {
+    cons_block *cb = cons_sweep_list;
+    cons_sweep_list = (cons_block *)cb->header.next;
+    sweep_block(cb);
+  }
 }
 
 int
@@ -260,6 +379,7 @@ Sets the value of the car slot in PAIR to VALUE.
   rep_DECLARE1(cons, rep_CONSP);
 
   rep_CAR(cons) = car;
+  rep_GC_WRITE_BARRIER(cons, car);
 
   return rep_undefined_value;
 }
@@ -274,6 +394,7 @@ Sets the value of the cdr slot in PAIR to VALUE-CDR.
   rep_DECLARE1(cons, rep_CONSP);
 
   rep_CDR(cons) = cdr;
+  rep_GC_WRITE_BARRIER(cons, cdr);
 
   return rep_undefined_value;
 }
@@ -384,7 +505,8 @@ to the beginning of the next list. Returns the new list.
     }
 
     *res_end = argv[i];
- 
+    rep_GC_CDRLOC_BARRIER(res_end, res, argv[i]);
+
     while (rep_CONSP(*res_end)) {
       rep_TEST_INT;
       if (rep_INTERRUPTP) {
@@ -445,6 +567,7 @@ they were. This function is destructive towards it's argument.
   while (rep_CONSP(head)) {
     repv next = rep_CDR(head);
     rep_CDR(head) = ret;
+    rep_GC_WRITE_BARRIER(head, ret);
     ret = head;
     head = next;
 
@@ -789,6 +912,7 @@ provided, the smallest list stops the function.
 
     repv cell = Fcons(tem, rep_nil);
     *tail = cell;
+    rep_GC_CDRLOC_BARRIER(tail, ret, cell);
     tail = rep_CDRLOC(cell);
 
     rep_TEST_INT;
@@ -915,6 +1039,7 @@ PREDICATE returns t when applied to; i.e. something like
     if (!rep_NILP(tem)) {
       repv cell = Fcons(rep_CAR(list), rep_nil);
       *ptr = cell;
+      rep_GC_CDRLOC_BARRIER(ptr, output, cell);
       ptr = &rep_CDR(cell);
     }
     list = rep_CDR(list);
@@ -1028,6 +1153,7 @@ Returns LIST with any members `equal?' to ELT destructively removed.
     repv cell = *ptr;
     if (!rep_value_cmp(elt, rep_CAR(cell))) {
       *ptr = rep_CDR(cell);
+      rep_GC_CDRLOC_BARRIER(ptr, list, *ptr);
     } else {
       ptr = &rep_CDR(cell);
     }
@@ -1056,6 +1182,7 @@ Returns LIST with any members `eq?' to ELT destructively removed.
     repv cell = *ptr;
     if (elt == rep_CAR(cell)) {
       *ptr = rep_CDR(cell);
+      rep_GC_CDRLOC_BARRIER(ptr, list, *ptr);
     } else {
       ptr = &rep_CDR(cell);
     }
@@ -1099,6 +1226,7 @@ applied to that element, ie,
     }
     if (!rep_NILP(tmp)) {
       *ptr = rep_CDR(*ptr);
+      rep_GC_CDRLOC_BARRIER(ptr, list, *ptr);
     } else {
       ptr = &rep_CDR(*ptr);
     }
@@ -1139,6 +1267,7 @@ applied to that element, ie,
     }
     if (rep_NILP(tmp)) {
       *ptr = rep_CDR(*ptr);
+      rep_GC_CDRLOC_BARRIER(ptr, list, *ptr);
     } else {
       ptr = &rep_CDR(*ptr);
     }
@@ -1236,14 +1365,17 @@ rep_lists_init(void)
 void
 rep_lists_kill(void)
 {
+  rep_cons_finish_sweep();
+
   cons_block *cb = cons_block_list;
 
   cons_block_list = NULL;
+  cons_free_list = NULL;
   rep_allocated_cons = rep_used_cons = 0;
 
   while (cb) {
-    cons_block *next = cb->next;
-    rep_free(cb);
+    cons_block *next = (cons_block *)cb->header.next;
+    rep_gc_free_block(cb);
     cb = next;
   }
 }
@@ -179,6 +179,7 @@ rep_init(char *prog_name, int *argc, char ***argv)
 
   rep_common_db = rep_db_alloc("common", 4096);
 
+  rep_hash_init();
   rep_types_init();
   rep_signals_init();
   rep_obarray_init();
@@ -220,6 +221,7 @@ rep_init(char *prog_name, int *argc, char ***argv)
   rep_fluids_init();
   rep_weak_refs_init();
   rep_tables_init();
+  rep_persistent_init();
   rep_environ_init();
   rep_processes_init();
   rep_sockets_init();
@@ -258,23 +260,61 @@ rep_load_environment(repv file)
   const char **ptr;
 
   repv ret = rep_nil;
+  repv image = rep_nil, dump = rep_nil;
+  repv args = rep_nil, batch = rep_nil;
+  bool restored = false;
 
-  rep_GC_root gc_file;
+  rep_GC_root gc_file, gc_image, gc_dump, gc_args, gc_batch;
   rep_PUSHGC(gc_file, file);
+  rep_PUSHGC(gc_image, image);
+  rep_PUSHGC(gc_dump, dump);
+  rep_PUSHGC(gc_args, args);
+  rep_PUSHGC(gc_batch, batch);
+
+  /* 1. Do the rep bootstrap, or restore its results from an image.
+     When dumping an image, the state before the bootstrap is what
+     the image is compared against. */
+
+  if (rep_get_option("--image", &image)) {
+    restored = rep_load_image(image);
+  } else if (rep_get_option("--dump-image", &dump)) {
+    rep_image_baseline();
+  }
 
-  /* 1. Do the rep bootstrap */
-
-  for (ptr = init; ret && *ptr != 0; ptr++) {
+  for (ptr = init; !restored && ret && *ptr != 0; ptr++) {
     ret = rep_bootstrap_structure(*ptr);
   }
 
+  /* When dumping, the modules named by the remaining arguments are
+     loaded by the caller-local bootstrap, as if each was given to
+     `--load', so that they see the same environment as in a normal
+     start. The user's startup files aren't loaded, and nothing is
+     run interactively. */
+
+  if (ret && dump != rep_nil) {
+    args = Fsymbol_value(Qcommand_line_args, Qt);
+    batch = Fsymbol_value(Qbatch_mode, Qt);
+    Fset(Qbatch_mode, Qt);
+    Fset(Qcommand_line_args, Fcons(rep_string_copy("--no-rc"), args));
+  }
+
   /* 2. Do the caller-local bootstrap */
 
   if (ret && rep_STRINGP(file)) {
     ret = Fload(file, rep_nil, rep_nil, rep_nil, rep_nil);
   }
 
-  rep_POPGC;
+  /* When dumping, write the image. The options of this process are
+     put back first, so that the image doesn't change those of the
+     processes restoring it. */
+
+  if (ret && dump != rep_nil) {
+    Fset(Qcommand_line_args, args);
+    Fset(Qbatch_mode, batch);
+    ret = rep_dump_image(dump);
+  }
+
+  rep_POPGC; rep_POPGC; rep_POPGC; rep_POPGC; rep_POPGC;
   return ret;
 }
 
@@ -320,7 +360,8 @@ rep_on_idle(int since_last_event)
   if (rep_on_idle_fun != 0 && (*rep_on_idle_fun)(since_last_event)) {
     ret = true;
   } else if (rep_data_after_gc > rep_idle_gc_threshold) {
-    Fgarbage_collect(rep_nil);
+    rep_gc_auto();
+    rep_gc_finish_sweep();
   } else if (!called_hook && depth == 1) {
     repv hook = Fsymbol_value(Qidle_hook, Qt);
     if (!rep_VOIDP(hook) && !rep_NILP(hook)) {
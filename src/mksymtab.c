@@ -0,0 +1,342 @@
+/* mksymtab.c -- Program to build the table of builtin symbols
+
+   Copyright (C) 1993-2015 John Harper <jsh@unfactored.org>
+
+   This file is part of Librep.
+
+   Librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   Librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+/* Scans the C sources of librep for the names of symbols declared by
+   DEFSYM and subrs declared by DEFUN, and writes to stdout a header
+   defining a statically allocated symbol for each, plus a minimal
+   perfect hash of their names. symbols.c includes the result, and
+   starts the obarray with these symbols already in it, see
+   rep_obarray_init().
+
+   Each name's obarray hash code, rep_hash_bytes() with the default
+   seed, is stored in its string, so that nothing is hashed at startup
+   unless REP_HASH_SEED changes the seed. The perfect hash (Hanov's
+   "hash, displace, and compress" scheme) lets rep_INTERN and
+   rep_ADD_SUBR find their symbol with one probe. */
+
+#include "repint.h"
+#include "perfect-hash.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+typedef struct {
+  char *name;
+  size_t len;
+} entry;
+
+static entry *entries;
+static size_t n_entries, entries_size;
+
+static void
+usage(void)
+{
+  fputs("usage: mksymtab src-files...\n", stderr);
+  exit(1);
+}
+
+static void
+add_name(const char *name, size_t len)
+{
+  if (n_entries == entries_size) {
+    entries_size = entries_size ? entries_size * 2 : 1024;
+    entries = realloc(entries, entries_size * sizeof(entry));
+    if (!entries) {
+      perror("realloc");
+      exit(1);
+    }
+  }
+
+  entries[n_entries].name = strndup(name, len);
+  entries[n_entries].len = len;
+  n_entries++;
+}
+
+/* If P points at `"NAME"', with no escapes in NAME, add it. */
+
+static void
+scan_name(const char *p)
+{
+  while (*p == ' ' || *p == '\t') {
+    p++;
+  }
+
+  if (*p++ != '"') {
+    return;
+  }
+
+  const char *end = p;
+  while (*end && *end != '"') {
+    if (*end == '\\') {
+      return;
+    }
+    end++;
+  }
+
+  if (*end == '"' && end > p) {
+    add_name(p, end - p);
+  }
+}
+
+static void
+scan_file(FILE *src)
+{
+  char buf[1024];
+
+  while (fgets(buf, sizeof(buf), src)) {
+    if (buf[0] == '#') {
+      continue;
+    }
+
+    for (char *p = buf; (p = strstr(p, "DEF")); p++) {
+      if (p > buf && (p[-1] == '_' || isalnum((unsigned char)p[-1]))) {
+	continue;
+      }
+      if (strncmp(p, "DEFSYM(", 7) == 0) {
+	char *comma = strchr(p, ',');
+	if (comma) {
+	  scan_name(comma + 1);
+	}
+      } else if (strncmp(p, "DEFUN(", 6) == 0) {
+	scan_name(p + 6);
+      } else if (strncmp(p, "DEFUN_INT(", 10) == 0) {
+	scan_name(p + 10);
+      }
+    }
+  }
+}
+
+static int
+compare_entries(const void *a, const void *b)
+{
+  return strcmp(((const entry *)a)->name, ((const entry *)b)->name);
+}
+
+/* Remove duplicate names, returning the number left. */
+
+static size_t
+unique_entries(void)
+{
+  size_t n = 0;
+
+  qsort(entries, n_entries, sizeof(entry), compare_entries);
+
+  for (size_t i = 0; i < n_entries; i++) {
+    if (n == 0 || strcmp(entries[n - 1].name, entries[i].name) != 0) {
+      entries[n++] = entries[i];
+    }
+  }
+
+  return n;
+}
+
+static inline uint32_t
+entry_hash(uint32_t d, const entry *e)
+{
+  return perfect_hash(d, e->name, e->len);
+}
+
+/* Fill in DISP[N], and SLOTS[N] with the index into ENTRIES of the
+   name stored in each slot of the table. */
+
+static void
+build_perfect_hash(size_t n, int32_t *disp, size_t *slots)
+{
+  size_t *bucket_size = calloc(n, sizeof(size_t));
+  size_t *order = malloc(n * sizeof(size_t));
+  size_t *members = malloc(n * sizeof(size_t));
+  size_t *tried = malloc(n * sizeof(size_t));
+  char *used = calloc(n, 1);
+
+  if (!bucket_size || !order || !members || !tried || !used) {
+    perror("malloc");
+    exit(1);
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    bucket_size[entry_hash(0, &entries[i]) % n]++;
+    order[i] = i;
+    slots[i] = SIZE_MAX;
+    disp[i] = 0;
+  }
+
+  /* Place the largest buckets first, while the table is empty. */
+
+  for (size_t i = 1; i < n; i++) {
+    size_t b = order[i], j = i;
+    while (j > 0 && bucket_size[order[j - 1]] < bucket_size[b]) {
+      order[j] = order[j - 1];
+      j--;
+    }
+    order[j] = b;
+  }
+
+  size_t free_slot = 0;
+
+  for (size_t i = 0; i < n && bucket_size[order[i]] > 0; i++) {
+    size_t b = order[i];
+
+    size_t count = 0;
+    for (size_t k = 0; k < n; k++) {
+      if (entry_hash(0, &entries[k]) % n == b) {
+	members[count++] = k;
+      }
+    }
+
+    if (count == 1) {
+      /* Single names go straight into the remaining free slots. */
+
+      while (used[free_slot]) {
+	free_slot++;
+      }
+      used[free_slot] = 1;
+      slots[free_slot] = members[0];
+      disp[b] = -(int32_t)free_slot - 1;
+      continue;
+    }
+
+    for (uint32_t d = 1;; d++) {
+      size_t k;
+      for (k = 0; k < count; k++) {
+	size_t slot = entry_hash(d, &entries[members[k]]) % n;
+	size_t j;
+	for (j = 0; j < k && tried[j] != slot; j++) ;
+	if (used[slot] || j < k) {
+	  break;
+	}
+	tried[k] = slot;
+      }
+      if (k == count) {
+	for (k = 0; k < count; k++) {
+	  used[tried[k]] = 1;
+	  slots[tried[k]] = members[k];
+	}
+	disp[b] = d;
+	break;
+      }
+      if (d == INT32_MAX) {
+	fputs("mksymtab: can't find a perfect hash\n", stderr);
+	exit(1);
+      }
+    }
+  }
+
+  free(bucket_size);
+  free(order);
+  free(members);
+  free(tried);
+  free(used);
+}
+
+static bool
+ascii_p(const entry *e)
+{
+  for (size_t i = 0; i < e->len; i++) {
+    if ((unsigned char)e->name[i] >= 0x80) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void
+output(size_t n, const int32_t *disp, const size_t *slots)
+{
+  printf("/* symtab.h -- builtin symbols, generated by mksymtab."
+	 " Don't edit. */\n\n");
+
+  printf("#define BUILTIN_SYMBOLS %zu\n", n);
+  printf("#define BUILTIN_HASH_SEED UINT64_C(0x%016llx)\n\n",
+	 (unsigned long long)rep_hash_seed);
+
+  printf("static const int32_t builtin_displacements[BUILTIN_SYMBOLS] = {");
+  for (size_t i = 0; i < n; i++) {
+    printf(i % 8 == 0 ? "\n  %d," : " %d,", disp[i]);
+  }
+  printf("\n};\n\n");
+
+  printf("rep_ALIGN_CELL(static rep_string"
+	 " builtin_names[BUILTIN_SYMBOLS]) = {\n");
+  for (size_t i = 0; i < n; i++) {
+    const entry *e = &entries[slots[i]];
+    printf("  { (%zu << rep_STRING_LEN_SHIFT) | rep_STRING_IMMUTABLE"
+	   " | rep_CELL_STATIC_BIT | rep_String,\n"
+	   "    (uint8_t *)\"%s\", ",
+	   e->len, e->name);
+
+    /* As DEFSTRING, ASCII names have their length in characters. */
+
+    if (ascii_p(e)) {
+      printf("rep_MAKE_INT(%zu), ", e->len);
+    } else {
+      printf("0, ");
+    }
+
+    printf("(uintptr_t)UINT64_C(0x%016llx) },\n",
+	   (unsigned long long)rep_hash_bytes(e->name, e->len));
+  }
+  printf("};\n\n");
+
+  printf("rep_ALIGN_CELL(static rep_symbol"
+	 " builtin_symbols[BUILTIN_SYMBOLS]) = {\n");
+  for (size_t i = 0; i < n; i++) {
+    printf("  { rep_Symbol | rep_CELL_STATIC_BIT, 0,"
+	   " rep_VAL(&builtin_names[%zu]) },\n", i);
+  }
+  printf("};\n");
+}
+
+int
+main(int argc, char **argv)
+{
+  if (argc < 2) {
+    usage();
+  }
+
+  for (int i = 1; i < argc; i++) {
+    FILE *src = fopen(argv[i], "r");
+    if (!src) {
+      perror(argv[i]);
+      return 1;
+    }
+    scan_file(src);
+    fclose(src);
+  }
+
+  size_t n = unique_entries();
+  if (n == 0) {
+    fputs("mksymtab: no symbols found\n", stderr);
+    return 1;
+  }
+
+  int32_t *disp = malloc(n * sizeof(int32_t));
+  size_t *slots = malloc(n * sizeof(size_t));
+  if (!disp || !slots) {
+    perror("malloc");
+    return 1;
+  }
+
+  build_perfect_hash(n, disp, slots);
+  output(n, disp, slots);
+
+  return 0;
+}
@@ -166,11 +166,17 @@ make_number(int type)
   cn->car = rep_Number | type;
 
   used_numbers++;
-  rep_data_after_gc += sizeof(rep_number);
+  rep_NOTE_ALLOCATION(sizeof(rep_number));
 
   return cn;
 }
 
+size_t
+rep_number_size(repv v)
+{
+  return number_sizeofs[type_to_index(rep_NUMBER_TYPE(v))];
+}
+
 static void
 number_sweep(void)
 {
@@ -202,6 +208,7 @@ number_sweep(void)
 	  }
 
 	  if (!rep_CELL_CONS_P(rep_VAL(ptr))) {
+	    rep_gc_note_freed(rep_Number, 1, number_sizeofs[idx]);
 	    switch (idx) {
 	    case 0:
 #ifdef HAVE_GMP
@@ -3487,6 +3494,7 @@ rep_numbers_init(void)
     .compare = number_cmp,
     .print = number_prin,
     .sweep = number_sweep,
+    .size = rep_number_size,
   };
 
   rep_define_type(&fixnum);
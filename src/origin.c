@@ -168,7 +168,7 @@ rep_scan_origins(void)
     origin_item **ptr = &buckets[i];
     origin_item *item = *ptr;
     for (ptr = &buckets[i]; (item = *ptr);) {
-      if (rep_GC_MARKEDP(item->form)) {
+      if (rep_GC_LIVEP(item->form)) {
 	ptr = &item->next;
       } else {
 	*ptr = item->next;
@@ -0,0 +1,56 @@
+/* perfect-hash.h -- hash function for the builtin symbol table
+
+   Copyright (C) 1993-2015 John Harper <jsh@unfactored.org>
+
+   This file is part of Librep.
+
+   Librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   Librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+#ifndef PERFECT_HASH_H
+#define PERFECT_HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* FNV-1 with D as the offset basis, and a final avalanche so that the
+   low bits depend on all of the input. Used by mksymtab to build the
+   perfect hash of the builtin symbol names, and by symbols.c to look
+   names up in it, so the two must agree; unlike rep_hash_bytes() it
+   doesn't depend on the run-time seed.
+
+   A name is found by hashing it with D zero to choose a displacement,
+   then either using that directly as the index (when negative), or
+   hashing again with it as D. */
+
+static inline uint32_t
+perfect_hash(uint32_t d, const void *data, size_t len)
+{
+  const uint8_t *p = data;
+  uint32_t h = d ? d : 0x811c9dc5;
+
+  for (size_t i = 0; i < len; i++) {
+    h = (h * 0x01000193) ^ p[i];
+  }
+
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+
+  return h;
+}
+
+#endif /* PERFECT_HASH_H */
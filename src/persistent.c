@@ -0,0 +1,2084 @@
+/* persistent.c -- persistent hash maps and vectors
+
+   Copyright (C) 1993-2015 John Harper <jsh@unfactored.org>
+
+   This file is part of Librep.
+
+   Librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   Librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+/* notes:
+
+   Maps are hash array mapped tries, and vectors are the wide trees of
+   Clojure's PersistentVector, both with 32-way branching. Updating
+   one copies the path from the root to the changed entry, so is
+   O(log32 n), and shares everything else with the original.
+
+   Trie nodes are ordinary vectors, never seen outside this file. Slot
+   zero of each node holds its owner: nil for nodes that may be shared,
+   or the token of the transient that created it. A transient updates
+   the nodes it owns in place, and copies any others on first touch,
+   so a batch of changes only copies each node once. Once a transient
+   is made persistent its token is never used again, and all its nodes
+   are effectively immutable.
+
+   A map node is [OWNER BITMAP K0 V0 K1 V1 ...], with one key-value
+   pair for each bit set in BITMAP, a key of zero meaning that the
+   value is a subnode. Nodes created by transients may have unused
+   slots at the end. Keys whose hash codes are wholly equal go in a
+   collision node, [OWNER -1-HASH K0 V0 ...], searched linearly.
+
+   A vector node is [OWNER E0 ... E31]. The last 1-32 elements of a
+   vector are kept in a separate tail node, outside the tree, so
+   pushing and popping usually only copies the tail.
+
+   As with tables, keys are hashed and compared by the functions given
+   to make-pmap, with the builtin ones called directly. All calls to
+   Lisp are made before anything is allocated by an update, and the
+   updated map and key are protected, so the nodes being built are
+   never seen by the garbage collector half-finished. */
+
+#include "repint.h"
+
+#include <string.h>
+#include <stdint.h>
+
+#ifdef NEED_MEMORY_H
+# include <memory.h>
+#endif
+
+/* Bitmaps are stored as fixnums, so must fit in one. */
+
+#if UINTPTR_MAX > 0xffffffffU
+# define MAP_BITS 5
+#else
+# define MAP_BITS 4
+#endif
+
+#define MAP_WIDTH (1 << MAP_BITS)
+#define MAP_MASK (MAP_WIDTH - 1)
+
+/* Number of bits of each hash code used, a whole number of levels
+   that leaves the result in a fixnum. */
+
+#define HASH_BITS ((((int) sizeof(uintptr_t) * CHAR_BIT) - 4) \
+		   / MAP_BITS * MAP_BITS)
+
+#define HASH_MASK ((((uintptr_t) 1) << HASH_BITS) - 1)
+
+#define VEC_BITS 5
+#define VEC_WIDTH (1 << VEC_BITS)
+#define VEC_MASK (VEC_WIDTH - 1)
+
+#define NODE_OWNER(n) rep_VECTI(n, 0)
+
+#define MAP_BITMAP(n) ((uint32_t) rep_INT(rep_VECTI(n, 1)))
+#define SET_MAP_BITMAP(n, b) (rep_VECTI(n, 1) = rep_MAKE_INT((intptr_t) (b)))
+#define MAP_KEY(n, i) rep_VECTI(n, 2 + 2 * (i))
+#define MAP_VALUE(n, i) rep_VECTI(n, 3 + 2 * (i))
+
+#define COLLISIONP(n) (rep_INT(rep_VECTI(n, 1)) < 0)
+#define COLLISION_HASH(n) ((uintptr_t) (-1 - rep_INT(rep_VECTI(n, 1))))
+#define COLLISION_COUNT(n) ((rep_VECTOR_LEN(n) - 2) / 2)
+
+#define VEC_SLOT(n, i) rep_VECTI(n, 1 + (i))
+
+enum pmap_hash {
+  HASH_LISP,
+  HASH_STRING,
+  HASH_SYMBOL,
+  HASH_EQ,
+  HASH_EQUAL,
+};
+
+enum pmap_compare {
+  COMPARE_LISP,
+  COMPARE_EQ,
+  COMPARE_EQV,
+  COMPARE_EQUAL,
+  COMPARE_STRING,
+};
+
+typedef struct pmap_struct pmap;
+typedef struct pvec_struct pvec;
+
+struct pmap_struct {
+  repv car;
+  pmap *next;
+  repv root;				/* nil when empty */
+  intptr_t count;
+  repv hash_fun;
+  repv compare_fun;
+  repv owner;				/* token when transient, else nil */
+  uint8_t hash_kind;
+  uint8_t compare_kind;
+};
+
+struct pvec_struct {
+  repv car;
+  pvec *next;
+  repv root;				/* nil until there's a full node */
+  repv tail;				/* nil when empty */
+  intptr_t count;
+  int shift;				/* of the root's children */
+  repv owner;
+};
+
+#define PMAPP(v) rep_CELL16_TYPEP(v, pmap_type())
+#define PMAP(v) ((pmap *) rep_PTR(v))
+#define PERSISTENT_PMAPP(v) (PMAPP(v) && PMAP(v)->owner == rep_nil)
+#define TRANSIENT_PMAPP(v) (PMAPP(v) && PMAP(v)->owner != rep_nil)
+
+#define PVECP(v) rep_CELL16_TYPEP(v, pvec_type())
+#define PVEC(v) ((pvec *) rep_PTR(v))
+#define PERSISTENT_PVECP(v) (PVECP(v) && PVEC(v)->owner == rep_nil)
+#define TRANSIENT_PVECP(v) (PVECP(v) && PVEC(v)->owner != rep_nil)
+
+static pmap *all_pmaps;
+static pvec *all_pvecs;
+
+/* Source of owner tokens for transients. */
+
+static intptr_t last_owner;
+
+static repv pmap_type(void);
+static repv pvec_type(void);
+
+
+/* Nodes */
+
+static inline bool
+ownedp(repv owner, repv node)
+{
+  return owner != rep_nil && NODE_OWNER(node) == owner;
+}
+
+static inline void
+node_store(repv node, int i, repv value)
+{
+  rep_VECTI(node, i) = value;
+  rep_GC_WRITE_BARRIER(node, value);
+}
+
+/* Return a vector of LEN slots owned by OWNER, with the rest of its
+   slots zero, or zero if no memory. */
+
+static repv
+new_node(repv owner, int len)
+{
+  repv node = rep_make_vector(len);
+  if (!node) {
+    return rep_mem_error();
+  }
+  NODE_OWNER(node) = owner;
+  memset(&rep_VECTI(node, 1), 0, (len - 1) * sizeof(repv));
+  return node;
+}
+
+/* Return NODE if it belongs to OWNER, else a copy of it that does. */
+
+static repv
+editable_node(repv owner, repv node)
+{
+  if (ownedp(owner, node)) {
+    return node;
+  }
+  int len = rep_VECTOR_LEN(node);
+  repv copy = rep_make_vector(len);
+  if (!copy) {
+    return rep_mem_error();
+  }
+  NODE_OWNER(copy) = owner;
+  memcpy(&rep_VECTI(copy, 1), &rep_VECTI(node, 1), (len - 1) * sizeof(repv));
+  return copy;
+}
+
+static repv
+new_owner(void)
+{
+  return rep_MAKE_INT(++last_owner);
+}
+
+
+/* Maps */
+
+static inline uintptr_t
+mix_hash(uintptr_t hash)
+{
+  const unsigned int bits = sizeof(uintptr_t) * CHAR_BIT;
+  hash *= (uintptr_t) 0x9e3779b97f4a7c15ULL;
+  return hash ^ (hash >> (bits / 2));
+}
+
+static int
+hash_kind(repv fun)
+{
+  if (rep_SUBRP(fun) && rep_SUBR_ARITY(fun) == rep_SUBR_1) {
+    repv (*f)(repv) = rep_SUBR_F1(fun);
+    if (f == Fstring_hash) {
+      return HASH_STRING;
+    } else if (f == Fsymbol_hash) {
+      return HASH_SYMBOL;
+    } else if (f == Feq_hash) {
+      return HASH_EQ;
+    } else if (f == Fequal_hash) {
+      return HASH_EQUAL;
+    }
+  }
+
+  return HASH_LISP;
+}
+
+static int
+compare_kind(repv fun)
+{
+  if (rep_SUBRP(fun) && rep_SUBR_ARITY(fun) == rep_SUBR_2) {
+    repv (*f)(repv, repv) = rep_SUBR_F2(fun);
+    if (f == Feq) {
+      return COMPARE_EQ;
+    } else if (f == Feql) {
+      return COMPARE_EQV;
+    } else if (f == Fequal) {
+      return COMPARE_EQUAL;
+    } else if (f == Fstring_equal) {
+      return COMPARE_STRING;
+    }
+  }
+
+  return COMPARE_LISP;
+}
+
+/* Store the trie hash of KEY in *HASHP, returning false if the hash
+   function exited abnormally. */
+
+static bool
+hash_key(pmap *m, repv key, uintptr_t *hashp)
+{
+  repv hash;
+  switch (m->hash_kind) {
+  case HASH_STRING:
+    hash = Fstring_hash(key);
+    break;
+
+  case HASH_SYMBOL:
+    hash = Fsymbol_hash(key);
+    break;
+
+  case HASH_EQ:
+    hash = Feq_hash(key);
+    break;
+
+  case HASH_EQUAL:
+    hash = Fequal_hash(key);
+    break;
+
+  default:
+    hash = rep_call_lisp1(m->hash_fun, key);
+    break;
+  }
+
+  if (!hash) {
+    return false;
+  }
+
+  *hashp = mix_hash(rep_INT(hash)) & HASH_MASK;
+  return true;
+}
+
+/* Returns 1 if VAL1 and VAL2 are the same key, 0 if not, -1 if the
+   compare function exited abnormally. */
+
+static inline int
+compare(pmap *m, repv val1, repv val2)
+{
+  repv ret;
+  switch (m->compare_kind) {
+  case COMPARE_EQ:
+    return val1 == val2;
+
+  case COMPARE_EQV:
+    ret = Feql(val1, val2);
+    break;
+
+  case COMPARE_EQUAL:
+    return rep_value_cmp(val1, val2) == 0;
+
+  case COMPARE_STRING:
+    ret = Fstring_equal(val1, val2);
+    break;
+
+  default:
+    ret = rep_call_lisp2(m->compare_fun, val1, val2);
+    break;
+  }
+
+  if (!ret) {
+    return -1;
+  }
+
+  return ret != rep_nil;
+}
+
+static inline int
+bit_index(uint32_t bitmap, uint32_t bit)
+{
+  return __builtin_popcount(bitmap & (bit - 1));
+}
+
+static inline uint32_t
+hash_bit(uintptr_t hash, int shift)
+{
+  return ((uint32_t) 1) << ((hash >> shift) & MAP_MASK);
+}
+
+/* Room for N entries in a new map node. Transients leave some spare,
+   so that most insertions can be made in place. */
+
+static inline int
+map_node_capacity(repv owner, int n)
+{
+  if (owner != rep_nil) {
+    n = MIN(n + 4, MAP_WIDTH);
+  }
+  return 2 + 2 * n;
+}
+
+/* Find KEY in the trie at NODE. Returns 1 and stores its value in
+   *VALUEP if found, 0 if not, -1 on error. */
+
+static int
+map_lookup(pmap *m, repv node, uintptr_t hash, repv key, repv *valuep)
+{
+  int shift = 0;
+
+  while (node != rep_nil) {
+    if (COLLISIONP(node)) {
+      if (COLLISION_HASH(node) != hash) {
+	return 0;
+      }
+      for (int i = 0; i < COLLISION_COUNT(node); i++) {
+	int c = compare(m, MAP_KEY(node, i), key);
+	if (c != 0) {
+	  if (c > 0) {
+	    *valuep = MAP_VALUE(node, i);
+	  }
+	  return c;
+	}
+      }
+      return 0;
+    }
+
+    uint32_t bitmap = MAP_BITMAP(node);
+    uint32_t bit = hash_bit(hash, shift);
+    if (!(bitmap & bit)) {
+      return 0;
+    }
+
+    int i = bit_index(bitmap, bit);
+    repv k = MAP_KEY(node, i);
+    if (k == 0) {
+      node = MAP_VALUE(node, i);
+      shift += MAP_BITS;
+      continue;
+    }
+
+    int c = compare(m, k, key);
+    if (c > 0) {
+      *valuep = MAP_VALUE(node, i);
+    }
+    return c;
+  }
+
+  return 0;
+}
+
+/* Return a node at SHIFT holding the two entries K1 and K2. */
+
+static repv
+map_pair_node(repv owner, int shift, repv k1, uintptr_t h1, repv v1,
+	      repv k2, uintptr_t h2, repv v2)
+{
+  repv node;
+
+  if (h1 == h2) {
+    node = new_node(owner, 6);
+    if (node) {
+      rep_VECTI(node, 1) = rep_MAKE_INT(-1 - (intptr_t) h1);
+      MAP_KEY(node, 0) = k1;
+      MAP_VALUE(node, 0) = v1;
+      MAP_KEY(node, 1) = k2;
+      MAP_VALUE(node, 1) = v2;
+    }
+    return node;
+  }
+
+  uint32_t b1 = hash_bit(h1, shift), b2 = hash_bit(h2, shift);
+
+  if (b1 == b2) {
+    repv child = map_pair_node(owner, shift + MAP_BITS,
+			       k1, h1, v1, k2, h2, v2);
+    if (!child) {
+      return 0;
+    }
+    node = new_node(owner, map_node_capacity(owner, 1));
+    if (node) {
+      SET_MAP_BITMAP(node, b1);
+      MAP_VALUE(node, 0) = child;
+    }
+    return node;
+  }
+
+  node = new_node(owner, map_node_capacity(owner, 2));
+  if (node) {
+    int i = b1 < b2 ? 0 : 1;
+    SET_MAP_BITMAP(node, b1 | b2);
+    MAP_KEY(node, i) = k1;
+    MAP_VALUE(node, i) = v1;
+    MAP_KEY(node, 1 - i) = k2;
+    MAP_VALUE(node, 1 - i) = v2;
+  }
+  return node;
+}
+
+/* Insert the entry (K . V) at index I of bitmap node NODE, as BIT. */
+
+static repv
+map_insert_entry(repv owner, repv node, uint32_t bit, int i, repv k, repv v)
+{
+  uint32_t bitmap = MAP_BITMAP(node);
+  int n = __builtin_popcount(bitmap);
+
+  if (ownedp(owner, node) && rep_VECTOR_LEN(node) >= 2 + 2 * (n + 1)) {
+    memmove(&MAP_KEY(node, i + 1), &MAP_KEY(node, i),
+	    2 * (n - i) * sizeof(repv));
+  } else {
+    repv copy = new_node(owner, map_node_capacity(owner, n + 1));
+    if (!copy) {
+      return 0;
+    }
+    memcpy(&MAP_KEY(copy, 0), &MAP_KEY(node, 0), 2 * i * sizeof(repv));
+    memcpy(&MAP_KEY(copy, i + 1), &MAP_KEY(node, i),
+	   2 * (n - i) * sizeof(repv));
+    node = copy;
+  }
+
+  SET_MAP_BITMAP(node, bitmap | bit);
+  node_store(node, 2 + 2 * i, k);
+  node_store(node, 3 + 2 * i, v);
+  return node;
+}
+
+/* Remove the entry at index I of bitmap node NODE, as BIT. Returns
+   nil if that leaves it empty. */
+
+static repv
+map_remove_entry(repv owner, repv node, uint32_t bit, int i)
+{
+  uint32_t bitmap = MAP_BITMAP(node);
+  int n = __builtin_popcount(bitmap);
+
+  if (n == 1) {
+    return rep_nil;
+  }
+
+  if (ownedp(owner, node)) {
+    memmove(&MAP_KEY(node, i), &MAP_KEY(node, i + 1),
+	    2 * (n - i - 1) * sizeof(repv));
+    MAP_KEY(node, n - 1) = 0;
+    MAP_VALUE(node, n - 1) = 0;
+  } else {
+    repv copy = new_node(owner, map_node_capacity(owner, n - 1));
+    if (!copy) {
+      return 0;
+    }
+    memcpy(&MAP_KEY(copy, 0), &MAP_KEY(node, 0), 2 * i * sizeof(repv));
+    memcpy(&MAP_KEY(copy, i), &MAP_KEY(node, i + 1),
+	   2 * (n - i - 1) * sizeof(repv));
+    node = copy;
+  }
+
+  SET_MAP_BITMAP(node, bitmap & ~bit);
+  return node;
+}
+
+/* Return the trie NODE at SHIFT with KEY bound to VALUE, setting
+   *ADDEDP if KEY wasn't already bound. Nodes owned by OWNER are
+   updated in place. Returns zero on error. */
+
+static repv
+map_set(pmap *m, repv owner, repv node, int shift,
+	uintptr_t hash, repv key, repv value, bool *addedp)
+{
+  if (node == rep_nil) {
+    node = new_node(owner, map_node_capacity(owner, 1));
+    if (node) {
+      SET_MAP_BITMAP(node, hash_bit(hash, shift));
+      MAP_KEY(node, 0) = key;
+      MAP_VALUE(node, 0) = value;
+      *addedp = true;
+    }
+    return node;
+  }
+
+  if (COLLISIONP(node)) {
+    if (COLLISION_HASH(node) != hash) {
+      /* Push the collision node down a level, and insert beside it. */
+      repv parent = new_node(owner, map_node_capacity(owner, 1));
+      if (!parent) {
+	return 0;
+      }
+      SET_MAP_BITMAP(parent, hash_bit(COLLISION_HASH(node), shift));
+      MAP_VALUE(parent, 0) = node;
+      return map_set(m, owner, parent, shift, hash, key, value, addedp);
+    }
+
+    int n = COLLISION_COUNT(node);
+    for (int i = 0; i < n; i++) {
+      int c = compare(m, MAP_KEY(node, i), key);
+      if (c < 0) {
+	return 0;
+      } else if (c > 0) {
+	if (MAP_VALUE(node, i) == value) {
+	  return node;
+	}
+	node = editable_node(owner, node);
+	if (node) {
+	  node_store(node, 3 + 2 * i, value);
+	}
+	return node;
+      }
+    }
+
+    repv copy = new_node(owner, 2 + 2 * (n + 1));
+    if (!copy) {
+      return 0;
+    }
+    memcpy(&rep_VECTI(copy, 1), &rep_VECTI(node, 1),
+	   (1 + 2 * n) * sizeof(repv));
+    MAP_KEY(copy, n) = key;
+    MAP_VALUE(copy, n) = value;
+    *addedp = true;
+    return copy;
+  }
+
+  uint32_t bitmap = MAP_BITMAP(node);
+  uint32_t bit = hash_bit(hash, shift);
+  int i = bit_index(bitmap, bit);
+
+  if (!(bitmap & bit)) {
+    *addedp = true;
+    return map_insert_entry(owner, node, bit, i, key, value);
+  }
+
+  repv k = MAP_KEY(node, i), v = MAP_VALUE(node, i);
+
+  if (k == 0) {
+    repv child = map_set(m, owner, v, shift + MAP_BITS,
+			 hash, key, value, addedp);
+    if (!child) {
+      return 0;
+    } else if (child == v) {
+      return node;
+    }
+    node = editable_node(owner, node);
+    if (node) {
+      node_store(node, 3 + 2 * i, child);
+    }
+    return node;
+  }
+
+  int c = compare(m, k, key);
+  if (c < 0) {
+    return 0;
+  } else if (c > 0) {
+    if (v == value) {
+      return node;
+    }
+    node = editable_node(owner, node);
+    if (node) {
+      node_store(node, 3 + 2 * i, value);
+    }
+    return node;
+  }
+
+  uintptr_t h;
+  if (!hash_key(m, k, &h)) {
+    return 0;
+  }
+
+  repv child = map_pair_node(owner, shift + MAP_BITS,
+			     k, h, v, key, hash, value);
+  if (!child) {
+    return 0;
+  }
+
+  *addedp = true;
+  node = editable_node(owner, node);
+  if (node) {
+    MAP_KEY(node, i) = 0;
+    node_store(node, 3 + 2 * i, child);
+  }
+  return node;
+}
+
+/* Return the trie NODE at SHIFT without KEY, setting *REMOVEDP if it
+   was there. Returns nil if the trie is left empty, zero on error. */
+
+static repv
+map_delete(pmap *m, repv owner, repv node, int shift,
+	   uintptr_t hash, repv key, bool *removedp)
+{
+  if (node == rep_nil) {
+    return node;
+  }
+
+  if (COLLISIONP(node)) {
+    if (COLLISION_HASH(node) != hash) {
+      return node;
+    }
+
+    int n = COLLISION_COUNT(node);
+    for (int i = 0; i < n; i++) {
+      int c = compare(m, MAP_KEY(node, i), key);
+      if (c < 0) {
+	return 0;
+      } else if (c > 0) {
+	*removedp = true;
+	if (n == 1) {
+	  return rep_nil;
+	}
+	repv copy = new_node(owner, 2 + 2 * (n - 1));
+	if (!copy) {
+	  return 0;
+	}
+	rep_VECTI(copy, 1) = rep_VECTI(node, 1);
+	memcpy(&MAP_KEY(copy, 0), &MAP_KEY(node, 0), 2 * i * sizeof(repv));
+	memcpy(&MAP_KEY(copy, i), &MAP_KEY(node, i + 1),
+	       2 * (n - i - 1) * sizeof(repv));
+	return copy;
+      }
+    }
+    return node;
+  }
+
+  uint32_t bitmap = MAP_BITMAP(node);
+  uint32_t bit = hash_bit(hash, shift);
+
+  if (!(bitmap & bit)) {
+    return node;
+  }
+
+  int i = bit_index(bitmap, bit);
+  repv k = MAP_KEY(node, i), v = MAP_VALUE(node, i);
+
+  if (k == 0) {
+    repv child = map_delete(m, owner, v, shift + MAP_BITS,
+			    hash, key, removedp);
+    if (!child) {
+      return 0;
+    } else if (child == v) {
+      return node;
+    } else if (child == rep_nil) {
+      return map_remove_entry(owner, node, bit, i);
+    }
+    node = editable_node(owner, node);
+    if (node) {
+      node_store(node, 3 + 2 * i, child);
+    }
+    return node;
+  }
+
+  int c = compare(m, k, key);
+  if (c < 0) {
+    return 0;
+  } else if (c == 0) {
+    return node;
+  }
+
+  *removedp = true;
+  return map_remove_entry(owner, node, bit, i);
+}
+
+/* Call FUN on each entry of the trie at NODE until it returns false. */
+
+static bool
+map_walk(repv node, bool (*fun)(repv key, repv value, void *data),
+	 void *data)
+{
+  if (node == rep_nil) {
+    return true;
+  }
+
+  int n = (COLLISIONP(node) ? COLLISION_COUNT(node)
+	   : __builtin_popcount(MAP_BITMAP(node)));
+
+  for (int i = 0; i < n; i++) {
+    repv k = MAP_KEY(node, i), v = MAP_VALUE(node, i);
+    if (k == 0 ? !map_walk(v, fun, data) : !fun(k, v, data)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static repv
+make_pmap(repv root, intptr_t count, repv hash_fun, repv compare_fun,
+	  repv owner)
+{
+  pmap *m = rep_alloc(sizeof(pmap));
+  if (!m) {
+    return rep_mem_error();
+  }
+  rep_NOTE_ALLOCATION(sizeof(pmap));
+
+  m->car = pmap_type();
+  m->next = all_pmaps;
+  all_pmaps = m;
+  m->root = root;
+  m->count = count;
+  m->hash_fun = hash_fun;
+  m->compare_fun = compare_fun;
+  m->hash_kind = hash_kind(hash_fun);
+  m->compare_kind = compare_kind(compare_fun);
+  m->owner = owner;
+
+  return rep_VAL(m);
+}
+
+/* Return a map like M, but with ROOT and COUNT. */
+
+static repv
+updated_pmap(repv m, repv root, intptr_t count)
+{
+  pmap *p = PMAP(m);
+
+  if (p->owner != rep_nil) {
+    p->root = root;
+    p->count = count;
+    rep_GC_WRITE_BARRIER(m, root);
+    return m;
+  } else if (root == p->root) {
+    return m;
+  } else {
+    return make_pmap(root, count, p->hash_fun, p->compare_fun, rep_nil);
+  }
+}
+
+static repv
+pmap_set(repv m, repv key, repv value)
+{
+  uintptr_t hash;
+  bool added = false;
+
+  rep_GC_root gc_m, gc_key, gc_value;
+  rep_PUSHGC(gc_m, m);
+  rep_PUSHGC(gc_key, key);
+  rep_PUSHGC(gc_value, value);
+
+  pmap *p = PMAP(m);
+  repv root = 0;
+  if (hash_key(p, key, &hash)) {
+    root = map_set(p, p->owner, p->root, 0, hash, key, value, &added);
+  }
+
+  rep_POPGC; rep_POPGC; rep_POPGC;
+
+  if (!root) {
+    return 0;
+  }
+
+  return updated_pmap(m, root, p->count + added);
+}
+
+static repv
+pmap_delete(repv m, repv key)
+{
+  uintptr_t hash;
+  bool removed = false;
+
+  rep_GC_root gc_m, gc_key;
+  rep_PUSHGC(gc_m, m);
+  rep_PUSHGC(gc_key, key);
+
+  pmap *p = PMAP(m);
+  repv root = 0;
+  if (hash_key(p, key, &hash)) {
+    root = map_delete(p, p->owner, p->root, 0, hash, key, &removed);
+  }
+
+  rep_POPGC; rep_POPGC;
+
+  if (!root) {
+    return 0;
+  }
+
+  return updated_pmap(m, root, p->count - removed);
+}
+
+/* Find KEY in map M, as map_lookup(). */
+
+static int
+pmap_lookup(repv m, repv key, repv *valuep)
+{
+  uintptr_t hash;
+  int ret = -1;
+
+  rep_GC_root gc_m, gc_key;
+  rep_PUSHGC(gc_m, m);
+  rep_PUSHGC(gc_key, key);
+
+  if (hash_key(PMAP(m), key, &hash)) {
+    ret = map_lookup(PMAP(m), PMAP(m)->root, hash, key, valuep);
+  }
+
+  rep_POPGC; rep_POPGC;
+
+  return ret;
+}
+
+static bool
+print_entry(repv key, repv value, void *stream)
+{
+  rep_stream_puts(*(repv *) stream, " (", -1, false);
+  rep_print_val(*(repv *) stream, key);
+  rep_stream_puts(*(repv *) stream, " . ", -1, false);
+  rep_print_val(*(repv *) stream, value);
+  rep_stream_putc(*(repv *) stream, ')');
+  return true;
+}
+
+static void
+pmap_print(repv stream, repv arg)
+{
+  if (PMAP(arg)->owner != rep_nil) {
+    rep_stream_puts(stream, "#<pmap transient>", -1, false);
+  } else {
+    rep_stream_puts(stream, "#<pmap", -1, false);
+    map_walk(PMAP(arg)->root, print_entry, &stream);
+    rep_stream_putc(stream, '>');
+  }
+}
+
+static void
+pmap_mark(repv val)
+{
+  pmap *m = PMAP(val);
+  rep_MARKVAL(m->root);
+  rep_MARKVAL(m->hash_fun);
+  rep_MARKVAL(m->compare_fun);
+}
+
+static void
+pmap_sweep(void)
+{
+  pmap *ptr = all_pmaps;
+  all_pmaps = 0;
+
+  while (ptr) {
+    pmap *next = ptr->next;
+    if (!rep_GC_CELL_MARKEDP(rep_VAL(ptr))) {
+      rep_gc_note_freed_cell(rep_VAL(ptr));
+      rep_free(ptr);
+    } else {
+      rep_GC_CLR_CELL(rep_VAL(ptr));
+      ptr->next = all_pmaps;
+      all_pmaps = ptr;
+    }
+    ptr = next;
+  }
+}
+
+static size_t
+pmap_size(repv val)
+{
+  return sizeof(pmap);
+}
+
+struct compare_data {
+  pmap *other;
+  bool equal;
+};
+
+static bool
+compare_entry(repv key, repv value, void *data)
+{
+  struct compare_data *d = data;
+  repv other;
+  uintptr_t hash;
+  if (!hash_key(d->other, key, &hash)
+      || map_lookup(d->other, d->other->root, hash, key, &other) <= 0
+      || rep_value_cmp(value, other) != 0)
+  {
+    d->equal = false;
+  }
+
+  return d->equal;
+}
+
+/* Persistent maps are equal when they have the same hash and compare
+   functions and equal entries. Finding the entries needs their hash
+   function, so this is only possible for the builtin ones. */
+
+static int
+pmap_compare(repv v1, repv v2)
+{
+  if (!PMAPP(v1) || !PMAPP(v2)) {
+    return 1;
+  }
+
+  pmap *m1 = PMAP(v1), *m2 = PMAP(v2);
+
+  if (m1->owner != rep_nil || m2->owner != rep_nil
+      || m1->count != m2->count
+      || m1->hash_fun != m2->hash_fun
+      || m1->compare_fun != m2->compare_fun
+      || m1->hash_kind == HASH_LISP
+      || m1->compare_kind == COMPARE_LISP)
+  {
+    return 1;
+  }
+
+  struct compare_data data = {m2, true};
+  map_walk(m1->root, compare_entry, &data);
+
+  return !data.equal;
+}
+
+struct hash_data {
+  uintptr_t hash;
+  unsigned int depth;
+};
+
+static bool
+hash_entry(repv key, repv value, void *data)
+{
+  struct hash_data *d = data;
+
+  /* Summed, so that the order of the entries doesn't matter. */
+
+  d->hash += mix_hash(rep_equal_hash(key, d->depth)
+		      ^ mix_hash(rep_equal_hash(value, d->depth)));
+  return true;
+}
+
+static uintptr_t
+pmap_hash(repv val, unsigned int depth)
+{
+  pmap *m = PMAP(val);
+
+  if (m->owner != rep_nil) {
+    return mix_hash(rep_VAL(m));
+  }
+
+  struct hash_data data = {m->count, depth / 2};
+  map_walk(m->root, hash_entry, &data);
+
+  return mix_hash(data.hash);
+}
+
+static repv
+pmap_type(void)
+{
+  static repv type;
+
+  if (!type) {
+    static rep_type pmap = {
+      .name = "pmap",
+      .compare = pmap_compare,
+      .print = pmap_print,
+      .mark = pmap_mark,
+      .sweep = pmap_sweep,
+      .size = pmap_size,
+      .hash = pmap_hash,
+    };
+
+    type = rep_define_type(&pmap);
+  }
+
+  return type;
+}
+
+DEFUN("make-pmap", Fmake_pmap, Smake_pmap,
+      (repv hash_fun, repv cmp_fun), rep_Subr2) /*
+::doc:rep.data.persistent#make-pmap::
+make-pmap [HASH-FUNCTION] [COMPARE-FUNCTION]
+
+Return a new empty persistent map, using HASH-FUNCTION to map its keys
+to hash codes and COMPARE-FUNCTION to test whether two keys are the
+same, as with `make-table'. These default to `equal-hash' and `equal?'.
+::end:: */
+{
+  if (hash_fun == rep_nil) {
+    hash_fun = rep_VAL(&Sequal_hash);
+  }
+  if (cmp_fun == rep_nil) {
+    cmp_fun = rep_VAL(&Sequal);
+  }
+
+  rep_DECLARE(1, hash_fun, Ffunctionp(hash_fun) != rep_nil);
+  rep_DECLARE(2, cmp_fun, Ffunctionp(cmp_fun) != rep_nil);
+
+  return make_pmap(rep_nil, 0, hash_fun, cmp_fun, rep_nil);
+}
+
+DEFUN("alist->pmap", Falist_to_pmap, Salist_to_pmap,
+      (repv alist, repv hash_fun, repv cmp_fun), rep_Subr3) /*
+::doc:rep.data.persistent#alist->pmap::
+alist->pmap ALIST [HASH-FUNCTION] [COMPARE-FUNCTION]
+
+Return a new persistent map containing the `(KEY . VALUE)' pairs of
+the association list ALIST. Where a key occurs more than once, its
+first value is used. The functions are as for `make-pmap'.
+::end:: */
+{
+  rep_DECLARE1(alist, rep_LISTP);
+
+  /* Reversed, so the first binding of each key wins. */
+
+  repv rev = Freverse(alist);
+  repv m = rev ? Fmake_pmap(hash_fun, cmp_fun) : 0;
+  if (!m) {
+    return 0;
+  }
+
+  rep_GC_root gc_rev, gc_m;
+  rep_PUSHGC(gc_rev, rev);
+  rep_PUSHGC(gc_m, m);
+
+  PMAP(m)->owner = new_owner();
+
+  for (; m && rep_CONSP(rev); rev = rep_CDR(rev)) {
+    repv cell = rep_CAR(rev);
+    if (!rep_CONSP(cell)) {
+      m = rep_signal_arg_error(alist, 1);
+    } else {
+      m = pmap_set(m, rep_CAR(cell), rep_CDR(cell));
+    }
+  }
+
+  rep_POPGC; rep_POPGC;
+
+  if (m) {
+    PMAP(m)->owner = rep_nil;
+  }
+
+  return m;
+}
+
+DEFUN("pmap?", Fpmapp, Spmapp, (repv arg), rep_Subr1) /*
+::doc:rep.data.persistent#pmap?::
+pmap? ARG
+
+Return true if ARG is a persistent map, or a transient one.
+::end:: */
+{
+  return PMAPP(arg) ? Qt : rep_nil;
+}
+
+DEFUN("pmap-size", Fpmap_size, Spmap_size, (repv m), rep_Subr1) /*
+::doc:rep.data.persistent#pmap-size::
+pmap-size MAP
+
+Return the number of keys bound in MAP.
+::end:: */
+{
+  rep_DECLARE1(m, PMAPP);
+
+  return rep_make_long_int(PMAP(m)->count);
+}
+
+DEFUN("pmap-ref", Fpmap_ref, Spmap_ref,
+      (repv m, repv key, repv dflt), rep_Subr3) /*
+::doc:rep.data.persistent#pmap-ref::
+pmap-ref MAP KEY [DEFAULT]
+
+Return the value bound to KEY in MAP, or DEFAULT (false if not given)
+when KEY isn't bound.
+::end:: */
+{
+  rep_DECLARE1(m, PMAPP);
+
+  repv value;
+  switch (pmap_lookup(m, key, &value)) {
+  case 1:
+    return value;
+
+  case 0:
+    return dflt;
+
+  default:
+    return 0;
+  }
+}
+
+DEFUN("pmap-bound?", Fpmap_bound_p, Spmap_bound_p,
+      (repv m, repv key), rep_Subr2) /*
+::doc:rep.data.persistent#pmap-bound?::
+pmap-bound? MAP KEY
+
+Return true if KEY is bound in MAP.
+::end:: */
+{
+  rep_DECLARE1(m, PMAPP);
+
+  repv value;
+  int ret = pmap_lookup(m, key, &value);
+
+  return ret < 0 ? 0 : ret > 0 ? Qt : rep_nil;
+}
+
+DEFUN("pmap-set", Fpmap_set, Spmap_set,
+      (repv m, repv key, repv value), rep_Subr3) /*
+::doc:rep.data.persistent#pmap-set::
+pmap-set MAP KEY VALUE
+
+Return a persistent map the same as MAP, but with KEY bound to VALUE.
+MAP itself is unchanged.
+::end:: */
+{
+  rep_DECLARE1(m, PERSISTENT_PMAPP);
+
+  return pmap_set(m, key, value);
+}
+
+DEFUN("pmap-delete", Fpmap_delete, Spmap_delete,
+      (repv m, repv key), rep_Subr2) /*
+::doc:rep.data.persistent#pmap-delete::
+pmap-delete MAP KEY
+
+Return a persistent map the same as MAP, but with KEY unbound. MAP
+itself is unchanged.
+::end:: */
+{
+  rep_DECLARE1(m, PERSISTENT_PMAPP);
+
+  return pmap_delete(m, key);
+}
+
+struct walk_data {
+  repv fun;
+  bool failed;
+};
+
+static bool
+call_entry(repv key, repv value, void *data)
+{
+  struct walk_data *d = data;
+
+  if (!rep_call_lisp2(d->fun, key, value)) {
+    d->failed = true;
+  }
+
+  return !d->failed;
+}
+
+DEFUN("pmap-for-each", Fpmap_for_each, Spmap_for_each,
+      (repv fun, repv m), rep_Subr2) /*
+::doc:rep.data.persistent#pmap-for-each::
+pmap-for-each FUNCTION MAP
+
+Call FUNCTION with arguments `(KEY VALUE)' for each key bound in the
+persistent map MAP.
+::end:: */
+{
+  rep_DECLARE2(m, PERSISTENT_PMAPP);
+
+  rep_GC_root gc_fun, gc_m;
+  rep_PUSHGC(gc_fun, fun);
+  rep_PUSHGC(gc_m, m);
+
+  struct walk_data data = {fun, false};
+  map_walk(PMAP(m)->root, call_entry, &data);
+
+  rep_POPGC; rep_POPGC;
+
+  return data.failed ? 0 : rep_undefined_value;
+}
+
+static bool
+cons_entry(repv key, repv value, void *data)
+{
+  repv cell = Fcons(key, value);
+  repv *list = data;
+
+  if (cell) {
+    *list = Fcons(cell, *list);
+  }
+
+  return cell && *list;
+}
+
+DEFUN("pmap->alist", Fpmap_to_alist, Spmap_to_alist, (repv m), rep_Subr1) /*
+::doc:rep.data.persistent#pmap->alist::
+pmap->alist MAP
+
+Return a new association list of the `(KEY . VALUE)' pairs bound in
+the persistent map MAP, in no particular order.
+::end:: */
+{
+  rep_DECLARE1(m, PERSISTENT_PMAPP);
+
+  repv list = rep_nil;
+
+  return map_walk(PMAP(m)->root, cons_entry, &list) ? list : 0;
+}
+
+DEFUN("pmap-transient", Fpmap_transient, Spmap_transient,
+      (repv m), rep_Subr1) /*
+::doc:rep.data.persistent#pmap-transient::
+pmap-transient MAP
+
+Return a transient map holding the same entries as the persistent map
+MAP. It may be changed in place by `pmap-set!' and `pmap-delete!',
+much more cheaply than making a new persistent map for each change,
+until `pmap-persistent!' turns it back into a persistent map. MAP is
+never affected by changes to the transient.
+::end:: */
+{
+  rep_DECLARE1(m, PERSISTENT_PMAPP);
+
+  pmap *p = PMAP(m);
+
+  return make_pmap(p->root, p->count, p->hash_fun, p->compare_fun,
+		   new_owner());
+}
+
+DEFUN("pmap-set!", Fpmap_set_, Spmap_set_,
+      (repv m, repv key, repv value), rep_Subr3) /*
+::doc:rep.data.persistent#pmap-set!::
+pmap-set! TRANSIENT KEY VALUE
+
+Bind KEY to VALUE in the transient map TRANSIENT, returning it.
+::end:: */
+{
+  rep_DECLARE1(m, TRANSIENT_PMAPP);
+
+  return pmap_set(m, key, value);
+}
+
+DEFUN("pmap-delete!", Fpmap_delete_, Spmap_delete_,
+      (repv m, repv key), rep_Subr2) /*
+::doc:rep.data.persistent#pmap-delete!::
+pmap-delete! TRANSIENT KEY
+
+Remove any binding of KEY from the transient map TRANSIENT, returning
+it.
+::end:: */
+{
+  rep_DECLARE1(m, TRANSIENT_PMAPP);
+
+  return pmap_delete(m, key);
+}
+
+DEFUN("pmap-persistent!", Fpmap_persistent_, Spmap_persistent_,
+      (repv m), rep_Subr1) /*
+::doc:rep.data.persistent#pmap-persistent!::
+pmap-persistent! TRANSIENT
+
+Turn the transient map TRANSIENT into a persistent map, and return it.
+It may no longer be changed in place.
+::end:: */
+{
+  rep_DECLARE1(m, TRANSIENT_PMAPP);
+
+  PMAP(m)->owner = rep_nil;
+
+  return m;
+}
+
+
+/* Vectors */
+
+static inline intptr_t
+tail_offset(intptr_t count)
+{
+  return count < VEC_WIDTH ? 0 : ((count - 1) >> VEC_BITS) << VEC_BITS;
+}
+
+/* Return the node holding element I of V. */
+
+static repv
+vec_node_for(pvec *v, intptr_t i)
+{
+  if (i >= tail_offset(v->count)) {
+    return v->tail;
+  }
+
+  repv node = v->root;
+  for (int level = v->shift; level > 0; level -= VEC_BITS) {
+    node = VEC_SLOT(node, (i >> level) & VEC_MASK);
+  }
+  return node;
+}
+
+static repv
+new_vec_node(repv owner)
+{
+  repv node = new_node(owner, 1 + VEC_WIDTH);
+  if (node) {
+    for (int i = 0; i < VEC_WIDTH; i++) {
+      VEC_SLOT(node, i) = rep_nil;
+    }
+  }
+  return node;
+}
+
+/* Return a new tail owned by OWNER with the first N elements of TAIL.
+   Persistent tails are only as long as needed for N+EXTRA elements,
+   transient ones have room for a whole node. */
+
+static repv
+copy_tail(repv owner, repv tail, int n, int extra)
+{
+  int len = owner != rep_nil ? 1 + VEC_WIDTH : 1 + n + extra;
+  repv node = rep_make_vector(len);
+  if (!node) {
+    return rep_mem_error();
+  }
+  NODE_OWNER(node) = owner;
+  if (n > 0) {
+    memcpy(&VEC_SLOT(node, 0), &VEC_SLOT(tail, 0), n * sizeof(repv));
+  }
+  for (int i = n; i < len - 1; i++) {
+    VEC_SLOT(node, i) = rep_nil;
+  }
+  return node;
+}
+
+/* Return a chain of nodes down from LEVEL leading to NODE. */
+
+static repv
+vec_new_path(repv owner, int level, repv node)
+{
+  while (level > 0 && node) {
+    repv parent = new_vec_node(owner);
+    if (parent) {
+      VEC_SLOT(parent, 0) = node;
+    }
+    node = parent;
+    level -= VEC_BITS;
+  }
+  return node;
+}
+
+/* Add the full node TAIL to the tree at PARENT, as elements COUNT-32
+   to COUNT-1. */
+
+static repv
+vec_push_tail(repv owner, intptr_t count, int level, repv parent, repv tail)
+{
+  int i = ((count - 1) >> level) & VEC_MASK;
+  repv child;
+
+  if (level == VEC_BITS) {
+    child = tail;
+  } else if (VEC_SLOT(parent, i) != rep_nil) {
+    child = vec_push_tail(owner, count, level - VEC_BITS,
+			  VEC_SLOT(parent, i), tail);
+  } else {
+    child = vec_new_path(owner, level - VEC_BITS, tail);
+  }
+
+  if (!child) {
+    return 0;
+  }
+
+  parent = editable_node(owner, parent);
+  if (parent) {
+    node_store(parent, 1 + i, child);
+  }
+  return parent;
+}
+
+/* Remove the last leaf, holding elements up to COUNT-1, from the tree
+   at NODE. Returns nil if that leaves NODE empty. */
+
+static repv
+vec_pop_tail(repv owner, intptr_t count, int level, repv node)
+{
+  int i = ((count - 2) >> level) & VEC_MASK;
+  repv child;
+
+  if (level > VEC_BITS) {
+    child = vec_pop_tail(owner, count, level - VEC_BITS, VEC_SLOT(node, i));
+    if (!child) {
+      return 0;
+    } else if (child == rep_nil && i == 0) {
+      return rep_nil;
+    }
+  } else if (i == 0) {
+    return rep_nil;
+  } else {
+    child = rep_nil;
+  }
+
+  node = editable_node(owner, node);
+  if (node) {
+    node_store(node, 1 + i, child);
+  }
+  return node;
+}
+
+static repv
+vec_assoc(repv owner, int level, repv node, intptr_t i, repv x)
+{
+  int j = (i >> level) & VEC_MASK;
+  repv child;
+
+  if (level == 0) {
+    child = x;
+  } else {
+    child = vec_assoc(owner, level - VEC_BITS, VEC_SLOT(node, j), i, x);
+    if (!child) {
+      return 0;
+    }
+  }
+
+  node = editable_node(owner, node);
+  if (node) {
+    node_store(node, 1 + j, child);
+  }
+  return node;
+}
+
+/* The following update the fields of *V, using OWNER for new nodes,
+   returning false on error. */
+
+static bool
+vec_push(pvec *v, repv owner, repv x)
+{
+  intptr_t count = v->count;
+  int n = count - tail_offset(count);
+
+  if (n < VEC_WIDTH) {
+    repv tail = v->tail;
+    if (tail == rep_nil || !ownedp(owner, tail)) {
+      tail = copy_tail(owner, tail, n, 1);
+      if (!tail) {
+	return false;
+      }
+    }
+    node_store(tail, 1 + n, x);
+    v->tail = tail;
+    v->count++;
+    return true;
+  }
+
+  repv root = v->root;
+  int shift = v->shift;
+
+  if (root == rep_nil) {
+    root = new_vec_node(owner);
+    if (!root) {
+      return false;
+    }
+  }
+
+  if ((count >> VEC_BITS) > (((intptr_t) 1) << shift)) {
+    repv path = vec_new_path(owner, shift, v->tail);
+    repv parent = path ? new_vec_node(owner) : 0;
+    if (!parent) {
+      return false;
+    }
+    VEC_SLOT(parent, 0) = root;
+    VEC_SLOT(parent, 1) = path;
+    root = parent;
+    shift += VEC_BITS;
+  } else {
+    root = vec_push_tail(owner, count, shift, root, v->tail);
+    if (!root) {
+      return false;
+    }
+  }
+
+  repv tail = copy_tail(owner, rep_nil, 0, 1);
+  if (!tail) {
+    return false;
+  }
+  VEC_SLOT(tail, 0) = x;
+
+  v->root = root;
+  v->shift = shift;
+  v->tail = tail;
+  v->count++;
+  return true;
+}
+
+static bool
+vec_pop(pvec *v, repv owner)
+{
+  intptr_t count = v->count;
+  int n = count - tail_offset(count);
+
+  if (count == 1) {
+    v->root = rep_nil;
+    v->tail = rep_nil;
+    v->shift = VEC_BITS;
+  } else if (n > 1) {
+    if (ownedp(owner, v->tail)) {
+      VEC_SLOT(v->tail, n - 1) = rep_nil;
+    } else {
+      repv tail = copy_tail(owner, v->tail, n - 1, 0);
+      if (!tail) {
+	return false;
+      }
+      v->tail = tail;
+    }
+  } else {
+    repv tail = vec_node_for(v, count - 2);
+    repv root = vec_pop_tail(owner, count, v->shift, v->root);
+    if (!root) {
+      return false;
+    }
+    if (root != rep_nil && v->shift > VEC_BITS
+	&& VEC_SLOT(root, 1) == rep_nil)
+    {
+      root = VEC_SLOT(root, 0);
+      v->shift -= VEC_BITS;
+    }
+    v->root = root;
+    v->tail = tail;
+  }
+
+  v->count--;
+  return true;
+}
+
+static bool
+vec_set(pvec *v, repv owner, intptr_t i, repv x)
+{
+  intptr_t offset = tail_offset(v->count);
+
+  if (i >= offset) {
+    repv tail = v->tail;
+    if (!ownedp(owner, tail)) {
+      tail = copy_tail(owner, tail, v->count - offset, 0);
+      if (!tail) {
+	return false;
+      }
+    }
+    node_store(tail, 1 + i - offset, x);
+    v->tail = tail;
+  } else {
+    repv root = vec_assoc(owner, v->shift, v->root, i, x);
+    if (!root) {
+      return false;
+    }
+    v->root = root;
+  }
+
+  return true;
+}
+
+static repv
+make_pvec(pvec *from, repv owner)
+{
+  pvec *v = rep_alloc(sizeof(pvec));
+  if (!v) {
+    return rep_mem_error();
+  }
+  rep_NOTE_ALLOCATION(sizeof(pvec));
+
+  v->car = pvec_type();
+  v->next = all_pvecs;
+  all_pvecs = v;
+  if (from) {
+    v->root = from->root;
+    v->tail = from->tail;
+    v->count = from->count;
+    v->shift = from->shift;
+  } else {
+    v->root = rep_nil;
+    v->tail = rep_nil;
+    v->count = 0;
+    v->shift = VEC_BITS;
+  }
+  v->owner = owner;
+
+  return rep_VAL(v);
+}
+
+/* Return from the calling function after evaluating EXPR, an update
+   of the pvec V by OWNER. A transient VEC is updated in place, else
+   V is a copy of it, made into a new persistent vector. */
+
+#define UPDATE_PVEC(vec, expr)					\
+  do {								\
+    pvec *v_ = PVEC(vec), copy_ = *v_;				\
+    if (v_->owner != rep_nil) {					\
+      pvec *v = v_;						\
+      repv owner = v->owner;					\
+      if (!(expr)) {						\
+	return 0;						\
+      }								\
+      rep_GC_WRITE_BARRIER(vec, v->root);			\
+      rep_GC_WRITE_BARRIER(vec, v->tail);			\
+      return vec;						\
+    } else {							\
+      pvec *v = &copy_;						\
+      repv owner = rep_nil;					\
+      if (!(expr)) {						\
+	return 0;						\
+      }								\
+      return make_pvec(v, rep_nil);				\
+    }								\
+  } while (0)
+
+static void
+pvec_print(repv stream, repv arg)
+{
+  pvec *v = PVEC(arg);
+
+  if (v->owner != rep_nil) {
+    rep_stream_puts(stream, "#<pvector transient>", -1, false);
+    return;
+  }
+
+  rep_stream_puts(stream, "#<pvector", -1, false);
+  for (intptr_t i = 0; i < v->count; i++) {
+    repv node = vec_node_for(v, i);
+    rep_stream_putc(stream, ' ');
+    rep_print_val(stream, VEC_SLOT(node, i & VEC_MASK));
+  }
+  rep_stream_putc(stream, '>');
+}
+
+static void
+pvec_mark(repv val)
+{
+  rep_MARKVAL(PVEC(val)->root);
+  rep_MARKVAL(PVEC(val)->tail);
+}
+
+static void
+pvec_sweep(void)
+{
+  pvec *ptr = all_pvecs;
+  all_pvecs = 0;
+
+  while (ptr) {
+    pvec *next = ptr->next;
+    if (!rep_GC_CELL_MARKEDP(rep_VAL(ptr))) {
+      rep_gc_note_freed_cell(rep_VAL(ptr));
+      rep_free(ptr);
+    } else {
+      rep_GC_CLR_CELL(rep_VAL(ptr));
+      ptr->next = all_pvecs;
+      all_pvecs = ptr;
+    }
+    ptr = next;
+  }
+}
+
+static size_t
+pvec_size(repv val)
+{
+  return sizeof(pvec);
+}
+
+static int
+pvec_compare(repv v1, repv v2)
+{
+  if (!PVECP(v1) || !PVECP(v2)) {
+    return 1;
+  }
+
+  pvec *a = PVEC(v1), *b = PVEC(v2);
+
+  if (a->owner != rep_nil || b->owner != rep_nil || a->count != b->count) {
+    return 1;
+  }
+
+  for (intptr_t i = 0; i < a->count; i += VEC_WIDTH) {
+    repv na = vec_node_for(a, i), nb = vec_node_for(b, i);
+    if (na != nb) {
+      int n = MIN(VEC_WIDTH, a->count - i);
+      for (int j = 0; j < n; j++) {
+	if (rep_value_cmp(VEC_SLOT(na, j), VEC_SLOT(nb, j)) != 0) {
+	  return 1;
+	}
+      }
+    }
+  }
+
+  return 0;
+}
+
+static uintptr_t
+pvec_hash(repv val, unsigned int depth)
+{
+  pvec *v = PVEC(val);
+
+  if (v->owner != rep_nil) {
+    return mix_hash(rep_VAL(v));
+  }
+
+  uintptr_t hash = v->count;
+  intptr_t n = MIN(depth, v->count);
+  for (intptr_t i = 0; i < n; i++) {
+    repv node = vec_node_for(v, i);
+    hash = mix_hash(hash ^ rep_equal_hash(VEC_SLOT(node, i & VEC_MASK),
+					  depth / 2));
+  }
+
+  return hash;
+}
+
+static repv
+pvec_type(void)
+{
+  static repv type;
+
+  if (!type) {
+    static rep_type pvec = {
+      .name = "pvector",
+      .compare = pvec_compare,
+      .print = pvec_print,
+      .mark = pvec_mark,
+      .sweep = pvec_sweep,
+      .size = pvec_size,
+      .hash = pvec_hash,
+    };
+
+    type = rep_define_type(&pvec);
+  }
+
+  return type;
+}
+
+static repv
+list_to_pvec(repv list)
+{
+  repv vec = make_pvec(NULL, new_owner());
+  if (!vec) {
+    return 0;
+  }
+
+  pvec *v = PVEC(vec);
+  while (rep_CONSP(list)) {
+    if (!vec_push(v, v->owner, rep_CAR(list))) {
+      return 0;
+    }
+    list = rep_CDR(list);
+  }
+
+  v->owner = rep_nil;
+  return vec;
+}
+
+DEFUN("pvector", Fpvector, Spvector, (int argc, repv *argv), rep_SubrV) /*
+::doc:rep.data.persistent#pvector::
+pvector ARGS...
+
+Return a new persistent vector with ARGS... as its elements.
+::end:: */
+{
+  repv vec = make_pvec(NULL, new_owner());
+  if (!vec) {
+    return 0;
+  }
+
+  pvec *v = PVEC(vec);
+  for (int i = 0; i < argc; i++) {
+    if (!vec_push(v, v->owner, argv[i])) {
+      return 0;
+    }
+  }
+
+  v->owner = rep_nil;
+  return vec;
+}
+
+DEFUN("list->pvector", Flist_to_pvector, Slist_to_pvector,
+      (repv list), rep_Subr1) /*
+::doc:rep.data.persistent#list->pvector::
+list->pvector LIST
+
+Return a new persistent vector with the elements of LIST.
+::end:: */
+{
+  rep_DECLARE1(list, rep_LISTP);
+
+  return list_to_pvec(list);
+}
+
+DEFUN("pvector->list", Fpvector_to_list, Spvector_to_list,
+      (repv vec), rep_Subr1) /*
+::doc:rep.data.persistent#pvector->list::
+pvector->list VECTOR
+
+Return a new list of the elements of the persistent vector VECTOR.
+::end:: */
+{
+  rep_DECLARE1(vec, PERSISTENT_PVECP);
+
+  pvec *v = PVEC(vec);
+  repv list = rep_nil;
+
+  for (intptr_t i = v->count - 1; i >= 0; i--) {
+    repv node = vec_node_for(v, i);
+    list = Fcons(VEC_SLOT(node, i & VEC_MASK), list);
+    if (!list) {
+      return 0;
+    }
+  }
+
+  return list;
+}
+
+DEFUN("pvector?", Fpvectorp, Spvectorp, (repv arg), rep_Subr1) /*
+::doc:rep.data.persistent#pvector?::
+pvector? ARG
+
+Return true if ARG is a persistent vector, or a transient one.
+::end:: */
+{
+  return PVECP(arg) ? Qt : rep_nil;
+}
+
+DEFUN("pvector-length", Fpvector_length, Spvector_length,
+      (repv vec), rep_Subr1) /*
+::doc:rep.data.persistent#pvector-length::
+pvector-length VECTOR
+
+Return the number of elements in VECTOR.
+::end:: */
+{
+  rep_DECLARE1(vec, PVECP);
+
+  return rep_make_long_int(PVEC(vec)->count);
+}
+
+DEFUN("pvector-ref", Fpvector_ref, Spvector_ref,
+      (repv vec, repv idx), rep_Subr2) /*
+::doc:rep.data.persistent#pvector-ref::
+pvector-ref VECTOR INDEX
+
+Return the INDEX'th element of VECTOR.
+::end:: */
+{
+  rep_DECLARE1(vec, PVECP);
+  rep_DECLARE2(idx, rep_NON_NEG_INT_P);
+
+  pvec *v = PVEC(vec);
+  intptr_t i = rep_INT(idx);
+
+  if (i >= v->count) {
+    return rep_signal_arg_error(idx, 2);
+  }
+
+  return VEC_SLOT(vec_node_for(v, i), i & VEC_MASK);
+}
+
+DEFUN("pvector-set", Fpvector_set, Spvector_set,
+      (repv vec, repv idx, repv value), rep_Subr3) /*
+::doc:rep.data.persistent#pvector-set::
+pvector-set VECTOR INDEX VALUE
+
+Return a persistent vector the same as VECTOR but with its INDEX'th
+element set to VALUE. INDEX may be the length of VECTOR, adding VALUE
+to its end.
+::end:: */
+{
+  rep_DECLARE1(vec, PERSISTENT_PVECP);
+  rep_DECLARE2(idx, rep_NON_NEG_INT_P);
+
+  intptr_t i = rep_INT(idx);
+
+  if (i > PVEC(vec)->count) {
+    return rep_signal_arg_error(idx, 2);
+  }
+
+  UPDATE_PVEC(vec, (i == v->count ? vec_push(v, owner, value)
+		    : vec_set(v, owner, i, value)));
+}
+
+DEFUN("pvector-push", Fpvector_push, Spvector_push,
+      (repv vec, repv value), rep_Subr2) /*
+::doc:rep.data.persistent#pvector-push::
+pvector-push VECTOR VALUE
+
+Return a persistent vector the same as VECTOR but with VALUE added to
+its end.
+::end:: */
+{
+  rep_DECLARE1(vec, PERSISTENT_PVECP);
+
+  UPDATE_PVEC(vec, vec_push(v, owner, value));
+}
+
+DEFUN("pvector-pop", Fpvector_pop, Spvector_pop, (repv vec), rep_Subr1) /*
+::doc:rep.data.persistent#pvector-pop::
+pvector-pop VECTOR
+
+Return a persistent vector the same as VECTOR but without its last
+element. VECTOR may not be empty.
+::end:: */
+{
+  rep_DECLARE(1, vec, PERSISTENT_PVECP(vec) && PVEC(vec)->count > 0);
+
+  UPDATE_PVEC(vec, vec_pop(v, owner));
+}
+
+DEFUN("pvector-for-each", Fpvector_for_each, Spvector_for_each,
+      (repv fun, repv vec), rep_Subr2) /*
+::doc:rep.data.persistent#pvector-for-each::
+pvector-for-each FUNCTION VECTOR
+
+Call FUNCTION on each element of the persistent vector VECTOR, in
+order.
+::end:: */
+{
+  rep_DECLARE2(vec, PERSISTENT_PVECP);
+
+  rep_GC_root gc_fun, gc_vec;
+  rep_PUSHGC(gc_fun, fun);
+  rep_PUSHGC(gc_vec, vec);
+
+  pvec *v = PVEC(vec);
+  repv ret = rep_undefined_value;
+
+  for (intptr_t i = 0; i < v->count && ret; i++) {
+    repv node = vec_node_for(v, i);
+    if (!rep_call_lisp1(fun, VEC_SLOT(node, i & VEC_MASK))) {
+      ret = 0;
+    }
+  }
+
+  rep_POPGC; rep_POPGC;
+
+  return ret;
+}
+
+DEFUN("pvector-transient", Fpvector_transient, Spvector_transient,
+      (repv vec), rep_Subr1) /*
+::doc:rep.data.persistent#pvector-transient::
+pvector-transient VECTOR
+
+Return a transient vector holding the same elements as the persistent
+vector VECTOR, that may be changed in place by `pvector-set!',
+`pvector-push!' and `pvector-pop!', until `pvector-persistent!' turns
+it back into a persistent vector. VECTOR is never affected by changes
+to the transient.
+::end:: */
+{
+  rep_DECLARE1(vec, PERSISTENT_PVECP);
+
+  return make_pvec(PVEC(vec), new_owner());
+}
+
+DEFUN("pvector-set!", Fpvector_set_, Spvector_set_,
+      (repv vec, repv idx, repv value), rep_Subr3) /*
+::doc:rep.data.persistent#pvector-set!::
+pvector-set! TRANSIENT INDEX VALUE
+
+Set the INDEX'th element of the transient vector TRANSIENT to VALUE,
+returning TRANSIENT. INDEX may be its length, adding VALUE to its end.
+::end:: */
+{
+  rep_DECLARE1(vec, TRANSIENT_PVECP);
+  rep_DECLARE2(idx, rep_NON_NEG_INT_P);
+
+  intptr_t i = rep_INT(idx);
+
+  if (i > PVEC(vec)->count) {
+    return rep_signal_arg_error(idx, 2);
+  }
+
+  UPDATE_PVEC(vec, (i == v->count ? vec_push(v, owner, value)
+		    : vec_set(v, owner, i, value)));
+}
+
+DEFUN("pvector-push!", Fpvector_push_, Spvector_push_,
+      (repv vec, repv value), rep_Subr2) /*
+::doc:rep.data.persistent#pvector-push!::
+pvector-push! TRANSIENT VALUE
+
+Add VALUE to the end of the transient vector TRANSIENT, returning it.
+::end:: */
+{
+  rep_DECLARE1(vec, TRANSIENT_PVECP);
+
+  UPDATE_PVEC(vec, vec_push(v, owner, value));
+}
+
+DEFUN("pvector-pop!", Fpvector_pop_, Spvector_pop_, (repv vec), rep_Subr1) /*
+::doc:rep.data.persistent#pvector-pop!::
+pvector-pop! TRANSIENT
+
+Remove the last element of the transient vector TRANSIENT, returning
+it. TRANSIENT may not be empty.
+::end:: */
+{
+  rep_DECLARE(1, vec, TRANSIENT_PVECP(vec) && PVEC(vec)->count > 0);
+
+  UPDATE_PVEC(vec, vec_pop(v, owner));
+}
+
+DEFUN("pvector-persistent!", Fpvector_persistent_, Spvector_persistent_,
+      (repv vec), rep_Subr1) /*
+::doc:rep.data.persistent#pvector-persistent!::
+pvector-persistent! TRANSIENT
+
+Turn the transient vector TRANSIENT into a persistent vector, and
+return it. It may no longer be changed in place.
+::end:: */
+{
+  rep_DECLARE1(vec, TRANSIENT_PVECP);
+
+  PVEC(vec)->owner = rep_nil;
+
+  return vec;
+}
+
+static void
+persistent_init(void)
+{
+  rep_ADD_SUBR(Smake_pmap);
+  rep_ADD_SUBR(Salist_to_pmap);
+  rep_ADD_SUBR(Spmapp);
+  rep_ADD_SUBR(Spmap_size);
+  rep_ADD_SUBR(Spmap_ref);
+  rep_ADD_SUBR(Spmap_bound_p);
+  rep_ADD_SUBR(Spmap_set);
+  rep_ADD_SUBR(Spmap_delete);
+  rep_ADD_SUBR(Spmap_for_each);
+  rep_ADD_SUBR(Spmap_to_alist);
+  rep_ADD_SUBR(Spmap_transient);
+  rep_ADD_SUBR(Spmap_set_);
+  rep_ADD_SUBR(Spmap_delete_);
+  rep_ADD_SUBR(Spmap_persistent_);
+  rep_ADD_SUBR(Spvector);
+  rep_ADD_SUBR(Slist_to_pvector);
+  rep_ADD_SUBR(Spvector_to_list);
+  rep_ADD_SUBR(Spvectorp);
+  rep_ADD_SUBR(Spvector_length);
+  rep_ADD_SUBR(Spvector_ref);
+  rep_ADD_SUBR(Spvector_set);
+  rep_ADD_SUBR(Spvector_push);
+  rep_ADD_SUBR(Spvector_pop);
+  rep_ADD_SUBR(Spvector_for_each);
+  rep_ADD_SUBR(Spvector_transient);
+  rep_ADD_SUBR(Spvector_set_);
+  rep_ADD_SUBR(Spvector_push_);
+  rep_ADD_SUBR(Spvector_pop_);
+  rep_ADD_SUBR(Spvector_persistent_);
+}
+
+void
+rep_persistent_init(void)
+{
+  rep_lazy_structure("rep.data.persistent", persistent_init);
+}
@@ -113,6 +113,7 @@ retrieved with the `get' function.
 	    && rep_value_cmp(rep_CAR(plist), prop) == 0))
     {
       rep_CAR(rep_CDR(plist)) = val;
+      rep_GC_WRITE_BARRIER(rep_CDR(plist), val);
       return val;
     }
     plist = rep_CDR(rep_CDR(plist));
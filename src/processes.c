@@ -935,6 +935,7 @@ process_sweep(void)
   while (pr) {
     rep_process *next = pr->next;
     if (!rep_GC_CELL_MARKEDP(rep_VAL(pr))) {
+      rep_gc_note_freed_cell(rep_VAL(pr));
       delete_process(pr);
     } else {
       rep_GC_CLR_CELL(rep_VAL(pr));
@@ -1005,7 +1006,7 @@ If the DIR parameter is nil it will be inherited from the
 ::end:: */
 {
   rep_process *pr = rep_alloc(sizeof(rep_process));
-  rep_data_after_gc += sizeof (rep_process);
+  rep_NOTE_ALLOCATION(sizeof (rep_process));
 
   pr->car = rep_Process;
   pr->next = process_list;
@@ -1648,6 +1649,7 @@ Sets the name of the program to run on PROCESS to FILE.
   rep_DECLARE2(prog, rep_STRINGP);
 
   PROC(proc)->program = prog;
+  rep_GC_WRITE_BARRIER(proc, prog);
 
   return rep_undefined_value;
 }
@@ -1676,6 +1678,7 @@ Set the arguments to PROCESS.
   rep_DECLARE2(args, rep_LISTP);
 
   PROC(proc)->args = args;
+  rep_GC_WRITE_BARRIER(proc, args);
 
   return rep_undefined_value;
 }
@@ -1705,6 +1708,7 @@ output.
   rep_DECLARE1(proc, PROCESSP);
 
   PROC(proc)->output_stream = stream;
+  rep_GC_WRITE_BARRIER(proc, stream);
 
   return rep_undefined_value;
 }
@@ -1737,6 +1741,7 @@ Note that this currently only works correctly with pipe connections.
   rep_DECLARE1(proc, PROCESSP);
 
   PROC(proc)->error_stream = stream;
+  rep_GC_WRITE_BARRIER(proc, stream);
 
   return rep_undefined_value;
 }
@@ -1767,6 +1772,7 @@ FUNCTION.
   rep_DECLARE1(proc, PROCESSP);
 
   PROC(proc)->notify_function = fn;
+  rep_GC_WRITE_BARRIER(proc, fn);
 
   return rep_undefined_value;
 }
@@ -1807,6 +1813,7 @@ Set the directory of PROCESS to DIR.
 
   if (dir && rep_STRINGP(dir)) {
     PROC(proc)->directory = dir;
+    rep_GC_WRITE_BARRIER(proc, dir);
   } else {
     PROC(proc)->directory = rep_nil;
   }
@@ -221,6 +221,7 @@ read_list(repv stream, register int *c_p)
 	  repv this = readl(stream, c_p, Qpremature_end_of_stream);
 	  if (this != 0) {
 	    rep_CDR(last) = this;
+	    rep_GC_WRITE_BARRIER(last, this);
 	  } else {
 	    result = 0;
 	    goto end;
@@ -258,10 +259,12 @@ read_list(repv stream, register int *c_p)
       repv this = Fcons(rep_nil, rep_nil);
       if (last) {
 	rep_CDR(last) = this;
+	rep_GC_WRITE_BARRIER(last, this);
       } else {
 	result = this;
       }
       rep_CAR(this) = readl(stream, c_p, Qpremature_end_of_stream);
+      rep_GC_WRITE_BARRIER(this, rep_CAR(this));
       if (!rep_CAR(this)) {
 	result = 0;
       }
@@ -944,6 +947,7 @@ readl(repv stream, register int *c_p, repv end_of_stream_error)
 				   stream, "during ` or ' syntax");
       }
       rep_CADR(form) = readl(stream, c_p, Qpremature_end_of_stream);
+      rep_GC_WRITE_BARRIER(rep_CDR(form), rep_CADR(form));
       rep_POPGC;
       if (!rep_CADR(form)) {
 	return 0;
@@ -962,6 +966,7 @@ readl(repv stream, register int *c_p, repv end_of_stream_error)
 				   stream, "during , syntax");
       case '@':
 	rep_CAR(form) = Qbackquote_splice;
+	rep_GC_WRITE_BARRIER(form, Qbackquote_splice);
 	if ((*c_p = rep_stream_getc(stream)) == EOF) {
 	  rep_POPGC;
 	  return signal_reader_error(Qpremature_end_of_stream,
@@ -969,6 +974,7 @@ readl(repv stream, register int *c_p, repv end_of_stream_error)
 	}
       }
       rep_CADR(form) = readl(stream, c_p, Qpremature_end_of_stream);
+      rep_GC_WRITE_BARRIER(rep_CDR(form), rep_CADR(form));
       rep_POPGC;
       if (!rep_CADR(form)) {
 	return 0;
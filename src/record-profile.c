@@ -23,11 +23,18 @@
    Hook into the interrupt-checking code to record the current
    backtrace statistics. Uses SIGPROF to tell the lisp system when it
    should interrupt (can't run the profiler off the signal itself,
-   since data would need to be allocated from the signal handler) */
+   since data would need to be allocated from the signal handler)
+
+   The allocation profiler is called by the garbage collector after
+   every so many bytes have been allocated. It records the backtrace
+   in C data, nothing may be allocated while the allocator is half way
+   through making an object. */
 
 #include "repint.h"
 
 #include <signal.h>
+#include <string.h>
+#include <limits.h>
 #include <time.h>
 
 #ifdef HAVE_UNISTD_H
@@ -78,6 +85,32 @@ clear_timer(void)
 #endif
 }
 
+/* Returns the name of the function called by frame C, as a string, or
+   zero if it doesn't have one. */
+
+static repv
+frame_name(const rep_stack_frame *c)
+{
+  repv name;
+
+  switch (rep_TYPE(c->fun)) {
+  case rep_Subr:
+    name = rep_SUBR(c->fun)->name;
+    break;
+  case rep_Closure:
+    name = rep_CLOSURE(c->fun)->name;
+    break;
+  default:
+    return 0;
+  }
+
+  if (rep_SYMBOLP(name)) {
+    name = rep_SYM(name)->name;
+  }
+
+  return rep_STRINGP(name) ? name : 0;
+}
+
 static void
 test_interrupt(void)
 {
@@ -95,24 +128,8 @@ test_interrupt(void)
   for (const rep_stack_frame *c = rep_call_stack;
        c != 0 && c->fun != rep_nil; c = c->next)
   {
-    repv name;
-
-    switch (rep_TYPE(c->fun)) {
-    case rep_Subr:
-      name = rep_SUBR(c->fun)->name;
-      break;
-    case rep_Closure:
-      name = rep_CLOSURE(c->fun)->name;
-      break;
-    default:
-      continue;
-    }
-
-    if (rep_SYMBOLP(name)) {
-      name = rep_SYM(name)->name;
-    }
-
-    if (!rep_STRINGP(name)) {
+    repv name = frame_name(c);
+    if (!name) {
       continue;
     }
 
@@ -187,6 +204,397 @@ DEFUN("profile-interval", Fprofile_interval,
   return ret;
 }
 
+
+/* Allocation profiling */
+
+/* The functions seen in samples, with their estimated allocations.
+   SELF counts allocations made while the function was the innermost
+   named one on the stack, TOTAL those made while it was anywhere on
+   the stack. */
+
+typedef struct {
+  char *name;
+  size_t length;
+  uint32_t hash;
+  double self_objects, self_bytes;
+  double total_objects, total_bytes;
+} alloc_function;
+
+/* Each distinct stack seen, as DEPTH indices into alloc_frames,
+   innermost first. */
+
+typedef struct {
+  uint32_t hash;
+  int depth, first;
+  double objects, bytes;
+} alloc_stack;
+
+static int alloc_interval = 65536;
+static uint32_t alloc_random = 2463534242U;
+
+static alloc_function *alloc_functions;
+static int alloc_function_count, alloc_functions_size;
+
+static alloc_stack *alloc_stacks;
+static int alloc_stack_count, alloc_stacks_size;
+
+static int *alloc_frames;
+static int alloc_frame_count, alloc_frames_size;
+
+/* Open-addressed tables of indices plus one into alloc_functions and
+   alloc_stacks, each with twice as many slots as entries allowed. */
+
+static int *function_table, *stack_table;
+
+static uint32_t
+hash_bytes(const char *data, size_t length)
+{
+  uint32_t hash = 2166136261U;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ (uint8_t)data[i]) * 16777619U;
+  }
+  return hash;
+}
+
+/* Make sure there's room for one more entry in ARRAY, and in its hash
+   TABLE, rebuilding the table when it grows. */
+
+static bool
+grow_alloc_table(void **array, int count, int *size, size_t elt_size,
+		 int **table, uint32_t (*hash)(int))
+{
+  if (count < *size) {
+    return true;
+  }
+
+  int new_size = *size ? *size * 2 : 256;
+  void *new_array = rep_realloc(*array, new_size * elt_size);
+  int *new_table = rep_alloc(2 * new_size * sizeof(int));
+  if (!new_array || !new_table) {
+    if (new_array) {
+      *array = new_array;
+    }
+    rep_free(new_table);
+    return false;
+  }
+
+  *array = new_array;
+  *size = new_size;
+
+  memset(new_table, 0, 2 * new_size * sizeof(int));
+  for (int i = 0; i < count; i++) {
+    uint32_t h = hash(i) & (2 * new_size - 1);
+    while (new_table[h] != 0) {
+      h = (h + 1) & (2 * new_size - 1);
+    }
+    new_table[h] = i + 1;
+  }
+
+  rep_free(*table);
+  *table = new_table;
+  return true;
+}
+
+static uint32_t
+function_hash(int i)
+{
+  return alloc_functions[i].hash;
+}
+
+static uint32_t
+stack_hash(int i)
+{
+  return alloc_stacks[i].hash;
+}
+
+/* Returns the index of the function called NAME, or -1. */
+
+static int
+alloc_function_index(repv name)
+{
+  const char *str = rep_STR(name);
+  size_t length = rep_STRING_LEN(name);
+  uint32_t hash = hash_bytes(str, length);
+
+  if (alloc_functions_size > 0) {
+    uint32_t mask = 2 * alloc_functions_size - 1;
+    for (uint32_t h = hash & mask; function_table[h] != 0;
+	 h = (h + 1) & mask)
+    {
+      alloc_function *f = &alloc_functions[function_table[h] - 1];
+      if (f->hash == hash && f->length == length
+	  && memcmp(f->name, str, length) == 0)
+      {
+	return function_table[h] - 1;
+      }
+    }
+  }
+
+  char *copy = rep_alloc(length + 1);
+  if (!copy
+      || !grow_alloc_table((void **)&alloc_functions, alloc_function_count,
+			   &alloc_functions_size, sizeof(alloc_function),
+			   &function_table, function_hash))
+  {
+    rep_free(copy);
+    return -1;
+  }
+
+  memcpy(copy, str, length);
+  copy[length] = 0;
+
+  int i = alloc_function_count++;
+  memset(&alloc_functions[i], 0, sizeof(alloc_function));
+  alloc_functions[i].name = copy;
+  alloc_functions[i].length = length;
+  alloc_functions[i].hash = hash;
+
+  uint32_t mask = 2 * alloc_functions_size - 1;
+  uint32_t h = hash & mask;
+  while (function_table[h] != 0) {
+    h = (h + 1) & mask;
+  }
+  function_table[h] = i + 1;
+
+  return i;
+}
+
+/* Returns the stack entry for the DEPTH functions in IDS, or null. */
+
+static alloc_stack *
+find_alloc_stack(const int *ids, int depth)
+{
+  uint32_t hash = hash_bytes((const char *)ids, depth * sizeof(int));
+
+  if (alloc_stacks_size > 0) {
+    uint32_t mask = 2 * alloc_stacks_size - 1;
+    for (uint32_t h = hash & mask; stack_table[h] != 0; h = (h + 1) & mask) {
+      alloc_stack *s = &alloc_stacks[stack_table[h] - 1];
+      if (s->hash == hash && s->depth == depth
+	  && memcmp(alloc_frames + s->first, ids, depth * sizeof(int)) == 0)
+      {
+	return s;
+      }
+    }
+  }
+
+  if (alloc_frame_count + depth > alloc_frames_size) {
+    int new_size = MAX(alloc_frames_size * 2, alloc_frame_count + depth + 1024);
+    int *new_frames = rep_realloc(alloc_frames, new_size * sizeof(int));
+    if (!new_frames) {
+      return 0;
+    }
+    alloc_frames = new_frames;
+    alloc_frames_size = new_size;
+  }
+
+  if (!grow_alloc_table((void **)&alloc_stacks, alloc_stack_count,
+			&alloc_stacks_size, sizeof(alloc_stack),
+			&stack_table, stack_hash))
+  {
+    return 0;
+  }
+
+  alloc_stack *s = &alloc_stacks[alloc_stack_count++];
+  s->hash = hash;
+  s->depth = depth;
+  s->first = alloc_frame_count;
+  s->objects = s->bytes = 0;
+  memcpy(alloc_frames + alloc_frame_count, ids, depth * sizeof(int));
+  alloc_frame_count += depth;
+
+  uint32_t mask = 2 * alloc_stacks_size - 1;
+  uint32_t h = hash & mask;
+  while (stack_table[h] != 0) {
+    h = (h + 1) & mask;
+  }
+  stack_table[h] = s - alloc_stacks + 1;
+
+  return s;
+}
+
+/* Returns the number of bytes to allocate before the next sample, a
+   random value averaging alloc_interval, so that regular patterns of
+   allocation aren't sampled unfairly. */
+
+static int
+next_alloc_interval(void)
+{
+  alloc_random ^= alloc_random << 13;
+  alloc_random ^= alloc_random >> 17;
+  alloc_random ^= alloc_random << 5;
+  return alloc_interval / 2 + alloc_random % (alloc_interval + 1);
+}
+
+/* Called with the size of the allocation that reached the sample
+   point. It stands for all those since the previous sample, so is
+   weighted by the sampling interval. */
+
+static void
+alloc_sample(size_t bytes)
+{
+  rep_alloc_sample_after(next_alloc_interval());
+
+  double weight_bytes = MAX(bytes, (size_t)alloc_interval);
+  double weight_objects = bytes > 0 ? weight_bytes / bytes : 1;
+
+  int *ids = rep_stack_alloc(int, rep_max_lisp_depth);
+  if (!ids) {
+    return;
+  }
+
+  int depth = 0;
+
+  for (const rep_stack_frame *c = rep_call_stack;
+       c != 0 && c->fun != rep_nil && depth < rep_max_lisp_depth;
+       c = c->next)
+  {
+    repv name = frame_name(c);
+    if (name) {
+      int i = alloc_function_index(name);
+      if (i >= 0) {
+	ids[depth++] = i;
+      }
+    }
+  }
+
+  alloc_stack *s = find_alloc_stack(ids, depth);
+  if (s) {
+    s->objects += weight_objects;
+    s->bytes += weight_bytes;
+  }
+
+  if (depth > 0) {
+    alloc_functions[ids[0]].self_objects += weight_objects;
+    alloc_functions[ids[0]].self_bytes += weight_bytes;
+  }
+
+  /* Recursive calls only count once towards the total. */
+
+  for (int i = 0; i < depth; i++) {
+    bool seen = false;
+    for (int j = 0; j < i; j++) {
+      if (ids[j] == ids[i]) {
+	seen = true;
+	break;
+      }
+    }
+    if (!seen) {
+      alloc_functions[ids[i]].total_objects += weight_objects;
+      alloc_functions[ids[i]].total_bytes += weight_bytes;
+    }
+  }
+
+  rep_stack_free(int, rep_max_lisp_depth, ids);
+}
+
+static void
+clear_alloc_profile(void)
+{
+  for (int i = 0; i < alloc_function_count; i++) {
+    rep_free(alloc_functions[i].name);
+  }
+  rep_free(alloc_functions);
+  rep_free(alloc_stacks);
+  rep_free(alloc_frames);
+  rep_free(function_table);
+  rep_free(stack_table);
+
+  alloc_functions = 0;
+  alloc_stacks = 0;
+  alloc_frames = 0;
+  function_table = stack_table = 0;
+  alloc_function_count = alloc_functions_size = 0;
+  alloc_stack_count = alloc_stacks_size = 0;
+  alloc_frame_count = alloc_frames_size = 0;
+}
+
+DEFUN("start-allocation-profiler", Fstart_allocation_profiler,
+      Sstart_allocation_profiler, (repv interval), rep_Subr1)
+{
+  if (rep_INTP(interval) && rep_INT(interval) > 0
+      && rep_INT(interval) < INT_MAX / 2)
+  {
+    alloc_interval = rep_INT(interval);
+  }
+
+  clear_alloc_profile();
+  rep_alloc_sampler = alloc_sample;
+  rep_alloc_sample_after(next_alloc_interval());
+  return Qt;
+}
+
+DEFUN("stop-allocation-profiler", Fstop_allocation_profiler,
+      Sstop_allocation_profiler, (void), rep_Subr0)
+{
+  rep_alloc_sampler = 0;
+  rep_alloc_sample_point = INT_MAX;
+  return Qt;
+}
+
+static repv
+alloc_function_symbol(int i)
+{
+  return Fintern(rep_string_copy_n(alloc_functions[i].name,
+				   alloc_functions[i].length), rep_nil);
+}
+
+DEFUN("fetch-allocation-profile", Ffetch_allocation_profile,
+      Sfetch_allocation_profile, (void), rep_Subr0)
+{
+  /* The samples may not change while they're being copied. */
+
+  void (*sampler)(size_t) = rep_alloc_sampler;
+  rep_alloc_sampler = 0;
+
+  repv functions = rep_nil, stacks = rep_nil;
+  rep_GC_root gc_functions, gc_stacks;
+  rep_PUSHGC(gc_functions, functions);
+  rep_PUSHGC(gc_stacks, stacks);
+
+  for (int i = alloc_function_count - 1; i >= 0; i--) {
+    alloc_function *f = &alloc_functions[i];
+    functions = Fcons(rep_list_5(alloc_function_symbol(i),
+				 rep_make_long_uint(f->self_objects + 0.5),
+				 rep_make_long_uint(f->self_bytes + 0.5),
+				 rep_make_long_uint(f->total_objects + 0.5),
+				 rep_make_long_uint(f->total_bytes + 0.5)),
+		      functions);
+  }
+
+  for (int i = alloc_stack_count - 1; i >= 0; i--) {
+    alloc_stack *s = &alloc_stacks[i];
+    repv names = rep_nil;
+    for (int j = s->depth - 1; j >= 0; j--) {
+      names = Fcons(alloc_function_symbol(alloc_frames[s->first + j]), names);
+    }
+    stacks = Fcons(rep_list_3(names, rep_make_long_uint(s->objects + 0.5),
+			      rep_make_long_uint(s->bytes + 0.5)),
+		   stacks);
+  }
+
+  rep_POPGC; rep_POPGC;
+
+  if (sampler) {
+    rep_alloc_sampler = sampler;
+    rep_alloc_sample_after(next_alloc_interval());
+  }
+
+  return Fcons(functions, stacks);
+}
+
+DEFUN("allocation-profile-interval", Fallocation_profile_interval,
+      Sallocation_profile_interval, (repv arg), rep_Subr1)
+{
+  repv ret = rep_MAKE_INT(alloc_interval);
+
+  if (rep_INTP(arg) && rep_INT(arg) > 0 && rep_INT(arg) < INT_MAX / 2) {
+    alloc_interval = rep_INT(arg);
+  }
+
+  return ret;
+}
+
 
 /* init */
 
@@ -205,6 +613,10 @@ rep_dl_init(void)
   rep_ADD_SUBR(Sstop_profiler);
   rep_ADD_SUBR(Sfetch_profile);
   rep_ADD_SUBR(Sprofile_interval);
+  rep_ADD_SUBR(Sstart_allocation_profiler);
+  rep_ADD_SUBR(Sstop_allocation_profiler);
+  rep_ADD_SUBR(Sfetch_allocation_profile);
+  rep_ADD_SUBR(Sallocation_profile_interval);
   rep_mark_static(&profile_table);
   return rep_pop_structure(tem);
 }
@@ -96,7 +96,7 @@ gdbm-open PATH ACCESS-TYPE [MODE] [FLAGS]
   dbm->next = dbm_list;
   dbm_list = dbm;
 
-  rep_data_after_gc += sizeof(rep_dbm);
+  rep_NOTE_ALLOCATION(sizeof(rep_dbm));
 
   return rep_VAL(dbm);
 }
@@ -248,6 +248,7 @@ dbm_sweep(void)
   while (ptr) {
     rep_dbm *next = ptr->next;
     if (!rep_GC_CELL_MARKEDP(rep_VAL(ptr))) {
+      rep_gc_note_freed_cell(rep_VAL(ptr));
       if (ptr->dbm) {
 	gdbm_close(ptr->dbm);
       }
@@ -0,0 +1,834 @@
+/* rep-heap-report.c -- analyze heap snapshots
+
+   Copyright (C) 1993-2015 John Harper <jsh@unfactored.org>
+
+   This file is part of Librep.
+
+   Librep is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   Librep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Librep; see the file COPYING.  If not, write to
+   the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+/* Reads a file written by `write-heap-snapshot' (see gc.c for its
+   format), computes the dominator tree of the object graph and prints
+   the size of the data retained by each type, structure and table, and
+   by the largest individual objects.
+
+   An object's retained size is the total size of the objects that are
+   only reachable through it, i.e. that would be freed if it was. The
+   dominators are found with the Lengauer-Tarjan algorithm, in time
+   close to linear in the number of references. */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#define MAX_TYPES (64 + 256)
+
+/* Node 0 is a made up root that references each root set, nodes 1 to
+   N_ROOTS are the root sets, then come the objects in the order they
+   were written. */
+
+#define MAX_ROOTS 64
+
+static char *type_names[MAX_TYPES];
+static char *root_names[MAX_ROOTS];
+static uint32_t n_roots;
+
+static uint32_t n_nodes, nodes_size;
+static uint64_t *node_addr;
+static uint16_t *node_type;
+static uint32_t *node_size;
+static uint64_t *node_edges;	/* index of first edge, N_NODES + 1 */
+static char **node_label;
+
+/* References from objects. Read as addresses, then replaced in place
+   by node numbers. */
+
+static uint64_t n_edges, edges_size;
+static uint64_t *edge_addr;
+static uint32_t *edges;
+
+/* References from the root sets. */
+
+static uint64_t n_root_refs, root_refs_size;
+static uint64_t *root_ref_addr;
+static uint8_t *root_ref_root;
+
+/* Labels, attached to their objects once all have been read. */
+
+static uint64_t n_labels, labels_size;
+static uint64_t *label_addr;
+static char **label_name;
+
+static const char *file_name;
+
+static void
+fatal(const char *msg)
+{
+  fprintf(stderr, "rep-heap-report: %s: %s\n", file_name, msg);
+  exit(1);
+}
+
+static void *
+xrealloc(void *ptr, size_t size)
+{
+  ptr = realloc(ptr, size);
+  if (!ptr && size > 0) {
+    fatal("out of memory");
+  }
+  return ptr;
+}
+
+#define GROW(array, count, size)					\
+  do {									\
+    if ((count) == (size)) {						\
+      (size) = (size) ? (size) * 2 : 1024;				\
+      (array) = xrealloc((array), (size) * sizeof(*(array)));		\
+    }									\
+  } while (0)
+
+
+/* Reading */
+
+static FILE *input;
+static uint8_t in_buffer[1 << 16];
+static size_t in_fill, in_pos;
+
+static inline int
+next_byte(void)
+{
+  if (in_pos == in_fill) {
+    in_fill = fread(in_buffer, 1, sizeof(in_buffer), input);
+    in_pos = 0;
+    if (in_fill == 0) {
+      fatal("unexpected end of file");
+    }
+  }
+  return in_buffer[in_pos++];
+}
+
+static inline uint64_t
+read_uint(void)
+{
+  uint64_t x = 0;
+  int shift = 0, c;
+  do {
+    c = next_byte();
+    x |= (uint64_t)(c & 0x7f) << shift;
+    shift += 7;
+  } while (c & 0x80);
+  return x;
+}
+
+static char *
+read_string(void)
+{
+  size_t len = read_uint();
+  char *str = xrealloc(0, len + 1);
+  for (size_t i = 0; i < len; i++) {
+    str[i] = next_byte();
+  }
+  str[len] = 0;
+  return str;
+}
+
+static void
+read_snapshot(void)
+{
+  char magic[8];
+  for (int i = 0; i < 8; i++) {
+    magic[i] = next_byte();
+  }
+  if (memcmp(magic, "REPHEAP1", 8) != 0) {
+    fatal("not a heap snapshot");
+  }
+
+  uint64_t index, addr, count;
+
+  while (1) {
+    switch (next_byte()) {
+    case 'T':
+      index = read_uint();
+      if (index >= MAX_TYPES) {
+	fatal("bad type number");
+      }
+      type_names[index] = read_string();
+      break;
+
+    case 'R':
+      index = read_uint();
+      if (index == 0 || index >= MAX_ROOTS) {
+	fatal("bad root number");
+      }
+      root_names[index] = read_string();
+      if (index > n_roots) {
+	n_roots = index;
+      }
+      break;
+
+    case 'r':
+      if (n_root_refs == root_refs_size) {
+	GROW(root_ref_addr, n_root_refs, root_refs_size);
+	root_ref_root = xrealloc(root_ref_root, root_refs_size);
+      }
+      index = read_uint();
+      if (index == 0 || index >= MAX_ROOTS) {
+	fatal("bad root number");
+      }
+      root_ref_root[n_root_refs] = index;
+      root_ref_addr[n_root_refs++] = read_uint();
+      break;
+
+    case 'O':
+      if (n_nodes == nodes_size) {
+	nodes_size = nodes_size ? nodes_size * 2 : 65536;
+	node_addr = xrealloc(node_addr, nodes_size * sizeof(uint64_t));
+	node_type = xrealloc(node_type, nodes_size * sizeof(uint16_t));
+	node_size = xrealloc(node_size, nodes_size * sizeof(uint32_t));
+	node_edges = xrealloc(node_edges,
+			      (nodes_size + 1) * sizeof(uint64_t));
+      }
+      addr = read_uint();
+      node_addr[n_nodes] = addr;
+      index = read_uint();
+      if (index >= MAX_TYPES) {
+	fatal("bad type number");
+      }
+      node_type[n_nodes] = index;
+      node_size[n_nodes] = read_uint();
+      node_edges[n_nodes] = n_edges;
+      count = read_uint();
+      for (uint64_t i = 0; i < count; i++) {
+	uint64_t z = read_uint();
+	int64_t delta = (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+	GROW(edge_addr, n_edges, edges_size);
+	edge_addr[n_edges++] = addr + delta;
+      }
+      n_nodes++;
+      break;
+
+    case 'L':
+      if (n_labels == labels_size) {
+	GROW(label_addr, n_labels, labels_size);
+	label_name = xrealloc(label_name, labels_size * sizeof(char *));
+      }
+      label_addr[n_labels] = read_uint();
+      label_name[n_labels++] = read_string();
+      break;
+
+    case 'E':
+      node_edges = xrealloc(node_edges, (n_nodes + 1) * sizeof(uint64_t));
+      node_edges[n_nodes] = n_edges;
+      return;
+
+    default:
+      fatal("corrupt heap snapshot");
+    }
+  }
+}
+
+
+/* Mapping addresses to objects */
+
+static uint32_t *addr_table;
+static uint64_t addr_mask;
+
+static inline uint64_t
+hash_addr(uint64_t addr)
+{
+  return (addr * UINT64_C(0x9e3779b97f4a7c15)) >> 17;
+}
+
+static void
+build_addr_table(void)
+{
+  uint64_t size = 1024;
+  while (size < (uint64_t)n_nodes * 2) {
+    size *= 2;
+  }
+  addr_table = calloc(size, sizeof(uint32_t));
+  if (!addr_table) {
+    fatal("out of memory");
+  }
+  addr_mask = size - 1;
+
+  for (uint32_t i = 0; i < n_nodes; i++) {
+    uint64_t h = hash_addr(node_addr[i]) & addr_mask;
+    while (addr_table[h] != 0) {
+      h = (h + 1) & addr_mask;
+    }
+    addr_table[h] = i + 1;
+  }
+}
+
+/* Returns the node number of the object at ADDR, or zero. */
+
+static inline uint32_t
+lookup_addr(uint64_t addr)
+{
+  uint64_t h = hash_addr(addr) & addr_mask;
+  uint32_t i;
+  while ((i = addr_table[h]) != 0) {
+    if (node_addr[i - 1] == addr) {
+      return n_roots + i;
+    }
+    h = (h + 1) & addr_mask;
+  }
+  return 0;
+}
+
+
+/* The graph */
+
+/* Successors of node V are SUCC[SUCC_START[V]] to
+   SUCC[SUCC_START[V+1]-1]; node zero (nothing) marks references to
+   objects not in the snapshot. */
+
+static uint32_t total_nodes;
+static uint64_t *succ_start;
+static uint32_t *succ;
+
+static void
+build_graph(void)
+{
+  build_addr_table();
+
+  /* Object edges are resolved in place, each uint32_t is stored over
+     the first half of a uint64_t not yet read. */
+
+  edges = (uint32_t *)edge_addr;
+  for (uint64_t i = 0; i < n_edges; i++) {
+    edges[i] = lookup_addr(edge_addr[i]);
+  }
+
+  total_nodes = 1 + n_roots + n_nodes;
+  uint64_t n_succ = n_roots + n_root_refs + n_edges;
+
+  succ_start = xrealloc(0, (total_nodes + 1) * sizeof(uint64_t));
+  succ = xrealloc(0, (n_succ ? n_succ : 1) * sizeof(uint32_t));
+
+  uint64_t k = 0;
+
+  succ_start[0] = k;
+  for (uint32_t r = 1; r <= n_roots; r++) {
+    succ[k++] = r;
+  }
+
+  uint64_t *counts = calloc(n_roots + 2, sizeof(uint64_t));
+  for (uint64_t i = 0; i < n_root_refs; i++) {
+    if (root_ref_root[i] > n_roots) {
+      fatal("bad root number");
+    }
+    counts[root_ref_root[i]]++;
+  }
+  for (uint32_t r = 1; r <= n_roots; r++) {
+    succ_start[r] = k;
+    k += counts[r];
+    counts[r] = succ_start[r];
+  }
+  for (uint64_t i = 0; i < n_root_refs; i++) {
+    succ[counts[root_ref_root[i]]++] = lookup_addr(root_ref_addr[i]);
+  }
+  free(counts);
+
+  for (uint32_t i = 0; i < n_nodes; i++) {
+    succ_start[1 + n_roots + i] = k + node_edges[i];
+  }
+  memcpy(succ + k, edges, n_edges * sizeof(uint32_t));
+  succ_start[total_nodes] = k + n_edges;
+
+  free(edge_addr);
+  edge_addr = 0;
+  edges = 0;
+
+  /* Attach the labels. */
+
+  node_label = calloc(total_nodes, sizeof(char *));
+  for (uint64_t i = 0; i < n_labels; i++) {
+    uint32_t v = lookup_addr(label_addr[i]);
+    if (v != 0) {
+      node_label[v] = label_name[i];
+    }
+  }
+  for (uint32_t r = 1; r <= n_roots; r++) {
+    node_label[r] = root_names[r];
+  }
+
+  free(addr_table);
+}
+
+static inline int
+type_of(uint32_t v)
+{
+  return v > n_roots ? node_type[v - n_roots - 1] : -1;
+}
+
+static inline uint64_t
+size_of(uint32_t v)
+{
+  return v > n_roots ? node_size[v - n_roots - 1] : 0;
+}
+
+
+/* Dominators (Lengauer and Tarjan, the simple version). Everything is
+   indexed by depth-first number, from 1; zero means none. */
+
+static uint32_t n_reached;
+static uint32_t *dfnum;		/* node -> dfnum */
+static uint32_t *vertex;	/* dfnum -> node */
+static uint32_t *idom;
+static uint64_t *retained;
+
+static void
+depth_first(void)
+{
+  uint64_t *pos = xrealloc(0, total_nodes * sizeof(uint64_t));
+  uint32_t *stack = xrealloc(0, total_nodes * sizeof(uint32_t));
+  int64_t top = 0;
+
+  dfnum = calloc(total_nodes, sizeof(uint32_t));
+  vertex = xrealloc(0, (total_nodes + 1) * sizeof(uint32_t));
+  idom = calloc(total_nodes + 1, sizeof(uint32_t));	/* parent, for now */
+
+  dfnum[0] = n_reached = 1;
+  vertex[1] = 0;
+  pos[0] = succ_start[0];
+  stack[top++] = 0;
+
+  while (top > 0) {
+    uint32_t v = stack[top - 1];
+    if (pos[v] == succ_start[v + 1]) {
+      top--;
+      continue;
+    }
+    uint32_t w = succ[pos[v]++];
+    if (w != 0 && dfnum[w] == 0) {
+      dfnum[w] = ++n_reached;
+      vertex[n_reached] = w;
+      idom[n_reached] = dfnum[v];
+      pos[w] = succ_start[w];
+      stack[top++] = w;
+    }
+  }
+
+  free(pos);
+  free(stack);
+}
+
+static uint32_t *ancestor, *label, *semi;
+static uint32_t *path;
+
+static inline uint32_t
+eval(uint32_t v)
+{
+  if (ancestor[v] == 0) {
+    return v;
+  }
+
+  /* Compress the path from V, iteratively. */
+
+  int n = 0;
+  uint32_t x = v;
+  while (ancestor[ancestor[x]] != 0) {
+    path[n++] = x;
+    x = ancestor[x];
+  }
+  while (n > 0) {
+    x = path[--n];
+    uint32_t a = ancestor[x];
+    if (semi[label[a]] < semi[label[x]]) {
+      label[x] = label[a];
+    }
+    ancestor[x] = ancestor[a];
+  }
+
+  return label[v];
+}
+
+static void
+dominators(void)
+{
+  depth_first();
+
+  uint32_t n = n_reached;
+
+  /* Predecessors of each reached node, by dfnum. */
+
+  uint64_t *pred_start = calloc(n + 2, sizeof(uint64_t));
+  for (uint32_t v = 0; v < total_nodes; v++) {
+    if (dfnum[v] == 0) {
+      continue;
+    }
+    for (uint64_t i = succ_start[v]; i < succ_start[v + 1]; i++) {
+      if (succ[i] != 0) {
+	pred_start[dfnum[succ[i]] + 1]++;
+      }
+    }
+  }
+  for (uint32_t w = 1; w <= n + 1; w++) {
+    pred_start[w] += pred_start[w - 1];
+  }
+  uint32_t *preds = xrealloc(0, (pred_start[n + 1] + 1) * sizeof(uint32_t));
+  uint64_t *fill = xrealloc(0, (n + 2) * sizeof(uint64_t));
+  memcpy(fill, pred_start, (n + 2) * sizeof(uint64_t));
+  for (uint32_t v = 0; v < total_nodes; v++) {
+    if (dfnum[v] == 0) {
+      continue;
+    }
+    for (uint64_t i = succ_start[v]; i < succ_start[v + 1]; i++) {
+      if (succ[i] != 0) {
+	preds[fill[dfnum[succ[i]]]++] = dfnum[v];
+      }
+    }
+  }
+  free(fill);
+
+  uint32_t *parent = idom;
+  idom = calloc(n + 1, sizeof(uint32_t));
+  ancestor = calloc(n + 1, sizeof(uint32_t));
+  label = xrealloc(0, (n + 1) * sizeof(uint32_t));
+  semi = xrealloc(0, (n + 1) * sizeof(uint32_t));
+  path = xrealloc(0, (n + 1) * sizeof(uint32_t));
+  uint32_t *bucket = calloc(n + 1, sizeof(uint32_t));
+  uint32_t *next = calloc(n + 1, sizeof(uint32_t));
+
+  for (uint32_t v = 1; v <= n; v++) {
+    label[v] = semi[v] = v;
+  }
+
+  for (uint32_t w = n; w >= 2; w--) {
+    for (uint64_t i = pred_start[w]; i < pred_start[w + 1]; i++) {
+      uint32_t u = eval(preds[i]);
+      if (semi[u] < semi[w]) {
+	semi[w] = semi[u];
+      }
+    }
+    next[w] = bucket[semi[w]];
+    bucket[semi[w]] = w;
+    ancestor[w] = parent[w];
+
+    uint32_t p = parent[w];
+    for (uint32_t v = bucket[p]; v != 0; v = next[v]) {
+      uint32_t u = eval(v);
+      idom[v] = semi[u] < semi[v] ? u : p;
+    }
+    bucket[p] = 0;
+  }
+
+  for (uint32_t w = 2; w <= n; w++) {
+    if (idom[w] != semi[w]) {
+      idom[w] = idom[idom[w]];
+    }
+  }
+  idom[1] = 0;
+
+  free(pred_start);
+  free(preds);
+  free(parent);
+  free(ancestor);
+  free(label);
+  free(semi);
+  free(path);
+  free(bucket);
+  free(next);
+
+  /* Each node's idom has a lower dfnum, so one pass in reverse order
+     accumulates the retained sizes. */
+
+  retained = xrealloc(0, (n + 1) * sizeof(uint64_t));
+  for (uint32_t v = 1; v <= n; v++) {
+    retained[v] = size_of(vertex[v]);
+  }
+  for (uint32_t v = n; v >= 2; v--) {
+    retained[idom[v]] += retained[v];
+  }
+}
+
+
+/* Reports */
+
+struct type_total {
+  uint64_t objects, bytes, retained;
+};
+
+static struct type_total type_totals[MAX_TYPES];
+
+/* Sum the retained size of each object not dominated by another of
+   the same type, walking the dominator tree depth first. */
+
+static void
+total_types(void)
+{
+  uint32_t n = n_reached;
+  uint32_t *child_start = calloc(n + 2, sizeof(uint32_t));
+  uint32_t *children = xrealloc(0, (n + 1) * sizeof(uint32_t));
+
+  for (uint32_t v = 2; v <= n; v++) {
+    child_start[idom[v] + 1]++;
+  }
+  for (uint32_t v = 1; v <= n + 1; v++) {
+    child_start[v] += child_start[v - 1];
+  }
+  uint32_t *fill = xrealloc(0, (n + 2) * sizeof(uint32_t));
+  memcpy(fill, child_start, (n + 2) * sizeof(uint32_t));
+  for (uint32_t v = 2; v <= n; v++) {
+    children[fill[idom[v]]++] = v;
+  }
+
+  uint32_t *stack = xrealloc(0, (n + 1) * sizeof(uint32_t));
+  uint32_t *pos = fill;
+  uint32_t depth[MAX_TYPES] = {0};
+  int64_t top = 0;
+
+  stack[top++] = 1;
+  pos[1] = child_start[1];
+
+  while (top > 0) {
+    uint32_t v = stack[top - 1];
+    int type = type_of(vertex[v]);
+
+    if (pos[v] == child_start[v]) {
+      /* Entering V. */
+      if (type >= 0) {
+	struct type_total *t = &type_totals[type];
+	t->objects++;
+	t->bytes += size_of(vertex[v]);
+	if (depth[type]++ == 0) {
+	  t->retained += retained[v];
+	}
+      }
+    }
+
+    if (pos[v] == child_start[v + 1]) {
+      if (type >= 0) {
+	depth[type]--;
+      }
+      top--;
+      continue;
+    }
+
+    uint32_t w = children[pos[v]++];
+    pos[w] = child_start[w];
+    stack[top++] = w;
+  }
+
+  free(child_start);
+  free(children);
+  free(fill);
+  free(stack);
+}
+
+static int
+compare_retained(const void *a, const void *b)
+{
+  uint64_t x = retained[*(const uint32_t *)a];
+  uint64_t y = retained[*(const uint32_t *)b];
+  return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static int
+compare_type_retained(const void *a, const void *b)
+{
+  uint64_t x = type_totals[*(const int *)a].retained;
+  uint64_t y = type_totals[*(const int *)b].retained;
+  return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static const char *
+type_name(int type)
+{
+  static char buf[32];
+  if (type < 0) {
+    return "root";
+  }
+  if (type_names[type]) {
+    return type_names[type];
+  }
+  snprintf(buf, sizeof(buf), "type-%d", type);
+  return buf;
+}
+
+static void
+print_node(uint32_t v)
+{
+  uint32_t node = vertex[v];
+  printf("  %12llu %12llu  %-12s ",
+	 (unsigned long long)retained[v],
+	 (unsigned long long)size_of(node), type_name(type_of(node)));
+  if (node_label[node]) {
+    printf("%s\n", node_label[node]);
+  } else {
+    printf("#<%llx>\n", (unsigned long long)(node_addr[node - n_roots - 1]
+					      << 3));
+  }
+}
+
+/* Print the LIMIT nodes with the largest retained sizes that satisfy
+   PRED (all of them if LIMIT is negative). */
+
+static void
+print_largest(const char *title, bool (*pred)(uint32_t), int limit)
+{
+  uint32_t n = 0;
+  uint32_t *list = xrealloc(0, (n_reached + 1) * sizeof(uint32_t));
+
+  for (uint32_t v = 2; v <= n_reached; v++) {
+    if (!pred(v)) {
+      continue;
+    }
+    if (limit < 0) {
+      list[n++] = v;
+    } else {
+      /* Keep the largest LIMIT in order, by insertion. */
+      uint32_t i = n < (uint32_t)limit ? n++ : n;
+      while (i > 0 && retained[list[i - 1]] < retained[v]) {
+	if (i < (uint32_t)limit) {
+	  list[i] = list[i - 1];
+	}
+	i--;
+      }
+      if (i < (uint32_t)limit) {
+	list[i] = v;
+      }
+    }
+  }
+
+  if (n > 0) {
+    if (limit < 0) {
+      qsort(list, n, sizeof(uint32_t), compare_retained);
+    }
+    printf("\n%s:\n  %12s %12s  %-12s %s\n", title,
+	   "retained", "bytes", "type", "object");
+    for (uint32_t i = 0; i < n && (limit < 0 || i < (uint32_t)limit); i++) {
+      print_node(list[i]);
+    }
+  }
+
+  free(list);
+}
+
+static bool
+root_p(uint32_t v)
+{
+  return vertex[v] <= n_roots;
+}
+
+static bool
+object_p(uint32_t v)
+{
+  return vertex[v] > n_roots;
+}
+
+static bool
+structure_p(uint32_t v)
+{
+  int type = type_of(vertex[v]);
+  return (type >= 0 && type_names[type]
+	  && strcmp(type_names[type], "structure") == 0);
+}
+
+static bool
+table_p(uint32_t v)
+{
+  int type = type_of(vertex[v]);
+  return (type >= 0 && type_names[type]
+	  && strcmp(type_names[type], "table") == 0);
+}
+
+static void
+report(int limit)
+{
+  uint64_t total_bytes = 0;
+  for (uint32_t i = 0; i < n_nodes; i++) {
+    total_bytes += node_size[i];
+  }
+
+  printf("%s: %lu objects, %llu bytes, %llu references\n", file_name,
+	 (unsigned long)n_nodes, (unsigned long long)total_bytes,
+	 (unsigned long long)(n_edges + n_root_refs));
+
+  total_types();
+
+  int types[MAX_TYPES], n_types = 0;
+  for (int i = 0; i < MAX_TYPES; i++) {
+    if (type_totals[i].objects > 0) {
+      types[n_types++] = i;
+    }
+  }
+  qsort(types, n_types, sizeof(int), compare_type_retained);
+
+  printf("\nTypes:\n  %12s %12s %12s  %s\n",
+	 "retained", "bytes", "objects", "type");
+  for (int i = 0; i < n_types; i++) {
+    struct type_total *t = &type_totals[types[i]];
+    printf("  %12llu %12llu %12llu  %s\n",
+	   (unsigned long long)t->retained, (unsigned long long)t->bytes,
+	   (unsigned long long)t->objects, type_name(types[i]));
+  }
+
+  print_largest("Roots", root_p, -1);
+  print_largest("Structures", structure_p, -1);
+  print_largest("Tables", table_p, limit);
+  print_largest("Dominators", object_p, limit);
+}
+
+static void
+usage(void)
+{
+  fputs("usage: rep-heap-report [-n COUNT] SNAPSHOT-FILE\n", stderr);
+  exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+  int limit = 20;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+    case 'n':
+      limit = atoi(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+
+  if (optind != argc - 1) {
+    usage();
+  }
+
+  file_name = argv[optind];
+  input = fopen(file_name, "rb");
+  if (!input) {
+    perror(file_name);
+    return 1;
+  }
+
+  read_snapshot();
+  fclose(input);
+
+  build_graph();
+  dominators();
+  report(limit);
+
+  return 0;
+}
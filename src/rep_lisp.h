@@ -55,8 +55,8 @@ typedef uintptr_t repv;
    type of the cell.
 
    If bit zero of the car is unset, the cell is a cons, a pair of two
-   values the car and the cdr (the GC mark bit of the cons is bit zero
-   of the cdr).
+   values the car and the cdr (the GC mark bit of the cons is kept in
+   the header of the block containing it).
 
    If bit zero of the car is set, then further type information is
    stored in bits 1->5 of the car, with bit 5 used to denote statically
@@ -72,7 +72,6 @@ typedef uintptr_t repv;
    CC, we'll use the alignment attribute. Otherwise the rep_ALIGN macro
    needs setting.. */
 
-#define rep_VALUE_CONS_MARK_BIT	1
 #define rep_VALUE_IS_INT	2
 #define rep_VALUE_INT_SHIFT	2
 #define rep_CELL_ALIGNMENT	sizeof(intptr_t)
@@ -188,8 +187,9 @@ typedef struct {
 #define rep_CDR(v)	(rep_CONS(v)->cdr)
 #define rep_CDRLOC(v)	(&(rep_CONS(v)->cdr))
 
-/* Get the cdr when GC is in progress. */
-#define rep_GCDR(v)	(rep_CDR(v) & ~rep_VALUE_CONS_MARK_BIT)
+/* Get the cdr when GC is in progress. Cons mark bits are no longer
+   stored in the cdr, so this is the same as rep_CDR. */
+#define rep_GCDR(v)	rep_CDR(v)
 
 
 /* Type data */
@@ -241,7 +241,10 @@ typedef struct rep_type_struct {
   void (*mark)(repv obj);
 
   /* When non-null, a function that should be called during the sweep
-     phase of garbage collection. */
+     phase of garbage collection. Only the type knows where its
+     objects are, so it must call rep_gc_note_freed_cell() on each
+     unmarked object before freeing it, else the collector's
+     statistics show none of them being freed. */
 
   void (*sweep)(void);
 
@@ -269,6 +272,17 @@ typedef struct rep_type_struct {
 
   void (*unbind)(repv obj);
 
+  /* When non-null, returns the number of bytes used by OBJ, for the
+     garbage collector's statistics. */
+
+  size_t (*size)(repv obj);
+
+  /* When non-null, returns a hash code for OBJ such that objects the
+     compare function finds equal have the same code, for equal-hash.
+     DEPTH is as for rep_equal_hash(). */
+
+  uintptr_t (*hash)(repv obj, unsigned int depth);
+
 } rep_type;
 
 /* Each type of Lisp object has a type code associated with it.
@@ -385,6 +399,11 @@ typedef struct {
 
   repv utf32_data;
 
+  /* Zero, or the cached result of rep_string_hash(). Only set for
+     immutable strings. */
+
+  uintptr_t hash;
+
 } rep_string;
 
 /* String contents are immutable. */
@@ -481,7 +500,6 @@ typedef struct {
 
 typedef struct rep_vector_struct {
   repv car;
-  struct rep_vector_struct *next;
   repv array[1];
 } rep_vector;
 
@@ -686,6 +704,8 @@ typedef struct rep_closure_struct {
 #define rep_LIST_3(v1,v2,v3)		Fcons(v1, rep_LIST_2(v2, v3))
 #define rep_LIST_4(v1,v2,v3,v4)		Fcons(v1, rep_LIST_3(v2, v3, v4))
 #define rep_LIST_5(v1,v2,v3,v4,v5)	Fcons(v1, rep_LIST_4(v2, v3, v4, v5))
+#define rep_LIST_6(v1,v2,v3,v4,v5,v6) \
+  Fcons(v1, rep_LIST_5(v2, v3, v4, v5, v6))
 
 #define rep_CAAR(obj)           rep_CAR(rep_CAR(obj))
 #define rep_CDAR(obj)           rep_CDR(rep_CAR(obj))
@@ -727,46 +747,163 @@ typedef struct rep_closure_struct {
 #define rep_GC_SET_CELL(v)	(rep_PTR(v)->car |= rep_CELL_MARK_BIT)
 #define rep_GC_CLR_CELL(v)	(rep_PTR(v)->car &= ~rep_CELL_MARK_BIT)
 
+/* Cons cells, tuples, vectors and (non-static) strings are allocated
+   from blocks of rep_GC_BLOCK_SIZE bytes, aligned to that size, so the
+   block holding a cell can be found by masking its address. (Large
+   vectors have a block to themselves, which may be bigger than that.)
+   The block header has two bitmaps with one bit for each eight-byte
+   granule of the block: MARK is set when the cell starting there has
+   been marked by the current collection, OLD when it has survived a
+   collection (generational mode, conses and strings only). Since the
+   cells themselves aren't modified by marking, blocks can be swept
+   lazily after the collection has finished, and collecting doesn't
+   dirty pages shared with a forked process. */
+
+#define rep_GC_BLOCK_SIZE	16384
+#define rep_GC_BLOCK_MASK	(rep_GC_BLOCK_SIZE - 1)
+#define rep_GC_WORD_BITS	(sizeof(uintptr_t) * CHAR_BIT)
+#define rep_GC_GRANULE_SIZE	8
+#define rep_GC_BITMAP_WORDS \
+  (rep_GC_BLOCK_SIZE / rep_GC_GRANULE_SIZE / rep_GC_WORD_BITS)
+
+typedef struct rep_gc_block_struct rep_gc_block;
+
+struct rep_gc_block_struct {
+  rep_gc_block *next;
+  uintptr_t mark[rep_GC_BITMAP_WORDS];
+  uintptr_t old[rep_GC_BITMAP_WORDS];
+};
+
+#define rep_GC_BLOCK(v)		((rep_gc_block *)((v) & ~(repv)rep_GC_BLOCK_MASK))
+#define rep_GC_GRANULE(v)	(((v) & rep_GC_BLOCK_MASK) / rep_GC_GRANULE_SIZE)
+#define rep_GC_BIT_WORD(v)	(rep_GC_GRANULE(v) / rep_GC_WORD_BITS)
+#define rep_GC_BIT(v)		((uintptr_t)1 << (rep_GC_GRANULE(v) % rep_GC_WORD_BITS))
+
+#define rep_GC_BLOCK_MARKEDP(v) \
+  ((rep_GC_BLOCK(v)->mark[rep_GC_BIT_WORD(v)] & rep_GC_BIT(v)) != 0)
+#define rep_GC_BLOCK_SET_MARK(v) \
+  (rep_GC_BLOCK(v)->mark[rep_GC_BIT_WORD(v)] |= rep_GC_BIT(v))
+#define rep_GC_BLOCK_CLR_MARK(v) \
+  (rep_GC_BLOCK(v)->mark[rep_GC_BIT_WORD(v)] &= ~rep_GC_BIT(v))
+
+#define rep_GC_OLDP(v) \
+  ((rep_GC_BLOCK(v)->old[rep_GC_BIT_WORD(v)] & rep_GC_BIT(v)) != 0)
+#define rep_GC_SET_OLD(v) \
+  (rep_GC_BLOCK(v)->old[rep_GC_BIT_WORD(v)] |= rep_GC_BIT(v))
+#define rep_GC_CLR_OLD(v) \
+  (rep_GC_BLOCK(v)->old[rep_GC_BIT_WORD(v)] &= ~rep_GC_BIT(v))
+
 /* GC macros for cons values */
 
-#define rep_GC_CONS_MARKEDP(v)	(rep_CDR(v) & rep_VALUE_CONS_MARK_BIT)
-#define rep_GC_SET_CONS(v)	(rep_CDR(v) |= rep_VALUE_CONS_MARK_BIT)
-#define rep_GC_CLR_CONS(v)	(rep_CDR(v) &= ~rep_VALUE_CONS_MARK_BIT)
+#define rep_GC_CONS_MARKEDP(v)	rep_GC_BLOCK_MARKEDP(v)
+#define rep_GC_SET_CONS(v)	rep_GC_BLOCK_SET_MARK(v)
+#define rep_GC_CLR_CONS(v)	rep_GC_BLOCK_CLR_MARK(v)
+
+/* rep_gc_block_types has an entry for each cell8 type code, and for
+   each cell16 type number, that is set when non-static cells of that
+   type are allocated from GC blocks (strings, vectors and tuples). */
+
+#define rep_GC_TYPE_INDEX(car)					\
+  (((car) & rep_CELL_IS_16)					\
+   ? 64 + (((car) >> rep_CELL16_TYPE_SHIFT) & 0xff)		\
+   : ((car) & rep_CELL8_TYPE_MASK))
+
+extern char rep_gc_block_types[64 + 256];
+
+/* True if cell V is allocated from a GC block, i.e. is a cons, a tuple,
+   a vector or a non-static string, and so has its mark bit in the
+   block. */
+
+#define rep_GC_BLOCK_CELL_P(v)						\
+  (rep_CELL_CONS_P(v)							\
+   || (!rep_CELL_STATIC_P(v)						\
+       && rep_gc_block_types[rep_GC_TYPE_INDEX(rep_PTR(v)->car)]))
+
+/* True if cell V may be in the nursery, i.e. is a cons or a non-static
+   string. */
+
+#define rep_GC_NURSERY_CELL_P(v)				\
+  (rep_CELL_CONS_P(v)						\
+   || (rep_CELL8_TYPE(v) == rep_String && !rep_CELL_STATIC_P(v)))
+
+/* True when cell V has been marked. During a minor (nursery only)
+   collection old cells count as marked, they're not traced. */
+
+#define rep_GC_MARKEDP(v)						\
+  (rep_GC_BLOCK_CELL_P(v)						\
+   ? (rep_GC_BLOCK_MARKEDP(v) || (rep_gc_minor && rep_GC_OLDP(v)))	\
+   : rep_GC_CELL_MARKEDP(v))
 
-/* True when cell V has been marked. */
+/* True when cell V will survive the current collection. Weak
+   references and guardians must test this rather than the mark bit,
+   since a minor collection only traces (and frees) young cells. */
 
-#define rep_GC_MARKEDP(v) \
-    (rep_CELL_CONS_P(v) ? rep_GC_CONS_MARKEDP(v) : rep_GC_CELL_MARKEDP(v))
+#define rep_GC_LIVEP(v)							\
+  (rep_GC_MARKEDP(v) || (rep_gc_minor && !rep_GC_NURSERY_CELL_P(v)))
+
+/* Must be called after allocating BYTES bytes of GC-managed data. */
+
+#define rep_NOTE_ALLOCATION(bytes)					\
+  do {									\
+    rep_data_after_gc += (bytes);					\
+    if (rep_data_after_gc >= rep_alloc_sample_point) {			\
+      rep_alloc_sample(bytes);						\
+    }									\
+  } while (0)
+
+/* Must be called after storing VAL into a field of heap object OBJ,
+   unless OBJ is a cons cell that can't have survived a collection
+   since it was allocated. OBJ may be zero when the object isn't
+   known, this is treated as being old. */
+
+#define rep_GC_WRITE_BARRIER(obj, val)			\
+  do {							\
+    if (rep_gc_generational && rep_CELLP(val)) {	\
+      rep_gc_write_barrier(obj, val);			\
+    }							\
+  } while (0)
+
+/* Write barrier for storing VAL at PTR, which either points to the cdr
+   of a cons cell, or is the address of the variable HEAD. */
+
+#define rep_GC_CDRLOC_BARRIER(ptr, head, val)				\
+  do {									\
+    if (rep_gc_generational && (ptr) != &(head) && rep_CELLP(val)) {	\
+      rep_gc_write_barrier(rep_VAL((char *)(ptr)			\
+				   - offsetof(rep_cons, cdr)), val);	\
+    }									\
+  } while (0)
 
 /* Set the mark bit of cell V. */
 
-#define rep_GC_SET(v)		\
-  do {				\
-    if (rep_CELLP(v)) {		\
-      rep_GC_SET_CELL(v);	\
-    } else {			\
-      rep_GC_SET_CONS(v);	\
-    }				\
+#define rep_GC_SET(v)			\
+  do {					\
+    if (rep_GC_BLOCK_CELL_P(v)) {	\
+      rep_GC_BLOCK_SET_MARK(v);		\
+    } else {				\
+      rep_GC_SET_CELL(v);		\
+    }					\
   } while (0)
 
 /* Clear the mark bit of cell V. */
 
-#define rep_GC_CLR(v)		\
-  do {				\
-    if(rep_CELLP(v)) {		\
-      rep_GC_CLR_CELL(v);	\
-    } else {			\
-      rep_GC_CLR_CONS(v);	\
-    }				\
+#define rep_GC_CLR(v)			\
+  do {					\
+    if (rep_GC_BLOCK_CELL_P(v)) {	\
+      rep_GC_BLOCK_CLR_MARK(v);		\
+    } else {				\
+      rep_GC_CLR_CELL(v);		\
+    }					\
   } while (0)
 
 /* Recursively mark object V. */
 
-#define rep_MARKVAL(v)					\
-  do {							\
-    if(v != 0 && !rep_INTP(v) && !rep_GC_MARKEDP(v)) {	\
-      rep_mark_value(v);				\
-    }							\
+#define rep_MARKVAL(v)						\
+  do {								\
+    if(v != 0 && !rep_INTP(v)					\
+       && (!rep_GC_MARKEDP(v) || rep_gc_snapshot)) {		\
+      rep_mark_value(v);					\
+    }								\
   } while (0)
 
 /* A stack of dynamic GC roots, i.e. objects to start marking from. */
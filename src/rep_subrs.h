@@ -157,6 +157,10 @@ extern repv Fquote_regexp(repv str);
 extern repv Fregexp_cache_control(repv limit);
 extern void rep_regerror(char *err);
 
+/* from hash.c */
+extern uint64_t rep_hash_seed;
+extern uint64_t rep_hash_bytes(const void *data, size_t len);
+
 /* from fluids.c */
 extern repv Fmake_fluid (repv);
 extern repv Ffluid_ref (repv);
@@ -443,6 +447,7 @@ extern repv Fmakunbound(repv);
 extern repv Fget(repv, repv);
 extern repv Fput(repv, repv, repv);
 extern repv Fapropos(repv, repv, repv);
+extern repv Fobarray_statistics(repv);
 extern repv Fmake_variable_special (repv sym);
 extern repv Fspecial_variable_p(repv sym);
 extern repv Ftrace(repv sym);
@@ -468,6 +473,9 @@ extern repv rep_add_subr(rep_xsubr *, bool);
 extern void rep_structure_exports_all (repv s, bool status);
 extern void rep_structure_set_binds (repv s, bool status);
 
+/* from tables.c */
+extern uintptr_t rep_equal_hash(repv x, unsigned int depth);
+
 /* from tuples.c */
 extern repv rep_make_tuple (repv car, repv a, repv b);
 extern void rep_mark_tuple (repv t);
@@ -506,8 +514,27 @@ extern rep_GC_root *rep_gc_root_stack;
 extern rep_GC_n_roots *rep_gc_n_roots_stack;
 extern repv Vgarbage_threshold(repv val);
 extern repv Vidle_garbage_threshold(repv val);
+extern repv Fgarbage_threshold_maximum(repv val);
+extern repv Fgarbage_growth_ratio(repv val);
+extern repv Fgarbage_pause_goal(repv val);
+extern repv Fgarbage_pacing_policy(repv policy);
 extern repv Fgarbage_collect(repv noStats);
 extern int rep_data_after_gc, rep_gc_threshold, rep_idle_gc_threshold;
+extern int rep_alloc_sample_point;
+extern void (*rep_alloc_sampler)(size_t bytes);
+extern void rep_alloc_sample(size_t bytes);
+extern void rep_alloc_sample_after(int bytes);
+extern bool rep_gc_generational, rep_gc_minor, rep_gc_snapshot;
+extern void rep_gc_write_barrier(repv obj, repv val);
+extern repv Fgarbage_collector_mode(repv mode);
+extern void rep_gc_finish_sweep(void);
+extern repv Ffinish_garbage_collection(void);
+extern void rep_gc_note_freed(repv car, size_t objects, size_t bytes);
+extern void rep_gc_note_freed_cell(repv val);
+extern repv Fgarbage_collection_statistics(void);
+extern repv Fgarbage_collection_totals(void);
+extern repv Fgarbage_pause_histogram(repv kind);
+extern repv Fwrite_heap_snapshot(repv file);
 
 /* from vectors.c */
 extern repv Fvectorp(repv);
@@ -520,6 +547,7 @@ extern repv Fmake_vector_immutable(repv);
 extern intptr_t rep_string_ptr_size(repv s);
 extern const char *rep_string_ptr(repv s);
 extern char *rep_string_mutable_ptr(repv s);
+extern uintptr_t rep_string_hash(repv s);
 extern void rep_string_set_ascii(repv s);
 extern intptr_t rep_stream_put_utf8(repv stream, repv str, intptr_t count);
 extern repv Fstringp(repv);
@@ -528,6 +556,7 @@ extern repv Fstring_ref(repv, repv);
 extern repv Fstring_set(repv, repv, repv);
 extern repv Fmake_string_immutable(repv);
 extern repv Fstring_to_immutable_string(repv);
+extern repv Fstring_equal(repv, repv);
 
 /* from unix_dl.c */
 extern bool rep_find_c_symbol(void *, char **, void **);
@@ -539,6 +568,8 @@ extern size_t rep_file_length(repv file);
 
 /* from unix_main.c */
 extern uintptr_t rep_time(void);
+extern long long rep_utime(void);
+extern long long rep_cpu_utime(void);
 extern void (*rep_register_input_fd_fun)(int fd, void (*callback)(int fd));
 extern void (*rep_deregister_input_fd_fun)(int fd);
 extern void rep_add_event_loop_callback (bool (*callback)(void));
@@ -563,12 +594,14 @@ extern bool rep_poll_input(int fd);
 
 #ifdef DEBUG_SYS_ALLOC
 extern void *rep_alloc(size_t length);
+extern void *rep_calloc(size_t count, size_t length);
 extern void *rep_realloc(void *ptr, size_t length);
 extern void rep_free(void *ptr);
 extern void rep_print_allocations(void);
 #else
 # include <stdlib.h>
 # define rep_alloc(n) malloc(n)
+# define rep_calloc(n,s) calloc(n,s)
 # define rep_realloc(p,n) realloc(p,n)
 # define rep_free(p) free(p)
 #endif
@@ -165,8 +165,27 @@ struct rep_struct_node_struct {
 
 #define rep_PENDING_CLOSE	(1 << (rep_CELL16_TYPE_BITS + 3))
 
+/* If set, the inline caches of the VM depend on this structure. */
+#define rep_STF_LINKED		(1 << (rep_CELL16_TYPE_BITS + 4))
+
 #define rep_STRUCT_HASH(s,x)	(((x) >> 3) & (s)->bucket_mask)
 
+/* Inline cache for an OP_REFQ or OP_SETQ naming one of a compiled
+   function's constants. Valid while S is the current structure and
+   EPOCH equals rep_structure_epoch, which changes whenever a lookup
+   made to fill a cache might give a different answer. LOCAL is set when N is a binding of S
+   itself (the only kind OP_SETQ may use). */
+
+typedef struct rep_ref_cache_struct {
+  rep_struct *s;
+  rep_struct_node *n;
+  uint32_t epoch;
+  bool local;
+} rep_ref_cache;
+
+#define rep_REF_CACHE_VALIDP(c, st)		\
+  ((c)->s == (st) && (c)->epoch == rep_structure_epoch)
+
 
 /* Binding frames. */
 
@@ -222,7 +241,8 @@ struct rep_stack_frame_struct {
 typedef struct rep_guardian_struct {
   repv car;
   struct rep_guardian_struct *next;
-  repv accessible;
+  repv accessible;			/* pushed since the last gc */
+  repv old_accessible;
   repv inaccessible;
 } rep_guardian;
 
@@ -261,6 +281,46 @@ typedef struct rep_guardian_struct {
 #endif
 
 
+/* Bit counting. */
+
+static inline int
+rep_popcount(uintptr_t x)
+{
+#ifdef __GNUC__
+  return __builtin_popcountl(x);
+#else
+  int n = 0;
+  for (; x != 0; x &= x - 1) {
+    n++;
+  }
+  return n;
+#endif
+}
+
+/* Index of the lowest set bit of X, which must be non-zero. */
+
+static inline int
+rep_ctz(uintptr_t x)
+{
+#ifdef __GNUC__
+  return __builtin_ctzl(x);
+#else
+  int n = 0;
+  for (; !(x & 1); x >>= 1) {
+    n++;
+  }
+  return n;
+#endif
+}
+
+/* Address of the cell starting at bit BIT of word WORD of the bitmaps
+   of GC block BLOCK. */
+
+#define rep_GC_CELL_AT(block, word, bit)			\
+  ((void *)((char *)(block) + ((word) * rep_GC_WORD_BITS + (bit))	\
+	    * rep_GC_GRANULE_SIZE))
+
+
 /* For flags field of rep_type. */
 
 enum rep_type_flags {
@@ -46,6 +46,7 @@ extern void rep_closures_init(void);
 extern void rep_closures_kill(void);
 
 /* from datums.c */
+extern repv rep_datum_printers(void);
 extern void rep_pre_datums_init (void);
 extern void rep_datums_init (void);
 
@@ -76,6 +77,14 @@ extern void rep_fluids_init(void);
 extern void rep_run_guardians(void);
 extern void rep_guardians_init(void);
 
+/* from hash.c */
+extern void rep_hash_init(void);
+
+/* from image.c */
+extern void rep_image_baseline(void);
+extern repv rep_dump_image(repv file);
+extern bool rep_load_image(repv file);
+
 /* from lambda.c */
 extern repv rep_apply_lambda(repv lambda_exp, repv arg_list, bool tail_posn);
 extern repv rep_tail_call_throw(repv lst);
@@ -105,6 +114,7 @@ extern repv Fvector (int argc, repv *argv);
 extern repv Fconcat (int, repv *);
 
 /* from compare.c */
+extern rep_xsubr Sequal;
 extern repv Fnum_eq (int, repv *);
 extern repv Fnum_noteq (int, repv *);
 extern repv Fgtthan (int, repv *);
@@ -114,19 +124,32 @@ extern repv Flethan (int, repv *);
 extern void rep_compare_init(void);
 
 /* from gc.c */
+extern void *rep_gc_alloc_block(void);
+extern void *rep_gc_alloc_large_block(size_t size);
+extern void rep_gc_free_block(void *block);
+extern size_t rep_gc_released_bytes;
+extern bool rep_gc_keep_empty_block(int *kept, size_t size);
+extern void rep_gc_cell_map(uintptr_t *map, size_t offset, size_t size,
+			    int count);
+extern int rep_gc_block_marked(rep_gc_block *block);
+extern void rep_gc_auto(void);
 extern void rep_gc_init(void);
 
 /* from lispmach.c */
 extern repv Qbytecode_error;
 extern repv Frun_byte_code(repv code, repv consts, repv stkreq);
 extern repv rep_apply_bytecode (repv subr, int nargs, repv *args);
+extern void rep_scan_bytecode_profile(void);
+extern void rep_scan_direct_threaded_code(void);
 extern void rep_lispmach_init(void);
 
 /* from lists.c */
 extern int rep_allocated_cons, rep_used_cons;
 extern void rep_cons_free(repv);
 extern int rep_cons_cmp(repv v1, repv v2);
+extern void rep_cons_clear_marks(void);
 extern void rep_cons_sweep(void);
+extern void rep_cons_finish_sweep(void);
 extern void rep_lists_init(void);
 extern void rep_lists_kill(void);
 
@@ -153,6 +176,8 @@ extern void rep_misc_init(void);
 /* from numbers.c */
 extern repv rep_parse_number (const char *buf, size_t len, int radix,
 			      int sign, unsigned int type);
+extern repv Fstring_to_number(repv string, repv radix);
+extern repv Fnumber_to_string(repv z, repv radix);
 extern repv Fplus(int, repv *);
 extern repv Fminus(int, repv *);
 extern repv Fproduct(int, repv *);
@@ -163,6 +188,7 @@ extern repv Flogand(int, repv *);
 extern repv Fmax(int, repv *);
 extern repv Fmin(int, repv *);
 extern repv Fgcd (int, repv *);
+extern size_t rep_number_size(repv v);
 extern void rep_numbers_init (void);
 extern void rep_numbers_kill(void);
 
@@ -174,6 +200,9 @@ extern void rep_mark_origins (void);
 extern void rep_scan_origins(void);
 extern void rep_origin_init (void);
 
+/* from persistent.c */
+extern void rep_persistent_init(void);
+
 /* from plists.c */
 extern void rep_plists_init(void);
 
@@ -202,7 +231,9 @@ extern int rep_allocated_strings, rep_used_strings;
 extern size_t rep_allocated_string_bytes;
 extern intptr_t rep_read_string_escape(repv stream, int *c_p, uint8_t *ptr);
 extern int rep_string_cmp(repv v1, repv v2);
+extern void rep_string_clear_marks(void);
 extern void rep_string_sweep(void);
+extern void rep_string_finish_sweep(void);
 extern void rep_strings_init(void);
 extern void rep_strings_kill(void);
 
@@ -221,8 +252,20 @@ extern repv Fstructure_access (repv, repv);
 extern repv Fintern_structure (repv);
 extern repv Ffind_structure (repv);
 extern repv Fexport_binding (repv var);
+extern repv Fstructure_install_vm (repv s, repv vm);
 extern repv rep_get_initial_special_value (repv sym);
 extern repv rep_documentation_property (repv structure);
+extern rep_struct *rep_structure_list(void);
+extern rep_struct_node *rep_structure_lookup(repv s, repv var);
+extern void rep_structure_install(repv s, repv var, repv value,
+				  bool constant, bool exported);
+extern void rep_structures_changed(void);
+extern uint32_t rep_structure_epoch;
+extern uintptr_t rep_ref_cache_hits;
+extern rep_ref_cache *rep_ref_caches(repv consts);
+extern rep_struct_node *rep_ref_cache_fill(rep_ref_cache *c, repv var);
+extern repv rep_ref_cache_set(rep_ref_cache *c, repv var, repv value);
+extern void rep_scan_ref_caches(void);
 extern void rep_pre_structures_init (void);
 extern void rep_structures_init (void);
 
@@ -230,16 +273,19 @@ extern void rep_structures_init (void);
 extern repv rep_keyword_obarray;
 extern int rep_allocated_closures, rep_used_closures;
 extern repv rep_intern_symbol(const char *name, size_t len, repv obarray);
+extern repv rep_intern_builtin(repv name);
 extern void rep_obarray_init(void);
 extern void rep_symbols_init(void);
 
 /* from tables.c */
+extern rep_xsubr Sequal_hash;
 extern repv Fstring_hash(repv arg);
 extern repv Fsymbol_hash(repv arg);
 extern repv Feq_hash(repv arg);
 extern repv Fequal_hash(repv arg);
-extern repv Fmake_table(repv hash_fun, repv cmp_fun);
-extern repv Fmake_weak_table(repv hash_fun, repv cmp_fun);
+extern repv Fmake_table(repv hash_fun, repv cmp_fun, repv size);
+extern repv Fmake_weak_table(repv hash_fun, repv cmp_fun, repv size,
+			     repv weakness);
 extern repv Ftablep(repv arg);
 extern repv Ftable_ref(repv tab, repv key);
 extern repv Ftable_boundp(repv tab, repv key);
@@ -247,11 +293,19 @@ extern repv Ftable_set(repv tab, repv key, repv value);
 extern repv Ftable_for_each(repv fun, repv tab);
 extern repv Ftable_size(repv tab);
 extern repv Ftable_unset(repv tab, repv key);
+extern repv rep_table_functions(repv tab, repv *hash_fun, repv *cmp_fun);
+extern void rep_table_walk(repv tab,
+			   void (*fun)(repv key, repv value, void *data),
+			   void *data);
+extern void rep_mark_weak_tables(void);
+extern void rep_scan_weak_tables(void);
 extern void rep_tables_init(void);
 
 /* from tuples.c */
 extern int rep_allocated_tuples, rep_used_tuples;
 extern void rep_sweep_tuples (void);
+extern void rep_tuples_clear_marks(void);
+extern void rep_tuples_finish_sweep(void);
 extern void rep_tuples_kill(void);
 
 /* from time.c */
@@ -291,6 +345,7 @@ extern void rep_weak_refs_init (void);
 extern repv rep_dl_open_structure(repv file_name);
 extern int rep_dl_intern_library (repv file_name);
 extern void rep_dl_mark_data(void);
+extern repv rep_dl_libraries(void);
 extern void *rep_dl_lookup_symbol (int idx, const char *name);
 extern void rep_dl_kill_libraries(void);
 
@@ -81,7 +81,7 @@ static rep_socket *
 make_socket_(int sock_fd, int namespace, int style)
 {
   rep_socket *s = rep_alloc(sizeof(rep_socket));
-  rep_data_after_gc += sizeof(rep_socket);
+  rep_NOTE_ALLOCATION(sizeof(rep_socket));
 
   s->car = socket_type() | IS_ACTIVE;
   s->sock = sock_fd;
@@ -707,6 +707,7 @@ socket_sweep(void)
     rep_socket *next = ptr->next;
 
     if (!rep_GC_CELL_MARKEDP(rep_VAL(ptr))) {
+      rep_gc_note_freed_cell(rep_VAL(ptr));
       delete_socket(ptr);
     } else {
       rep_GC_CLR_CELL(rep_VAL(ptr));
@@ -200,6 +200,7 @@ rep_stream_putc(repv stream, int c)
 	memcpy(rep_MUTABLE_STR(new), rep_STR(str), len);
 	rep_CAR(stream) = new;
 	rep_CDR(stream) = rep_MAKE_INT(new_capacity);
+	rep_GC_WRITE_BARRIER(stream, new);
 	str = new;
       }
       rep_MUTABLE_STR(str)[len] = c;
@@ -298,6 +299,7 @@ rep_stream_puts(repv stream, const void *data,
 	memcpy(rep_MUTABLE_STR(new), rep_STR(str), len);
 	rep_CAR(stream) = new;
 	rep_CDR(stream) = rep_MAKE_INT(new_capacity);
+	rep_GC_WRITE_BARRIER(stream, new);
 	str = new;
       }
       memcpy(rep_MUTABLE_STR(str) + len, buf, data_len);
@@ -1123,6 +1125,7 @@ stream will only return the new characters.
 
   rep_CAR(strm) = rep_string_copy_n("", 0);
   rep_CDR(strm) = rep_MAKE_INT(0);
+  rep_GC_WRITE_BARRIER(strm, rep_CAR(strm));
 
   return string;
 }
@@ -41,17 +41,61 @@ struct rep_string_utf32_struct {
 
 #define STRING_LEN(car) ((car) >> rep_STRING_LEN_SHIFT)
 
-#define STRINGS_PER_BLOCK 510 /* ~4k */
+/* Strings whose data (including the zero terminator) fits in
+   SHORT_STRING_BYTES are stored in a larger cell, with the data
+   following the rep_string header, rather than in a separate
+   allocation. utf8_data then points into the cell itself. */
 
-typedef struct string_block_struct string_block;
+#define SHORT_STRING_BYTES 16
 
-struct string_block_struct {
-  string_block *next;
-  rep_ALIGN_CELL(rep_string data[STRINGS_PER_BLOCK]);
+typedef struct {
+  rep_string str;
+  uint8_t data[SHORT_STRING_BYTES];
+} short_string;
+
+#define SHORT_DATA(s) (((short_string *)(s))->data)
+
+/* True if the data of string S is stored inline. */
+
+#define INLINE_DATA_P(s) ((s)->utf8_data == SHORT_DATA(s))
+
+/* String cells of each size are allocated from their own GC blocks, the
+   first cell following the block header. */
+
+#define BLOCK_DATA(b) ((char *)(b) + sizeof(rep_gc_block))
+
+typedef struct string_heap_struct string_heap;
+
+struct string_heap_struct {
+  size_t cell_size;
+  int cells_per_block;
+
+  /* Blocks that have been swept since the last collection, and those
+     that haven't yet. */
+
+  rep_gc_block *block_list;
+  rep_gc_block *sweep_list;
+  rep_string *free_list;
+
+  /* Number of empty blocks kept by sweep_block() since the last
+     collection. */
+
+  int empty_blocks_kept;
+
+  uintptr_t cell_map[rep_GC_BITMAP_WORDS];
+  bool cell_map_ready;
+};
+
+#define CELLS_PER_BLOCK(size) \
+  ((rep_GC_BLOCK_SIZE - sizeof(rep_gc_block)) / (size))
+
+static string_heap long_strings = {
+  sizeof(rep_string), CELLS_PER_BLOCK(sizeof(rep_string)),
 };
 
-static string_block *string_block_list;
-static rep_string *string_freelist;
+static string_heap short_strings = {
+  sizeof(short_string), CELLS_PER_BLOCK(sizeof(short_string)),
+};
 
 int rep_allocated_strings, rep_used_strings;
 size_t rep_allocated_string_bytes;
@@ -62,22 +106,60 @@ DEFSYM(newlines, "newlines");
 DEFSTRING(null_string_const, "");
 DEFSTRING(string_overflow, "String too long");
 
+static void sweep_block(string_heap *h, rep_gc_block *b);
+
+/* Note that the cell returned is not linked into the free list! */
+
 static rep_string *
-refill_free_list(void)
+refill_free_list(string_heap *h)
 {
-  string_block *cb = rep_alloc(sizeof(string_block));
-  rep_allocated_strings += STRINGS_PER_BLOCK;
+  while (h->sweep_list) {
+    rep_gc_block *b = h->sweep_list;
+    h->sweep_list = b->next;
+    sweep_block(h, b);
+    if (h->free_list) {
+      rep_string *str = h->free_list;
+      h->free_list = rep_STRING(str->car);
+      return str;
+    }
+  }
+
+  rep_static_assert(sizeof(rep_gc_block) % rep_GC_GRANULE_SIZE == 0);
+
+  rep_gc_block *b = rep_gc_alloc_block();
+  if (!b) {
+    return NULL;
+  }
+
+  rep_allocated_strings += h->cells_per_block;
+
+  b->next = h->block_list;
+  h->block_list = b;
 
-  cb->next = string_block_list;
-  string_block_list = cb;
+  char *data = BLOCK_DATA(b);
 
-  for (int i = 1; i < STRINGS_PER_BLOCK - 1; i++) {
-    cb->data[i].car = rep_VAL(&cb->data[i + 1]);
+  for (int i = 1; i < h->cells_per_block - 1; i++) {
+    ((rep_string *)(data + i * h->cell_size))->car
+      = rep_VAL(data + (i + 1) * h->cell_size);
+  }
+  ((rep_string *)(data + (h->cells_per_block - 1) * h->cell_size))->car = 0;
+  h->free_list = (rep_string *)(data + h->cell_size);
+
+  return (rep_string *)data;
+}
+
+static inline rep_string *
+alloc_string_cell(string_heap *h)
+{
+  rep_string *str = h->free_list;
+
+  if (str) {
+    h->free_list = rep_STRING(str->car);
+  } else {
+    str = refill_free_list(h);
   }
-  cb->data[STRINGS_PER_BLOCK - 1].car = 0;
-  string_freelist = &cb->data[1];
 
-  return &cb->data[0];
+  return str;
 }
 
 /* PTR should have been allocated using rep_alloc or malloc. Ownership
@@ -91,20 +173,20 @@ rep_box_string(char *ptr, size_t len)
     return Fsignal(Qerror, rep_LIST_1(rep_VAL(&string_overflow)));
   }
 
-  rep_string *str = string_freelist;
+  rep_string *str = alloc_string_cell(&long_strings);
 
-  if (str) {
-    string_freelist = rep_STRING(str->car);
-  } else {
-    str = refill_free_list();
+  if (!str) {
+    return rep_mem_error();
   }
 
   str->car = rep_String | (len << rep_STRING_LEN_SHIFT);
   str->utf8_data = (uint8_t *)ptr;
   str->utf32_data = 0;
+  str->hash = 0;
 
   rep_used_strings++;
-  rep_data_after_gc += sizeof(rep_string) + len;
+  rep_allocated_string_bytes += len;
+  rep_NOTE_ALLOCATION(sizeof(rep_string) + len);
 
   return rep_VAL(str);
 }
@@ -121,6 +203,25 @@ rep_null_string(void)
 repv
 rep_allocate_string(size_t len)
 {
+  if (len <= SHORT_STRING_BYTES && len > 0) {
+    rep_string *str = alloc_string_cell(&short_strings);
+
+    if (!str) {
+      return 0;
+    }
+
+    str->car = rep_String | ((len - 1) << rep_STRING_LEN_SHIFT);
+    str->utf8_data = SHORT_DATA(str);
+    str->utf32_data = 0;
+    str->hash = 0;
+
+    rep_used_strings++;
+    rep_allocated_string_bytes += len - 1;
+    rep_NOTE_ALLOCATION(sizeof(short_string));
+
+    return rep_VAL(str);
+  }
+
   char *data = rep_alloc(len);
   if (data) {
     return rep_box_string(data, len - 1);
@@ -214,7 +315,15 @@ flatten_utf32(rep_string *s)
   }
 
   ssize_t size = utf32_to_utf8_size(u->data, u->len);
-  uint8_t *ptr = rep_realloc(s->utf8_data, size + 1);
+  uint8_t *ptr;
+
+  if (!INLINE_DATA_P(s)) {
+    ptr = rep_realloc(s->utf8_data, size + 1);
+  } else if (size < SHORT_STRING_BYTES) {
+    ptr = s->utf8_data;
+  } else {
+    ptr = rep_alloc(size + 1);
+  }
 
   if (!ptr) {
     return false;
@@ -224,6 +333,10 @@ flatten_utf32(rep_string *s)
   ptr[size] = 0;
   s->utf8_data = ptr;
 
+  if (!rep_CELL_STATIC_P(rep_VAL(s))) {
+    rep_allocated_string_bytes += size - STRING_LEN(s->car);
+  }
+
   uintptr_t len_mask = (~((uintptr_t)0)) << rep_STRING_LEN_SHIFT;
   s->car = (s->car & ~len_mask) | (size << rep_STRING_LEN_SHIFT);
 
@@ -264,7 +377,7 @@ ensure_utf32(rep_string *s, bool force)
     return NULL;
   }
 
-  rep_data_after_gc += SIZEOF_UTF32(len);
+  rep_NOTE_ALLOCATION(SIZEOF_UTF32(len));
 
   u->len = len;
   utf8_to_utf32(u->data, s->utf8_data, STRING_LEN(s->car));
@@ -350,9 +463,36 @@ rep_string_mutable_ptr(repv s)
     rep_STRING(s)->utf32_data = 0;
   }
 
+  if (!rep_CELL_STATIC_P(s)) {
+    rep_STRING(s)->hash = 0;
+  }
+
   return (char *)rep_STRING(s)->utf8_data;
 }
 
+/* Return the hash code of the contents of string S. It's cached in
+   immutable strings (static strings may be in read-only storage, so
+   they're left alone). Zero means "not computed", so a real hash of
+   zero is just recomputed each time. */
+
+uintptr_t
+rep_string_hash(repv s)
+{
+  rep_string *str = rep_STRING(s);
+
+  if (str->hash) {
+    return str->hash;
+  }
+
+  uintptr_t hash = rep_hash_bytes(rep_string_ptr(s), rep_string_ptr_size(s));
+
+  if ((str->car & rep_STRING_IMMUTABLE) && !rep_CELL_STATIC_P(s)) {
+    str->hash = hash;
+  }
+
+  return hash;
+}
+
 int
 rep_string_cmp(repv v1, repv v2)
 {
@@ -448,63 +588,151 @@ rep_string_print(repv strm, repv obj)
   }
 }
 
-void
-rep_string_sweep(void)
+/* Free the unmarked strings in block B of heap H. If none are left the
+   block may be released, otherwise it's moved to the list of swept
+   blocks. */
+
+static void
+sweep_block(string_heap *h, rep_gc_block *b)
 {
-  string_block *cb = string_block_list;
+  if (!h->cell_map_ready) {
+    rep_gc_cell_map(h->cell_map, sizeof(rep_gc_block),
+		    h->cell_size, h->cells_per_block);
+    h->cell_map_ready = true;
+  }
 
-  string_block_list = NULL;
-  string_freelist = NULL;
+  rep_string *free_list = NULL;
+  rep_string *free_tail = NULL;
+  bool used = false;
+  size_t freed = 0, freed_bytes = 0;
 
-  rep_used_strings = 0;
-  rep_allocated_string_bytes = 0;
+  for (int i = 0; i < rep_GC_BITMAP_WORDS; i++) {
+    uintptr_t live = b->mark[i] | b->old[i];
 
-  while (cb) {
-    string_block *next = cb->next;
+    /* Live strings are only read, unless their UTF-32 data expires. */
 
-    rep_string *free_list = NULL;
-    rep_string *free_tail = NULL;
-    int used_strings = 0;
+    for (uintptr_t bits = h->cell_map[i] & live; bits != 0; bits &= bits - 1) {
+      collect_utf32(rep_GC_CELL_AT(b, i, rep_ctz(bits)));
+      used = true;
+    }
 
-    for (int i = 0; i < STRINGS_PER_BLOCK; i++) {
-      repv str = rep_VAL(&cb->data[i]);
+    for (uintptr_t bits = h->cell_map[i] & ~live; bits != 0; bits &= bits - 1) {
+      rep_string *str = rep_GC_CELL_AT(b, i, rep_ctz(bits));
 
       /* If on the freelist then the CELL_IS_8 bit will be unset (since
 	 the pointer is long aligned). */
 
-      if (rep_CELL_CONS_P(str) || !rep_GC_CELL_MARKEDP(str)) {
-	if (!free_tail) {
-	  free_tail = rep_STRING(str);
-	}
-	if (!rep_CELL_CONS_P(str)) {
-	  rep_free(rep_STRING(str)->utf8_data);
-	  free_utf32(rep_STRING(str));
+      if (!rep_CELL_CONS_P(rep_VAL(str))) {
+	rep_allocated_string_bytes -= STRING_LEN(str->car);
+	freed++;
+	freed_bytes += h->cell_size;
+	if (!INLINE_DATA_P(str)) {
+	  freed_bytes += STRING_LEN(str->car) + 1;
+	  rep_free(str->utf8_data);
 	}
-	rep_STRING(str)->car = rep_VAL(free_list);
-	free_list = rep_STRING(str);
-      } else {
-	rep_GC_CLR_CELL(str);
-	collect_utf32(rep_STRING(str));
-	rep_allocated_string_bytes += rep_STRING_LEN(str);
-	used_strings++;
+	free_utf32(str);
       }
-    }
 
-    if (used_strings == 0) {
-      rep_free(cb);
-      rep_allocated_strings -= STRINGS_PER_BLOCK;
-    } else {
-      if (free_tail) {
-	free_tail->car = rep_VAL(string_freelist);
-	string_freelist = free_list;
-	rep_used_strings += used_strings;
+      if (!free_tail) {
+	free_tail = str;
       }
-      cb->next = string_block_list;
-      string_block_list = cb;
+      str->car = rep_VAL(free_list);
+      free_list = str;
     }
+  }
+
+  rep_gc_note_freed(rep_String, freed, freed_bytes);
+
+  if (!used
+      && !rep_gc_keep_empty_block(&h->empty_blocks_kept, rep_GC_BLOCK_SIZE))
+  {
+    rep_gc_free_block(b);
+    rep_allocated_strings -= h->cells_per_block;
+    return;
+  }
+
+  if (free_tail) {
+    free_tail->car = rep_VAL(h->free_list);
+    h->free_list = free_list;
+  }
+
+  memset(b->mark, 0, sizeof(b->mark));
+
+  b->next = h->block_list;
+  h->block_list = b;
+}
+
+static void
+clear_marks(string_heap *h)
+{
+  for (rep_gc_block *b = h->sweep_list; b; b = b->next) {
+    memset(b->mark, 0, sizeof(b->mark));
+  }
+}
+
+/* Called before marking, clears the marks left by the previous
+   collection in blocks that haven't been swept since. */
+
+void
+rep_string_clear_marks(void)
+{
+  clear_marks(&long_strings);
+  clear_marks(&short_strings);
+}
+
+/* Queue all blocks of heap H to be swept, returning the number of live
+   strings in them. */
 
-    cb = next;
+static int
+queue_blocks(string_heap *h)
+{
+  rep_gc_block *list = h->sweep_list;
+  int used = 0;
+
+  while (h->block_list) {
+    rep_gc_block *b = h->block_list;
+    h->block_list = b->next;
+    b->next = list;
+    list = b;
+  }
+
+  for (rep_gc_block *b = list; b; b = b->next) {
+    used += rep_gc_block_marked(b);
   }
+
+  h->sweep_list = list;
+  h->free_list = NULL;
+  h->empty_blocks_kept = 0;
+
+  return used;
+}
+
+/* Called after marking. All blocks are queued to be swept when a
+   string next needs a cell of their size. */
+
+void
+rep_string_sweep(void)
+{
+  rep_used_strings = queue_blocks(&long_strings) + queue_blocks(&short_strings);
+}
+
+static void
+finish_sweep(string_heap *h)
+{
+  while (h->sweep_list) {
+    rep_gc_block *b = h->sweep_list;
+    h->sweep_list = b->next;
+    sweep_block(h, b);
+  }
+}
+
+/* Sweep all blocks not yet swept since the last collection. */
+
+void
+rep_string_finish_sweep(void)
+{
+  finish_sweep(&long_strings);
+  finish_sweep(&short_strings);
 }
 
 /* Sets the length-field of the dynamic string STR to LEN. */
@@ -518,6 +746,10 @@ rep_string_set_len(repv str, size_t len)
 
   free_utf32(rep_STRING(str));
 
+  if (!rep_CELL_STATIC_P(str)) {
+    rep_allocated_string_bytes += len - STRING_LEN(rep_STRING(str)->car);
+  }
+
   uintptr_t len_mask = (~((uintptr_t)0)) << rep_STRING_LEN_SHIFT;
 
   rep_STRING(str)->car = ((rep_STRING(str)->car & ~len_mask)
@@ -1138,18 +1370,20 @@ string_compare(repv str1, repv str2)
 
   const char *s1 = rep_STR(str1);
   const char *s2 = rep_STR(str2);
+  size_t len1 = rep_STRING_LEN(str1);
+  size_t len2 = rep_STRING_LEN(str2);
 
-  while (*s1 && *s2) {
-    int c1 = *s1++;
-    int c2 = *s2++;
+  for (size_t i = 0; i < len1 && i < len2; i++) {
+    int c1 = s1[i];
+    int c2 = s2[i];
     if (c1 != c2) {
       return rep_MAKE_INT(c1 - c2);
     }
   }
 
-  if (*s1) {
+  if (len1 > len2) {
     return rep_MAKE_INT(1);
-  } else if (*s2) {
+  } else if (len1 < len2) {
     return rep_MAKE_INT(-1);
   } else {
     return rep_MAKE_INT(0);
@@ -1164,18 +1398,20 @@ string_compare_ci(repv str1, repv str2)
 
   const char *s1 = rep_STR(str1);
   const char *s2 = rep_STR(str2);
+  size_t len1 = rep_STRING_LEN(str1);
+  size_t len2 = rep_STRING_LEN(str2);
 
-  while (*s1 && *s2) {
-    int c1 = rep_toupper(*s1++);
-    int c2 = rep_toupper(*s2++);
+  for (size_t i = 0; i < len1 && i < len2; i++) {
+    int c1 = rep_toupper(s1[i]);
+    int c2 = rep_toupper(s2[i]);
     if (c1 != c2) {
       return rep_MAKE_INT(c1 - c2);
     }
   }
 
-  if (*s1) {
+  if (len1 > len2) {
     return rep_MAKE_INT(1);
-  } else if (*s2) {
+  } else if (len1 < len2) {
     return rep_MAKE_INT(-1);
   } else {
     return rep_MAKE_INT(0);
@@ -1539,25 +1775,39 @@ rep_strings_init(void)
   rep_INTERN(control);
 }
 
-void
-rep_strings_kill(void)
+static void
+free_heap(string_heap *h)
 {
-  string_block *s = string_block_list;
+  finish_sweep(h);
 
-  string_block_list = NULL;
-  rep_allocated_strings = rep_used_strings = 0;
-  rep_allocated_string_bytes = 0;
+  rep_gc_block *b = h->block_list;
 
-  while (s) {
-    int i;
-    string_block *next = s->next;
-    for (i = 0; i < STRINGS_PER_BLOCK; i++) {
-      if (!rep_CELL_CONS_P(rep_VAL(s->data + i))) {
-	rep_free(s->data[i].utf8_data);
-	free_utf32(&s->data[i]);
+  h->block_list = NULL;
+  h->free_list = NULL;
+
+  while (b) {
+    rep_gc_block *next = b->next;
+    char *data = BLOCK_DATA(b);
+    for (int i = 0; i < h->cells_per_block; i++) {
+      rep_string *str = (rep_string *)(data + i * h->cell_size);
+      if (!rep_CELL_CONS_P(rep_VAL(str))) {
+	if (!INLINE_DATA_P(str)) {
+	  rep_free(str->utf8_data);
+	}
+	free_utf32(str);
       }
     }
-    rep_free(s);
-    s = next;
+    rep_gc_free_block(b);
+    b = next;
   }
 }
+
+void
+rep_strings_kill(void)
+{
+  free_heap(&long_strings);
+  free_heap(&short_strings);
+
+  rep_allocated_strings = rep_used_strings = 0;
+  rep_allocated_string_bytes = 0;
+}
@@ -133,12 +133,25 @@ DEFSYM(rep_lang_interpreter, "rep.lang.interpreter");
 DEFSYM(rep_vm_interpreter, "rep.vm.interpreter");
 DEFSYM(external, "external");
 DEFSYM(local, "local");
+DEFSYM(inline_cache_hits, "inline-cache-hits");
+DEFSYM(inline_cache_misses, "inline-cache-misses");
+DEFSYM(inline_caches, "inline-caches");
+DEFSYM(inline_cache_flushes, "inline-cache-flushes");
+DEFSYM(bindings, "bindings");
+DEFSYM(total_buckets, "total-buckets");
+DEFSYM(empty_buckets, "empty-buckets");
 
 static rep_struct_node *lookup_or_add(rep_struct *s, repv var);
 
 
 /* Cached lookups. */
 
+/* Incremented to invalidate every inline cache of the VM (see
+   rep_ref_cache), when the result of a lookup they depend on might
+   have changed. */
+
+uint32_t rep_structure_epoch = 1;
+
 #ifdef VERBOSE
 
 /* Hits and misses are obvious. Collisions occur when a miss ejects
@@ -401,6 +414,58 @@ cache_flush(void)
 
 #endif /* No cache. */
 
+/* The inline caches are only invalidated by changes that could affect
+   them: those made to a structure marked rep_STF_LINKED, because a
+   cache was filled by searching it, and, for changes to a single
+   binding, only when its symbol's bit is set in this filter. */
+
+#define LINKED_SYMBOL_SHIFT 12
+#define LINKED_SYMBOL_BITS (1 << LINKED_SYMBOL_SHIFT)
+#define LINKED_SYMBOL_BIT(v) \
+  ((uint32_t) ((v) >> 3) * 2654435761U >> (32 - LINKED_SYMBOL_SHIFT))
+
+static uint32_t linked_symbols[LINKED_SYMBOL_BITS / 32];
+static uintptr_t ref_cache_flushes;
+
+static inline void
+set_linked_symbol(repv var)
+{
+  unsigned int bit = LINKED_SYMBOL_BIT(var);
+  linked_symbols[bit / 32] |= 1U << (bit % 32);
+}
+
+static inline bool
+linked_symbol_p(repv var)
+{
+  unsigned int bit = LINKED_SYMBOL_BIT(var);
+  return (linked_symbols[bit / 32] & (1U << (bit % 32))) != 0;
+}
+
+static void
+flush_ref_caches(void)
+{
+  rep_structure_epoch++;
+  ref_cache_flushes++;
+
+  memset(linked_symbols, 0, sizeof(linked_symbols));
+
+  for (rep_struct *s = all_structures; s; s = s->next) {
+    s->car &= ~rep_STF_LINKED;
+  }
+}
+
+/* Called when the bindings visible through structure S may have
+   changed, either only those of symbol VAR, or all of them if VAR is
+   a null pointer. */
+
+static inline void
+ref_caches_changed(rep_struct *s, repv var)
+{
+  if ((s->car & rep_STF_LINKED) && (!var || linked_symbol_p(var))) {
+    flush_ref_caches();
+  }
+}
+
 
 /* Type hooks. */
 
@@ -426,10 +491,36 @@ structure_mark(repv x)
   rep_MARKVAL(rep_STRUCTURE(x)->file_handlers);
 }
 
+static size_t
+structure_size(repv x)
+{
+  size_t size = sizeof(rep_struct);
+  if (rep_STRUCTURE(x)->bucket_mask != 0) {
+    size += ((rep_STRUCTURE(x)->bucket_mask + 1) * sizeof(rep_struct_node *)
+	     + rep_STRUCTURE(x)->total_bindings * sizeof(rep_struct_node));
+  }
+  return size;
+}
+
+/* Bindings are modified in too many places (including the VM) for a
+   write barrier, so minor collections treat every structure as a
+   root. */
+
+static void
+structure_mark_type(void)
+{
+  if (rep_gc_minor) {
+    for (rep_struct *s = all_structures; s; s = s->next) {
+      rep_MARKVAL(rep_VAL(s));
+    }
+  }
+}
+
 static void
 free_structure(rep_struct *x)
 {
   cache_invalidate_struct(x);
+  ref_caches_changed(x, 0);
 
   if (x->bucket_mask != 0) {
     unsigned int total_buckets = x->bucket_mask + 1;
@@ -457,6 +548,7 @@ structure_sweep(void)
     rep_struct *next = s->next;
 
     if (!rep_GC_CELL_MARKEDP(rep_VAL(s))) {
+      rep_gc_note_freed_cell(rep_VAL(s));
       free_structure(s);
     } else {
       rep_GC_CLR_CELL(rep_VAL(s));
@@ -528,18 +620,25 @@ init_struct(rep_struct *s)
   rep_structure = old;
 }
 
+/* While linking, structures aren't initialised; if one would need
+   to be searched, LINK_BLOCKED is set instead. */
+
+static bool linking, link_blocked;
+
 /* Scan for an immediate binding of symbol VAR in structure S, or
    return a null pointer if no such binding */
 
 static inline rep_struct_node *
 lookup(rep_struct *s, repv var)
 {
-  /* Also in OP_REFQ in lispmach.h */
-
   if (s->bucket_mask == 0) {
     if (!s->init) {
       return NULL;
     }
+    if (linking) {
+      link_blocked = true;
+      return NULL;
+    }
     init_struct(s);
     if (s->bucket_mask == 0) {
       return NULL;
@@ -570,7 +669,7 @@ lookup_or_add(rep_struct *s, repv var)
     s->bucket_mask = MIN_BUCKETS - 1;
     s->buckets = rep_alloc(sizeof(rep_struct_node *) * MIN_BUCKETS);
     memset(s->buckets, 0, sizeof(rep_struct_node *) * MIN_BUCKETS);
-    rep_data_after_gc += sizeof(rep_struct_node *) * MIN_BUCKETS;
+    rep_NOTE_ALLOCATION(sizeof(rep_struct_node *) * MIN_BUCKETS);
   }
 
   unsigned int total_buckets = s->bucket_mask + 1;
@@ -580,7 +679,7 @@ lookup_or_add(rep_struct *s, repv var)
     rep_struct_node **buckets =
       rep_alloc(new_total * sizeof(rep_struct_node *));
     memset(buckets, 0, new_total * sizeof(rep_struct_node *));
-    rep_data_after_gc += new_total * sizeof(rep_struct_node *);
+    rep_NOTE_ALLOCATION(new_total * sizeof(rep_struct_node *));
     s->bucket_mask = new_total - 1;	/* for rep_STRUCT_HASH(s) */
     for (int i = 0; i < total_buckets; i++) {
       rep_struct_node *next;
@@ -596,7 +695,7 @@ lookup_or_add(rep_struct *s, repv var)
   }
 
   n = rep_alloc(sizeof(rep_struct_node));
-  rep_data_after_gc += sizeof(rep_struct_node);
+  rep_NOTE_ALLOCATION(sizeof(rep_struct_node));
 
   n->symbol = var;
   n->is_constant = false;
@@ -614,6 +713,7 @@ lookup_or_add(rep_struct *s, repv var)
   }
 
   cache_invalidate_symbol(var);
+  ref_caches_changed(s, var);
 
   return n;
 }
@@ -635,6 +735,7 @@ remove_binding(rep_struct *s, repv var)
       *ptr = n->next;
       rep_free(n);
       cache_invalidate_symbol(var);
+      ref_caches_changed(s, var);
       return;
     }
     ptr = &(n->next);
@@ -692,10 +793,280 @@ rep_search_imports(rep_struct *s, repv var)
     }
   }
 
-  enter_cache(s, var, n);
+  if (!link_blocked) {
+    enter_cache(s, var, n);
+  }
   return n;
 }
 
+
+/* Inline caches. */
+
+/* Each constants vector of a compiled function is given an array of
+   caches parallel to it, for the OP_REFQ and OP_SETQ instructions
+   naming its symbols. The arrays are found through this table, and
+   freed after their vector is garbage collected. */
+
+typedef struct ref_caches_struct ref_caches;
+
+struct ref_caches_struct {
+  ref_caches *next;
+  repv consts;
+  rep_ref_cache entries[1];
+};
+
+#define REF_CACHES_HASH(v) (((v) >> 3) & ref_caches_mask)
+
+static ref_caches **ref_caches_buckets;
+static unsigned int ref_caches_mask, ref_caches_count;
+
+uintptr_t rep_ref_cache_hits;
+static uintptr_t ref_cache_fills;
+
+static bool
+grow_ref_caches(void)
+{
+  unsigned int total = ref_caches_buckets ? (ref_caches_mask + 1) * 2 : 256;
+  ref_caches **buckets = rep_alloc(total * sizeof(ref_caches *));
+  if (!buckets) {
+    return false;
+  }
+  memset(buckets, 0, total * sizeof(ref_caches *));
+
+  unsigned int old_total = ref_caches_buckets ? ref_caches_mask + 1 : 0;
+  ref_caches_mask = total - 1;
+
+  for (unsigned int i = 0; i < old_total; i++) {
+    ref_caches *next;
+    for (ref_caches *c = ref_caches_buckets[i]; c; c = next) {
+      next = c->next;
+      c->next = buckets[REF_CACHES_HASH(c->consts)];
+      buckets[REF_CACHES_HASH(c->consts)] = c;
+    }
+  }
+
+  rep_free(ref_caches_buckets);
+  ref_caches_buckets = buckets;
+  return true;
+}
+
+/* Return the array of caches for constants vector CONSTS, or a null
+   pointer if there's no memory for one. */
+
+rep_ref_cache *
+rep_ref_caches(repv consts)
+{
+  if (ref_caches_buckets) {
+    for (ref_caches *c = ref_caches_buckets[REF_CACHES_HASH(consts)];
+	 c; c = c->next)
+    {
+      if (c->consts == consts) {
+	return c->entries;
+      }
+    }
+  }
+
+  if ((!ref_caches_buckets || ref_caches_count > ref_caches_mask * 2)
+      && !grow_ref_caches())
+  {
+    return NULL;
+  }
+
+  size_t len = MAX(rep_VECTOR_LEN(consts), 1);
+  size_t size = sizeof(ref_caches) + (len - 1) * sizeof(rep_ref_cache);
+  ref_caches *c = rep_alloc(size);
+  if (!c) {
+    return NULL;
+  }
+  memset(c, 0, size);
+  rep_NOTE_ALLOCATION(size);
+
+  c->consts = consts;
+  c->next = ref_caches_buckets[REF_CACHES_HASH(consts)];
+  ref_caches_buckets[REF_CACHES_HASH(consts)] = c;
+  ref_caches_count++;
+
+  return c->entries;
+}
+
+/* Mark S, and the structures it imports, as having been searched to
+   fill caches. The names of the imports are marked too, since their
+   structures may be replaced. */
+
+static void
+mark_linked(rep_struct *s)
+{
+  if (s->car & rep_STF_LINKED) {
+    return;
+  }
+
+  s->car |= rep_STF_LINKED;
+
+  for (repv lst = s->imports; rep_CONSP(lst); lst = rep_CDR(lst)) {
+    repv tem = rep_CAR(lst);
+    if (rep_SYMBOLP(tem)) {
+      rep_STRUCTURE(rep_structures_structure)->car |= rep_STF_LINKED;
+      set_linked_symbol(tem);
+      tem = Ffind_structure(tem);
+    }
+    if (rep_STRUCTUREP(tem)) {
+      mark_linked(rep_STRUCTURE(tem));
+    }
+  }
+}
+
+static inline void
+fill_ref_cache(rep_ref_cache *c, rep_struct *s, repv var,
+	       rep_struct_node *n, bool local)
+{
+  mark_linked(s);
+  set_linked_symbol(var);
+
+  c->s = s;
+  c->n = n;
+  c->local = local;
+  c->epoch = rep_structure_epoch;
+}
+
+/* OP_REFQ of VAR has missed cache C, look it up in the current
+   structure and refill C. Returns a null pointer if VAR is unbound. */
+
+rep_struct_node *
+rep_ref_cache_fill(rep_ref_cache *c, repv var)
+{
+  rep_struct *s = rep_STRUCTURE(rep_structure);
+
+  rep_struct_node *n = lookup(s, var);
+  bool local = n != NULL;
+
+  if (!n) {
+    n = rep_search_imports(s, var);
+  }
+
+  ref_cache_fills++;
+
+  if (n) {
+    fill_ref_cache(c, s, var, n, local);
+  }
+
+  return n;
+}
+
+/* OP_SETQ of VAR to VALUE couldn't use cache C, do it the slow way and
+   refill C. */
+
+repv
+rep_ref_cache_set(rep_ref_cache *c, repv var, repv value)
+{
+  repv ret = Fstructure_set(rep_structure, var, value);
+
+  ref_cache_fills++;
+
+  if (ret && !rep_VOIDP(value)) {
+    rep_struct *s = rep_STRUCTURE(rep_structure);
+    rep_struct_node *n = lookup(s, var);
+    if (n) {
+      fill_ref_cache(c, s, var, n, true);
+    }
+  }
+
+  return ret;
+}
+
+/* Fill the caches of the compiled function BC, and of those in its
+   constants, for calls from structure S. Unbound symbols, and those
+   whose lookup would initialise a lazy structure, are left for the
+   first instruction that references them. */
+
+static void
+link_bytecode(rep_struct *s, repv bc)
+{
+  repv consts = rep_BYTECODE_CONSTANTS(bc);
+  if (!rep_VECTORP(consts)) {
+    return;
+  }
+
+  rep_ref_cache *caches = rep_ref_caches(consts);
+  if (!caches) {
+    return;
+  }
+
+  for (int i = 0; i < rep_VECTOR_LEN(consts); i++) {
+    repv var = rep_VECTI(consts, i);
+
+    if (rep_BYTECODEP(var)) {
+      link_bytecode(s, var);
+    } else if (rep_SYMBOLP(var) && !rep_KEYWORDP(var)
+	       && !rep_REF_CACHE_VALIDP(&caches[i], s))
+    {
+      linking = true;
+      link_blocked = false;
+
+      rep_struct_node *n = lookup(s, var);
+      bool local = n != NULL;
+      if (!n) {
+	n = rep_search_imports(s, var);
+      }
+
+      linking = false;
+
+      if (n && !link_blocked) {
+	fill_ref_cache(&caches[i], s, var, n, local);
+      }
+
+      link_blocked = false;
+    }
+  }
+}
+
+/* Called when structure S has been loaded, to link the functions
+   defined in it to the bindings they reference. */
+
+static void
+link_structure(rep_struct *s)
+{
+  unsigned int total_buckets = s->bucket_mask ? s->bucket_mask + 1 : 0;
+
+  for (unsigned int i = 0; i < total_buckets; i++) {
+    for (rep_struct_node *n = s->buckets[i]; n; n = n->next) {
+      repv fun = n->binding;
+      if (rep_CONSP(fun) && rep_CAR(fun) == Qmacro) {
+	fun = rep_CDR(fun);
+      }
+      if (rep_CLOSUREP(fun) && rep_CLOSURE(fun)->structure == rep_VAL(s)
+	  && rep_BYTECODEP(rep_CLOSURE(fun)->fun))
+      {
+	link_bytecode(s, rep_CLOSURE(fun)->fun);
+      }
+    }
+  }
+}
+
+/* Called by the garbage collector after marking, frees the caches of
+   any constants vectors that weren't. */
+
+void
+rep_scan_ref_caches(void)
+{
+  if (ref_caches_count == 0) {
+    return;
+  }
+
+  for (unsigned int i = 0; i <= ref_caches_mask; i++) {
+    ref_caches **ptr = &ref_caches_buckets[i];
+    ref_caches *c;
+    while ((c = *ptr)) {
+      if (rep_GC_LIVEP(c->consts)) {
+	ptr = &c->next;
+      } else {
+	*ptr = c->next;
+	rep_free(c);
+	ref_caches_count--;
+      }
+    }
+  }
+}
+
 
 /* Lisp functions. */
 
@@ -748,7 +1119,7 @@ BODY-THUNK may be modified by this function!
   rep_DECLARE4_OPT(name, rep_SYMBOLP);
 
   rep_struct *s = rep_alloc(sizeof(rep_struct));
-  rep_data_after_gc += sizeof(rep_struct);
+  rep_NOTE_ALLOCATION(sizeof(rep_struct));
 
   s->car = rep_Structure;
   s->inherited = sig;
@@ -773,6 +1144,7 @@ BODY-THUNK may be modified by this function!
 
   if (s->name != rep_nil) {
     Fstructure_define(rep_structures_structure, name, rep_VAL(s));
+    ref_caches_changed(rep_STRUCTURE(rep_structures_structure), name);
   }
 
   rep_GC_root gc_body;
@@ -783,6 +1155,7 @@ BODY-THUNK may be modified by this function!
     rep_CLOSURE(header_thunk)->structure = s_;
     repv tem = rep_call_lisp0(header_thunk);
     s->imports = Fdelq(Q_meta, s->imports);
+    ref_caches_changed(s, 0);
     if (!tem) {
       s = 0;
     }
@@ -801,6 +1174,7 @@ BODY-THUNK may be modified by this function!
   rep_POPGC;
 
   if (s) {
+    link_structure(s);
     return rep_VAL(s);
   }
 
@@ -809,6 +1183,7 @@ BODY-THUNK may be modified by this function!
   s = rep_STRUCTURE(s_);
   if (s->name != rep_nil) {
     Fstructure_define(rep_structures_structure, name, rep_void);
+    ref_caches_changed(rep_STRUCTURE(rep_structures_structure), name);
   }
 
   return 0;
@@ -1107,6 +1482,7 @@ Set the interface of structure object STRUCTURE to INTERFACE.
   }
 
   cache_flush();
+  ref_caches_changed(s, 0);
   return rep_undefined_value;
 }
 
@@ -1246,6 +1622,7 @@ named in the list STRUCT-NAMES.
   rep_POPGC;
 
   cache_flush();
+  ref_caches_changed(dst, 0);
   return ret;
 }
 
@@ -1394,34 +1771,64 @@ out:
   return ret ? rep_undefined_value : 0;
 }
 
-#ifdef VERBOSE
-
 DEFUN("structure-stats", Fstructure_stats,
-       Sstructure_stats, (repv structure), rep_Subr1)
+       Sstructure_stats, (repv structure), rep_Subr1) /*
+::doc:rep.structures#structure-stats::
+structure-stats [STRUCTURE]
+
+Returns an alist describing the global variable references and
+assignments made by compiled code, with the following keys:
+
+	inline-cache-hits	The number answered by the inline cache
+				 of their instruction.
+	inline-cache-misses	The number that searched the structures.
+	inline-caches		The number of compiled functions whose
+				 constants have caches.
+	inline-cache-flushes	The number of times a change to a
+				 structure the caches depend on has
+				 invalidated all of them.
+
+If STRUCTURE is given, the hash buckets of its bindings are also
+described:
+
+	bindings		The number of bindings in STRUCTURE.
+	total-buckets		The number of hash buckets.
+	empty-buckets		The number of buckets holding no bindings.
+::end:: */
 {
-  rep_DECLARE1(structure, rep_STRUCTUREP);
+  repv ret = rep_nil;
 
-  rep_struct *s = rep_STRUCTURE(structure);
+  if (structure != rep_nil) {
+    rep_DECLARE1(structure, rep_STRUCTUREP);
+
+    rep_struct *s = rep_STRUCTURE(structure);
 
-  int empties = 0;
+    int empties = 0;
 
-  unsigned int total_buckets = s->bucket_mask != 0 ? s->bucket_mask + 1 : 0;
+    unsigned int total_buckets = s->bucket_mask != 0 ? s->bucket_mask + 1 : 0;
 
-  for (int i = 0; i < total_buckets; i++) {
-    if (s->buckets[i] == 0) {
-      empties++;
+    for (int i = 0; i < total_buckets; i++) {
+      if (s->buckets[i] == 0) {
+	empties++;
+      }
     }
-  }
 
-  fprintf(stderr, "%d buckets, %d of which are empty,\n"
-	  "%g bindings per non-empty bucket\n", total_buckets, empties,
-	  (double) s->total_bindings / (total_buckets - empties));
+    ret = rep_list_3(Fcons(Qbindings, rep_MAKE_INT(s->total_bindings)),
+		     Fcons(Qtotal_buckets, rep_MAKE_INT(total_buckets)),
+		     Fcons(Qempty_buckets, rep_MAKE_INT(empties)));
+  }
 
-  return Qt;
+  return Fcons(Fcons(Qinline_cache_hits,
+		     rep_make_long_uint(rep_ref_cache_hits)),
+	       Fcons(Fcons(Qinline_cache_misses,
+			   rep_make_long_uint(ref_cache_fills)),
+		     Fcons(Fcons(Qinline_caches,
+				 rep_make_long_uint(ref_caches_count)),
+			   Fcons(Fcons(Qinline_cache_flushes,
+				       rep_make_long_uint(ref_cache_flushes)),
+				 ret))));
 }
 
-#endif /* VERBOSE */
-
 DEFUN("set-binding-immutable!", Fset_binding_immutable,
        Sset_binding_immutable, (repv var, repv state), rep_Subr2) /*
 ::doc:rep.structures#set-binding-immutable!::
@@ -1479,10 +1886,12 @@ Fexport_binding(repv var)
     if (!n->is_exported) {
       n->is_exported = true;
       cache_invalidate_symbol(var);
+      ref_caches_changed(s, var);
     }
   } else if (!structure_exports_inherited_p(s, var)) {
     s->inherited = Fcons(var, s->inherited);
     cache_invalidate_symbol(var);
+    ref_caches_changed(s, var);
   }
 
   return rep_nil;
@@ -1619,6 +2028,7 @@ loaded is either FILE (if given), or the print name of FEATURE.
       dst->imports = Fcons(feature, dst->imports);
       Fprovide(feature);
       cache_flush();
+      ref_caches_changed(dst, 0);
     }
   }
 
@@ -1716,13 +2126,19 @@ rep_bootstrap_structure(const char *name_str)
     while ((cell = *ptr) && rep_CONSP(cell)) {
       if (cell == structures_cell) {
 	*ptr = rep_CDR(cell);
+	rep_GC_CDRLOC_BARRIER(ptr, s->imports, *ptr);
 	cache_flush();
+	ref_caches_changed(s, 0);
 	break;
       }
       ptr = rep_CDRLOC(cell);
     }
   }
 
+  if (ret) {
+    link_structure(s);
+  }
+
   rep_pop_structure(old);
   return ret;
 }
@@ -1730,7 +2146,7 @@ rep_bootstrap_structure(const char *name_str)
 repv
 rep_add_subr(rep_xsubr *subr, bool export)
 {
-  repv sym = Fintern(subr->name, rep_nil);
+  repv sym = rep_intern_builtin(subr->name);
 
   if (sym) {
     rep_struct *s = rep_STRUCTURE(rep_structure);
@@ -1753,6 +2169,7 @@ DEFUN("set-structure-implicit-export!", Fset_structure_implicit_export,
     rep_STRUCTURE(s)->car &= ~rep_STF_EXPORT_ALL;
   }
 
+  ref_caches_changed(rep_STRUCTURE(s), 0);
   return rep_undefined_value;
 }
 
@@ -1770,6 +2187,41 @@ DEFUN("set-structure-implicit-define!", Fset_structure_implicit_define,
   return rep_undefined_value;
 }
 
+/* Access for image.c, which saves and restores the bindings of all
+   structures. */
+
+rep_struct *
+rep_structure_list(void)
+{
+  return all_structures;
+}
+
+/* Return the binding of VAR in structure S itself, or a null pointer. */
+
+rep_struct_node *
+rep_structure_lookup(repv s, repv var)
+{
+  return lookup(rep_STRUCTURE(s), var);
+}
+
+void
+rep_structure_install(repv s, repv var, repv value,
+		      bool constant, bool exported)
+{
+  rep_struct_node *n = lookup_or_add(rep_STRUCTURE(s), var);
+
+  n->binding = value;
+  n->is_constant = constant;
+  n->is_exported = exported;
+}
+
+void
+rep_structures_changed(void)
+{
+  cache_flush();
+  flush_ref_caches();
+}
+
 void
 rep_structure_exports_all(repv s, bool status)
 {
@@ -1901,6 +2353,8 @@ rep_pre_structures_init(void)
     .print = structure_print,
     .sweep = structure_sweep,
     .mark = structure_mark,
+    .size = structure_size,
+    .mark_type = structure_mark_type,
   };
 
   rep_define_type(&structure);
@@ -1937,9 +2391,7 @@ rep_structures_init(void)
   rep_ADD_SUBR(Sstructurep);
   rep_ADD_SUBR(Seval_real);
   rep_ADD_SUBR(Sstructure_for_each);
-#ifdef VERBOSE
   rep_ADD_SUBR(Sstructure_stats);
-#endif
   rep_ADD_SUBR(Sset_binding_immutable);
   rep_ADD_SUBR(Sbinding_immutable_p);
   rep_ADD_SUBR(Sexport_bindings);
@@ -1967,6 +2419,13 @@ rep_structures_init(void)
   rep_INTERN(rep_vm_interpreter);
   rep_INTERN(external);
   rep_INTERN(local);
+  rep_INTERN(inline_cache_hits);
+  rep_INTERN(inline_cache_misses);
+  rep_INTERN(inline_caches);
+  rep_INTERN(inline_cache_flushes);
+  rep_INTERN(bindings);
+  rep_INTERN(total_buckets);
+  rep_INTERN(empty_buckets);
 
   rep_mark_static(&rep_structure);
   rep_mark_static(&rep_default_structure);
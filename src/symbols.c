@@ -19,21 +19,44 @@
    the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
 
 #include "repint.h"
+#include "perfect-hash.h"
 
 #include <string.h>
 #include <ctype.h>
 #include <stdlib.h>
 
-/* The number of hash buckets in each rep_obarray, this is a prime number. */
+/* The initial number of hash buckets in each rep_obarray. */
 
 #define rep_OBSIZE		509
 #define rep_KEY_OBSIZE		127
 
+/* An obarray is a vector [COUNT BUCKETS], COUNT being the number of
+   symbols interned in it, and BUCKETS a vector of chains of symbols,
+   linked through their `next' fields. When COUNT exceeds the number of
+   buckets times OB_MAX_LOAD, the buckets are doubled. A plain vector of
+   buckets is also accepted as an obarray, but never grows. */
+
+#define OB_MAX_LOAD 1
+
+#define OBARRAY_HEADER_P(ob)					\
+  (rep_VECTOR_LEN(ob) == 2 && rep_INTP(rep_VECTI(ob, 0))	\
+   && rep_VECTORP(rep_VECTI(ob, 1)))
+
+/* The symbols declared by DEFSYM and DEFUN in the librep sources,
+   generated by mksymtab. rep_obarray starts out containing them. */
+
+#include "symtab.h"
+
 /* Global symbol tables.  */
 
 repv rep_obarray, rep_keyword_obarray;
 
 DEFSYM(t, "t");
+DEFSYM(symbols, "symbols");
+DEFSYM(buckets, "buckets");
+DEFSYM(used_buckets, "used-buckets");
+DEFSYM(longest_chain, "longest-chain");
+DEFSYM(chain_lengths, "chain-lengths");
 
 /* Void value. */
 
@@ -46,23 +69,128 @@ DEFSYM(t, "t");
 
 repv rep_scm_t, rep_scm_f, rep_undefined_value;
 
-static uintptr_t
+static inline uintptr_t
 string_hash(const char *name, size_t len)
 {
-  uintptr_t value = 5381;
+  return rep_hash_bytes(name, len);
+}
+
+static inline uintptr_t
+symbol_name_hash(repv name)
+{
+  return rep_string_hash(name);
+}
+
+/* Returns the vector of hash buckets of obarray OB. */
+
+static inline repv
+obarray_buckets(repv ob)
+{
+  return OBARRAY_HEADER_P(ob) ? rep_VECTI(ob, 1) : ob;
+}
+
+/* Rehash the symbols in obarray OB into SIZE buckets. Nothing changes
+   if there's no memory for them. */
+
+static void
+resize_obarray(repv ob, intptr_t size)
+{
+  repv old = rep_VECTI(ob, 1);
+  repv new = rep_make_vector(size);
+  if (!new) {
+    return;
+  }
+
+  for (intptr_t i = 0; i < size; i++) {
+    rep_VECTI(new, i) = OB_NIL;
+  }
 
-  const uint8_t *str = (const uint8_t *)name;
-  for (size_t i = 0; i < len; i++) {
-    value = (value * 33) + str[i];
+  for (intptr_t i = 0; i < rep_VECTOR_LEN(old); i++) {
+    repv sym = rep_VECTI(old, i);
+    while (rep_SYMBOLP(sym)) {
+      repv next = rep_SYM(sym)->next;
+      uintptr_t h = symbol_name_hash(rep_SYM(sym)->name) % size;
+      rep_SYM(sym)->next = rep_VECTI(new, h);
+      rep_VECTI(new, h) = sym;
+      sym = next;
+    }
   }
 
-  return value;
+  rep_VECTI(ob, 1) = new;
+  rep_GC_WRITE_BARRIER(ob, new);
 }
 
-static inline uintptr_t
-symbol_name_hash(repv name)
+/* Add DELTA to the number of symbols in obarray OB, growing it if
+   it's become too full. */
+
+static void
+count_symbols(repv ob, int delta)
+{
+  if (OBARRAY_HEADER_P(ob)) {
+    intptr_t count = rep_INT(rep_VECTI(ob, 0)) + delta;
+    intptr_t size = rep_VECTOR_LEN(rep_VECTI(ob, 1));
+    rep_VECTI(ob, 0) = rep_MAKE_INT(count);
+    if (count > size * OB_MAX_LOAD && size <= INT_MAX / 2) {
+      resize_obarray(ob, size * 2);
+    }
+  }
+}
+
+/* Returns the builtin symbol called NAME, or zero if there isn't one.
+   Its name is only hashed by perfect_hash(). */
+
+static repv
+builtin_symbol(repv name)
+{
+  const char *str = rep_STR(name);
+  size_t len = rep_STRING_LEN(name);
+
+  int32_t d = builtin_displacements[perfect_hash(0, str, len)
+				    % BUILTIN_SYMBOLS];
+  uint32_t i = d < 0 ? -d - 1 : perfect_hash(d, str, len) % BUILTIN_SYMBOLS;
+
+  repv builtin = rep_VAL(&builtin_names[i]);
+  if (rep_STRING_LEN(builtin) == len
+      && memcmp(rep_STR(builtin), str, len) == 0) {
+    return rep_VAL(&builtin_symbols[i]);
+  }
+
+  return 0;
+}
+
+/* Add the builtin symbols to the new obarray OB, using the hash codes
+   computed by mksymtab unless the seed has changed since. */
+
+static void
+intern_builtin_symbols(repv ob)
+{
+  repv buckets = rep_VECTI(ob, 1);
+  uintptr_t size = rep_VECTOR_LEN(buckets);
+  bool rehash = rep_hash_seed != BUILTIN_HASH_SEED;
+
+  for (int i = 0; i < BUILTIN_SYMBOLS; i++) {
+    rep_string *name = &builtin_names[i];
+    if (rehash) {
+      name->hash = rep_hash_bytes(name->utf8_data,
+				  rep_STRING_LEN(rep_VAL(name)));
+    }
+    uintptr_t h = name->hash % size;
+    builtin_symbols[i].next = rep_VECTI(buckets, h);
+    rep_VECTI(buckets, h) = rep_VAL(&builtin_symbols[i]);
+  }
+
+  rep_VECTI(ob, 0) = rep_MAKE_INT(BUILTIN_SYMBOLS);
+}
+
+/* The builtin symbols aren't allocated from GC blocks, so have their
+   mark bits in the cells, which must be cleared after collecting. */
+
+static void
+sweep_builtin_symbols(void)
 {
-  return string_hash(rep_STR(name), rep_STRING_LEN(name));
+  for (int i = 0; i < BUILTIN_SYMBOLS; i++) {
+    builtin_symbols[i].car &= ~rep_CELL_MARK_BIT;
+  }
 }
 
 static int
@@ -171,10 +299,27 @@ out:
   rep_stack_free(char, max_size, buf);
 }
 
+/* Like Fintern(NAME, rep_nil), but finds builtin symbols without
+   searching the obarray. Used when registering builtins at startup. */
+
+repv
+rep_intern_builtin(repv name)
+{
+  repv sym = builtin_symbol(name);
+
+  /* Unless it's been uninterned. */
+
+  if (sym && rep_SYM(sym)->next != 0) {
+    return sym;
+  }
+
+  return Fintern(name, rep_nil);
+}
+
 void
 rep_intern_static(repv *symp, repv name)
 {
-  repv symbol = Fintern(name, rep_nil);
+  repv symbol = rep_intern_builtin(name);
   *symp = symbol;
   rep_mark_static(symp);
 }
@@ -195,6 +340,17 @@ function definition are both void and it has a nil property-list.
     return 0;
   }
 
+  /* Static strings can't cache their hash codes, and the names of
+     builtin symbols are hashed as often as any. */
+
+  if (rep_CELL_STATIC_P(name)) {
+    name = rep_string_copy_n(rep_STR(name), rep_STRING_LEN(name));
+    if (!name) {
+      return 0;
+    }
+    rep_STRING(name)->car |= rep_STRING_IMMUTABLE;
+  }
+
   return rep_make_tuple(rep_Symbol, 0, name);
 }
 
@@ -284,14 +440,26 @@ DEFUN("make-obarray", Fmake_obarray, Smake_obarray, (repv size), rep_Subr1) /*
 ::doc:rep.lang.symbols#make-obarray::
 make-obarray SIZE
 
-Creates a new structure for storing symbols in. This is basically a
-vector with a few slight differences (all elements initialised to a
-special value).
+Creates a new structure for storing symbols in, a hash table with
+initially SIZE buckets. It grows as symbols are interned in it.
 ::end:: */
 {
-  rep_DECLARE1(size, rep_INTP);
+  rep_DECLARE(1, size, rep_INTP(size) && rep_INT(size) > 0);
+
+  repv buckets = Fmake_vector(size, OB_NIL);
+  if (!buckets) {
+    return 0;
+  }
 
-  return Fmake_vector(size, OB_NIL);
+  repv ob = rep_make_vector(2);
+  if (!ob) {
+    return rep_mem_error();
+  }
+
+  rep_VECTI(ob, 0) = rep_MAKE_INT(0);
+  rep_VECTI(ob, 1) = buckets;
+
+  return ob;
 }
 
 DEFUN("find-symbol", Ffind_symbol, Sfind_symbol,
@@ -309,17 +477,20 @@ the default `rep_obarray' if nil), or nil if no such symbol exists.
     ob = rep_obarray;
   }
 
-  uintptr_t vsize = rep_VECTOR_LEN(ob);
+  repv buckets = obarray_buckets(ob);
+  uintptr_t vsize = rep_VECTOR_LEN(buckets);
   if (vsize == 0) {
     return rep_signal_arg_error(ob, 2);
   }
-                                
-  uintptr_t h = symbol_name_hash(name) % vsize;
 
-  repv sym = rep_VECT(ob)->array[h];
+  uintptr_t hash = symbol_name_hash(name);
+  uintptr_t h = hash % vsize;
+
+  repv sym = rep_VECT(buckets)->array[h];
 
   while (rep_SYMBOLP(sym)) {
-    if (strcmp(rep_STR(name), rep_STR(rep_SYM(sym)->name)) == 0) {
+    if (symbol_name_hash(rep_SYM(sym)->name) == hash
+	&& strcmp(rep_STR(name), rep_STR(rep_SYM(sym)->name)) == 0) {
       return sym;
     }
     sym = rep_SYM(sym)->next;
@@ -350,15 +521,18 @@ interned somewhere an error is signalled.
     ob = rep_obarray;
   }
 
-  uintptr_t vsize = rep_VECTOR_LEN(ob);
+  repv buckets = obarray_buckets(ob);
+  uintptr_t vsize = rep_VECTOR_LEN(buckets);
   if (vsize == 0) {
     return rep_signal_arg_error(ob, 2);
   }
 
   uintptr_t h = symbol_name_hash(rep_SYM(sym)->name) % vsize;
 
-  rep_SYM(sym)->next = rep_VECT(ob)->array[h];
-  rep_VECT(ob)->array[h] = sym;
+  rep_SYM(sym)->next = rep_VECT(buckets)->array[h];
+  rep_VECT(buckets)->array[h] = sym;
+
+  count_symbols(ob, 1);
 
   return sym;
 }
@@ -393,13 +567,16 @@ rep_intern_symbol(const char *str, size_t len, repv obarray)
 {
   /* Inlined Ffind_symbol() to avoid string allocation. */
 
-  uintptr_t vsize = rep_VECTOR_LEN(obarray);
-  uintptr_t h = string_hash(str, len) % vsize;
+  repv buckets = obarray_buckets(obarray);
+  uintptr_t vsize = rep_VECTOR_LEN(buckets);
+  uintptr_t hash = string_hash(str, len);
+  uintptr_t h = hash % vsize;
 
-  for (repv sym = rep_VECT(obarray)->array[h];
+  for (repv sym = rep_VECT(buckets)->array[h];
        rep_SYMBOLP(sym); sym = rep_SYM(sym)->next) {
     repv name = rep_SYM(sym)->name;
-    if (rep_STRING_LEN(name) == len && memcmp(rep_STR(name), str, len) == 0) {
+    if (symbol_name_hash(name) == hash && rep_STRING_LEN(name) == len
+	&& memcmp(rep_STR(name), str, len) == 0) {
       return sym;
     }
   }
@@ -428,21 +605,24 @@ Removes SYMBOL from OBARRAY (or the default). Use this with caution.
     ob = rep_obarray;
   }
 
-  uintptr_t vsize = rep_VECTOR_LEN(ob);
+  repv buckets = obarray_buckets(ob);
+  uintptr_t vsize = rep_VECTOR_LEN(buckets);
   if (vsize == 0) {
     return rep_signal_arg_error(ob, 2);
   }
-  
+
   uintptr_t h = symbol_name_hash(rep_SYM(sym)->name) % vsize;
 
-  repv list = rep_VECT(ob)->array[h];
-  rep_VECT(ob)->array[h] = OB_NIL;
+  repv list = rep_VECT(buckets)->array[h];
+  rep_VECT(buckets)->array[h] = OB_NIL;
 
   while (rep_SYMBOLP(list)) {
     repv next = rep_SYM(list)->next;
     if (list != sym) {
-      rep_SYM(list)->next = rep_VECT(ob)->array[h];
-      rep_VECT(ob)->array[h] = rep_VAL(list);
+      rep_SYM(list)->next = rep_VECT(buckets)->array[h];
+      rep_VECT(buckets)->array[h] = rep_VAL(list);
+    } else {
+      count_symbols(ob, -1);
     }
     list = next;
   }
@@ -474,36 +654,111 @@ PREDICATE, if the value is non-nil it is considered a match.
   }
 
   repv ret = rep_nil;
-  int len = rep_VECTOR_LEN(ob);
+  repv buckets = obarray_buckets(ob);
+  int len = rep_VECTOR_LEN(buckets);
 
-  rep_GC_root gc_ret, gc_ob, gc_pred;
-  rep_PUSHGC(gc_ret, ret);
-  rep_PUSHGC(gc_ob, ob);
-  rep_PUSHGC(gc_pred, pred);
+  /* Find the matches before calling PREDICATE, since it may intern
+     symbols, rehashing the obarray. */
 
   for (int i = 0; i < len; i++) {
-    for (repv sym = rep_VECT(ob)->array[i];
+    for (repv sym = rep_VECT(buckets)->array[i];
 	 rep_SYMBOLP(sym); sym = rep_SYM(sym)->next)
     {
       if (rep_regexec(prog, rep_STR(rep_SYM(sym)->name))) {
-	if (pred && pred != rep_nil) {
-	  repv tmp = rep_apply(pred, rep_LIST_1(sym));
-	  if (!tmp || tmp == rep_nil) {
-	    continue;
-	  }
-	}
 	ret = Fcons(sym, ret);
       }
     }
   }
-  
-  rep_POPGC; rep_POPGC; rep_POPGC;
+
+  if (pred && pred != rep_nil) {
+    rep_GC_root gc_ret, gc_pred;
+    rep_PUSHGC(gc_ret, ret);
+    rep_PUSHGC(gc_pred, pred);
+
+    repv *ptr = &ret;
+    while (rep_CONSP(*ptr)) {
+      repv tmp = rep_apply(pred, rep_LIST_1(rep_CAR(*ptr)));
+      if (!tmp || tmp == rep_nil) {
+	*ptr = rep_CDR(*ptr);
+	rep_GC_CDRLOC_BARRIER(ptr, ret, *ptr);
+      } else {
+	ptr = rep_CDRLOC(*ptr);
+      }
+    }
+
+    rep_POPGC; rep_POPGC;
+  }
 
   free(prog);
 
   return ret;
 }
 
+DEFUN("obarray-statistics", Fobarray_statistics, Sobarray_statistics,
+      (repv ob), rep_Subr1) /*
+::doc:rep.lang.symbols#obarray-statistics::
+obarray-statistics [OBARRAY]
+
+Returns an alist describing the hash buckets of OBARRAY (or the
+default), with the following keys:
+
+	symbols			The number of symbols interned in it.
+	buckets			The number of hash buckets.
+	used-buckets		The number of buckets holding symbols.
+	longest-chain		The most symbols in any one bucket.
+	chain-lengths		A list whose Nth element is the number of
+				 buckets holding N symbols.
+::end:: */
+{
+  if (!rep_VECTORP(ob)) {
+    ob = rep_obarray;
+  }
+
+  repv buckets = obarray_buckets(ob);
+  int len = rep_VECTOR_LEN(buckets);
+  intptr_t symbols = 0;
+  int used = 0, longest = 0;
+
+  for (int i = 0; i < len; i++) {
+    int chain = 0;
+    for (repv sym = rep_VECTI(buckets, i);
+	 rep_SYMBOLP(sym); sym = rep_SYM(sym)->next) {
+      chain++;
+    }
+    symbols += chain;
+    used += chain > 0;
+    longest = MAX(longest, chain);
+  }
+
+  intptr_t *counts = rep_alloc((longest + 1) * sizeof(intptr_t));
+  if (!counts) {
+    return rep_mem_error();
+  }
+  memset(counts, 0, (longest + 1) * sizeof(intptr_t));
+
+  for (int i = 0; i < len; i++) {
+    int chain = 0;
+    for (repv sym = rep_VECTI(buckets, i);
+	 rep_SYMBOLP(sym); sym = rep_SYM(sym)->next) {
+      chain++;
+    }
+    counts[chain]++;
+  }
+
+  repv lengths = rep_nil;
+  for (int i = longest; i >= 0; i--) {
+    lengths = Fcons(rep_make_long_int(counts[i]), lengths);
+  }
+
+  rep_free(counts);
+
+  return rep_list_5(Fcons(Qsymbols, rep_make_long_int(symbols)),
+		    Fcons(Qbuckets, rep_MAKE_INT(len)),
+		    Fcons(Qused_buckets, rep_MAKE_INT(used)),
+		    Fcons(Qlongest_chain, rep_MAKE_INT(longest)),
+		    Fcons(Qchain_lengths, lengths));
+}
+
 DEFUN_INT("trace", Ftrace, Strace, (repv sym),
 	  rep_Subr1, "aFunction to trace") /*
 ::doc:rep.lang.debug#trace::
@@ -542,12 +797,20 @@ rep_obarray_init(void)
     .compare = symbol_cmp,
     .princ = symbol_princ,
     .print = symbol_print,
+    .sweep = sweep_builtin_symbols,
     // marked inline by rep_mark_value()
   };
 
   rep_define_type(&symbol);
 
-  rep_obarray = Fmake_obarray(rep_MAKE_INT(rep_OBSIZE));
+  intptr_t size = rep_OBSIZE;
+  while (size * OB_MAX_LOAD < BUILTIN_SYMBOLS) {
+    size *= 2;
+  }
+
+  rep_obarray = Fmake_obarray(rep_MAKE_INT(size));
+  intern_builtin_symbols(rep_obarray);
+
   rep_keyword_obarray = Fmake_obarray(rep_MAKE_INT(rep_KEY_OBSIZE));
 
   rep_mark_static(&rep_obarray);
@@ -576,6 +839,12 @@ rep_symbols_init(void)
   rep_mark_static(&rep_scm_f);
   rep_mark_static(&rep_scm_t);
   rep_mark_static(&rep_undefined_value);
+
+  rep_INTERN(symbols);
+  rep_INTERN(buckets);
+  rep_INTERN(used_buckets);
+  rep_INTERN(longest_chain);
+  rep_INTERN(chain_lengths);
   
   tem = rep_push_structure("rep.lang.symbols");
   rep_ADD_SUBR(Smake_symbol);
@@ -590,6 +859,7 @@ rep_symbols_init(void)
   rep_ADD_SUBR(Sintern);
   rep_ADD_SUBR(Sunintern);
   rep_ADD_SUBR(Sapropos);
+  rep_ADD_SUBR(Sobarray_statistics);
   rep_pop_structure(tem);
   
   tem = rep_push_structure("rep.lang.debug");
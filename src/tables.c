@@ -33,34 +33,224 @@
 # include <memory.h>
 #endif
 
-typedef struct node_struct node;
+#if defined(HAVE_MADVISE) && defined(HAVE_SYS_MMAN_H)
+# include <sys/mman.h>
+# include <unistd.h>
+#endif
+
+/* Tables use open addressing, in the style of the "Swiss tables" of
+   Abseil. Entries are stored inline in an array of slots, alongside
+   an array of control bytes giving the state of each slot: empty,
+   deleted, or full and holding the low seven bits of the mixed hash.
+   Slots are probed in aligned groups of eight, with all eight control
+   bytes tested at once as a single word, so most lookups touch one
+   control word and a single slot.
+
+   The builtin hash and compare functions are recognized when the
+   table is created and called directly, only user-defined functions
+   go through the Lisp calling convention.
+
+   Growing a table doesn't rehash it in one go. The existing slots are
+   kept as the "old" entries, while new keys go into the larger array,
+   and each subsequent operation migrates a bounded number of old slots
+   across. Lookups search both arrays until the migration is done. So
+   that table-for-each sees every entry exactly once, no entries are
+   migrated while a walk is in progress.
+
+   Weak tables don't mark their weak halves. Instead, each weak table
+   the collector reaches is put on a list, and once everything else
+   has been marked rep_mark_weak_tables() marks the values of the
+   weakly keyed entries whose keys are live. Marking those values may
+   make more keys live, so this repeats until nothing changes; keys
+   only reachable from their own (or each other's) values are never
+   found live, so these entries are ephemerons. Then
+   rep_scan_weak_tables() deletes the entries whose weak parts were
+   not marked. Each weakly keyed table is scanned once per collection,
+   as a strong table would be marked; the entries whose keys weren't
+   live are remembered, and after that only they are looked at. */
+
+typedef struct slot_struct slot;
+typedef struct entries_struct entries;
 typedef struct table_struct table;
 
-struct node_struct {
-  node *next;
+struct slot_struct {
   repv key, value;
   uintptr_t hash;
 };
 
+struct entries_struct {
+  int total_slots;
+  slot *slots;
+  uint8_t *ctrl;			/* follows the slots in one block */
+};
+
+enum table_hash {
+  HASH_LISP,
+  HASH_STRING,
+  HASH_SYMBOL,
+  HASH_EQ,
+  HASH_EQUAL,
+};
+
+enum table_compare {
+  COMPARE_LISP,
+  COMPARE_EQ,
+  COMPARE_EQV,
+  COMPARE_EQUAL,
+  COMPARE_STRING,
+};
+
+enum table_weakness {
+  WEAK_NONE,
+  WEAK_KEY,				/* values retained by their keys */
+  WEAK_VALUE,
+  WEAK_KEY_AND_VALUE,			/* entry dies with either */
+};
+
 struct table_struct {
   repv car;
   table *next;
-  int total_buckets, total_nodes;
-  node **buckets;
+  int total_nodes;
+  int growth_left;			/* empty slots usable before resizing */
+  entries cur;
+  entries old;				/* being migrated into CUR */
+  int migrate_pos;
+  int walkers;				/* active table-for-each calls */
+  unsigned int moves;			/* changed when entries move */
   repv hash_fun;
   repv compare_fun;
-  repv guardian;			/* non-null if a weak table */
+  table *next_weak;			/* on a list of marked weak tables */
+  uint8_t hash_kind;
+  uint8_t compare_kind;
+  uint8_t weakness;
 };
 
 #define TABLEP(v) rep_CELL16_TYPEP(v, table_type())
 #define TABLE(v)  ((table *) rep_PTR(v))
 
+/* Empty control bytes are zero, so new arrays come straight from
+   calloc. Large ones are then mapped lazily by the system, and growing
+   a table costs nothing in proportion to its size. */
+
+#define CTRL_EMPTY   0x00
+#define CTRL_DELETED 0x01
+#define CTRL_FULL    0x80
+#define CTRL_FULLP(c) ((c) & CTRL_FULL)
+
+#define GROUP_SIZE 8
+#define MIN_SLOTS 16
+#define MAX_SLOTS (1 << 30)
+
+/* Number of old slots migrated by each operation. Growing doubles the
+   table, leaving room for at least 7/8 of the old size in new keys
+   before the next resize, so the migration always finishes first. */
+
+#define MIGRATE_SLOTS 32
+
+/* Migrated slots of old arrays at least this large are given back to
+   the system in chunks of this size as the migration goes, since
+   freeing the whole array at the end can take some milliseconds. */
+
+#define RELEASE_BYTES (64 * 1024)
+
+/* At most 7/8 of the slots may be non-empty. */
+
+#define MAX_LOAD(n) ((n) - (n) / 8)
+
+/* Returned by lookup() when the key isn't in the table, and when the
+   hash or compare function exited abnormally. */
+
+#define NOT_FOUND -1
+#define LOOKUP_ERROR -2
+
+#define BYTES_LSB 0x0101010101010101ULL
+#define BYTES_MSB 0x8080808080808080ULL
+
 static table *all_tables;
 
+/* Weak tables marked by the current collection, those not yet seen
+   by rep_mark_weak_tables() and those that have been. */
+
+static table *marked_weak_tables, *scanned_weak_tables;
+
+/* Entries of weakly keyed tables whose keys weren't live when last
+   looked at by the current collection. */
+
+typedef struct {
+  table *t;
+  entries *e;
+  int i;
+} weak_entry;
+
+static weak_entry *pending_entries;
+static int pending_count, pending_size;
+
+DEFSYM(key, "key");
+DEFSYM(value, "value");
+DEFSYM(key_and_value, "key-and-value");
+
 /* Ensure X is +ve and in an int. */
 
 #define TRUNC(x) (((x) << (rep_VALUE_INT_SHIFT+1)) >> (rep_VALUE_INT_SHIFT+1))
 
+static inline uint64_t
+group_load(const uint8_t *ctrl)
+{
+  uint64_t group;
+  memcpy(&group, ctrl, sizeof(group));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  group = __builtin_bswap64(group);
+#endif
+  return group;
+}
+
+/* Sets the top bit of each byte of GROUP equal to BYTE. A borrow may
+   also set the bit of the byte after a real match, so the result is
+   only used for candidates checked by their full hash, or to test if
+   a group has any match at all. */
+
+static inline uint64_t
+group_match_byte(uint64_t group, unsigned int byte)
+{
+  uint64_t x = group ^ (BYTES_LSB * byte);
+  return (x - BYTES_LSB) & ~x & BYTES_MSB;
+}
+
+static inline uint64_t
+group_match(uint64_t group, unsigned int h2)
+{
+  return group_match_byte(group, CTRL_FULL | h2);
+}
+
+static inline uint64_t
+group_match_empty(uint64_t group)
+{
+  return group_match_byte(group, CTRL_EMPTY);
+}
+
+static inline uint64_t
+group_match_free(uint64_t group)
+{
+  return ~group & BYTES_MSB;
+}
+
+static inline int
+group_first(uint64_t mask)
+{
+  return __builtin_ctzll(mask) / CHAR_BIT;
+}
+
+/* Spread the bits of the fixnum hash code HASH, so that sequential
+   codes don't crowd into the same group. */
+
+static inline uintptr_t
+mix_hash(uintptr_t hash)
+{
+  const unsigned int bits = sizeof(uintptr_t) * CHAR_BIT;
+  hash *= (uintptr_t) 0x9e3779b97f4a7c15ULL;
+  return hash ^ (hash >> (bits / 2));
+}
+
 static void
 table_print(repv stream, repv arg)
 {
@@ -71,38 +261,77 @@ table_print(repv stream, repv arg)
   rep_stream_putc(stream, '>');
 }
 
+static size_t
+table_size(repv val)
+{
+  table *t = TABLE(val);
+  return (sizeof(table) + (t->cur.total_slots + t->old.total_slots)
+	  * (sizeof(slot) + sizeof(uint8_t)));
+}
+
 static void
-table_mark(repv val)
+mark_entries(entries *e, bool keys, bool values)
 {
-  for (int i = 0; i < TABLE(val)->total_buckets; i++) {
-    for (node *n = TABLE(val)->buckets[i]; n; n = n->next) {
-      if (!TABLE(val)->guardian) {
-	rep_MARKVAL(n->key);
+  for (int i = 0; i < e->total_slots; i++) {
+    if (CTRL_FULLP(e->ctrl[i])) {
+      if (keys) {
+	rep_MARKVAL(e->slots[i].key);
+      }
+      if (values) {
+	rep_MARKVAL(e->slots[i].value);
       }
-      rep_MARKVAL(n->value);
     }
   }
-
-  rep_MARKVAL(TABLE(val)->hash_fun);
-  rep_MARKVAL(TABLE(val)->compare_fun);
-  rep_MARKVAL(TABLE(val)->guardian);
 }
 
 static void
-free_table(table *x)
+table_mark(repv val)
 {
-  for (int i = 0; i < x->total_buckets; i++) {
-    node *n = x->buckets[i];
-    while (n) {
-      node *next = n->next;
-      rep_free(n);
-      n = next;
+  table *t = TABLE(val);
+
+  if (t->weakness == WEAK_NONE) {
+    mark_entries(&t->cur, true, true);
+    mark_entries(&t->old, true, true);
+  } else {
+    if (t->weakness == WEAK_VALUE) {
+      mark_entries(&t->cur, true, false);
+      mark_entries(&t->old, true, false);
     }
+    t->next_weak = marked_weak_tables;
+    marked_weak_tables = t;
   }
 
-  if (x->total_buckets > 0) {
-    rep_free(x->buckets);
+  rep_MARKVAL(t->hash_fun);
+  rep_MARKVAL(t->compare_fun);
+}
+
+static void
+alloc_entries(entries *e, int total_slots)
+{
+  size_t bytes = sizeof(slot) + sizeof(uint8_t);
+
+  e->slots = rep_calloc(total_slots, bytes);
+  rep_NOTE_ALLOCATION(total_slots * bytes);
+  e->ctrl = (uint8_t *) (e->slots + total_slots);
+  e->total_slots = total_slots;
+}
+
+static void
+free_entries(entries *e)
+{
+  if (e->total_slots > 0) {
+    rep_free(e->slots);
   }
+  e->total_slots = 0;
+  e->slots = NULL;
+  e->ctrl = NULL;
+}
+
+static void
+free_table(table *x)
+{
+  free_entries(&x->cur);
+  free_entries(&x->old);
   rep_free(x);
 }
 
@@ -115,6 +344,7 @@ table_sweep(void)
   while (ptr) {
     table *next = ptr->next;
     if (!rep_GC_CELL_MARKEDP(rep_VAL(ptr))) {
+      rep_gc_note_freed_cell(rep_VAL(ptr));
       free_table(ptr);
     } else {
       rep_GC_CLR_CELL(rep_VAL(ptr));
@@ -125,22 +355,6 @@ table_sweep(void)
   }
 }
 
-static void
-table_after_gc(void)
-{
-  for (table *ptr = all_tables; ptr != 0; ptr = ptr->next) {
-    if (ptr->guardian) {
-      repv key;
-      while ((key = Fprimitive_guardian_pop(ptr->guardian)) != rep_nil) {
-	rep_GC_root gc_key;
-	rep_PUSHGC(gc_key, key);
-	Ftable_unset(rep_VAL(ptr), key);
-	rep_POPGC;
-      }
-    }
-  }
-}
-
 static repv
 table_type(void)
 {
@@ -151,8 +365,8 @@ table_type(void)
       .name = "table",
       .print = table_print,
       .mark = table_mark,
+      .size = table_size,
       .sweep = table_sweep,
-      .after_gc = table_after_gc,
     };
 
     type = rep_define_type(&table);
@@ -161,16 +375,10 @@ table_type(void)
   return type;
 }
 
-static inline repv
-hash_string(const char *ptr)
+static inline uintptr_t
+hash_string(repv string)
 {
-  uintptr_t value = 5381;
-
-  while (*ptr) {
-    value = (value * 33) + *ptr++;
-  }
-
-  return rep_MAKE_INT(TRUNC(value));
+  return rep_string_hash(string);
 }
 
 DEFUN("string-hash", Fstring_hash, Sstring_hash, (repv string), rep_Subr1) /*
@@ -183,7 +391,7 @@ such that (string=? X Y) implies (= (string-hash X) (string-hash Y)).
 {
   rep_DECLARE1(string, rep_STRINGP);
 
-  return hash_string(rep_STR(string));
+  return rep_MAKE_INT(TRUNC(hash_string(string)));
 }
 
 DEFUN("symbol-hash", Fsymbol_hash, Ssymbol_hash, (repv sym), rep_Subr1) /*
@@ -195,7 +403,7 @@ Return a positive fixnum somehow related to the name of SYMBOL.
 {
   rep_DECLARE1(sym, rep_SYMBOLP);
 
-  return hash_string(rep_STR(rep_SYM(sym)->name));
+  return rep_MAKE_INT(TRUNC(hash_string(rep_SYM(sym)->name)));
 }
 
 DEFUN("eq-hash", Feq_hash, Seq_hash, (repv value), rep_Subr1) /*
@@ -210,42 +418,64 @@ Y) implies (= (eq-hash X) (eq-hash Y)).
   return rep_MAKE_INT(TRUNC(hv));
 }
 
-/* FIXME This is probably _very_ sub-optimal.. */
+/* Fold the hash code VALUE into HASH. */
+
+static inline uintptr_t
+hash_combine(uintptr_t hash, uintptr_t value)
+{
+  return mix_hash(hash ^ value);
+}
+
+/* Hash X, looking at no more than N elements of each list or vector,
+   and half as many at each level of nesting. */
 
 static uintptr_t
 equal_hash(repv x, unsigned int n)
 {
   if (rep_CONSP(x)) {
-    uintptr_t hash = 5381 * rep_Cons;
+    uintptr_t hash = rep_Cons;
     int i = n;
     while (rep_CONSP(x) && i-- > 0) {
-      hash = hash * 33 + equal_hash(rep_CAR(x), n / 2);
+      hash = hash_combine(hash, equal_hash(rep_CAR(x), n / 2));
       x = rep_CDR(x);
     }
     if (i > 0) {
-      hash = hash * 33 + equal_hash(x, n / 2);
+      hash = hash_combine(hash, equal_hash(x, n / 2));
     }
     return hash;
   } else if (rep_VECTORP(x) || rep_BYTECODEP(x)) {
-    uintptr_t hash = 5381 * rep_Vector;
+    uintptr_t hash = rep_Vector;
     int i = MIN(n, rep_VECTOR_LEN(x));
     while (i-- > 0) {
-      hash = hash * 33 + equal_hash(rep_VECTI(x, i), n / 2);
+      hash = hash_combine(hash, equal_hash(rep_VECTI(x, i), n / 2));
     }
     return hash;
   } else if (rep_STRINGP(x)) {
-    return hash_string(rep_STR(x));
+    return hash_string(x);
   } else if (rep_SYMBOLP(x)) {
-    return hash_string(rep_STR(rep_SYM(x)->name));
+    return hash_string(rep_SYM(x)->name);
   } else if (rep_INTP(x)) {
     return rep_INT(x);
   } else if (rep_NUMBERP(x)) {
     return rep_get_long_uint(x);
   } else {
-    return 5381 * 33 + rep_TYPE(x);
+    const rep_type *t = rep_value_type(x);
+    if (t && t->hash) {
+      return t->hash(x, n);
+    }
+    return hash_combine(rep_TYPE(x), 0);
   }
 }
 
+/* Hash X as equal-hash does, looking at no more than DEPTH elements of
+   each list or vector. For the hash functions of new types. */
+
+uintptr_t
+rep_equal_hash(repv x, unsigned int depth)
+{
+  return equal_hash(x, depth);
+}
+
 DEFUN("equal-hash", Fequal_hash, Sequal_hash, (repv x), rep_Subr1) /*
 ::doc:rep.data.tables#equal-hash::
 equal-hash ARG
@@ -261,45 +491,105 @@ implies (= (equal-hash X) (equal-hash Y)).
   return rep_MAKE_INT(TRUNC(hash));
 }
 
+static int
+hash_kind(repv fun)
+{
+  if (fun == rep_VAL(&Sstring_hash)) {
+    return HASH_STRING;
+  } else if (fun == rep_VAL(&Ssymbol_hash)) {
+    return HASH_SYMBOL;
+  } else if (fun == rep_VAL(&Seq_hash)) {
+    return HASH_EQ;
+  } else if (fun == rep_VAL(&Sequal_hash)) {
+    return HASH_EQUAL;
+  } else {
+    return HASH_LISP;
+  }
+}
+
+static int
+compare_kind(repv fun)
+{
+  if (rep_SUBRP(fun) && rep_SUBR_ARITY(fun) == rep_SUBR_2) {
+    repv (*f)(repv, repv) = rep_SUBR_F2(fun);
+    if (f == Feq) {
+      return COMPARE_EQ;
+    } else if (f == Feql) {
+      return COMPARE_EQV;
+    } else if (f == Fequal) {
+      return COMPARE_EQUAL;
+    } else if (f == Fstring_equal) {
+      return COMPARE_STRING;
+    }
+  }
+
+  return COMPARE_LISP;
+}
+
 static repv
-make_table(repv hash_fun, repv cmp_fun, bool weak_keys)
+make_table(repv hash_fun, repv cmp_fun, repv size, int weakness)
 {
   rep_DECLARE(1, hash_fun, Ffunctionp(hash_fun) != rep_nil);
   rep_DECLARE(2, cmp_fun, Ffunctionp(cmp_fun) != rep_nil);
+  rep_DECLARE(3, size, size == rep_nil
+	      || (rep_INTP(size) && rep_INT(size) >= 0));
 
   table *tab = rep_alloc(sizeof(table));
-  rep_data_after_gc += sizeof(table);
+  rep_NOTE_ALLOCATION(sizeof(table));
 
   tab->car = table_type();
   tab->next = all_tables;
   all_tables = tab;
   tab->hash_fun = hash_fun;
   tab->compare_fun = cmp_fun;
-  tab->total_buckets = 0;
+  tab->hash_kind = hash_kind(hash_fun);
+  tab->compare_kind = compare_kind(cmp_fun);
   tab->total_nodes = 0;
-  tab->guardian = !weak_keys ? 0 : Fmake_primitive_guardian();
+  tab->growth_left = 0;
+  tab->cur.total_slots = 0;
+  tab->cur.slots = NULL;
+  tab->cur.ctrl = NULL;
+  tab->old = tab->cur;
+  tab->migrate_pos = 0;
+  tab->walkers = 0;
+  tab->moves = 0;
+  tab->next_weak = 0;
+  tab->weakness = weakness;
+
+  if (size != rep_nil && rep_INT(size) > 0) {
+    int total_slots = MIN_SLOTS;
+    while (MAX_LOAD(total_slots) < rep_INT(size)
+	   && total_slots < MAX_SLOTS)
+    {
+      total_slots *= 2;
+    }
+    alloc_entries(&tab->cur, total_slots);
+    tab->growth_left = MAX_LOAD(total_slots);
+  }
 
   return rep_VAL(tab);
 }
 
 DEFUN("make-table", Fmake_table, Smake_table,
-      (repv hash_fun, repv cmp_fun), rep_Subr2) /*
+      (repv hash_fun, repv cmp_fun, repv size), rep_Subr3) /*
 ::doc:rep.data.tables#make-table::
-make-table HASH-FUNCTION COMPARE-FUNCTION
+make-table HASH-FUNCTION COMPARE-FUNCTION [SIZE]
 
 Create and return a new hash table. When storing and referencing keys
 it will use the function HASH-FUNCTION to map keys to hash codes
 (positive fixnums), and the predicate function COMPARE-FUNCTION to
 compare two keys (should return true if the keys are considered equal).
+
+If SIZE is given, the table is created with room for that many keys.
 ::end:: */
 {
-  return make_table(hash_fun, cmp_fun, false);
+  return make_table(hash_fun, cmp_fun, size, WEAK_NONE);
 }
 
 DEFUN("make-weak-table", Fmake_weak_table, Smake_weak_table,
-      (repv hash_fun, repv cmp_fun), rep_Subr2) /*
+      (repv hash_fun, repv cmp_fun, repv size, repv weakness), rep_Subr4) /*
 ::doc:rep.data.tables#make-weak-table::
-make-weak-table HASH-FUNCTION COMPARE-FUNCTION
+make-weak-table HASH-FUNCTION COMPARE-FUNCTION [SIZE] [WEAKNESS]
 
 Similar to `make-table, except that key-value pairs stored in the table
 are said to be ``weakly keyed''. That is, they are only retained in the
@@ -307,10 +597,28 @@ table as long the key has not been garbage collected.
 
 Unlike with tables created by the `make-table function, the fact that
 the key is stored in the table is not considered good enough to prevent
-it being garbage collected.
+it being garbage collected. Nor is the value: a key referenced only by
+values stored in weakly keyed tables may still be collected, along with
+those values.
+
+WEAKNESS may be one of the symbols `key' (the default), `value', when
+pairs are retained as long as the value hasn't been garbage collected,
+or `key-and-value', when both must remain.
 ::end:: */
 {
-  return make_table(hash_fun, cmp_fun, true);
+  int weak;
+
+  if (weakness == rep_nil || weakness == Qkey) {
+    weak = WEAK_KEY;
+  } else if (weakness == Qvalue) {
+    weak = WEAK_VALUE;
+  } else if (weakness == Qkey_and_value) {
+    weak = WEAK_KEY_AND_VALUE;
+  } else {
+    return rep_signal_arg_error(weakness, 4);
+  }
+
+  return make_table(hash_fun, cmp_fun, size, weak);
 }
 
 DEFUN("table?", Ftablep, Stablep, (repv arg), rep_Subr1) /*
@@ -323,60 +631,293 @@ Return true if ARG is a hash table.
   return TABLEP(arg) ? Qt : rep_nil;
 }
 
-static uintptr_t
-hash_key(repv tab, repv key)
+/* Store the hash code of KEY in *HASHP, returning false if the hash
+   function exited abnormally. */
+
+static bool
+hash_key(repv tab, repv key, uintptr_t *hashp)
 {
   repv hash;
-  if (TABLE(tab)->hash_fun == rep_VAL(&Sstring_hash)) {
+  switch (TABLE(tab)->hash_kind) {
+  case HASH_STRING:
     hash = Fstring_hash(key);
-  } else if (TABLE(tab)->hash_fun == rep_VAL(&Ssymbol_hash)) {
+    break;
+
+  case HASH_SYMBOL:
     hash = Fsymbol_hash(key);
-  } else if (TABLE(tab)->hash_fun == rep_VAL(&Seq_hash)) {
-    hash = Feq_hash(key);
-  } else if (TABLE(tab)->hash_fun == rep_VAL(&Sequal_hash)) {
+    break;
+
+  case HASH_EQ:
+    *hashp = TRUNC(pointer_hash(key));
+    return true;
+
+  case HASH_EQUAL:
     hash = Fequal_hash(key);
-  } else {
+    break;
+
+  default: {
     rep_GC_root gc_tab;
     rep_PUSHGC(gc_tab, tab);
     hash = rep_call_lisp1(TABLE(tab)->hash_fun, key);
     rep_POPGC;
+    break; }
   }
-  return rep_INT(hash);
+
+  if (!hash) {
+    return false;
+  }
+
+  *hashp = rep_INT(hash);
+  return true;
 }
 
+/* Returns 1 if VAL1 and VAL2 are the same key, 0 if not, -1 if the
+   compare function exited abnormally. */
+
 static inline int
-hash_key_to_bin(repv tab, uintptr_t hash)
+compare(repv tab, repv val1, repv val2)
 {
-  return hash % TABLE(tab)->total_buckets;
+  repv ret;
+  switch (TABLE(tab)->compare_kind) {
+  case COMPARE_EQ:
+    return val1 == val2;
+
+  case COMPARE_EQV:
+    ret = Feql(val1, val2);
+    break;
+
+  case COMPARE_EQUAL:
+    return rep_value_cmp(val1, val2) == 0;
+
+  case COMPARE_STRING:
+    if (rep_STRINGP(val1) && rep_STRINGP(val2)) {
+      size_t len = rep_STRING_LEN(val1);
+      return (len == rep_STRING_LEN(val2)
+	      && memcmp(rep_STR(val1), rep_STR(val2), len) == 0);
+    }
+    ret = Fstring_equal(val1, val2);
+    break;
+
+  default: {
+    rep_GC_root gc_tab;
+    rep_PUSHGC(gc_tab, tab);
+    ret = rep_call_lisp2(TABLE(tab)->compare_fun, val1, val2);
+    rep_POPGC;
+    break; }
+  }
+
+  if (!ret) {
+    return -1;
+  }
+
+  return ret != rep_nil;
 }
 
-static inline bool
-compare(repv tab, repv val1, repv val2)
+/* Return the index of the first empty or deleted slot in the probe
+   sequence of the mixed hash MIX. There's always at least one. */
+
+static int
+find_free_slot(entries *e, uintptr_t mix)
 {
-  rep_GC_root gc_tab;
-  rep_PUSHGC(gc_tab, tab);
-  repv ret = rep_call_lisp2(TABLE(tab)->compare_fun, val1, val2);
-  rep_POPGC;
-  return ret != rep_nil;
+  int mask = e->total_slots / GROUP_SIZE - 1;
+  int group = (mix >> 7) & mask;
+
+  for (int step = 1;; step++) {
+    uint64_t m = group_match_free(group_load(e->ctrl + group * GROUP_SIZE));
+    if (m != 0) {
+      return group * GROUP_SIZE + group_first(m);
+    }
+    group = (group + step) & mask;
+  }
 }
 
-static node *
-lookup(repv tab, repv key)
+static void
+set_ctrl(entries *e, int i, uintptr_t mix)
 {
-  if (TABLE(tab)->total_buckets == 0) {
-    return NULL;
+  e->ctrl[i] = CTRL_FULL | (mix & 0x7f);
+}
+
+/* Store the entry S in T's current slots. Entries already counted by
+   the table are being moved, so their slots were reserved when the
+   current array was sized. */
+
+static void
+move_entry(table *t, slot *s)
+{
+  uintptr_t mix = mix_hash(s->hash);
+  int i = find_free_slot(&t->cur, mix);
+  if (t->cur.ctrl[i] == CTRL_DELETED) {
+    t->growth_left++;
+  }
+  set_ctrl(&t->cur, i, mix);
+  t->cur.slots[i] = *s;
+}
+
+/* The slots of E from FROM to TO have been migrated and won't be read
+   again, release any whole chunks of memory they cover. */
+
+static void
+release_slots(entries *e, int from, int to)
+{
+#if defined(HAVE_MADVISE) && defined(HAVE_SYS_MMAN_H) && defined(MADV_DONTNEED)
+  static uintptr_t page_size;
+  if (page_size == 0) {
+    page_size = sysconf(_SC_PAGESIZE);
+  }
+
+  if (e->total_slots * sizeof(slot) < 4 * RELEASE_BYTES) {
+    return;
+  }
+
+  uintptr_t base = (uintptr_t) e->slots;
+  uintptr_t start = (base + from * sizeof(slot)) & ~(RELEASE_BYTES - 1);
+  uintptr_t end = (base + to * sizeof(slot)) & ~(RELEASE_BYTES - 1);
+  uintptr_t first_page = (base + page_size - 1) & ~(page_size - 1);
+
+  if (start < first_page) {
+    start = first_page;
+  }
+  if (end > start) {
+    madvise((void *) start, end - start, MADV_DONTNEED);
   }
+#endif
+}
 
-  uintptr_t hv = hash_key(tab, key);
-  int index = hash_key_to_bin(tab, hv);
+/* Move up to COUNT old slots of T into the current array, freeing the
+   old array once it's empty. Does nothing while T is being walked. */
 
-  for (node *ptr = TABLE(tab)->buckets[index]; ptr; ptr = ptr->next) {
-    if (ptr->hash == hv && compare(tab, key, ptr->key)) {
-      return ptr;
+static void
+migrate_entries(table *t, int count)
+{
+  if (t->old.total_slots == 0 || t->walkers > 0) {
+    return;
+  }
+
+  int end = t->old.total_slots - t->migrate_pos <= count
+	     ? t->old.total_slots : t->migrate_pos + count;
+
+  for (int i = t->migrate_pos; i < end; i++) {
+    if (CTRL_FULLP(t->old.ctrl[i])) {
+      move_entry(t, &t->old.slots[i]);
+      t->old.ctrl[i] = CTRL_DELETED;
     }
   }
 
-  return NULL;
+  if (end == t->old.total_slots) {
+    free_entries(&t->old);
+  } else {
+    release_slots(&t->old, t->migrate_pos, end);
+  }
+
+  t->migrate_pos = end;
+  t->moves++;
+}
+
+/* Give T a new, empty, array of NEW_SLOTS slots. The existing entries
+   are migrated incrementally, unless a migration is already under way
+   when it's finished first. If T is being walked that isn't allowed,
+   the current entries are rehashed immediately instead. */
+
+static void
+resize_table(table *t, int new_slots)
+{
+  if (t->old.total_slots != 0) {
+    migrate_entries(t, INT_MAX);
+  }
+
+  entries prev = t->cur;
+  alloc_entries(&t->cur, new_slots);
+  t->growth_left = MAX_LOAD(new_slots) - t->total_nodes;
+  t->moves++;
+
+  if (t->old.total_slots == 0) {
+    t->old = prev;
+    t->migrate_pos = 0;
+  } else {
+    for (int i = 0; i < prev.total_slots; i++) {
+      if (CTRL_FULLP(prev.ctrl[i])) {
+	move_entry(t, &prev.slots[i]);
+      }
+    }
+    free_entries(&prev);
+  }
+}
+
+/* Find KEY, with hash code HASH, in the slots E of table TAB. Returns
+   its index, NOT_FOUND, LOOKUP_ERROR, or RESTART_LOOKUP if a Lisp
+   compare function caused the table's entries to move. */
+
+#define RESTART_LOOKUP -3
+
+static int
+probe(repv tab, entries *e, repv key, uintptr_t hash)
+{
+  table *t = TABLE(tab);
+  unsigned int moves = t->moves;
+  uintptr_t mix = mix_hash(hash);
+  unsigned int h2 = mix & 0x7f;
+  int mask = e->total_slots / GROUP_SIZE - 1;
+  int group = (mix >> 7) & mask;
+
+  for (int step = 1;; step++) {
+    uint64_t ctrl = group_load(e->ctrl + group * GROUP_SIZE);
+
+    for (uint64_t m = group_match(ctrl, h2); m != 0; m &= m - 1) {
+      int i = group * GROUP_SIZE + group_first(m);
+      if (e->slots[i].hash == hash) {
+	int same = compare(tab, key, e->slots[i].key);
+	if (same < 0) {
+	  return LOOKUP_ERROR;
+	}
+	if (t->moves != moves) {
+	  return RESTART_LOOKUP;
+	}
+	if (same && CTRL_FULLP(e->ctrl[i])) {
+	  return i;
+	}
+      }
+    }
+
+    if (group_match_empty(ctrl)) {
+      return NOT_FOUND;
+    }
+
+    group = (group + step) & mask;
+  }
+}
+
+/* Return the index of the slot holding KEY in TAB, or NOT_FOUND,
+   storing the array containing it in *ENTRIESP. Stores the hash code
+   of KEY in *HASHP if non-null. Returns LOOKUP_ERROR if calling the
+   table's functions failed. */
+
+static int
+lookup(repv tab, repv key, uintptr_t *hashp, entries **entriesp)
+{
+  uintptr_t hash;
+  if (!hash_key(tab, key, &hash)) {
+    return LOOKUP_ERROR;
+  }
+  if (hashp) {
+    *hashp = hash;
+  }
+
+again:
+  for (int old = 0; old < 2; old++) {
+    entries *e = !old ? &TABLE(tab)->cur : &TABLE(tab)->old;
+    if (e->total_slots == 0) {
+      continue;
+    }
+    int i = probe(tab, e, key, hash);
+    if (i == RESTART_LOOKUP) {
+      goto again;
+    } else if (i != NOT_FOUND) {
+      *entriesp = e;
+      return i;
+    }
+  }
+
+  return NOT_FOUND;
 }
 
 DEFUN("table-ref", Ftable_ref, Stable_ref, (repv tab, repv key), rep_Subr2) /*
@@ -389,8 +930,15 @@ Returns false if no such value exists.
 {
   rep_DECLARE1(tab, TABLEP);
 
-  node *n = lookup(tab, key);
-  return n ? n->value : rep_nil;
+  migrate_entries(TABLE(tab), MIGRATE_SLOTS);
+
+  entries *e;
+  int i = lookup(tab, key, NULL, &e);
+  if (i == LOOKUP_ERROR) {
+    return 0;
+  }
+
+  return i != NOT_FOUND ? e->slots[i].value : rep_nil;
 }
 
 DEFUN("table-bound?", Ftable_bound_p,
@@ -404,8 +952,15 @@ KEY.
 {
   rep_DECLARE1(tab, TABLEP);
 
-  node *n = lookup(tab, key);
-  return n ? Qt : rep_nil;
+  migrate_entries(TABLE(tab), MIGRATE_SLOTS);
+
+  entries *e;
+  int i = lookup(tab, key, NULL, &e);
+  if (i == LOOKUP_ERROR) {
+    return 0;
+  }
+
+  return i != NOT_FOUND ? Qt : rep_nil;
 }
 
 DEFUN("table-set!", Ftable_set, Stable_set,
@@ -418,69 +973,90 @@ Associate VALUE with KEY in hash table TABLE. Returns VALUE.
 {
   rep_DECLARE1(tab, TABLEP);
 
-  node *n = lookup(tab, key);
+  table *t = TABLE(tab);
+  migrate_entries(t, MIGRATE_SLOTS);
 
-  if (!n) {
-    n = rep_alloc(sizeof(node));
-    rep_data_after_gc += sizeof(node);
-
-    n->key = key;
-    n->value = value;
-    n->hash = hash_key(tab, key);
+  uintptr_t hash;
+  entries *e;
+  int i = lookup(tab, key, &hash, &e);
+  if (i == LOOKUP_ERROR) {
+    return 0;
+  }
 
-    TABLE(tab)->total_nodes++;
-    if (TABLE(tab)->total_nodes >= 2 * TABLE(tab)->total_buckets) {
+  if (i == NOT_FOUND) {
+    uintptr_t mix = mix_hash(hash);
 
-      /* The (misguided?) idea is to set number of buckets as (2^N) - 1,
-         then increase N each time we get twice as many keys as buckets.
-	 Start at N=5 */
+    if (t->cur.total_slots == 0) {
+      resize_table(t, MIN_SLOTS);
+    }
 
-      node **old_bins = TABLE(tab)->buckets;
-      int old_size = TABLE(tab)->total_buckets;
+    e = &t->cur;
+    i = find_free_slot(e, mix);
 
-      int new_size;
-      if (old_size == 0) {
-	new_size = 31;
-      } else {
-	new_size = (old_size + 1) * 2 - 1;
-      }
+    if (e->ctrl[i] == CTRL_EMPTY && t->growth_left == 0) {
 
-      node **new_bins = rep_alloc(sizeof(node *) * new_size);
-      rep_data_after_gc += sizeof(node *) * new_size;
-      memset(new_bins, 0, sizeof(node *) * new_size);
-
-      TABLE(tab)->buckets = new_bins;
-      TABLE(tab)->total_buckets = new_size;
-
-      for (int i = 0; i < old_size; i++) {
-	node *ptr = old_bins[i];
-	while (ptr) {
-	  int index = hash_key_to_bin(tab, ptr->hash);
-	  node *next = ptr->next;
-	  ptr->next = new_bins[index];
-	  new_bins[index] = ptr;
-	  ptr = next;
-	}
-      }
+      /* Double the size if the table is more than half full,
+	 otherwise just rehash to clear out deleted slots. */
 
-      if (old_size > 0) {
-	rep_free(old_bins);
+      int new_slots = e->total_slots;
+      if (t->total_nodes >= MAX_LOAD(e->total_slots) / 2
+	  && new_slots < MAX_SLOTS)
+      {
+	new_slots *= 2;
       }
+      resize_table(t, new_slots);
+      i = find_free_slot(e, mix);
     }
 
-    int bin = hash_key_to_bin(tab, n->hash);
-    n->next = TABLE(tab)->buckets[bin];
-    TABLE(tab)->buckets[bin] = n;
-    if (TABLE(tab)->guardian) {
-      Fprimitive_guardian_push(TABLE(tab)->guardian, n->key);
+    if (e->ctrl[i] == CTRL_EMPTY) {
+      t->growth_left--;
     }
+
+    set_ctrl(e, i, mix);
+    e->slots[i].key = key;
+    e->slots[i].hash = hash;
+    t->total_nodes++;
+    rep_GC_WRITE_BARRIER(tab, key);
   }
 
-  n->value = value;
+  e->slots[i].value = value;
+  rep_GC_WRITE_BARRIER(tab, value);
 
   return rep_undefined_value;
 }
 
+/* Empty slot I of E, one of T's arrays. */
+
+static void
+remove_entry(table *t, entries *e, int i)
+{
+  if (e == &t->old) {
+
+    /* Old slots are never probed for free space, and the slot
+       reserved for this entry in the current array is released. */
+
+    e->ctrl[i] = CTRL_DELETED;
+    t->growth_left++;
+  } else {
+
+    /* If the slot's group still has an empty slot no probe sequence
+       can have passed through it, so the slot may be marked empty.
+       Otherwise it must remain as a deleted placeholder. */
+
+    int first = i - i % GROUP_SIZE;
+    if (group_match_empty(group_load(e->ctrl + first))) {
+      e->ctrl[i] = CTRL_EMPTY;
+      t->growth_left++;
+    } else {
+      e->ctrl[i] = CTRL_DELETED;
+    }
+  }
+
+  e->slots[i].key = rep_nil;
+  e->slots[i].value = rep_nil;
+  t->total_nodes--;
+}
+
 DEFUN("table-delete!", Ftable_unset, Stable_unset,
       (repv tab, repv key), rep_Subr2) /*
 ::doc:rep.data.tables#table-delete!::
@@ -491,23 +1067,171 @@ Remove any value stored in TABLE associated with KEY.
 {
   rep_DECLARE1(tab, TABLEP);
 
-  node *n = lookup(tab, key);
+  table *t = TABLE(tab);
+  migrate_entries(t, MIGRATE_SLOTS);
 
-  if (n) {
-    int bin = hash_key_to_bin(tab, n->hash);
-    for (node **ptr = &(TABLE(tab)->buckets[bin]);
-	 *ptr; ptr = &((*ptr)->next))
-    {
-      if (*ptr == n) {
-	*ptr = n->next;
-	rep_free(n);
-	TABLE(tab)->total_nodes--;
-	break;
+  entries *e;
+  int i = lookup(tab, key, NULL, &e);
+  if (i == LOOKUP_ERROR) {
+    return 0;
+  }
+
+  if (i != NOT_FOUND) {
+    remove_entry(t, e, i);
+  }
+
+  return rep_undefined_value;
+}
+
+/* True if V will survive the current collection. Subrs and static
+   cells are never marked. */
+
+static inline bool
+weak_live_p(repv v)
+{
+  if (!rep_CELLP(v) || rep_GC_LIVEP(v)) {
+    return true;
+  } else if (rep_CELL_CONS_P(v)) {
+    return false;
+  } else {
+    return (rep_CELL_STATIC_P(v) || rep_CELL8_TYPE(v) == rep_Subr
+	    || rep_CELL8_TYPE(v) == rep_SF);
+  }
+}
+
+static bool
+add_pending_entry(table *t, entries *e, int i)
+{
+  if (pending_count == pending_size) {
+    int new_size = pending_size ? pending_size * 2 : 256;
+    weak_entry *new = rep_realloc(pending_entries,
+				  new_size * sizeof(weak_entry));
+    if (!new) {
+      return false;
+    }
+    pending_entries = new;
+    pending_size = new_size;
+  }
+
+  weak_entry *w = &pending_entries[pending_count++];
+  w->t = t;
+  w->e = e;
+  w->i = i;
+  return true;
+}
+
+/* Mark the values of the entries of E whose keys are live, setting
+   *MARKED if any weren't already. The other entries are remembered,
+   so that only they need be looked at again (if there's no memory for
+   that the value is marked anyway). */
+
+static void
+mark_ephemerons(table *t, entries *e, bool *marked)
+{
+  for (int i = 0; i < e->total_slots; i++) {
+    if (CTRL_FULLP(e->ctrl[i])) {
+      slot *s = &e->slots[i];
+      if ((weak_live_p(s->key) || !add_pending_entry(t, e, i))
+	  && !weak_live_p(s->value))
+      {
+	rep_MARKVAL(s->value);
+	*marked = true;
       }
     }
   }
+}
 
-  return rep_undefined_value;
+/* Called by the collector once all strongly reachable objects have
+   been marked, and again after guardians have marked the objects they
+   resurrect. Each weakly keyed table is scanned once, after that only
+   its pending entries are. */
+
+void
+rep_mark_weak_tables(void)
+{
+  bool marked;
+
+  do {
+    marked = false;
+
+    while (marked_weak_tables != 0) {
+      table *t = marked_weak_tables;
+      marked_weak_tables = t->next_weak;
+      t->next_weak = scanned_weak_tables;
+      scanned_weak_tables = t;
+
+      if (t->weakness == WEAK_KEY) {
+	mark_ephemerons(t, &t->cur, &marked);
+	mark_ephemerons(t, &t->old, &marked);
+      }
+    }
+
+    int count = 0;
+    for (int j = 0; j < pending_count; j++) {
+      slot *s = &pending_entries[j].e->slots[pending_entries[j].i];
+      if (!weak_live_p(s->key)) {
+	pending_entries[count++] = pending_entries[j];
+      } else if (!weak_live_p(s->value)) {
+	rep_MARKVAL(s->value);
+	marked = true;
+      }
+    }
+    pending_count = count;
+
+  } while (marked || marked_weak_tables != 0);
+}
+
+static void
+scan_weak_entries(table *t, entries *e)
+{
+  bool keys = t->weakness == WEAK_KEY_AND_VALUE;
+
+  for (int i = 0; i < e->total_slots; i++) {
+    if (CTRL_FULLP(e->ctrl[i])
+	&& ((keys && !weak_live_p(e->slots[i].key))
+	    || !weak_live_p(e->slots[i].value)))
+    {
+      remove_entry(t, e, i);
+    }
+  }
+}
+
+/* Called by the collector after marking is complete. Deletes the
+   entries of marked weak tables whose weak parts are dead. */
+
+void
+rep_scan_weak_tables(void)
+{
+  for (int j = 0; j < pending_count; j++) {
+    weak_entry *w = &pending_entries[j];
+    remove_entry(w->t, w->e, w->i);
+  }
+  pending_count = 0;
+
+  for (table *t = scanned_weak_tables; t != 0; t = t->next_weak) {
+    if (t->weakness != WEAK_KEY) {
+      scan_weak_entries(t, &t->cur);
+      scan_weak_entries(t, &t->old);
+    }
+  }
+  scanned_weak_tables = 0;
+}
+
+/* Return the array of TAB whose slots are SLOTS, or null if it no
+   longer exists. */
+
+static entries *
+walked_entries(table *t, slot *slots)
+{
+  if (slots == NULL) {
+    return NULL;
+  } else if (t->cur.slots == slots) {
+    return &t->cur;
+  } else if (t->old.slots == slots) {
+    return &t->old;
+  } else {
+    return NULL;
+  }
 }
 
 DEFUN("table-for-each", Ftable_for_each, Stable_for_each,
@@ -525,14 +1249,32 @@ each pair, the function is called with arguments `(KEY VALUE)'.
   rep_PUSHGC(gc_tab, tab);
   rep_PUSHGC(gc_fun, fun);
 
-  for (int i = 0; i < TABLE(tab)->total_buckets; i++) {
-    for (node *n = TABLE(tab)->buckets[i]; n != 0; n = n->next) {
-      if (!rep_call_lisp2(fun, n->key, n->value)) {
+  /* Finish any migration, then stop entries moving until the walk is
+     over. If the table grows the array being walked becomes the old
+     array, and stays in place. */
+
+  table *t = TABLE(tab);
+  migrate_entries(t, INT_MAX);
+  t->walkers++;
+
+  slot *walk[2] = {t->cur.slots, t->old.slots};
+
+  for (int w = 0; w < 2 && !rep_throw_value; w++) {
+    for (int i = 0;; i++) {
+      entries *e = walked_entries(t, walk[w]);
+      if (!e || i >= e->total_slots) {
 	break;
       }
+      if (CTRL_FULLP(e->ctrl[i])) {
+	if (!rep_call_lisp2(fun, e->slots[i].key, e->slots[i].value)) {
+	  break;
+	}
+      }
     }
   }
 
+  t->walkers--;
+
   rep_POPGC; rep_POPGC;
 
   return rep_throw_value ? 0 : rep_undefined_value;
@@ -550,9 +1292,56 @@ Returns the number of items currently stored in TABLE.
   return rep_make_long_int(TABLE(tab)->total_nodes);
 }
 
+/* For image.c. Store the functions of table TAB, and return its
+   weakness as make-weak-table would accept it, or nil. */
+
+repv
+rep_table_functions(repv tab, repv *hash_fun, repv *cmp_fun)
+{
+  table *t = TABLE(tab);
+
+  *hash_fun = t->hash_fun;
+  *cmp_fun = t->compare_fun;
+
+  switch (t->weakness) {
+  case WEAK_KEY:
+    return Qkey;
+  case WEAK_VALUE:
+    return Qvalue;
+  case WEAK_KEY_AND_VALUE:
+    return Qkey_and_value;
+  default:
+    return rep_nil;
+  }
+}
+
+/* Call FUN with each key and value stored in TAB. FUN mustn't modify
+   the table or call Lisp code. */
+
+void
+rep_table_walk(repv tab, void (*fun)(repv key, repv value, void *data),
+	       void *data)
+{
+  table *t = TABLE(tab);
+  entries *walk[2] = {&t->cur, &t->old};
+
+  for (int w = 0; w < 2; w++) {
+    entries *e = walk[w];
+    for (int i = 0; i < e->total_slots; i++) {
+      if (CTRL_FULLP(e->ctrl[i])) {
+	fun(e->slots[i].key, e->slots[i].value, data);
+      }
+    }
+  }
+}
+
 static void
 tables_init(void)
 {
+  rep_INTERN(key);
+  rep_INTERN(value);
+  rep_INTERN(key_and_value);
+
   rep_ADD_SUBR(Smake_table);
   rep_ADD_SUBR(Smake_weak_table);
   rep_ADD_SUBR(Sstring_hash);
@@ -45,24 +45,36 @@ number of seconds since the Unix epoch.
   return rep_make_long_uint(rep_time());
 }
 
-DEFUN("current-utime", Fcurrent_utime, Scurrent_utime, (void), rep_Subr0) /*
-::doc:rep.system#current-utime::
-current-utime
+/* Returns the current time in microseconds. */
 
-Return the current time in microseconds.
-::end:: */
+long long
+rep_utime(void)
 {
-  long long t;
-
 #ifdef HAVE_GETTIMEOFDAY
   struct timeval time;
   gettimeofday (&time, 0);
-  t = ((long long)time.tv_sec * 1000000) + time.tv_usec;
+  return ((long long)time.tv_sec * 1000000) + time.tv_usec;
 #else
-  t = (long long)rep_time () * 1000000;
+  return (long long)rep_time () * 1000000;
 #endif
+}
+
+/* Returns the processor time used by this process, in microseconds. */
+
+long long
+rep_cpu_utime(void)
+{
+  return (long long)clock() * 1000000 / CLOCKS_PER_SEC;
+}
 
-  return rep_make_longlong_int(t);
+DEFUN("current-utime", Fcurrent_utime, Scurrent_utime, (void), rep_Subr0) /*
+::doc:rep.system#current-utime::
+current-utime
+
+Return the current time in microseconds.
+::end:: */
+{
+  return rep_make_longlong_int(rep_utime());
 }
 
 DEFUN("current-time-string", Fcurrent_time_string,
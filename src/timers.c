@@ -244,7 +244,7 @@ to re-enable it.
 ::end:: */
 {
   Lisp_Timer *t = rep_alloc(sizeof(Lisp_Timer));
-  rep_data_after_gc += sizeof(Lisp_Timer);
+  rep_NOTE_ALLOCATION(sizeof(Lisp_Timer));
 
   t->car = timer_type;
   t->function = fun;
@@ -332,6 +332,7 @@ timer_sweep(void)
     Lisp_Timer *next = t->next_alloc;
 
     if (!rep_GC_CELL_MARKEDP(rep_VAL(t))) {
+      rep_gc_note_freed_cell(rep_VAL(t));
       rep_free(t);
     } else {
       rep_GC_CLR_CELL(rep_VAL(t));
@@ -20,27 +20,111 @@
 
 #include "repint.h"
 
-#define TUPLES_PER_BLOCK 680 /* ~8k */
+#include <string.h>
+#include <stddef.h>
+
+#define TUPLES_PER_BLOCK \
+  ((rep_GC_BLOCK_SIZE - sizeof(rep_gc_block)) / sizeof(rep_tuple))
 
 typedef struct tuple_block_struct tuple_block;
 
 struct tuple_block_struct {
-  tuple_block *next;
+  rep_gc_block header;
   rep_ALIGN_CELL(rep_tuple tuples[TUPLES_PER_BLOCK]);
 };
 
+/* Blocks that have been swept since the last collection, and those
+   that haven't yet. */
+
 static tuple_block *tuple_block_list;
+static tuple_block *tuple_sweep_list;
 static rep_tuple *tuple_free_list;
 
+/* Number of empty blocks kept by sweep_block() since the last
+   collection. */
+
+static int empty_blocks_kept;
+
 int rep_allocated_tuples, rep_used_tuples;
 
+/* Put the unmarked tuples in block B onto the free list, and move it
+   to the list of swept blocks. Blocks with no live tuples may be
+   released instead. */
+
+static void
+sweep_block(tuple_block *b)
+{
+  static uintptr_t cell_map[rep_GC_BITMAP_WORDS];
+  static bool cell_map_ready;
+
+  if (!cell_map_ready) {
+    rep_gc_cell_map(cell_map, offsetof(tuple_block, tuples),
+		    sizeof(rep_tuple), TUPLES_PER_BLOCK);
+    cell_map_ready = true;
+  }
+
+  rep_tuple *free_list = NULL;
+  rep_tuple *free_tail = NULL;
+  int freed = 0;
+
+  for (int i = 0; i < rep_GC_BITMAP_WORDS; i++) {
+    uintptr_t dead = cell_map[i] & ~b->header.mark[i];
+    freed += rep_popcount(dead);
+    for (; dead != 0; dead &= dead - 1) {
+      rep_tuple *ptr = rep_GC_CELL_AT(b, i, rep_ctz(dead));
+      if (ptr->car != 0) {
+	rep_gc_note_freed(ptr->car, 1, sizeof(rep_tuple));
+	ptr->car = 0;
+      }
+      if (!free_tail) {
+	free_tail = ptr;
+      }
+      ptr->a = rep_VAL(free_list);
+      free_list = ptr;
+    }
+  }
+
+  rep_used_tuples -= freed;
+
+  if (freed == TUPLES_PER_BLOCK
+      && !rep_gc_keep_empty_block(&empty_blocks_kept, rep_GC_BLOCK_SIZE))
+  {
+    rep_gc_free_block(b);
+    rep_allocated_tuples -= TUPLES_PER_BLOCK;
+    return;
+  }
+
+  if (free_tail) {
+    free_tail->a = rep_VAL(tuple_free_list);
+    tuple_free_list = free_list;
+  }
+
+  memset(b->header.mark, 0, sizeof(b->header.mark));
+
+  b->header.next = (rep_gc_block *)tuple_block_list;
+  tuple_block_list = b;
+}
+
 static rep_tuple *
 refill_free_list(void)
 {
-  tuple_block *b = rep_alloc(sizeof(tuple_block));
+  while (tuple_sweep_list) {
+    tuple_block *b = tuple_sweep_list;
+    tuple_sweep_list = (tuple_block *)b->header.next;
+    sweep_block(b);
+    if (tuple_free_list) {
+      rep_tuple *t = tuple_free_list;
+      tuple_free_list = rep_TUPLE(t->a);
+      return t;
+    }
+  }
+
+  rep_static_assert(sizeof(tuple_block) <= rep_GC_BLOCK_SIZE);
+
+  tuple_block *b = rep_gc_alloc_block();
   rep_allocated_tuples += TUPLES_PER_BLOCK;
 
-  b->next = tuple_block_list;
+  b->header.next = (rep_gc_block *)tuple_block_list;
   tuple_block_list = b;
 
   for (int i = 1; i < TUPLES_PER_BLOCK - 1; i++) {
@@ -67,7 +151,11 @@ rep_make_tuple(repv car, repv a, repv b)
   }
 
   rep_used_tuples++;
-  rep_data_after_gc += sizeof(rep_tuple);
+  rep_NOTE_ALLOCATION(sizeof(rep_tuple));
+
+  /* Cells of this type are now marked in the block bitmap. */
+
+  rep_gc_block_types[rep_GC_TYPE_INDEX(car)] = 1;
 
   t->car = car;
   t->a = a;
@@ -83,36 +171,63 @@ rep_mark_tuple(repv t)
   rep_MARKVAL(rep_TUPLE(t)->b);
 }
 
+/* Called after marking. Blocks are swept when rep_make_tuple next needs
+   more cells; until then rep_used_tuples counts all cells in unswept
+   blocks as used. */
+
 void
 rep_sweep_tuples(void)
 {
-  rep_tuple *free_list = 0;
-  int used = 0;
-
-  for (tuple_block *b = tuple_block_list; b != 0; b = b->next) {
-    for (int i = 0; i < TUPLES_PER_BLOCK; i++) {
-      rep_tuple *ptr = &b->tuples[i];
-      if (!rep_GC_CELL_MARKEDP(rep_VAL(ptr))) {
-	ptr->a = rep_VAL(free_list);
-	free_list = ptr;
-      } else {
-	rep_GC_CLR_CELL(rep_VAL(ptr));
-	used++;
-      }
-    }
+  tuple_block *list = tuple_sweep_list;
+
+  while (tuple_block_list) {
+    tuple_block *b = tuple_block_list;
+    tuple_block_list = (tuple_block *)b->header.next;
+    b->header.next = (rep_gc_block *)list;
+    list = b;
   }
 
-  tuple_free_list = free_list;
-  rep_used_tuples = used;
+  tuple_sweep_list = list;
+  tuple_free_list = 0;
+  rep_used_tuples = rep_allocated_tuples;
+  empty_blocks_kept = 0;
+}
+
+/* Called before a full collection marks. Blocks that weren't swept
+   after the previous one still have its mark bits set; their unmarked
+   cells are unreachable, so can be left for the next sweep. */
+
+void
+rep_tuples_clear_marks(void)
+{
+  for (tuple_block *b = tuple_sweep_list; b;
+       b = (tuple_block *)b->header.next)
+  {
+    memset(b->header.mark, 0, sizeof(b->header.mark));
+  }
+}
+
+/* Sweep all blocks not yet swept since the last collection. */
+
+void
+rep_tuples_finish_sweep(void)
+{
+  while (tuple_sweep_list) {
+    tuple_block *b = tuple_sweep_list;
+    tuple_sweep_list = (tuple_block *)b->header.next;
+    sweep_block(b);
+  }
 }
 
 void
 rep_tuples_kill(void)
 {
+  rep_tuples_finish_sweep();
+
   tuple_block *b = tuple_block_list;
   while (b) {
-    tuple_block *next = b->next;
-    rep_free(b);
+    tuple_block *next = (tuple_block *)b->header.next;
+    rep_gc_free_block(b);
     b = next;
   }
 
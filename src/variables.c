@@ -358,6 +358,7 @@ set_symbol_special_value(repv sym, repv val, bool only_default)
     repv tem = search_environment(sym, rep_special_env);
     if (tem != rep_nil) {
       rep_CDR(tem) = val;
+      rep_GC_WRITE_BARRIER(tem, val);
       return rep_undefined_value;
     }
   }
@@ -577,6 +578,7 @@ evaluating FORM.
   repv tem = search_environment(sym, rep_env);
   if (tem != rep_nil) {
     rep_CDR(tem) = value;
+    rep_GC_WRITE_BARRIER(tem, value);
     return rep_undefined_value;
   }
 
@@ -26,44 +26,215 @@
 # include <memory.h>
 #endif
 
-static rep_vector *vector_list;
+/* Vectors of up to MAX_SMALL_VECTOR bytes are allocated from GC
+   blocks, each block holding vectors of a single size class. Larger
+   vectors are each given a block of their own. In both cases the mark
+   bit of a vector is in the header of its block, and the blocks are
+   swept by walking their mark bitmaps. */
+
+#define MAX_SMALL_VECTOR 2048
+
+/* The first vector in a block starts immediately after the header. */
+
+#define BLOCK_DATA(b)	((char *)(b) + sizeof(rep_gc_block))
+
+/* Size classes, in bytes. Each is a power of two, or half way between
+   two, so no more than a third of a vector's cell is wasted. */
+
+static const unsigned short class_sizes[] = {
+  16, 24, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048,
+};
+
+#define N_CLASSES (sizeof(class_sizes) / sizeof(class_sizes[0]))
+
+typedef struct size_class_struct size_class;
+
+struct size_class_struct {
+  size_t size;
+  int count;				/* vectors per block */
+  rep_gc_block *blocks;
+  rep_vector *free_list;		/* linked through car */
+  uintptr_t cell_map[rep_GC_BITMAP_WORDS];
+};
+
+static size_class size_classes[N_CLASSES];
+
+/* Index into size_classes for each vector size, in granules. */
+
+static unsigned char class_index[MAX_SMALL_VECTOR / rep_GC_GRANULE_SIZE + 1];
+
+static bool size_classes_ready;
+
+/* Blocks holding a single large vector each. */
+
+static rep_gc_block *large_vectors;
+
+/* Number of empty blocks kept by sweep_block() since the last
+   collection. */
+
+static int empty_blocks_kept;
 
 int rep_used_vector_slots;
 
+static void
+init_size_classes(void)
+{
+  rep_static_assert(sizeof(rep_gc_block) % rep_GC_GRANULE_SIZE == 0);
+
+  int j = 0;
+
+  for (int i = 0; i < N_CLASSES; i++) {
+    size_class *c = &size_classes[i];
+    c->size = class_sizes[i];
+    c->count = (rep_GC_BLOCK_SIZE - sizeof(rep_gc_block)) / c->size;
+    rep_gc_cell_map(c->cell_map, sizeof(rep_gc_block), c->size, c->count);
+    for (; j <= c->size / rep_GC_GRANULE_SIZE; j++) {
+      class_index[j] = i;
+    }
+  }
+
+  size_classes_ready = true;
+}
+
+/* Note that the vector returned is not linked into the free list! */
+
+static rep_vector *
+refill_free_list(size_class *c)
+{
+  rep_gc_block *b = rep_gc_alloc_block();
+  if (!b) {
+    return NULL;
+  }
+
+  b->next = c->blocks;
+  c->blocks = b;
+
+  char *data = BLOCK_DATA(b);
+
+  for (int i = 1; i < c->count - 1; i++) {
+    ((rep_vector *)(data + i * c->size))->car
+      = rep_VAL(data + (i + 1) * c->size);
+  }
+  ((rep_vector *)(data + (c->count - 1) * c->size))->car = 0;
+  c->free_list = (rep_vector *)(data + c->size);
+
+  return (rep_vector *)data;
+}
+
 repv
 rep_make_vector(int size)
 {
-  int len = rep_VECT_SIZEOF(size);
-  rep_vector *v = rep_alloc(len);
+  size_t len = rep_VECT_SIZEOF(size);
+  rep_vector *v;
+
+  if (len <= MAX_SMALL_VECTOR) {
+    if (!size_classes_ready) {
+      init_size_classes();
+    }
+
+    size_class *c = &size_classes[class_index[(len + rep_GC_GRANULE_SIZE - 1)
+					      / rep_GC_GRANULE_SIZE]];
+
+    v = c->free_list;
+    if (v) {
+      c->free_list = (rep_vector *)v->car;
+    } else {
+      v = refill_free_list(c);
+    }
+
+    len = c->size;
+  } else {
+    rep_gc_block *b = rep_gc_alloc_large_block(sizeof(rep_gc_block) + len);
+    if (b) {
+      b->next = large_vectors;
+      large_vectors = b;
+      v = (rep_vector *)BLOCK_DATA(b);
+    } else {
+      v = NULL;
+    }
+  }
+
   if (v) {
     v->car = rep_Vector | (size << rep_VECTOR_LEN_SHIFT);
-    v->next = vector_list;
-    vector_list = v;
     rep_used_vector_slots += size;
-    rep_data_after_gc += len;
+    rep_NOTE_ALLOCATION(len);
   }
+
   return rep_VAL(v);
 }
 
+/* Put the unmarked vectors in block B of class C onto the class's free
+   list. Returns false if the block is empty and should be released.
+   Free cells are recognized by their car, which is a pointer. */
+
+static bool
+sweep_block(size_class *c, rep_gc_block *b)
+{
+  rep_vector *free_list = c->free_list;
+  int freed = 0;
+
+  for (int i = 0; i < rep_GC_BITMAP_WORDS; i++) {
+    uintptr_t dead = c->cell_map[i] & ~b->mark[i];
+    freed += rep_popcount(dead);
+    for (; dead != 0; dead &= dead - 1) {
+      rep_vector *v = rep_GC_CELL_AT(b, i, rep_ctz(dead));
+      if (rep_CELL8P(rep_VAL(v))) {
+	rep_used_vector_slots -= rep_VECTOR_LEN(v);
+	rep_gc_note_freed(v->car, 1, c->size);
+      }
+      v->car = rep_VAL(free_list);
+      free_list = v;
+    }
+  }
+
+  if (freed == c->count
+      && !rep_gc_keep_empty_block(&empty_blocks_kept, rep_GC_BLOCK_SIZE))
+  {
+    return false;
+  }
+
+  c->free_list = free_list;
+  memset(b->mark, 0, sizeof(b->mark));
+  return true;
+}
+
 void
 rep_vector_sweep(void)
 {
-  rep_vector *ptr = vector_list;
-  vector_list = NULL;
-
-  rep_used_vector_slots = 0;
+  empty_blocks_kept = 0;
+
+  if (size_classes_ready) {
+    for (int i = 0; i < N_CLASSES; i++) {
+      size_class *c = &size_classes[i];
+      rep_gc_block **ptr = &c->blocks;
+      c->free_list = NULL;
+      while (*ptr) {
+	rep_gc_block *b = *ptr;
+	if (sweep_block(c, b)) {
+	  ptr = &b->next;
+	} else {
+	  *ptr = b->next;
+	  rep_gc_free_block(b);
+	}
+      }
+    }
+  }
 
-  while (ptr) {
-    rep_vector *next = ptr->next;
-    if (!rep_GC_CELL_MARKEDP(rep_VAL(ptr))) {
-      rep_free(ptr);
+  rep_gc_block **ptr = &large_vectors;
+
+  while (*ptr) {
+    rep_gc_block *b = *ptr;
+    repv v = rep_VAL(BLOCK_DATA(b));
+    if (!rep_GC_BLOCK_MARKEDP(v)) {
+      rep_used_vector_slots -= rep_VECTOR_LEN(v);
+      rep_gc_note_freed(rep_VECT(v)->car, 1,
+			rep_VECT_SIZEOF(rep_VECTOR_LEN(v)));
+      *ptr = b->next;
+      rep_gc_free_block(b);
     } else {
-      ptr->next = vector_list;
-      vector_list = ptr;
-      rep_used_vector_slots += rep_VECTOR_LEN(ptr);
-      rep_GC_CLR_CELL(rep_VAL(ptr));
+      rep_GC_BLOCK_CLR_MARK(v);
+      ptr = &b->next;
     }
-    ptr = next;
   }
 }
 
@@ -178,6 +349,7 @@ Sets the INDEX'th element of VECTOR to VALUE.
   }
 
   rep_VECTI(vec, rep_INT(idx)) = value;
+  rep_GC_WRITE_BARRIER(vec, value);
 
   return rep_undefined_value;
 }
@@ -382,14 +554,25 @@ rep_vectors_init(void)
 void
 rep_vectors_kill(void)
 {
-  rep_vector *ptr = vector_list;
-
-  vector_list = NULL;
-  rep_used_vector_slots = 0;
+  for (int i = 0; i < N_CLASSES; i++) {
+    size_class *c = &size_classes[i];
+    rep_gc_block *b = c->blocks;
+    while (b) {
+      rep_gc_block *next = b->next;
+      rep_gc_free_block(b);
+      b = next;
+    }
+    c->blocks = NULL;
+    c->free_list = NULL;
+  }
 
-  while (ptr) {
-    rep_vector *next = ptr->next;
-    rep_free(ptr);
-    ptr = next;
+  rep_gc_block *b = large_vectors;
+  while (b) {
+    rep_gc_block *next = b->next;
+    rep_gc_free_block(b);
+    b = next;
   }
+
+  large_vectors = NULL;
+  rep_used_vector_slots = 0;
 }
@@ -25,7 +25,12 @@
 #define WEAK_NEXT(v)	(WEAK(v)->a)
 #define WEAK_REF(v)	(WEAK(v)->b)
 
-static repv weak_refs;
+/* Weak references created since the last collection, and those whose
+   referents had survived one when they were last scanned. The second
+   list is only scanned by full collections, since a minor collection
+   can't free old objects. */
+
+static repv weak_refs, old_weak_refs;
 
 DEFUN("make-weak", Fmake_weak, Smake_weak, (repv ref), rep_Subr1)
 {
@@ -49,28 +54,29 @@ DEFUN("weak-set!", Fweak_set, Sweak_set, (repv weak, repv value), rep_Subr2)
 {
   rep_DECLARE1(weak, WEAKP);
 
+  /* A referent that's young while the reference is on the old list
+     must survive the next minor collection. */
+
   WEAK_REF(weak) = value;
+  rep_GC_WRITE_BARRIER(weak, value);
   return value;
 }
 
-void
-rep_scan_weak_refs(void)
+static void
+scan_weak_refs(repv ref)
 {
-  repv ref = weak_refs;
-  weak_refs = 0;
-
   while (ref) {
     repv next = WEAK_NEXT(ref);
 
-    if (rep_GC_CELL_MARKEDP(ref)) {
+    if (rep_GC_LIVEP(ref)) {
 
       /* This ref wasn't gc'd. */
 
-      WEAK_NEXT(ref) = weak_refs;
-      weak_refs = ref;
+      WEAK_NEXT(ref) = old_weak_refs;
+      old_weak_refs = ref;
 
       if (rep_CELLP(WEAK_REF(ref))
-	  && !rep_GC_MARKEDP(WEAK_REF(ref)))
+	  && !rep_GC_LIVEP(WEAK_REF(ref)))
       {
 	/* But the object it points to was. */
 
@@ -82,6 +88,21 @@ rep_scan_weak_refs(void)
   }
 }
 
+void
+rep_scan_weak_refs(void)
+{
+  repv ref = weak_refs;
+  weak_refs = 0;
+
+  if (!rep_gc_minor) {
+    repv old = old_weak_refs;
+    old_weak_refs = 0;
+    scan_weak_refs(old);
+  }
+
+  scan_weak_refs(ref);
+}
+
 static void
 weak_ref_print(repv stream, repv arg)
 {